@@ -4,6 +4,12 @@
 /*
  * insert_open.cpp -- this simple benchmarks is used to measure time of
  * inserting specified number of elements and time of runtime_initialize().
+ * If n_threads is specified for open, time of runtime_initialize(n_threads)
+ * and its speedup over runtime_initialize() are reported as well.
+ *
+ * The map is stored without FEATURE_CONSISTENT_SIZE (as if it was created
+ * by an older version of the library), so runtime_initialize() has to count
+ * the elements, and the pool is reopened before each measured run.
  */
 
 #include <cassert>
@@ -40,8 +46,27 @@ using value_type = pmem::obj::p<int>;
 using persistent_map_type =
 	pmem::obj::concurrent_hash_map<key_type, value_type>;
 
+struct map_type : public persistent_map_type {
+	/*
+	 * Brings the map back to the layout used before
+	 * FEATURE_CONSISTENT_SIZE was introduced.
+	 */
+	void
+	clear_consistent_size()
+	{
+		auto pop = this->get_pool_base();
+
+		pmem::obj::transaction::run(pop, [&] {
+			pmem::obj::delete_persistent<tls_t>(this->tls_ptr);
+			this->tls_ptr = nullptr;
+			this->layout_features.compat &=
+				~static_cast<uint32_t>(FEATURE_CONSISTENT_SIZE);
+		});
+	}
+};
+
 struct root {
-	pmem::obj::persistent_ptr<persistent_map_type> pptr;
+	pmem::obj::persistent_ptr<map_type> pptr;
 };
 
 void
@@ -75,13 +100,21 @@ insert(pmem::obj::pool<root> &pop, size_t n_inserts, size_t n_threads)
 }
 
 void
-open(pmem::obj::pool<root> &pop)
+reopen(pmem::obj::pool<root> &pop, const char *path)
+{
+	pop.root()->pptr->clear_consistent_size();
+	pop.close();
+	pop = pmem::obj::pool<root>::open(path, LAYOUT);
+}
+
+void
+open(pmem::obj::pool<root> &pop, size_t n_threads)
 {
 	auto map = pop.root()->pptr;
 
 	assert(map != nullptr);
 
-	map->runtime_initialize();
+	map->runtime_initialize(n_threads);
 
 	assert(map->size() > 0);
 }
@@ -92,7 +125,7 @@ main(int argc, char *argv[])
 	pmem::obj::pool<root> pop;
 	try {
 		std::string usage =
-			"usage: %s file-name <create n_inserts n_threads | open>";
+			"usage: %s file-name <create n_inserts n_threads | open [n_threads]>";
 
 		if (argc < 3) {
 			std::cerr << usage << std::endl;
@@ -134,7 +167,7 @@ main(int argc, char *argv[])
 				pmem::obj::transaction::run(pop, [&] {
 					pop.root()->pptr =
 						pmem::obj::make_persistent<
-							persistent_map_type>();
+							map_type>();
 				});
 			} catch (pmem::pool_error &pe) {
 				std::cerr << "!pool::create: " << pe.what()
@@ -145,6 +178,8 @@ main(int argc, char *argv[])
 			std::cout << measure<std::chrono::milliseconds>([&] {
 				insert(pop, n_inserts, n_threads);
 			}) << "ms" << std::endl;
+
+			pop.root()->pptr->clear_consistent_size();
 		} else {
 			try {
 				pop = pmem::obj::pool<root>::open(path, LAYOUT);
@@ -153,9 +188,25 @@ main(int argc, char *argv[])
 					  << std::endl;
 				return 1;
 			}
-			std::cout << measure<std::chrono::milliseconds>([&] {
-				open(pop);
-			}) << "ms" << std::endl;
+
+			reopen(pop, path);
+			auto serial = measure<std::chrono::microseconds>(
+				[&] { open(pop, 1); });
+			std::cout << serial / 1000 << "ms" << std::endl;
+
+			if (argc > 3) {
+				size_t n_threads = std::stoull(argv[3]);
+
+				reopen(pop, path);
+				auto parallel =
+					measure<std::chrono::microseconds>(
+						[&] { open(pop, n_threads); });
+				std::cout << parallel / 1000 << "ms ("
+					  << n_threads << " threads), speedup: "
+					  << double(serial) /
+						(parallel > 0 ? parallel : 1)
+					  << std::endl;
+			}
 		}
 
 		pop.close();
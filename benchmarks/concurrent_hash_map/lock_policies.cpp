@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * lock_policies.cpp -- this simple benchmark is used to compare
+ * concurrent_hash_map with different bucket lock types: the default
+ * pmem::obj::shared_mutex and lighter experimental spin_shared_mutex and
+ * seq_shared_mutex. For each of them time of inserts, lookups (shared
+ * locks), optimistic lookups with find_value() and updates (exclusive
+ * locks) of short critical sections is measured.
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/experimental/seq_shared_mutex.hpp>
+#include <libpmemobj++/experimental/spin_shared_mutex.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/shared_mutex.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include "../measure.hpp"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#define CREATE_MODE_RW (S_IWUSR | S_IRUSR)
+
+#else
+
+#include <windows.h>
+#define CREATE_MODE_RW (S_IWRITE | S_IREAD)
+
+#endif
+
+static const std::string LAYOUT = "lock_policies";
+
+template <typename MutexType>
+using map_type =
+	pmem::obj::concurrent_hash_map<pmem::obj::p<size_t>,
+				       pmem::obj::p<size_t>,
+				       std::hash<pmem::obj::p<size_t>>,
+				       std::equal_to<pmem::obj::p<size_t>>,
+				       MutexType>;
+
+using shared_mutex_map = map_type<pmem::obj::shared_mutex>;
+using spin_map = map_type<pmem::obj::experimental::spin_shared_mutex>;
+using seq_map = map_type<pmem::obj::experimental::seq_shared_mutex>;
+
+struct root {
+	pmem::obj::persistent_ptr<shared_mutex_map> shared_mutex_ptr;
+	pmem::obj::persistent_ptr<spin_map> spin_ptr;
+	pmem::obj::persistent_ptr<seq_map> seq_ptr;
+};
+
+template <typename F>
+void
+run_threads(size_t n_threads, F &&f)
+{
+	std::vector<std::thread> v;
+	for (size_t i = 0; i < n_threads; i++)
+		v.emplace_back(f, i);
+
+	for (auto &t : v)
+		t.join();
+}
+
+template <typename MapType>
+void
+run(pmem::obj::persistent_ptr<MapType> map, const std::string &name,
+    size_t n_keys, size_t n_ops, size_t n_threads)
+{
+	map->runtime_initialize();
+
+	auto insert = measure<std::chrono::milliseconds>([&] {
+		run_threads(n_threads, [&](size_t tid) {
+			for (size_t i = tid; i < n_keys; i += n_threads)
+				map->insert(typename MapType::value_type(i, i));
+		});
+	});
+
+	auto lookup = measure<std::chrono::milliseconds>([&] {
+		run_threads(n_threads, [&](size_t tid) {
+			for (size_t i = 0; i < n_ops; ++i) {
+				typename MapType::const_accessor acc;
+				map->find(acc, (i * 7 + tid) % n_keys);
+			}
+		});
+	});
+
+	auto find_value = measure<std::chrono::milliseconds>([&] {
+		run_threads(n_threads, [&](size_t tid) {
+			typename MapType::mapped_type v;
+			for (size_t i = 0; i < n_ops; ++i)
+				map->find_value((i * 7 + tid) % n_keys, v);
+		});
+	});
+
+	auto update = measure<std::chrono::milliseconds>([&] {
+		run_threads(n_threads, [&](size_t tid) {
+			for (size_t i = 0; i < n_ops; ++i) {
+				typename MapType::accessor acc;
+				if (map->find(acc, (i * 7 + tid) % n_keys))
+					acc->second = acc->second + 1;
+			}
+		});
+	});
+
+	std::cout << name << ": insert " << insert << "ms, lookup " << lookup
+		  << "ms, find_value " << find_value << "ms, update " << update
+		  << "ms" << std::endl;
+
+	map->clear();
+}
+
+int
+main(int argc, char *argv[])
+{
+	pmem::obj::pool<root> pop;
+	try {
+		std::string usage =
+			"usage: %s file-name n_keys n_ops [n_threads]";
+
+		if (argc < 4) {
+			std::cerr << usage << std::endl;
+			return 1;
+		}
+
+		const char *path = argv[1];
+		size_t n_keys = std::stoull(argv[2]);
+		size_t n_ops = std::stoull(argv[3]);
+		size_t n_threads = argc > 4 ? std::stoull(argv[4]) : 1;
+
+		if (n_keys * n_ops * n_threads == 0) {
+			std::cerr << "n_keys, n_ops and n_threads must be > 0"
+				  << std::endl;
+			return 1;
+		}
+
+		try {
+			auto pool_size = n_keys * 512 + 20 * PMEMOBJ_MIN_POOL;
+
+			pop = pmem::obj::pool<root>::create(
+				path, LAYOUT, pool_size, CREATE_MODE_RW);
+			pmem::obj::transaction::run(pop, [&] {
+				using pmem::obj::make_persistent;
+
+				auto r = pop.root();
+				r->shared_mutex_ptr =
+					make_persistent<shared_mutex_map>();
+				r->spin_ptr = make_persistent<spin_map>();
+				r->seq_ptr = make_persistent<seq_map>();
+			});
+		} catch (pmem::pool_error &pe) {
+			std::cerr << "!pool::create: " << pe.what()
+				  << std::endl;
+			return 1;
+		}
+
+		auto r = pop.root();
+		run(r->shared_mutex_ptr, "shared_mutex", n_keys, n_ops,
+		    n_threads);
+		run(r->spin_ptr, "spin_shared_mutex", n_keys, n_ops, n_threads);
+		run(r->seq_ptr, "seq_shared_mutex", n_keys, n_ops, n_threads);
+
+		pop.close();
+	} catch (const std::logic_error &e) {
+		std::cerr << "!pool::close: " << e.what() << std::endl;
+		return 1;
+	} catch (const std::exception &e) {
+		std::cerr << "!exception: " << e.what() << std::endl;
+		try {
+			pop.close();
+		} catch (const std::logic_error &e) {
+			std::cerr << "!exception: " << e.what() << std::endl;
+		}
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * string_lookup.cpp -- this simple benchmark is used to measure time of
+ * lookups in concurrent_hash_map with pmem::obj::string keys (as in the
+ * concurrent_hash_map_string example). Lookups with a temporary std::string
+ * built from the raw key data are compared with allocation-free lookups
+ * with string_view and const char * keys.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/string_view.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include "../measure.hpp"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#define CREATE_MODE_RW (S_IWUSR | S_IRUSR)
+
+#else
+
+#include <windows.h>
+#define CREATE_MODE_RW (S_IWRITE | S_IREAD)
+
+#endif
+
+static const std::string LAYOUT = "string_lookup";
+
+using persistent_map_type =
+	pmem::obj::concurrent_hash_map<pmem::obj::string, pmem::obj::p<int>,
+				       pmem::obj::string_hash>;
+
+struct root {
+	pmem::obj::persistent_ptr<persistent_map_type> pptr;
+};
+
+/* Keys are longer than the small string buffer of std::string */
+std::string
+make_key(size_t i)
+{
+	return "key-with-a-long-common-prefix-" + std::to_string(i);
+}
+
+template <typename F>
+void
+lookup(const std::vector<std::string> &keys, size_t n_threads, F &&find)
+{
+	std::vector<std::thread> v;
+	for (size_t i = 0; i < n_threads; i++) {
+		v.emplace_back(
+			[&](size_t tid) {
+				size_t found = 0;
+				for (size_t j = tid; j < keys.size();
+				     j += n_threads)
+					found += find(keys[j]);
+				assert(found > 0);
+				(void)found;
+			},
+			i);
+	}
+
+	for (auto &t : v)
+		t.join();
+}
+
+int
+main(int argc, char *argv[])
+{
+	pmem::obj::pool<root> pop;
+	try {
+		std::string usage =
+			"usage: %s file-name n_keys n_lookups [n_threads]";
+
+		if (argc < 4) {
+			std::cerr << usage << std::endl;
+			return 1;
+		}
+
+		const char *path = argv[1];
+		size_t n_keys = std::stoull(argv[2]);
+		size_t n_lookups = std::stoull(argv[3]);
+		size_t n_threads = argc > 4 ? std::stoull(argv[4]) : 1;
+
+		if (n_keys * n_lookups * n_threads == 0) {
+			std::cerr
+				<< "n_keys, n_lookups and n_threads must be > 0"
+				<< std::endl;
+			return 1;
+		}
+
+		try {
+			auto pool_size = n_keys * 256 + 20 * PMEMOBJ_MIN_POOL;
+
+			pop = pmem::obj::pool<root>::create(
+				path, LAYOUT, pool_size, CREATE_MODE_RW);
+			pmem::obj::transaction::run(pop, [&] {
+				pop.root()->pptr = pmem::obj::make_persistent<
+					persistent_map_type>();
+			});
+		} catch (pmem::pool_error &pe) {
+			std::cerr << "!pool::create: " << pe.what()
+				  << std::endl;
+			return 1;
+		}
+
+		auto map = pop.root()->pptr;
+		map->runtime_initialize();
+
+		for (size_t i = 0; i < n_keys; ++i)
+			map->insert_or_assign(make_key(i), int(i));
+
+		/* Every second key is missing from the map */
+		std::vector<std::string> keys;
+		keys.reserve(n_lookups);
+		for (size_t i = 0; i < n_lookups; ++i)
+			keys.emplace_back(make_key((i * 7) % (2 * n_keys)));
+
+		auto temporary = measure<std::chrono::milliseconds>([&] {
+			lookup(keys, n_threads, [&](const std::string &k) {
+				std::string tmp(k.data(), k.size());
+				return map->count(tmp);
+			});
+		});
+
+		auto view = measure<std::chrono::milliseconds>([&] {
+			lookup(keys, n_threads, [&](const std::string &k) {
+				return map->count(pmem::obj::string_view(
+					k.data(), k.size()));
+			});
+		});
+
+		auto cstr = measure<std::chrono::milliseconds>([&] {
+			lookup(keys, n_threads, [&](const std::string &k) {
+				return map->count(k.c_str());
+			});
+		});
+
+		std::cout << "std::string temporary: " << temporary << "ms"
+			  << std::endl;
+		std::cout << "string_view: " << view << "ms" << std::endl;
+		std::cout << "const char *: " << cstr << "ms" << std::endl;
+
+		map->clear();
+		pop.close();
+	} catch (const std::logic_error &e) {
+		std::cerr << "!pool::close: " << e.what() << std::endl;
+		return 1;
+	} catch (const std::exception &e) {
+		std::cerr << "!exception: " << e.what() << std::endl;
+		try {
+			pop.close();
+		} catch (const std::logic_error &e) {
+			std::cerr << "!exception: " << e.what() << std::endl;
+		}
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * scan.cpp -- this simple benchmark is used to measure throughput of range
+ * scans of concurrent_map depending on the number of nodes in the map.
+ * Scans which iterate from lower_bound() are compared with scan(), which
+ * prefetches nodes ahead of the currently processed one. Keys are inserted
+ * in random order and both kinds of scans are measured alternately.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include "../measure.hpp"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#define CREATE_MODE_RW (S_IWUSR | S_IRUSR)
+
+#else
+
+#include <windows.h>
+#define CREATE_MODE_RW (S_IWRITE | S_IREAD)
+
+#endif
+
+static const std::string LAYOUT = "scan";
+
+static const size_t MIN_KEYS = 1024;
+
+static const size_t N_ROUNDS = 3;
+
+using map_type =
+	pmem::obj::experimental::concurrent_map<pmem::obj::p<size_t>,
+						pmem::obj::p<size_t>>;
+
+struct root {
+	pmem::obj::persistent_ptr<map_type> map;
+};
+
+/*
+ * fill -- inserts elements with keys 2 * i and values i for i in
+ * [first, last), in random order, so that neighbouring nodes are not
+ * adjacent in memory
+ */
+static void
+fill(map_type &map, size_t first, size_t last, std::mt19937_64 &rng)
+{
+	std::vector<size_t> input;
+	input.reserve(last - first);
+	for (size_t i = first; i < last; ++i)
+		input.push_back(i);
+
+	std::shuffle(input.begin(), input.end(), rng);
+
+	for (auto i : input)
+		map.emplace(i * 2, i);
+}
+
+/*
+ * run -- performs n_scans scans of scan_length elements each, starting at
+ * pseudo-random keys, using iterators and using scan(), alternately for
+ * n_rounds rounds, and reports the best time of each
+ */
+static void
+run(map_type &map, size_t n_scans, size_t scan_length, size_t n_rounds)
+{
+	size_t n_keys = map.size();
+	size_t sum_iter = 0;
+	size_t sum_scan = 0;
+
+	auto iter = (std::numeric_limits<long long>::max)();
+	auto scan = (std::numeric_limits<long long>::max)();
+
+	for (size_t r = 0; r < n_rounds; ++r) {
+		auto t = measure<std::chrono::microseconds>([&] {
+			for (size_t i = 0; i < n_scans; ++i) {
+				size_t from = ((i * 7919) % n_keys) * 2;
+				auto it = map.lower_bound(from);
+				for (size_t j = 0;
+				     j < scan_length && it != map.end();
+				     ++j, ++it)
+					sum_iter += it->second;
+			}
+		});
+		iter = (std::min)(iter, static_cast<long long>(t));
+
+		t = measure<std::chrono::microseconds>([&] {
+			for (size_t i = 0; i < n_scans; ++i) {
+				size_t from = ((i * 7919) % n_keys) * 2;
+				map.scan(from,
+					 std::numeric_limits<size_t>::max(),
+					 scan_length,
+					 [&](const map_type::value_type &v) {
+						 sum_scan += v.second;
+					 });
+			}
+		});
+		scan = (std::min)(scan, static_cast<long long>(t));
+	}
+
+	if (sum_iter != sum_scan)
+		throw std::runtime_error("scans returned different elements");
+
+	auto throughput = [&](long long us) {
+		return static_cast<double>(n_scans * scan_length) /
+			static_cast<double>(us > 0 ? us : 1);
+	};
+
+	std::cout << n_keys << " nodes: iterator " << iter << "us ("
+		  << throughput(iter) << " M elements/s), scan " << scan
+		  << "us (" << throughput(scan) << " M elements/s)"
+		  << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pmem::obj::pool<root> pop;
+	try {
+		std::string usage =
+			"usage: %s file-name n_keys [n_scans] [scan_length]";
+
+		if (argc < 3) {
+			std::cerr << usage << std::endl;
+			return 1;
+		}
+
+		const char *path = argv[1];
+		size_t n_keys = std::stoull(argv[2]);
+		size_t n_scans = argc > 3 ? std::stoull(argv[3]) : 10000;
+		size_t scan_length = argc > 4 ? std::stoull(argv[4]) : 100;
+
+		if (n_keys < MIN_KEYS || n_scans * scan_length == 0) {
+			std::cerr << "n_keys must be >= " << MIN_KEYS
+				  << ", n_scans and scan_length must be > 0"
+				  << std::endl;
+			return 1;
+		}
+
+		try {
+			auto pool_size = n_keys * 256 + 20 * PMEMOBJ_MIN_POOL;
+
+			pop = pmem::obj::pool<root>::create(
+				path, LAYOUT, pool_size, CREATE_MODE_RW);
+			pmem::obj::transaction::run(pop, [&] {
+				pop.root()->map =
+					pmem::obj::make_persistent<map_type>();
+			});
+		} catch (pmem::pool_error &pe) {
+			std::cerr << "!pool::create: " << pe.what()
+				  << std::endl;
+			return 1;
+		}
+
+		auto map = pop.root()->map;
+		map->runtime_initialize();
+
+		std::mt19937_64 rng(n_keys);
+
+		/* Throughput is measured for growing number of nodes */
+		size_t size = 0;
+		for (size_t n = MIN_KEYS; size < n_keys; n *= 2) {
+			size_t next = (std::min)(n, n_keys);
+			fill(*map, size, next, rng);
+			size = next;
+
+			run(*map, n_scans, scan_length, N_ROUNDS);
+		}
+
+		pop.close();
+	} catch (const std::logic_error &e) {
+		std::cerr << "!pool::close: " << e.what() << std::endl;
+		return 1;
+	} catch (const std::exception &e) {
+		std::cerr << "!exception: " << e.what() << std::endl;
+		try {
+			pop.close();
+		} catch (const std::logic_error &e) {
+			std::cerr << "!exception: " << e.what() << std::endl;
+		}
+		return 1;
+	}
+	return 0;
+}
@@ -13,9 +13,13 @@
 #include <libpmemobj++/detail/atomic_backoff.hpp>
 #include <libpmemobj++/detail/common.hpp>
 #include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/detail/pool_data.hpp>
+#include <libpmemobj++/detail/run_in_threads.hpp>
 #include <libpmemobj++/detail/template_helpers.hpp>
 
 #include <libpmemobj++/defrag.hpp>
+#include <libpmemobj++/experimental/inline_string.hpp>
+#include <libpmemobj++/experimental/v.hpp>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/mutex.hpp>
 #include <libpmemobj++/p.hpp>
@@ -27,8 +31,12 @@
 
 #include <libpmemobj++/detail/enumerable_thread_specific.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <functional>
 #include <initializer_list>
 #include <iterator> // for std::distance
@@ -224,6 +232,41 @@ public:
 };
 }
 
+/**
+ * Tags selecting the layout of concurrent_hash_map nodes.
+ */
+namespace hash_map_layout
+{
+/**
+ * Next pointer, node mutex and the item.
+ */
+struct standard {
+};
+
+/**
+ * Next pointer, the item and node mutex. Key and value of a small item
+ * share the cache line with the next pointer, so walking a bucket reads one
+ * cache line of every node instead of two. Intended for small, trivially
+ * copyable keys and values.
+ */
+struct compact {
+};
+}
+
+/**
+ * Selects the layout of nodes of concurrent_hash_map with given key and
+ * mapped types, hash_map_layout::standard by default.
+ *
+ * To opt in to the compact layout, specialize this template (before the map
+ * is used) with type = hash_map_layout::compact. The layout is a part of
+ * the persistent layout of the map, so it must not be changed for an
+ * existing pool.
+ */
+template <typename Key, typename T>
+struct concurrent_hash_map_node_layout {
+	using type = hash_map_layout::standard;
+};
+
 template <typename Key, typename T, typename Hash = std::hash<Key>,
 	  typename KeyEqual = std::equal_to<Key>,
 	  typename MutexType = pmem::obj::shared_mutex,
@@ -273,8 +316,308 @@ assert_not_locked(Mutex &mtx)
 #endif
 }
 
+/**
+ * A structure that checks if objects of type T can be copied while they are
+ * concurrently modified or freed (such a copy is discarded afterwards), which
+ * is required by optimistic reads. Can have specialization.
+ */
+template <typename T>
+struct can_read_optimistically {
+	static constexpr bool value = LIBPMEMOBJ_CPP_IS_TRIVIALLY_COPYABLE(T);
+};
+
+template <typename T>
+struct can_read_optimistically<pmem::obj::p<T>>
+    : can_read_optimistically<T> {
+};
+
+template <typename MutexType>
+using read_begin_t = decltype(std::declval<const MutexType &>().read_begin());
+
+/**
+ * Checks if MutexType is a sequence lock, which validates optimistic reads of
+ * data it guards by itself, e.g. pmem::obj::experimental::seq_shared_mutex.
+ */
+template <typename MutexType>
+using has_optimistic_reads = detail::supports<MutexType, read_begin_t>;
+
+/**
+ * Sequence lock used to validate optimistic (lock-free) reads.
+ *
+ * Lower bits of the state count writers which are currently modifying data
+ * guarded by the lock, upper bits hold a version which is incremented each
+ * time a writer finishes. Readers never write to the lock. Each lock
+ * occupies a whole cache line.
+ */
+class alignas(64) optimistic_lock {
+public:
+	constexpr optimistic_lock() noexcept : state(0)
+	{
+	}
+
+	/** Mark the beginning of a modification. */
+	void
+	write_begin() noexcept
+	{
+		state.fetch_add(1, std::memory_order_acq_rel);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	/** Mark the end of a modification. */
+	void
+	write_end() noexcept
+	{
+		state.fetch_add(version_inc - 1, std::memory_order_release);
+	}
+
+	/**
+	 * @return state which should be passed to read_validate() or 0 if
+	 * there is a writer in progress.
+	 */
+	uint64_t
+	read_begin() const noexcept
+	{
+		uint64_t s = state.load(std::memory_order_acquire);
+
+		return (s & writers_mask) ? 0 : s | writers_mask;
+	}
+
+	/**
+	 * @return true if no writer modified the guarded data since
+	 * read_begin() returned @p s.
+	 */
+	bool
+	read_validate(uint64_t s) const noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		return (state.load(std::memory_order_relaxed) | writers_mask) ==
+			s;
+	}
+
+private:
+	static constexpr uint64_t version_inc = 1ULL << 16;
+	static constexpr uint64_t writers_mask = version_inc - 1;
+
+	std::atomic<uint64_t> state;
+};
+
+/**
+ * RAII helper which marks a modification of data guarded by an
+ * optimistic_lock. Does nothing if the lock is nullptr.
+ */
+class optimistic_write_guard {
+public:
+	explicit optimistic_write_guard(optimistic_lock *l) noexcept : lock(l)
+	{
+		if (lock)
+			lock->write_begin();
+	}
+
+	~optimistic_write_guard()
+	{
+		if (lock)
+			lock->write_end();
+	}
+
+	optimistic_write_guard(const optimistic_write_guard &) = delete;
+	optimistic_write_guard &
+	operator=(const optimistic_write_guard &) = delete;
+
+private:
+	optimistic_lock *lock;
+};
+
+/**
+ * Table of optimistic locks. It lives in volatile memory and is shared by
+ * all concurrent_hash_map instances in the process which can be read
+ * optimistically (see can_read_optimistically). Bucket with index idx
+ * (and each item stored in it) is guarded by the lock returned by
+ * get(map, idx), which depends only on the lowest bits of idx. Thanks to
+ * that, items moved between buckets by rehashing stay guarded by the same
+ * lock as long as the table has at least min_buckets buckets.
+ */
+class optimistic_lock_table {
+public:
+	/** Minimal number of buckets required for optimistic reads. */
+	static constexpr size_t min_buckets = 256;
+
+	static optimistic_lock &
+	get(const void *map, size_t idx) noexcept
+	{
+		static optimistic_lock locks[size];
+
+		/* spread locks of different maps over the table */
+		size_t salt = static_cast<size_t>(
+			(reinterpret_cast<uintptr_t>(map) >> 6) *
+			0x9E3779B97F4A7C15ULL >> 40);
+
+		return locks[((idx & (min_buckets - 1)) + salt) & (size - 1)];
+	}
+
+private:
+	static constexpr size_t size = 1024;
+};
+
+/*
+ * Fields of a hash map node, in the order defined by the Layout tag.
+ */
+template <typename Node, typename Value, typename MutexType, typename Layout>
+struct hash_map_node_fields;
+
+template <typename Node, typename Value, typename MutexType>
+struct hash_map_node_fields<Node, Value, MutexType,
+			    hash_map_layout::standard> {
+	using node_ptr_t = detail::persistent_pool_ptr<Node>;
+
+	template <typename... Args>
+	hash_map_node_fields(const node_ptr_t &_next, Args &&... args)
+	    : next(_next), item(std::forward<Args>(args)...)
+	{
+	}
+
+	/** Next node in chain. */
+	node_ptr_t next;
+
+	/** Node mutex. */
+	MutexType mutex;
+
+	/** Item stored in node */
+	Value item;
+};
+
+template <typename Node, typename Value, typename MutexType>
+struct hash_map_node_fields<Node, Value, MutexType, hash_map_layout::compact> {
+	using node_ptr_t = detail::persistent_pool_ptr<Node>;
+
+	template <typename... Args>
+	hash_map_node_fields(const node_ptr_t &_next, Args &&... args)
+	    : next(_next), item(std::forward<Args>(args)...)
+	{
+	}
+
+	/** Next node in chain. */
+	node_ptr_t next;
+
+	/** Item stored in node */
+	Value item;
+
+	/** Node mutex. */
+	MutexType mutex;
+};
+
+template <typename T>
+using pair_second_t = decltype(std::declval<T &>().second);
+
+/*
+ * Size of storage allocated right after a node, for the characters of an
+ * inline string mapped value. The value is the last field of a node with
+ * the standard layout, so its data may follow the node.
+ */
+template <typename T>
+struct hash_map_node_tail {
+	static constexpr bool is_empty = true;
+
+	template <typename... Args>
+	static size_t
+	size(const Args &...)
+	{
+		return 0;
+	}
+
+	/* Arguments which construct an empty mapped value */
+	static std::tuple<>
+	empty_value_args()
+	{
+		return {};
+	}
+};
+
+template <typename CharT, typename Traits>
+struct hash_map_node_tail<experimental::basic_inline_string<CharT, Traits>> {
+	using string_type = experimental::basic_inline_string<CharT, Traits>;
+
+	static constexpr bool is_empty = false;
+
+	/* Node constructed from a key or an item */
+	template <typename A>
+	static size_t
+	size(const A &a)
+	{
+		return item_size(a, detail::supports<A, pair_second_t>{});
+	}
+
+	/* Node constructed from a key and a value */
+	template <typename K, typename V>
+	static size_t
+	size(const K &, const V &v)
+	{
+		return value_size(v);
+	}
+
+	/* Node constructed piecewise from arguments of the key and the
+	 * value */
+	template <typename KeyTuple, typename... ValueArgs>
+	static size_t
+	size(std::piecewise_construct_t, const KeyTuple &,
+	     const std::tuple<ValueArgs...> &value_args)
+	{
+		static_assert(sizeof...(ValueArgs) <= 1,
+			      "inline string mapped value must be constructed "
+			      "from at most one argument");
+
+		return tuple_value_size(value_args);
+	}
+
+	static std::tuple<basic_string_view<CharT, Traits>>
+	empty_value_args()
+	{
+		return std::tuple<basic_string_view<CharT, Traits>>();
+	}
+
+private:
+	template <typename V>
+	static size_t
+	value_size(const V &v)
+	{
+		return experimental::total_sizeof<string_type>::value(v) -
+			sizeof(string_type);
+	}
+
+	static size_t
+	tuple_value_size(const std::tuple<> &)
+	{
+		return value_size(basic_string_view<CharT, Traits>());
+	}
+
+	template <typename V>
+	static size_t
+	tuple_value_size(const std::tuple<V> &value_args)
+	{
+		return value_size(std::get<0>(value_args));
+	}
+
+	template <typename Item>
+	static size_t
+	item_size(const Item &item, std::true_type)
+	{
+		return size(item.first, item.second);
+	}
+
+	template <typename K>
+	static size_t
+	item_size(const K &key, std::false_type)
+	{
+		return size(key, basic_string_view<CharT, Traits>());
+	}
+};
+
 template <typename Key, typename T, typename MutexType, typename ScopedLockType>
-struct hash_map_node {
+struct hash_map_node
+    : hash_map_node_fields<
+	      hash_map_node<Key, T, MutexType, ScopedLockType>,
+	      detail::pair<const Key, T>, MutexType,
+	      typename concurrent_hash_map_node_layout<Key, T>::type> {
 	/**Mutex type. */
 	using mutex_t = MutexType;
 
@@ -283,44 +626,50 @@ struct hash_map_node {
 
 	using value_type = detail::pair<const Key, T>;
 
-	/** Persistent pointer type for next. */
-	using node_ptr_t = detail::persistent_pool_ptr<
-		hash_map_node<Key, T, mutex_t, scoped_t>>;
+	using layout_type =
+		typename concurrent_hash_map_node_layout<Key, T>::type;
 
-	/** Next node in chain. */
-	node_ptr_t next;
+	using fields_type =
+		hash_map_node_fields<hash_map_node, value_type, mutex_t,
+				     layout_type>;
 
-	/** Node mutex. */
-	mutex_t mutex;
+	using tail_type = hash_map_node_tail<T>;
 
-	/** Item stored in node */
-	value_type item;
+	static_assert(!detail::is_inline_string<Key>::value,
+		      "inline string can be used only as the mapped type");
+	static_assert(tail_type::is_empty ||
+			      std::is_same<layout_type,
+					   hash_map_layout::standard>::value,
+		      "inline string mapped value requires standard layout");
+
+	/** Persistent pointer type for next. */
+	using node_ptr_t = typename fields_type::node_ptr_t;
 
 	hash_map_node(const node_ptr_t &_next, const Key &key)
-	    : next(_next),
-	      item(std::piecewise_construct, std::forward_as_tuple(key),
-		   std::forward_as_tuple())
+	    : fields_type(_next, std::piecewise_construct,
+			  std::forward_as_tuple(key),
+			  tail_type::empty_value_args())
 	{
 	}
 
 	hash_map_node(const node_ptr_t &_next, const Key &key, const T &t)
-	    : next(_next), item(key, t)
+	    : fields_type(_next, key, t)
 	{
 	}
 
 	hash_map_node(const node_ptr_t &_next, value_type &&i)
-	    : next(_next), item(std::move(i))
+	    : fields_type(_next, std::move(i))
 	{
 	}
 
 	template <typename... Args>
 	hash_map_node(const node_ptr_t &_next, Args &&... args)
-	    : next(_next), item(std::forward<Args>(args)...)
+	    : fields_type(_next, std::forward<Args>(args)...)
 	{
 	}
 
 	hash_map_node(const node_ptr_t &_next, const value_type &i)
-	    : next(_next), item(i)
+	    : fields_type(_next, i)
 	{
 	}
 
@@ -749,6 +1098,180 @@ private:
 	segment_index_t my_seg;
 }; /* End of class segment_facade_impl */
 
+/*
+ * Operations on the word stored in bucket::rehashed. Besides the rehashed
+ * flag it holds 8-bit fingerprints of hash codes of the first nodes in the
+ * bucket, so that nodes with a different fingerprint do not have to be read
+ * during a lookup:
+ * - bit 0: bucket is rehashed,
+ * - bit 1: fingerprints are valid,
+ * - bit 2: bucket may contain more nodes than fingerprints,
+ * - bits 4-7: number of fingerprints,
+ * - byte n (n = 1..7): fingerprint of the (n-1)-th node in the bucket.
+ * Pools created by older versions of the library have only bit 0 set, so
+ * their fingerprints are not valid until the bucket is rebuilt. Older
+ * versions would modify buckets without updating the fingerprints, so hash
+ * maps with fingerprints have the FEATURE_FINGERPRINTS incompat flag set.
+ */
+struct bucket_fingerprints {
+	enum : uint64_t {
+		rehashed = 1,
+		valid = 2,
+		overflow = 4,
+		count_shift = 4,
+		count_mask = 0xF0,
+		max_count = 7
+	};
+
+	/* State of a rehashed, empty bucket. */
+	static constexpr uint64_t
+	empty()
+	{
+		return rehashed | valid;
+	}
+
+	static uint8_t
+	fingerprint(size_t h)
+	{
+		/* low bits of a hash code select the bucket, mix all bits */
+		return static_cast<uint8_t>(
+			(static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ULL) >>
+			56);
+	}
+
+	static size_t
+	count(uint64_t s)
+	{
+		return static_cast<size_t>((s & count_mask) >> count_shift);
+	}
+
+	static bool
+	is_valid(uint64_t s)
+	{
+		return (s & valid) != 0;
+	}
+
+	/*
+	 * Returns mask with bit n set if fingerprint of the n-th node is equal
+	 * to fp. Valid only for n < count(s).
+	 */
+	static unsigned
+	match(uint64_t s, uint8_t fp)
+	{
+		return (detail::match_bytes(s, fp) >> 1) &
+			((1u << count(s)) - 1);
+	}
+
+	/* State after inserting a node at the beginning of the bucket. */
+	static uint64_t
+	push_front(uint64_t s, uint8_t fp)
+	{
+		if (!is_valid(s))
+			return s;
+
+		size_t n = count(s);
+		uint64_t flags = s & (rehashed | valid | overflow);
+
+		if (n == max_count)
+			flags |= overflow;
+		else
+			++n;
+
+		/* the last fingerprint is dropped if there are too many */
+		return ((s & ~uint64_t(0xFF)) << 8) | (uint64_t(fp) << 8) |
+			flags | (uint64_t(n) << count_shift);
+	}
+
+	/*
+	 * State after removing the pos-th node of the bucket. Fingerprints
+	 * become invalid if the bucket contains more nodes than fingerprints,
+	 * as fingerprint of the next node is not known.
+	 */
+	static uint64_t
+	erase(uint64_t s, size_t pos)
+	{
+		size_t n = count(s);
+
+		if (!is_valid(s) || pos >= n)
+			return s;
+
+		if (s & overflow)
+			return s & ~uint64_t(valid);
+
+		/* bytes 1..pos stay, bytes pos + 2..7 are moved down */
+		uint64_t low = (uint64_t(1) << (8 * (pos + 1))) - 1;
+		uint64_t fps = (s & low & ~uint64_t(0xFF)) | ((s >> 8) & ~low);
+
+		return fps | (s & (rehashed | valid)) |
+			(uint64_t(n - 1) << count_shift);
+	}
+
+	/*
+	 * Selects nodes of a bucket whose keys have to be compared when
+	 * looking for a key with hash code h.
+	 */
+	class filter {
+	public:
+		filter(uint64_t s, size_t h)
+		    : candidates(0), listed(0), complete(false)
+		{
+			if (is_valid(s)) {
+				candidates = match(s, fingerprint(h));
+				listed = count(s);
+				complete = !(s & overflow);
+			}
+		}
+
+		/* Returns true if the key cannot be in the bucket. */
+		bool
+		none() const
+		{
+			return complete && candidates == 0;
+		}
+
+		/* Returns true if key of the pos-th node must be compared. */
+		bool
+		operator()(size_t pos) const
+		{
+			return pos >= listed || ((candidates >> pos) & 1u);
+		}
+
+	private:
+		unsigned candidates;
+		size_t listed;
+		bool complete;
+	};
+
+	/* Builds fingerprints of a bucket from its nodes, in order. */
+	class builder {
+	public:
+		builder() : state(empty()), n(0)
+		{
+		}
+
+		void
+		push_back(uint8_t fp)
+		{
+			if (n < max_count) {
+				state |= uint64_t(fp) << (8 * (n + 1));
+				++n;
+			} else {
+				state |= overflow;
+			}
+		}
+
+		uint64_t
+		get() const
+		{
+			return state | (uint64_t(n) << count_shift);
+		}
+
+	private:
+		uint64_t state;
+		size_t n;
+	};
+};
+
 /**
  * Base class of concurrent_hash_map.
  * Implements logic not dependent to Key/Value types.
@@ -805,20 +1328,50 @@ public:
 		bool
 		is_rehashed(std::memory_order order)
 		{
-			return rehashed.get_ro().load(order);
+			return (rehashed.get_ro().load(order) &
+				bucket_fingerprints::rehashed) != 0;
 		}
 
+		/**
+		 * Marks bucket as rehashed. Fingerprints are valid only if
+		 * the bucket is empty.
+		 */
 		void
 		set_rehashed(std::memory_order order)
 		{
-			rehashed.get_rw().store(true, order);
+			uint64_t s = bucket_fingerprints::rehashed;
+			if (node_list == nullptr)
+				s = bucket_fingerprints::empty();
+
+			rehashed.get_rw().store(s, order);
 		}
 
-		/** Copy constructor is deleted */
-		bucket(const bucket &) = delete;
+		/**
+		 * @returns rehashed flag together with fingerprints of the
+		 * nodes, see bucket_fingerprints.
+		 */
+		uint64_t
+		fingerprints(std::memory_order order)
+		{
+			return rehashed.get_ro().load(order);
+		}
 
-		/** Assignment operator is deleted */
-		bucket &operator=(const bucket &) = delete;
+		/**
+		 * Sets rehashed flag together with fingerprints. Must be
+		 * called under write lock, in the transaction which modifies
+		 * node_list.
+		 */
+		void
+		set_fingerprints(uint64_t s, std::memory_order order)
+		{
+			rehashed.get_rw().store(s, order);
+		}
+
+		/** Copy constructor is deleted */
+		bucket(const bucket &) = delete;
+
+		/** Assignment operator is deleted */
+		bucket &operator=(const bucket &) = delete;
 	}; /* End of struct bucket */
 
 	/** Segment traits */
@@ -858,7 +1411,86 @@ public:
 
 	using tls_t = detail::enumerable_thread_specific<tls_data_t>;
 
-	enum feature_flags : uint32_t { FEATURE_CONSISTENT_SIZE = 1 };
+	/** Header of a node storage kept in a node cache */
+	struct free_node {
+		detail::persistent_pool_ptr<free_node> next;
+	};
+
+	/**
+	 * Storage for nodes cached by a thread. Storage of erased nodes is
+	 * reused by subsequent inserts, which avoids calls to the allocator.
+	 *
+	 * Nodes erased by the thread are first retired: they are unlinked
+	 * from buckets but can be still used via accessors, so they are
+	 * destroyed only when their mutexes are free. Retired nodes are
+	 * reclaimed by an erase which finds node_retire_batch of them and by
+	 * an insert which finds the cache empty, so a thread keeps fewer than
+	 * node_retire_batch retired nodes which are not held by accessors.
+	 * runtime_initialize() reclaims and free_data() frees all of them.
+	 *
+	 * The cache is modified in the same transactions as the buckets,
+	 * so no storage is lost on a crash.
+	 */
+	struct node_cache_data_t {
+		detail::persistent_pool_ptr<free_node> head;
+		p<uint64_t> count = 0;
+
+		/** Retired nodes, linked through next */
+		node_ptr_t retired;
+		p<uint64_t> retired_count = 0;
+	};
+
+	using node_cache_t =
+		detail::enumerable_thread_specific<node_cache_data_t>;
+
+	enum node_cache_limits : uint64_t {
+		/** Max number of nodes cached by a thread */
+		node_cache_capacity = 64,
+		/** Number of nodes allocated when the cache is empty */
+		node_cache_batch = 8,
+		/** Number of retired nodes which triggers reclamation */
+		node_retire_batch = 16
+	};
+
+	/**
+	 * Volatile size counter shared by a group of threads. Changes of
+	 * size are accumulated here and folded into my_size in batches.
+	 */
+	struct size_shard_t {
+		std::atomic<int64_t> diff;
+		char padding[64 - sizeof(std::atomic<int64_t>)];
+	};
+
+	enum size_shards_limits : uint64_t {
+		/** Number of size counters */
+		size_shards_count = 64,
+		/** Absolute value of a counter which is folded into my_size */
+		size_fold_threshold = 32
+	};
+
+	/** Size counters of a hash map, kept in volatile memory */
+	struct size_shards_t {
+		size_shards_t()
+		{
+			reset();
+		}
+
+		void
+		reset()
+		{
+			for (auto &shard : shards)
+				shard.diff.store(0, std::memory_order_relaxed);
+		}
+
+		size_shard_t shards[size_shards_count];
+	};
+
+	enum feature_flags : uint32_t {
+		FEATURE_CONSISTENT_SIZE = 1,
+		FEATURE_NODE_CACHE = 2
+	};
+
+	enum incompat_feature_flags : uint32_t { FEATURE_FINGERPRINTS = 1 };
 
 	/** Compat and incompat features of a layout */
 	struct features {
@@ -914,8 +1546,17 @@ public:
 	 */
 	p<size_t> on_init_size;
 
+	/** Per-thread node caches, valid if FEATURE_NODE_CACHE is set */
+	persistent_ptr<node_cache_t> node_cache_ptr;
+
+	/**
+	 * Size counters in volatile memory, owned by the pool. Null until
+	 * runtime_initialize() is called in the current run.
+	 */
+	obj::experimental::v<size_shards_t *> size_shards;
+
 	/** Reserved for future use */
-	std::aligned_storage<40, 8>::type reserved;
+	std::aligned_storage<8, 8>::type reserved;
 
 	/** Segment mutex used to enable new segment. */
 	segment_enable_mutex_t my_segment_enable_mutex;
@@ -929,7 +1570,8 @@ public:
 	static constexpr features
 	header_features()
 	{
-		return {FEATURE_CONSISTENT_SIZE, 0};
+		return {FEATURE_CONSISTENT_SIZE | FEATURE_NODE_CACHE,
+			FEATURE_FINGERPRINTS};
 	}
 
 	const std::atomic<hashcode_type> &
@@ -944,12 +1586,148 @@ public:
 		return my_mask;
 	}
 
+	/**
+	 * @returns number of items, including changes which were not folded
+	 * into my_size yet.
+	 */
 	size_t
 	size() const
+	{
+		int64_t sz = static_cast<int64_t>(
+			my_size.load(std::memory_order_relaxed));
+
+		size_shards_t *shards = get_size_shards();
+		if (shards != nullptr) {
+			for (auto &shard : shards->shards)
+				sz += shard.diff.load(std::memory_order_relaxed);
+		}
+
+		/* Erase can be counted before the insert of the item */
+		return sz < 0 ? 0 : static_cast<size_t>(sz);
+	}
+
+	/**
+	 * @returns number of items, without changes which were not folded
+	 * into my_size yet.
+	 */
+	size_t
+	approximate_size() const
 	{
 		return my_size.load(std::memory_order_relaxed);
 	}
 
+	/**
+	 * Adds diff to the size counter of the calling thread. The counter
+	 * is folded into my_size when its absolute value reaches
+	 * size_fold_threshold.
+	 * @returns approximate number of items after the change.
+	 */
+	size_t
+	add_size(int64_t diff)
+	{
+		size_shards_t *shards = get_size_shards();
+		if (shards == nullptr)
+			return my_size.fetch_add(static_cast<size_t>(diff),
+						 std::memory_order_relaxed) +
+				static_cast<size_t>(diff);
+
+		auto &shard = shards->shards[thread_size_shard()];
+		int64_t d = shard.diff.fetch_add(diff,
+						 std::memory_order_relaxed) +
+			diff;
+
+		if (d >= int64_t(size_fold_threshold) ||
+		    d <= -int64_t(size_fold_threshold)) {
+			d = shard.diff.exchange(0, std::memory_order_relaxed);
+			return my_size.fetch_add(static_cast<size_t>(d),
+						 std::memory_order_relaxed) +
+				static_cast<size_t>(d);
+		}
+
+		return my_size.load(std::memory_order_relaxed) +
+			static_cast<size_t>(d);
+	}
+
+	/**
+	 * Folds all size counters into my_size.
+	 * Not thread safe.
+	 */
+	void
+	fold_size()
+	{
+		size_shards_t *shards = get_size_shards();
+		if (shards == nullptr)
+			return;
+
+		for (auto &shard : shards->shards) {
+			int64_t d = shard.diff.exchange(
+				0, std::memory_order_relaxed);
+			my_size += static_cast<size_t>(d);
+		}
+	}
+
+	/**
+	 * Binds size counters in volatile memory to the hash map and resets
+	 * them. The counters are owned by the pool, so they are freed on pool
+	 * close, and they are not valid after restart.
+	 */
+	void
+	init_size_shards()
+	{
+		size_shards_t *shards =
+			get_pool_data()->template get_volatile<size_shards_t>(
+				pmemobj_oid(this).off);
+		shards->reset();
+
+		size_shards.get() = shards;
+	}
+
+	/**
+	 * Destroys size counters when the transaction is committed.
+	 * Should be called inside a transaction.
+	 */
+	void
+	destroy_size_shards()
+	{
+		detail::pool_data *data = get_pool_data();
+		uint64_t off = pmemobj_oid(this).off;
+
+		flat_transaction::register_callback(
+			flat_transaction::stage::oncommit,
+			[data, off] { data->destroy_volatile(off); });
+	}
+
+	/** @returns size counters or nullptr if they were not initialized */
+	size_shards_t *
+	get_size_shards() const
+	{
+		return const_cast<obj::experimental::v<size_shards_t *> &>(
+			       size_shards)
+			.get();
+	}
+
+	detail::pool_data *
+	get_pool_data() const
+	{
+		auto *data = static_cast<detail::pool_data *>(
+			pmemobj_get_user_data(pmemobj_pool_by_ptr(this)));
+		assert(data != nullptr);
+
+		return data;
+	}
+
+	/** @returns index of the size counter of the calling thread */
+	static size_t
+	thread_size_shard()
+	{
+		static std::atomic<size_t> next_shard(0);
+		static thread_local size_t shard =
+			next_shard.fetch_add(1, std::memory_order_relaxed) %
+			size_shards_count;
+
+		return shard;
+	}
+
 	p<int64_t> &
 	thread_size_diff()
 	{
@@ -1024,6 +1802,7 @@ public:
 		value_size = 0;
 
 		this->tls_ptr = nullptr;
+		this->node_cache_ptr = nullptr;
 	}
 
 	/*
@@ -1043,6 +1822,314 @@ public:
 				tls_ptr = nullptr;
 			});
 		}
+
+		if (node_cache_enabled()) {
+			flat_transaction::run(pop, [&] {
+				free_node_caches();
+				delete_persistent<node_cache_t>(node_cache_ptr);
+				node_cache_ptr = nullptr;
+			});
+		}
+
+		flat_transaction::run(pop, [&] { destroy_size_shards(); });
+	}
+
+	bool
+	node_cache_enabled() const
+	{
+		return (layout_features.compat & FEATURE_NODE_CACHE) &&
+			node_cache_ptr != nullptr;
+	}
+
+	/**
+	 * Sets FEATURE_FINGERPRINTS for hash maps created without it, before
+	 * any fingerprint is written, so that older versions of the library,
+	 * which do not update fingerprints, cannot open the pool anymore.
+	 * Fingerprints of such maps are not valid until buckets are rebuilt.
+	 */
+	void
+	enable_fingerprints()
+	{
+		if (layout_features.incompat & FEATURE_FINGERPRINTS)
+			return;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] {
+			layout_features.incompat |= FEATURE_FINGERPRINTS;
+		});
+	}
+
+	/**
+	 * Allocates node caches for hash maps created without
+	 * FEATURE_NODE_CACHE.
+	 */
+	void
+	enable_node_cache()
+	{
+		if (layout_features.compat & FEATURE_NODE_CACHE)
+			return;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] {
+			node_cache_ptr = make_persistent<node_cache_t>();
+			layout_features.compat |= FEATURE_NODE_CACHE;
+		});
+	}
+
+	/**
+	 * @returns node cache of the calling thread or nullptr if node
+	 * caches are not enabled or nodes do not have a fixed size.
+	 * @pre must be called outside of a transaction.
+	 */
+	node_cache_data_t *
+	thread_node_cache()
+	{
+		if (!node::tail_type::is_empty)
+			return nullptr;
+
+		return node_cache_enabled() ? &node_cache_ptr->local()
+					    : nullptr;
+	}
+
+	/**
+	 * Constructs a node in storage taken from the node cache. The cache
+	 * is refilled with node_cache_batch new allocations when it is
+	 * empty. If cache is nullptr, the node is simply allocated.
+	 * @pre must be called inside transaction.
+	 */
+	template <typename... Args>
+	node_ptr_t
+	allocate_node(node_cache_data_t *cache, Args &&... args)
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+		if (!cache && node::tail_type::is_empty)
+			return make_persistent<node>(
+				std::forward<Args>(args)...);
+
+		if (!cache) {
+			size_t size = sizeof(node) + node_tail_size(args...);
+			node_ptr_t np(allocate_storage(size));
+			detail::create<node>(np.get(my_pool_uuid),
+					     std::forward<Args>(args)...);
+
+			return np;
+		}
+
+		if (cache->count == 0)
+			fill_node_cache(*cache);
+
+		detail::persistent_pool_ptr<free_node> f = cache->head;
+		free_node *fn = f.get(my_pool_uuid);
+
+		/*
+		 * The cache still points to the storage on abort, so its link
+		 * to the next cached storage must be restored. The rest of the
+		 * storage is not needed on abort.
+		 */
+		detail::conditional_add_to_tx(fn);
+		detail::conditional_add_to_tx(
+			reinterpret_cast<char *>(fn) + sizeof(free_node),
+			sizeof(node) - sizeof(free_node),
+			POBJ_XADD_NO_SNAPSHOT);
+
+		cache->head = fn->next;
+		--cache->count;
+
+		node *n = reinterpret_cast<node *>(fn);
+		detail::create<node>(n, std::forward<Args>(args)...);
+
+		return node_ptr_t(f.raw());
+	}
+
+	/**
+	 * Destroys a node and keeps its storage in the node cache, or frees
+	 * it if cache is nullptr or full.
+	 * @pre must be called inside transaction.
+	 */
+	void
+	deallocate_node(node_cache_data_t *cache, const node_ptr_t &np)
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+		if (!cache || cache->count >= node_cache_capacity) {
+			delete_persistent<node>(
+				np.get_persistent_ptr(my_pool_uuid));
+			return;
+		}
+
+		node *n = np.get(my_pool_uuid);
+		detail::destroy<node>(*n);
+
+		free_node *f = reinterpret_cast<free_node *>(n);
+		detail::conditional_add_to_tx(f);
+		detail::create<free_node>(f);
+
+		f->next = cache->head;
+		cache->head = detail::persistent_pool_ptr<free_node>(np.raw());
+		++cache->count;
+	}
+
+	/**
+	 * Frees storage kept in node caches of all threads.
+	 * @pre must be called inside transaction.
+	 */
+	void
+	free_node_caches()
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+		if (!node_cache_enabled())
+			return;
+
+		for (auto &cache : *node_cache_ptr) {
+			while (cache.head) {
+				auto f = cache.head;
+				cache.head = f.get(my_pool_uuid)->next;
+				free_storage(f.raw_oid(my_pool_uuid));
+			}
+
+			while (cache.retired) {
+				auto n = cache.retired;
+				cache.retired = n.get(my_pool_uuid)->next;
+				delete_persistent<node>(
+					n.get_persistent_ptr(my_pool_uuid));
+			}
+		}
+
+		node_cache_ptr->clear();
+	}
+
+	/**
+	 * Puts a node, which is already unlinked from its bucket, on the
+	 * retired list of the cache.
+	 * @pre must be called inside transaction.
+	 */
+	void
+	retire_node(node_cache_data_t *cache, const node_ptr_t &np)
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+		np.get(my_pool_uuid)->next = cache->retired;
+		cache->retired = np;
+		++cache->retired_count;
+	}
+
+	/**
+	 * Destroys retired nodes of the cache which are not used by any
+	 * accessor. Retired nodes are not reachable from buckets, so no
+	 * accessor can acquire them after their mutexes were found free.
+	 * Does nothing if there are less than threshold retired nodes.
+	 * @pre must be called outside of a transaction.
+	 */
+	void
+	reclaim_retired_nodes(node_cache_data_t *cache, uint64_t threshold)
+	{
+		if (cache->retired_count == 0 ||
+		    cache->retired_count < threshold)
+			return;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] {
+			node_ptr_t *p = &cache->retired;
+
+			while (*p) {
+				node *n = p->get(my_pool_uuid);
+
+				typename node::scoped_t lock;
+				if (!lock.try_acquire(n->mutex, true)) {
+					p = &n->next;
+					continue;
+				}
+				lock.release();
+
+				node_ptr_t del = *p;
+				*p = n->next;
+				--cache->retired_count;
+
+				deallocate_node(cache, del);
+			}
+		});
+	}
+
+	/**
+	 * Reclaims retired nodes of the cache if it has no free storage, so
+	 * that their storage is reused instead of a new allocation.
+	 * @pre must be called outside of a transaction.
+	 */
+	void
+	reuse_retired_nodes(node_cache_data_t *cache)
+	{
+		if (cache && cache->count == 0)
+			reclaim_retired_nodes(cache, 1);
+	}
+
+	/**
+	 * Destroys retired nodes of all threads.
+	 * Not thread safe, there must be no accessors in use.
+	 */
+	void
+	reclaim_all_retired_nodes()
+	{
+		if (!node_cache_enabled())
+			return;
+
+		for (auto &cache : *node_cache_ptr)
+			reclaim_retired_nodes(&cache, 0);
+	}
+
+	/* Size of storage allocated after a node constructed from args */
+	template <typename... Args>
+	static size_t
+	node_tail_size(const node_ptr_t &, const Args &... args)
+	{
+		return node::tail_type::size(args...);
+	}
+
+	/**
+	 * Allocates size bytes of storage for a node.
+	 * @pre must be called inside transaction.
+	 */
+	PMEMoid
+	allocate_storage(size_t size)
+	{
+		PMEMoid oid =
+			pmemobj_tx_xalloc(size, detail::type_num<node>(), 0);
+		if (OID_IS_NULL(oid)) {
+			if (errno == ENOMEM)
+				throw pmem::transaction_out_of_memory(
+					"Failed to allocate persistent memory object")
+					.with_pmemobj_errormsg();
+			else
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate persistent memory object")
+					.with_pmemobj_errormsg();
+		}
+
+		return oid;
+	}
+
+	void
+	fill_node_cache(node_cache_data_t &cache)
+	{
+		for (uint64_t i = 0; i < node_cache_batch; ++i) {
+			detail::persistent_pool_ptr<free_node> f(
+				allocate_storage(sizeof(node)));
+			detail::create<free_node>(f.get(my_pool_uuid));
+
+			f.get(my_pool_uuid)->next = cache.head;
+			cache.head = f;
+			++cache.count;
+		}
+	}
+
+	void
+	free_storage(PMEMoid oid)
+	{
+		if (pmemobj_tx_free(oid) != 0)
+			throw pmem::transaction_free_error(
+				"failed to delete persistent memory object")
+				.with_pmemobj_errormsg();
 	}
 
 	/**
@@ -1213,29 +2300,38 @@ public:
 	}
 
 	/**
-	 * Insert a node to bucket.
+	 * Insert a node with hash code h to bucket, using storage from
+	 * cache if it is not nullptr.
 	 * @pre must be called inside transaction.
 	 */
 	template <typename Node, typename... Args>
 	void
-	insert_new_node_internal(bucket *b,
+	insert_new_node_internal(bucket *b, hashcode_type h,
 				 detail::persistent_pool_ptr<Node> &new_node,
-				 Args &&... args)
+				 node_cache_data_t *cache, Args &&... args)
 	{
 		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 
-		new_node = pmem::obj::make_persistent<Node>(
-			b->node_list, std::forward<Args>(args)...);
+		new_node = allocate_node(cache, b->node_list,
+					 std::forward<Args>(args)...);
 		b->node_list = new_node; /* bucket is locked */
+
+		uint64_t s = b->fingerprints(std::memory_order_relaxed);
+		if (bucket_fingerprints::is_valid(s))
+			b->set_fingerprints(
+				bucket_fingerprints::push_front(
+					s, bucket_fingerprints::fingerprint(h)),
+				std::memory_order_release);
 	}
 
 	/**
-	 * Insert a node.
+	 * Insert a node with hash code h.
 	 * @return new size.
 	 */
 	template <typename Node, typename... Args>
 	size_type
-	insert_new_node(bucket *b, detail::persistent_pool_ptr<Node> &new_node,
+	insert_new_node(bucket *b, hashcode_type h,
+			detail::persistent_pool_ptr<Node> &new_node,
 			Args &&... args)
 	{
 		pool_base pop = get_pool_base();
@@ -1246,22 +2342,27 @@ public:
 		 * modify on_init_size.
 		 */
 		if (pmemobj_tx_stage() == TX_STAGE_WORK) {
-			insert_new_node_internal(b, new_node,
+			insert_new_node_internal(b, h, new_node, nullptr,
 						 std::forward<Args>(args)...);
 			this->on_init_size++;
+
+			return ++(this->my_size);
 		} else {
 			auto &size_diff = thread_size_diff();
+			auto cache = thread_node_cache();
+
+			reuse_retired_nodes(cache);
 
 			pmem::obj::flat_transaction::run(pop, [&] {
 				insert_new_node_internal(
-					b, new_node,
+					b, h, new_node, cache,
 					std::forward<Args>(args)...);
 				++size_diff;
 			});
 		}
 
 		/* Increment volatile size */
-		return ++(this->my_size);
+		return add_size(1);
 	}
 
 	/**
@@ -1336,6 +2437,9 @@ public:
 			 * transaction we must make sure that mask and size
 			 * changes are transactional
 			 */
+			this->fold_size();
+			table.fold_size();
+
 			flat_transaction::snapshot((size_t *)&this->my_mask);
 			flat_transaction::snapshot((size_t *)&this->my_size);
 
@@ -1348,9 +2452,21 @@ public:
 			/* Swap consistent size */
 			std::swap(this->tls_ptr, table.tls_ptr);
 
-			for (size_type i = 0; i < embedded_buckets; ++i)
-				this->my_embedded_segment[i].node_list.swap(
-					table.my_embedded_segment[i].node_list);
+			for (size_type i = 0; i < embedded_buckets; ++i) {
+				bucket &b = this->my_embedded_segment[i];
+				bucket &other = table.my_embedded_segment[i];
+
+				b.node_list.swap(other.node_list);
+
+				uint64_t s = b.fingerprints(
+					std::memory_order_relaxed);
+				b.set_fingerprints(
+					other.fingerprints(
+						std::memory_order_relaxed),
+					std::memory_order_relaxed);
+				other.set_fingerprints(
+					s, std::memory_order_relaxed);
+			}
 
 			for (size_type i = segment_traits_t::embedded_segments;
 			     i < block_table_size; ++i)
@@ -1414,6 +2530,9 @@ private:
 	template <typename Key, typename T, typename Hash, typename KeyEqual,
 		  typename MutexType, typename ScopedLockType>
 	friend class ::pmem::obj::concurrent_hash_map;
+
+	template <typename Iterator>
+	friend class hash_map_range;
 #else
 public: /* workaround */
 #endif
@@ -1568,8 +2687,117 @@ operator!=(const hash_map_iterator<Container, M> &i,
 {
 	return i.my_node != j.my_node || i.my_map != j.my_map;
 }
-} /* namespace concurrent_hash_map_internal */
-/** @endcond */
+
+/**
+ * Range of buckets of concurrent_hash_map which can be recursively split
+ * into subranges (like TBB's ranges, see is_divisible() and the splitting
+ * constructor) and iterated independently, e.g. by different threads.
+ *
+ * Iterating over a range is not thread-safe with respect to concurrent
+ * insert, erase and rehashing of the map.
+ */
+template <typename Iterator>
+class hash_map_range {
+public:
+	using iterator = Iterator;
+	using value_type = typename iterator::value_type;
+	using reference = typename iterator::reference;
+	using difference_type = typename iterator::difference_type;
+	using size_type = size_t;
+
+	/**
+	 * Splitting constructor. Takes the upper half of buckets of r, which
+	 * is left with the lower half.
+	 *
+	 * @pre r.is_divisible()
+	 */
+	hash_map_range(hash_map_range &r, pmem::obj::split)
+	    : my_map(r.my_map),
+	      my_end_index(r.my_end_index),
+	      my_grainsize(r.my_grainsize),
+	      my_end(r.my_end)
+	{
+		assert(r.is_divisible());
+
+		my_begin_index = r.my_begin_index +
+			(r.my_end_index - r.my_begin_index) / 2;
+		my_begin = iterator(my_map, my_begin_index);
+
+		r.my_end_index = my_begin_index;
+		r.my_end = my_begin;
+	}
+
+	/** @returns true if the range contains no elements. */
+	bool
+	empty() const
+	{
+		return my_begin == my_end;
+	}
+
+	/** @returns true if the range spans more than grainsize() buckets. */
+	bool
+	is_divisible() const
+	{
+		return my_end_index - my_begin_index > my_grainsize;
+	}
+
+	/** @returns minimal number of buckets in a subrange. */
+	size_type
+	grainsize() const
+	{
+		return my_grainsize;
+	}
+
+	/** @returns an iterator to the first element of the range. */
+	iterator
+	begin() const
+	{
+		return my_begin;
+	}
+
+	/** @returns an iterator past the last element of the range. */
+	iterator
+	end() const
+	{
+		return my_end;
+	}
+
+#if !defined(_MSC_VER) || defined(__INTEL_COMPILER)
+private:
+	template <typename Key, typename T, typename Hash, typename KeyEqual,
+		  typename MutexType, typename ScopedLockType>
+	friend class ::pmem::obj::concurrent_hash_map;
+#else
+public: /* workaround */
+#endif
+	using map_ptr = typename iterator::map_ptr;
+
+	hash_map_range(map_ptr map, size_type begin, size_type end,
+		       size_type grainsize)
+	    : my_map(map),
+	      my_begin_index(begin),
+	      my_end_index(end),
+	      my_grainsize((std::max)(grainsize, size_type(1))),
+	      my_begin(map, begin),
+	      my_end(map, end)
+	{
+	}
+
+private:
+	map_ptr my_map;
+
+	/* Range covers buckets [my_begin_index, my_end_index) */
+	size_type my_begin_index;
+	size_type my_end_index;
+	size_type my_grainsize;
+
+	/* First elements of buckets my_begin_index and my_end_index, or
+	 * of the next non-empty buckets */
+	iterator my_begin;
+	iterator my_end;
+};
+} /* namespace concurrent_hash_map_internal */
+/** @endcond */
 
 /**
  * Persistent memory aware implementation of Intel TBB concurrent_hash_map.
@@ -1609,6 +2837,20 @@ operator!=(const hash_map_iterator<Container, M> &i,
  * improve performance if MutexType supports efficient upgrading and
  * downgrading operations.
  *
+ * pmem::obj::experimental::spin_shared_mutex and
+ * pmem::obj::experimental::seq_shared_mutex are lighter alternatives to the
+ * default pmem::obj::shared_mutex, for maps whose items are locked only for
+ * short periods of time. With seq_shared_mutex, find_value() validates
+ * optimistic reads with the bucket and item locks themselves.
+ *
+ * T may be pmem::obj::experimental::basic_inline_string. Characters of such
+ * a value are kept right after the node, so each item takes a single
+ * allocation (plus storage of the key, if it has any). The size of the node
+ * is computed from the value the item is constructed with, e.g. by
+ * insert_or_assign(key, value). A value can be changed in place only within
+ * its capacity, a bigger one throws std::out_of_range and requires erase and
+ * insert of the item. Nodes of such a map are not kept in node caches.
+ *
  * Testing note:
  * In some case, helgrind and drd might report lock ordering errors for
  * concurrent_hash_map. This might happen when calling find, insert or erase
@@ -1648,6 +2890,10 @@ public:
 		concurrent_hash_map, false>;
 	using const_iterator = concurrent_hash_map_internal::hash_map_iterator<
 		concurrent_hash_map, true>;
+	using range_type =
+		concurrent_hash_map_internal::hash_map_range<iterator>;
+	using const_range_type =
+		concurrent_hash_map_internal::hash_map_range<const_iterator>;
 	using hasher = Hash;
 	using key_equal = typename concurrent_hash_map_internal::key_equal_type<
 		Hash, KeyEqual>::type;
@@ -1685,10 +2931,49 @@ protected:
 	using segment_facade_t = typename hash_map_base::segment_facade_t;
 	using scoped_lock_traits_type =
 		concurrent_hash_map_internal::scoped_lock_traits<scoped_t>;
+	using optimistic_lock_t = concurrent_hash_map_internal::optimistic_lock;
+	using optimistic_write_guard_t =
+		concurrent_hash_map_internal::optimistic_write_guard;
+
+	/**
+	 * Modifications are marked in optimistic locks only if items can be
+	 * read optimistically by find_value(). Otherwise, writers do not
+	 * touch the lock table at all.
+	 */
+	static constexpr bool optimistic_reads =
+		concurrent_hash_map_internal::can_read_optimistically<
+			Key>::value &&
+		concurrent_hash_map_internal::can_read_optimistically<T>::value;
+
+	/**
+	 * If MutexType is a sequence lock, optimistic reads are validated by
+	 * the bucket and node mutexes, which are locked for exclusive access
+	 * by each modification, instead of the lock table.
+	 */
+	static constexpr bool mutex_optimistic_reads =
+		concurrent_hash_map_internal::has_optimistic_reads<
+			MutexType>::value;
+	using fingerprints_t =
+		concurrent_hash_map_internal::bucket_fingerprints;
 
 	friend class const_accessor;
 	using persistent_node_ptr_t = detail::persistent_pool_ptr<node>;
 
+	/**
+	 * @return lock which validates optimistic reads of a bucket with
+	 * index @p idx and of items stored in it or nullptr if the map
+	 * cannot be read optimistically.
+	 */
+	optimistic_lock_t *
+	optimistic_lock_for(hashcode_type idx) const noexcept
+	{
+		if (!optimistic_reads || mutex_optimistic_reads)
+			return nullptr;
+
+		return &concurrent_hash_map_internal::optimistic_lock_table::get(
+			this, idx);
+	}
+
 	void
 	delete_node(const node_ptr_t &n)
 	{
@@ -1697,26 +2982,60 @@ protected:
 				.get_persistent_ptr(this->my_pool_uuid));
 	}
 
+	/**
+	 * Search for a key with hash code h in a locked bucket. Keys of nodes
+	 * whose fingerprint differs from the fingerprint of h are not read.
+	 */
 	template <typename K>
 	persistent_node_ptr_t
-	search_bucket(const K &key, bucket *b) const
+	search_bucket(const K &key, bucket *b, hashcode_type h) const
 	{
 		assert(b->is_rehashed(std::memory_order_relaxed));
 
+		fingerprints_t::filter f(
+			b->fingerprints(std::memory_order_relaxed), h);
+
+		if (f.none())
+			return nullptr;
+
 		persistent_node_ptr_t n =
 			detail::static_persistent_pool_pointer_cast<node>(
 				b->node_list);
 
-		while (n &&
-		       !key_equal{}(key,
-				    n.get(this->my_pool_uuid)->item.first)) {
+		for (size_t i = 0; n; ++i) {
+			/* translate the pool pointer only once per node */
+			node *np = n.get(this->my_pool_uuid);
+
+			if (f(i) && key_equal{}(key, np->item.first))
+				break;
+
 			n = detail::static_persistent_pool_pointer_cast<node>(
-				n.get(this->my_pool_uuid)->next);
+				np->next);
 		}
 
 		return n;
 	}
 
+	/**
+	 * Recompute fingerprints of a bucket from its nodes.
+	 * @pre bucket is locked for write, must be called inside transaction.
+	 */
+	void
+	rebuild_fingerprints(bucket *b)
+	{
+		fingerprints_t::builder fps;
+		size_t i = 0;
+
+		/* One node more than fingerprints marks the overflow */
+		for (node_ptr_t n = b->node_list;
+		     n && i <= fingerprints_t::max_count;
+		     n = n(this->my_pool_uuid)->next, ++i)
+			fps.push_back(
+				fingerprints_t::fingerprint(get_hash_code(n)));
+
+		b->set_fingerprints(fps.get(), std::memory_order_release);
+	}
+
 	/**
 	 * Bucket accessor is to find, rehash, acquire a lock, and access a
 	 * bucket
@@ -1910,16 +3229,27 @@ protected:
 			this, h & mask,
 			scoped_lock_traits_type::initial_rw_state(true));
 
+		/* b_new is not marked as rehashed yet, so only the parent
+		 * bucket can be read optimistically */
+		optimistic_write_guard_t guard(optimistic_lock_for(h & mask));
+
+		/* Fingerprints of nodes of both buckets, in order */
+		fingerprints_t::builder fps_old, fps_new;
+		bool moved = false;
+
 		pmem::obj::flat_transaction::run(pop, [&] {
 			/* get full mask for new bucket */
 			mask = (mask << 1) | 1;
 			assert((mask & (mask + 1)) == 0 && (h & mask) == h);
 
 		restart:
+			fps_old = fingerprints_t::builder();
+
 			for (node_ptr_t *p_old = &(b_old->node_list),
 					n = *p_old;
 			     n; n = *p_old) {
 				hashcode_type c = get_hash_code(n);
+				uint8_t fp = fingerprints_t::fingerprint(c);
 #ifndef NDEBUG
 				hashcode_type bmask = h & (mask >> 1);
 
@@ -1941,29 +3271,41 @@ protected:
 
 					/* Add to new b_new */
 					*p_new = n;
+					fps_new.push_back(fp);
+					moved = true;
 
 					/* exclude from b_old */
 					*p_old = n(this->my_pool_uuid)->next;
 
 					p_new = &(n(this->my_pool_uuid)->next);
 				} else {
+					fps_old.push_back(fp);
+
 					/* iterate to next item */
 					p_old = &(n(this->my_pool_uuid)->next);
 				}
 			}
 
 			*p_new = nullptr;
+
+			if (moved)
+				b_old->set_fingerprints(
+					fps_old.get(),
+					std::memory_order_release);
 		});
 
 		/* mark rehashed */
-		b_new->set_rehashed(std::memory_order_release);
+		b_new->set_fingerprints(fps_new.get(),
+					std::memory_order_release);
 		pop.persist(b_new->rehashed);
 	}
 
 	void
 	check_incompat_features()
 	{
-		if (layout_features.incompat != header_features().incompat)
+		/* Hash maps created without FEATURE_FINGERPRINTS can be
+		 * opened, see enable_fingerprints() */
+		if (layout_features.incompat & ~header_features().incompat)
 			throw pmem::layout_error(
 				"Incompat flags mismatch, for more details go to: https://pmem.io/pmdk/cpp_obj/ \n");
 
@@ -2015,6 +3357,7 @@ public:
 			concurrent_hash_map_internal::check_outside_tx();
 
 			if (my_node) {
+				write_end();
 				node::scoped_t::release();
 				my_node = 0;
 			}
@@ -2043,7 +3386,8 @@ public:
 		 *
 		 * Cannot be used in a transaction.
 		 */
-		const_accessor() : my_node(OID_NULL), my_hash()
+		const_accessor()
+		    : my_node(OID_NULL), my_hash(), my_optimistic_lock(nullptr)
 		{
 			concurrent_hash_map_internal::check_outside_tx();
 		}
@@ -2053,6 +3397,7 @@ public:
 		 */
 		~const_accessor()
 		{
+			write_end();
 			my_node = OID_NULL; // scoped lock's release() is called
 					    // in its destructor
 		}
@@ -2061,6 +3406,28 @@ public:
 		node_ptr_t my_node;
 
 		hashcode_type my_hash;
+
+		/* Lock marked as modified while the item is write-locked */
+		optimistic_lock_t *my_optimistic_lock;
+
+		void
+		write_begin(optimistic_lock_t *l)
+		{
+			assert(!my_optimistic_lock);
+
+			my_optimistic_lock = l;
+			if (my_optimistic_lock)
+				my_optimistic_lock->write_begin();
+		}
+
+		void
+		write_end()
+		{
+			if (my_optimistic_lock) {
+				my_optimistic_lock->write_end();
+				my_optimistic_lock = nullptr;
+			}
+		}
 	};
 
 	/**
@@ -2087,6 +3454,162 @@ public:
 		}
 	};
 
+	/**
+	 * Rehashes buckets of the table in a background thread.
+	 *
+	 * Buckets of a newly enabled segment are rehashed lazily, by the
+	 * first operation which accesses them. Background rehasher walks
+	 * through the table and rehashes such buckets in advance, so that
+	 * foreground operations rarely have to do it. Buckets are rehashed
+	 * exactly as on demand (each bucket is marked as rehashed in the same
+	 * transaction which moves its nodes), so the rehasher can be stopped
+	 * (or interrupted by a crash) at any point.
+	 *
+	 * Rehasher processes at most batch_size buckets at once and sleeps for
+	 * the given pause between batches and when there is nothing to do.
+	 *
+	 * The table must not be destroyed and its pool must not be closed
+	 * while the rehasher is running.
+	 */
+	class background_rehasher {
+	public:
+		/**
+		 * Start rehashing buckets of the map in a new thread.
+		 *
+		 * @param[in] map table to rehash.
+		 * @param[in] batch_size maximum number of buckets rehashed
+		 * without a pause.
+		 * @param[in] pause time to sleep between batches.
+		 */
+		background_rehasher(concurrent_hash_map &map,
+				    size_type batch_size = 256,
+				    std::chrono::microseconds pause =
+					    std::chrono::microseconds(100))
+		    : my_map(map),
+		      my_batch_size(batch_size > 0 ? batch_size : 1),
+		      my_pause(pause),
+		      my_stopped(false),
+		      my_rehashed(0)
+		{
+			my_thread = std::thread([this] { run(); });
+		}
+
+		background_rehasher(const background_rehasher &) = delete;
+
+		background_rehasher &
+		operator=(const background_rehasher &) = delete;
+
+		/**
+		 * Stop the rehasher.
+		 */
+		~background_rehasher()
+		{
+			join();
+		}
+
+		/**
+		 * Stop the rehasher and wait for the background thread.
+		 * Buckets which were not rehashed yet will be rehashed on
+		 * demand.
+		 *
+		 * @throw rethrows exception which stopped the background
+		 * thread (e.g. pmem::transaction_error), if any.
+		 */
+		void
+		stop()
+		{
+			join();
+
+			if (my_error) {
+				auto e = my_error;
+				my_error = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+
+		/**
+		 * @returns number of buckets rehashed by this rehasher.
+		 */
+		size_type
+		rehashed_count() const
+		{
+			return my_rehashed.load(std::memory_order_relaxed);
+		}
+
+	private:
+		concurrent_hash_map &my_map;
+		const size_type my_batch_size;
+		const std::chrono::microseconds my_pause;
+
+		std::thread my_thread;
+		std::mutex my_mutex;
+		std::condition_variable my_cv;
+		bool my_stopped;
+
+		std::atomic<size_type> my_rehashed;
+		std::exception_ptr my_error;
+
+		void
+		join()
+		{
+			{
+				std::lock_guard<std::mutex> lock(my_mutex);
+				my_stopped = true;
+			}
+			my_cv.notify_all();
+
+			if (my_thread.joinable())
+				my_thread.join();
+		}
+
+		void
+		run()
+		{
+			/* Embedded buckets are always rehashed */
+			hashcode_type idx = embedded_buckets;
+
+			try {
+				std::unique_lock<std::mutex> lock(my_mutex);
+				while (!my_stopped) {
+					lock.unlock();
+					idx = rehash_batch(idx);
+					lock.lock();
+
+					if (!my_stopped)
+						my_cv.wait_for(lock, my_pause);
+				}
+			} catch (...) {
+				my_error = std::current_exception();
+			}
+		}
+
+		/*
+		 * Rehash up to my_batch_size buckets starting at idx, returns
+		 * index of the first bucket which was not examined.
+		 */
+		hashcode_type
+		rehash_batch(hashcode_type idx)
+		{
+			hashcode_type m =
+				my_map.mask().load(std::memory_order_acquire);
+			size_type n = 0;
+
+			for (; idx <= m && n < my_batch_size; ++idx) {
+				bucket *b = my_map.get_bucket(idx);
+				if (b->is_rehashed(std::memory_order_acquire))
+					continue;
+
+				/* Acquiring the bucket rehashes it */
+				bucket_accessor acc(&my_map, idx);
+				my_rehashed.fetch_add(
+					1, std::memory_order_relaxed);
+				++n;
+			}
+
+			return idx;
+		}
+	};
+
 	/**
 	 * Construct empty table.
 	 */
@@ -2163,27 +3686,57 @@ public:
 	 */
 	void
 	runtime_initialize()
+	{
+		runtime_initialize(size_type(1));
+	}
+
+	/**
+	 * Initialize persistent concurrent hash map after process restart,
+	 * using up to num_threads threads (including the calling one).
+	 * MUST be called every time after process restart.
+	 * Not thread safe.
+	 *
+	 * If the hash map was created without FEATURE_CONSISTENT_SIZE, its
+	 * size has to be recomputed by visiting every bucket. Buckets are
+	 * then partitioned between num_threads threads. Persistent bucket
+	 * locks do not have to be reset, libpmemobj reinitializes them on
+	 * first use after the pool is opened.
+	 *
+	 * @param[in] num_threads maximum number of threads used, 0 is
+	 * treated as 1.
+	 *
+	 * @throw pmem::layout_error if hashmap was created using incompatible
+	 * version of libpmemobj-cpp
+	 * @throw std::system_error if a thread could not be started.
+	 */
+	template <typename Size,
+		  typename = typename std::enable_if<
+			  std::is_integral<Size>::value &&
+			  !std::is_same<Size, bool>::value>::type>
+	void
+	runtime_initialize(Size num_threads)
 	{
 		check_incompat_features();
 
+		this->enable_fingerprints();
+
 		calculate_mask();
 
+		size_type n_threads = static_cast<size_type>(num_threads);
+
 		/*
 		 * Handle case where hash_map was created without
 		 * FEATURE_CONSISTENT_SIZE.
 		 */
 		if (!(layout_features.compat & FEATURE_CONSISTENT_SIZE)) {
-			auto actual_size =
-				std::distance(this->begin(), this->end());
-			assert(actual_size >= 0);
+			size_type actual_size = internal_count(n_threads);
 
-			this->my_size = static_cast<size_t>(actual_size);
+			this->my_size = actual_size;
 
 			auto pop = get_pool_base();
 			flat_transaction::run(pop, [&] {
 				this->tls_ptr = make_persistent<tls_t>();
-				this->on_init_size =
-					static_cast<size_t>(actual_size);
+				this->on_init_size = actual_size;
 				this->value_size = sizeof(value_type);
 
 				layout_features.compat |=
@@ -2194,28 +3747,28 @@ public:
 			this->tls_restore();
 		}
 
-		assert(this->size() ==
-		       size_type(std::distance(this->begin(), this->end())));
+		this->enable_node_cache();
+		this->reclaim_all_retired_nodes();
+		this->init_size_shards();
+
+		assert(this->size() == internal_count(n_threads));
 	}
 
+	/**
+	 * Initialize persistent concurrent hash map after process restart,
+	 * in the same way as runtime_initialize(). The size is restored from
+	 * per-thread data or recomputed, so graceful_shutdown is ignored.
+	 *
+	 * @throw pmem::layout_error if hashmap was created using incompatible
+	 * version of libpmemobj-cpp
+	 */
 	[[deprecated(
 		"runtime_initialize(bool) is now deprecated, use runtime_initialize(void)")]] void
 	runtime_initialize(bool graceful_shutdown)
 	{
-		check_incompat_features();
+		(void)graceful_shutdown;
 
-		calculate_mask();
-
-		if (!graceful_shutdown) {
-			auto actual_size =
-				std::distance(this->begin(), this->end());
-			assert(actual_size >= 0);
-			this->my_size = static_cast<size_type>(actual_size);
-		} else {
-			assert(this->size() ==
-			       size_type(std::distance(this->begin(),
-						       this->end())));
-		}
+		runtime_initialize(size_type(1));
 	}
 
 	/**
@@ -2273,6 +3826,42 @@ public:
 	 */
 	void rehash(size_type n = 0);
 
+	/**
+	 * Reduces the number of buckets to the smallest power of two which
+	 * is not less than n, but not below the size of the first block.
+	 * Items of the removed buckets are merged into the remaining ones
+	 * and the trailing segments are freed. Typically called after a
+	 * large number of items was erased, it can be followed by
+	 * defragment() to compact the remaining nodes.
+	 *
+	 * Buckets are merged one by one, each in its own transaction, and a
+	 * merged bucket is marked as not rehashed. If the operation is
+	 * interrupted, the hash map stays consistent and the items are
+	 * moved back on demand.
+	 *
+	 * Not thread safe. Background rehasher must not be running.
+	 *
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw pmem::transaction_error in case of PMDK transaction failure
+	 */
+	void rehash_down(size_type n);
+
+	/**
+	 * Reduces the number of buckets to the smallest one which can hold
+	 * the current number of items, see rehash_down().
+	 * Not thread safe. Background rehasher must not be running.
+	 *
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw pmem::transaction_error in case of PMDK transaction failure
+	 */
+	void
+	shrink_to_fit()
+	{
+		/* Not thread safe, so the counters can be folded */
+		this->fold_size();
+		rehash_down(this->approximate_size() + 1);
+	}
+
 	/**
 	 * Clear hash map content
 	 * Not thread safe.
@@ -2375,8 +3964,74 @@ public:
 		return const_iterator(this, mask() + 1);
 	}
 
+	/**
+	 * @returns a splittable range over all buckets of the table.
+	 * Not thread safe.
+	 *
+	 * @param[in] grainsize minimal number of buckets in a subrange
+	 * obtained by splitting.
+	 */
+	range_type
+	range(size_type grainsize = 1)
+	{
+		return range_type(this, 0, mask() + 1, grainsize);
+	}
+
+	/**
+	 * @returns a splittable range over all buckets of the table.
+	 * Not thread safe.
+	 *
+	 * @param[in] grainsize minimal number of buckets in a subrange
+	 * obtained by splitting.
+	 */
+	const_range_type
+	range(size_type grainsize = 1) const
+	{
+		return const_range_type(this, 0, mask() + 1, grainsize);
+	}
+
+	/**
+	 * Calls f for every element of the table, using num_threads threads
+	 * (including the calling one). The table is split into subranges
+	 * which are processed by threads in turns.
+	 * Not thread safe with respect to concurrent insert, erase and
+	 * rehash. If f throws, remaining subranges are skipped and the first
+	 * exception is rethrown after all threads finish.
+	 *
+	 * @param[in] num_threads number of threads to use.
+	 * @param[in] f function object called with reference to an element.
+	 */
+	template <typename F>
+	void
+	parallel_for_each(size_type num_threads, F &&f)
+	{
+		internal_parallel_for_each(range(), num_threads, f);
+	}
+
+	/**
+	 * Calls f for every element of the table, using num_threads threads
+	 * (including the calling one). The table is split into subranges
+	 * which are processed by threads in turns.
+	 * Not thread safe with respect to concurrent insert, erase and
+	 * rehash. If f throws, remaining subranges are skipped and the first
+	 * exception is rethrown after all threads finish.
+	 *
+	 * @param[in] num_threads number of threads to use.
+	 * @param[in] f function object called with const reference to an
+	 * element.
+	 */
+	template <typename F>
+	void
+	parallel_for_each(size_type num_threads, F &&f) const
+	{
+		internal_parallel_for_each(range(), num_threads, f);
+	}
+
 	/**
 	 * @returns number of items in table.
+	 *
+	 * Sums up the size counters of all threads, so it is more expensive
+	 * than approximate_size().
 	 */
 	size_type
 	size() const
@@ -2384,6 +4039,22 @@ public:
 		return hash_map_base::size();
 	}
 
+	/**
+	 * Wait-free estimate of the number of items in table.
+	 *
+	 * Threads accumulate changes of size in separate counters, which are
+	 * folded into the shared one in batches. The result may omit up to
+	 * a few dozen recent changes per thread, but reading it does not
+	 * touch cache lines modified by writers.
+	 *
+	 * @returns approximate number of items in table.
+	 */
+	size_type
+	approximate_size() const
+	{
+		return hash_map_base::approximate_size();
+	}
+
 	/**
 	 * @returns true if size()==0.
 	 */
@@ -2548,27 +4219,120 @@ public:
 
 		return internal_find(key, &result, true);
 	}
+
 	/**
-	 * Insert item (if not already present) and
-	 * acquire a read lock on the item.
-	 * @return true if item is new.
-	 * @throw pmem::transaction_alloc_error on allocation failure.
+	 * Find all items with keys from range [first, last) and call @p f
+	 * with a const reference to each item found.
+	 *
+	 * All hash codes are calculated upfront and keys are grouped by
+	 * bucket, so that each bucket is locked only once for the whole
+	 * batch and bucket memory, including the first node of each bucket,
+	 * can be prefetched before it is accessed. The order in which @p f
+	 * is called is unspecified. @p f is called while the bucket and the
+	 * item are locked for reading, so it must not call any other method
+	 * of this concurrent_hash_map.
+	 *
+	 * Keys must be of key_type or, if Hash::transparent_key_equal is
+	 * defined, of any type which is comparable with key_type.
+	 *
+	 * @return number of items found.
+	 *
 	 * @throw pmem::transaction_scope_error if called inside transaction
 	 */
-	bool
-	insert(const_accessor &result, const Key &key)
+	template <typename I, typename F>
+	size_type
+	find_batch(I first, I last, F f) const
 	{
 		concurrent_hash_map_internal::check_outside_tx();
 
-		result.release();
-
-		return internal_insert(key, &result, false, key);
+		return const_cast<concurrent_hash_map *>(this)
+			->internal_find_batch(first, last, f);
 	}
 
 	/**
-	 * Insert item (if not already present) and
-	 * acquire a write lock on the item.
-	 * @returns true if item is new.
+	 * Copy the value of an item with given key to @p value.
+	 *
+	 * Unlike find(), this method does not acquire bucket nor item locks
+	 * in the common case. The bucket is read optimistically and the read
+	 * is validated by a sequence lock kept in volatile memory or, if
+	 * MutexType is a sequence lock (e.g. experimental::seq_shared_mutex),
+	 * by the bucket and item mutexes, so readers never write to shared
+	 * memory. If the bucket or the item is being modified at the same
+	 * time, the read is retried and, eventually, falls back to find().
+	 *
+	 * Available only if both Key and T can be safely copied while being
+	 * concurrently modified (see can_read_optimistically), e.g. for
+	 * trivially copyable types and p<> of such types. Modifications of
+	 * maps of other types do not update the sequence locks.
+	 *
+	 * @return true if item is found, false otherwise.
+	 *
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	find_value(const Key &key, mapped_type &value) const
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		return const_cast<concurrent_hash_map *>(this)
+			->internal_find_value(
+				key, value,
+				std::integral_constant<
+					bool, mutex_optimistic_reads>());
+	}
+
+	/**
+	 * Copy the value of an item with given key to @p value, see
+	 * find_value(const Key &key, mapped_type &value).
+	 *
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 * This assumes that such Hash is callable with both K and Key type, and
+	 * that its key_equal is transparent, which, together, allows calling
+	 * this function without constructing an instance of Key
+	 *
+	 * @return true if item is found, false otherwise.
+	 *
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	find_value(const K &key, mapped_type &value) const
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		return const_cast<concurrent_hash_map *>(this)
+			->internal_find_value(
+				key, value,
+				std::integral_constant<
+					bool, mutex_optimistic_reads>());
+	}
+
+	/**
+	 * Insert item (if not already present) and
+	 * acquire a read lock on the item.
+	 * @return true if item is new.
+	 * @throw pmem::transaction_alloc_error on allocation failure.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	insert(const_accessor &result, const Key &key)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		result.release();
+
+		return internal_insert(key, &result, false, key);
+	}
+
+	/**
+	 * Insert item (if not already present) and
+	 * acquire a write lock on the item.
+	 * @returns true if item is new.
 	 * @throw pmem::transaction_alloc_error on allocation failure.
 	 * @throw pmem::transaction_scope_error if called inside transaction
 	 */
@@ -2709,6 +4473,93 @@ public:
 		insert(il.begin(), il.end());
 	}
 
+	/**
+	 * Insert items from range [first, last) (those which keys are not
+	 * already present).
+	 *
+	 * Unlike insert(I first, I last), all hash codes are calculated
+	 * upfront, the table is grown to fit the whole batch and items are
+	 * grouped by bucket. Each bucket is locked only once and all of its
+	 * new nodes are allocated in a single transaction.
+	 *
+	 * If the range contains several items with the same key, only the
+	 * first of them is inserted.
+	 *
+	 * @return number of inserted items.
+	 * @throw pmem::transaction_alloc_error on allocation failure.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename I>
+	size_type
+	insert_batch(I first, I last)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		return internal_insert_batch(first, last);
+	}
+
+	/**
+	 * Populates the map with items from range [first, last) (those which
+	 * keys are not already present), using num_threads threads.
+	 *
+	 * Intended for the initial load of the map, e.g. from a snapshot.
+	 * The table is grown to its final size before any item is inserted,
+	 * so no bucket is rehashed during the load. Items are grouped by
+	 * bucket and buckets are partitioned between threads. Each thread
+	 * inserts up to bulk_load_tx_size items in a single transaction.
+	 *
+	 * If the range contains several items with the same key, only the
+	 * first of them is inserted.
+	 *
+	 * Not thread safe: no other thread may access the map until
+	 * bulk_load returns. If an exception is thrown, items inserted by
+	 * transactions which were already committed stay in the map.
+	 *
+	 * @return number of inserted items.
+	 * @throw pmem::transaction_alloc_error on allocation failure.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename I>
+	size_type bulk_load(I first, I last, size_type num_threads);
+
+	/**
+	 * Calls f(const value_type &) for each item of the map, e.g. to
+	 * export it to a backup, see experimental::export_snapshot.
+	 *
+	 * Can be called concurrently with find, insert and erase. Buckets are
+	 * visited one by one, each of them under a shared lock, so the set of
+	 * items of a bucket is consistent. Each item is also locked for
+	 * shared access while f is called with it, so f sees a consistent
+	 * value. Items inserted or erased concurrently may or may not be
+	 * visited, other items are visited exactly once. The table does not
+	 * grow while items of a bucket (and of buckets created from it by
+	 * concurrent growth) are visited, so f should not block for long.
+	 *
+	 * f must not access the map.
+	 *
+	 * @return number of visited items.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw rethrows exception thrown by f.
+	 */
+	template <typename F>
+	size_type
+	snapshot(F f)
+	{
+		return snapshot(f, [] {});
+	}
+
+	/**
+	 * Like snapshot(F f), but also calls bucket_done() after each
+	 * bucket is visited, when no locks are held and the table can grow,
+	 * e.g. to write out the items buffered by f.
+	 *
+	 * @return number of visited items.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw rethrows exception thrown by f or bucket_done.
+	 */
+	template <typename F, typename G>
+	size_type snapshot(F f, G bucket_done);
+
 	/**
 	 * Inserts item if there is no such key present already, assigns
 	 * provided value otherwise.
@@ -2801,7 +4652,9 @@ public:
 	}
 
 	/**
-	 * Remove element with corresponding key
+	 * Remove element with corresponding key. Does not wait for accessors
+	 * which hold the element, its node is destroyed after they are
+	 * released.
 	 *
 	 * @return true if element was deleted by this call
 	 * @throw pmem::transaction_free_error in case of PMDK unable to free
@@ -2928,6 +4781,17 @@ protected:
 	public:
 		using mutex_t = MutexType;
 
+		mutex_vector() = default;
+
+		mutex_vector(const mutex_vector &) = delete;
+		mutex_vector &operator=(const mutex_vector &) = delete;
+
+		~mutex_vector()
+		{
+			for (auto l : optimistic_locks)
+				l->write_end();
+		}
+
 		/** Save pointer to the lock in the vector and lock it. */
 		bucket *
 		push_and_try_lock(concurrent_hash_map *base, hashcode_type h)
@@ -2952,11 +4816,19 @@ protected:
 						(base->my_pool_uuid)));
 			}
 
+			/* nodes of the bucket can be relocated */
+			optimistic_lock_t *l = base->optimistic_lock_for(h);
+			if (l) {
+				optimistic_locks.push_back(l);
+				l->write_begin();
+			}
+
 			return b;
 		}
 
 	private:
 		std::vector<bucket_accessor> vec;
+		std::vector<optimistic_lock_t *> optimistic_locks;
 	};
 
 	template <typename K>
@@ -2966,13 +4838,111 @@ protected:
 	bool internal_insert(const K &key, const_accessor *result, bool write,
 			     Args &&... args);
 
+	template <typename I, typename F>
+	size_type internal_find_batch(I first, I last, F &f);
+
+	template <typename K>
+	bool internal_find_value(const K &key, mapped_type &value,
+				 std::false_type);
+
+	template <typename K>
+	bool internal_find_value(const K &key, mapped_type &value,
+				 std::true_type);
+
+	template <typename I>
+	size_type internal_insert_batch(I first, I last);
+
+	/* Hash code of a batch element and position of it in the batch */
+	template <typename I>
+	using batch_entry_t = std::pair<hashcode_type, I>;
+
+	enum bulk_load_limits : size_type {
+		/** Maximum number of items inserted in one transaction */
+		bulk_load_tx_size = 1024
+	};
+
+	/**
+	 * Inserts entries [first, last) of a batch prepared for mask m,
+	 * in transactions of up to bulk_load_tx_size items.
+	 * @return number of inserted items.
+	 */
+	template <typename I>
+	size_type
+	bulk_load_entries(const std::vector<batch_entry_t<I>> &entries,
+			  size_type first, size_type last, hashcode_type m);
+
+	/**
+	 * Calculate hash codes for all elements in range [first, last),
+	 * order them by bucket index (for mask @p m) and prefetch the
+	 * buckets and their first nodes. @p key_of extracts a key from the
+	 * element.
+	 */
+	template <typename I, typename KeyOf>
+	std::vector<batch_entry_t<I>>
+	prepare_batch(I first, I last, hashcode_type m, KeyOf key_of) const
+	{
+		std::vector<batch_entry_t<I>> entries;
+
+		for (; first != last; ++first)
+			entries.emplace_back(hasher{}(key_of(*first)), first);
+
+		std::stable_sort(entries.begin(), entries.end(),
+				 [m](const batch_entry_t<I> &lhs,
+				     const batch_entry_t<I> &rhs) {
+					 return (lhs.first & m) <
+						 (rhs.first & m);
+				 });
+
+		for (size_type i = 0; i < entries.size(); ++i) {
+			if (i == 0 ||
+			    (entries[i].first & m) !=
+				    (entries[i - 1].first & m))
+				detail::prefetch(
+					get_bucket(entries[i].first & m));
+		}
+
+		/* Second pass, so that bucket headers are already on their
+		 * way when their node lists are read. The lists are read
+		 * without locks, a stale pointer only makes the hint useless,
+		 * prefetching never faults. */
+		for (size_type i = 0; i < entries.size(); ++i) {
+			if (i == 0 ||
+			    (entries[i].first & m) !=
+				    (entries[i - 1].first & m)) {
+				const bucket *b =
+					get_bucket(entries[i].first & m);
+				if (b->node_list)
+					detail::prefetch(b->node_list.get(
+						this->my_pool_uuid));
+			}
+		}
+
+		return entries;
+	}
+
+	/**
+	 * @return iterator to the first entry after @p first which maps
+	 * to a different bucket than @p first (for mask @p m).
+	 */
+	template <typename It>
+	static It
+	batch_group_end(It first, It last, hashcode_type m)
+	{
+		hashcode_type idx = first->first & m;
+
+		while (first != last && (first->first & m) == idx)
+			++first;
+
+		return first;
+	}
+
 	/* Obtain pointer to node and lock bucket */
 	template <bool Bucket_rw_lock, typename K>
 	persistent_node_ptr_t
-	get_node(const K &key, bucket_accessor &b)
+	get_node(const K &key, hashcode_type h, bucket_accessor &b)
 	{
 		/* find a node */
-		auto n = search_bucket(key, b.get());
+		auto n = search_bucket(key, b.get(), h);
 
 		if (!n) {
 			if (Bucket_rw_lock && !b.is_writer() &&
@@ -2980,7 +4950,7 @@ protected:
 				/* Rerun search_list, in case another
 				 * thread inserted the item during the
 				 * upgrade. */
-				n = search_bucket(key, b.get());
+				n = search_bucket(key, b.get(), h);
 				if (n) {
 					/* unfortunately, it did */
 					scoped_lock_traits_type::
@@ -2998,6 +4968,12 @@ protected:
 
 	void clear_segment(segment_index_t s);
 
+	/**
+	 * Move items of the s-th (last) segment to their parent buckets and
+	 * free the segment.
+	 */
+	void merge_segment(segment_index_t s);
+
 	/**
 	 * Copy "source" to *this, where *this must start out empty.
 	 */
@@ -3006,6 +4982,16 @@ protected:
 	template <typename I>
 	void internal_copy(I first, I last);
 
+	/**
+	 * Count elements by visiting all buckets, which are partitioned
+	 * between num_threads threads.
+	 */
+	size_type internal_count(size_type num_threads) const;
+
+	template <typename Range, typename F>
+	static void internal_parallel_for_each(Range r, size_type num_threads,
+					       F &f);
+
 	/**
 	 * Internal method used by defragment().
 	 * Adds nodes to the defragmentation list.
@@ -3080,7 +5066,7 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 		bucket_accessor b(
 			this, h & m,
 			scoped_lock_traits_type::initial_rw_state(false));
-		node = get_node<false>(key, b);
+		node = get_node<false>(key, h, b);
 
 		if (!node) {
 			/* Element was possibly relocated, try again */
@@ -3113,6 +5099,10 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 	if (result) {
 		result->my_node = node.get_persistent_ptr(this->my_pool_uuid);
 		result->my_hash = h;
+
+		/* value can be modified through the accessor */
+		if (write)
+			result->write_begin(optimistic_lock_for(h));
 	}
 
 	return true;
@@ -3148,7 +5138,7 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 		bucket_accessor b(
 			this, h & m,
 			scoped_lock_traits_type::initial_rw_state(true));
-		node = get_node<true>(key, b);
+		node = get_node<true>(key, h, b);
 
 		if (!node) {
 			/* Element was possibly relocated, try again */
@@ -3158,7 +5148,9 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 			}
 
 			/* insert and set flag to grow the container */
-			new_size = insert_new_node(b.get(), node,
+			optimistic_write_guard_t guard(
+				optimistic_lock_for(h & m));
+			new_size = insert_new_node(b.get(), h, node,
 						   std::forward<Args>(args)...);
 			inserted = true;
 		}
@@ -3184,6 +5176,10 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 	if (result) {
 		result->my_node = node.get_persistent_ptr(this->my_pool_uuid);
 		result->my_hash = h;
+
+		/* value can be modified through the accessor */
+		if (write)
+			result->write_begin(optimistic_lock_for(h));
 	}
 
 	check_growth(m, new_size);
@@ -3191,6 +5187,386 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 	return inserted;
 }
 
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename I, typename F>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::internal_find_batch(I first, I last, F &f)
+{
+	hashcode_type m = mask().load(std::memory_order_acquire);
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+	ANNOTATE_HAPPENS_AFTER(&(this->my_mask));
+#endif
+
+	assert((m & (m + 1)) == 0);
+
+	auto entries = prepare_batch(
+		first, last, m,
+		[](const typename std::iterator_traits<I>::value_type &k)
+			-> const typename std::iterator_traits<
+				I>::value_type & { return k; });
+
+	/* Keys which must be looked up one by one (mask race or item
+	 * locked for too long) */
+	std::vector<I> retry;
+	size_type found = 0;
+
+	for (auto it = entries.begin(); it != entries.end();) {
+		auto group_end = batch_group_end(it, entries.end(), m);
+
+		bucket_accessor b(
+			this, it->first & m,
+			scoped_lock_traits_type::initial_rw_state(false));
+
+		for (; it != group_end; ++it) {
+			persistent_node_ptr_t n =
+				search_bucket(*it->second, b.get(), it->first);
+
+			if (!n) {
+				hashcode_type m_now = m;
+
+				/* Element was possibly relocated */
+				if (check_mask_race(it->first, m_now))
+					retry.push_back(it->second);
+
+				continue;
+			}
+
+			node *np = n.get(this->my_pool_uuid);
+
+			const_accessor acc;
+			if (!try_acquire_item(&acc, np->mutex, false)) {
+				retry.push_back(it->second);
+				continue;
+			}
+
+			f(static_cast<const_reference>(np->item));
+			++found;
+		}
+	}
+
+	for (auto &key : retry) {
+		const_accessor acc;
+		if (internal_find(*key, &acc, false)) {
+			f(*acc);
+			++found;
+		}
+	}
+
+	return found;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename K>
+bool
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::internal_find_value(const K &key,
+							 mapped_type &value,
+							 std::false_type)
+{
+	static_assert(
+		optimistic_reads,
+		"Key and T must be trivially copyable to be read optimistically");
+
+	using lock_table_t =
+		concurrent_hash_map_internal::optimistic_lock_table;
+
+	hashcode_type const h = hasher{}(key);
+
+	/* Copy of the value, it is discarded if the read turns out to be
+	 * inconsistent */
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type copy;
+
+	for (detail::atomic_backoff backoff;;) {
+		hashcode_type m = mask().load(std::memory_order_acquire);
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		ANNOTATE_HAPPENS_AFTER(&(this->my_mask));
+#endif
+
+		/* Items of small tables are not guarded by a single lock */
+		if (m < lock_table_t::min_buckets - 1)
+			break;
+
+		hashcode_type idx = h & m;
+		bucket *b = get_bucket(idx);
+
+		/* Items of a bucket which is not rehashed yet are still
+		 * stored in one of its parents. Parents are guarded by the
+		 * same lock unless they are in the first block. */
+		while (!b->is_rehashed(std::memory_order_acquire) &&
+		       idx >= lock_table_t::min_buckets) {
+			idx &= (hashcode_type(1) << detail::Log2(idx)) - 1;
+			b = get_bucket(idx);
+		}
+
+		if (!b->is_rehashed(std::memory_order_acquire))
+			break;
+
+		const optimistic_lock_t &lock = *optimistic_lock_for(idx);
+		uint64_t s = lock.read_begin();
+
+		if (s) {
+			bool consistent, found = false;
+			persistent_node_ptr_t n =
+				detail::static_persistent_pool_pointer_cast<
+					node>(b->node_list);
+
+			fingerprints_t::filter f(
+				b->fingerprints(std::memory_order_acquire), h);
+			if (f.none())
+				n = nullptr;
+
+			/* Each pointer is validated before it is followed, so
+			 * only nodes which were not freed at the time of
+			 * validation are accessed */
+			for (size_t pos = 0;
+			     (consistent = lock.read_validate(s)) && n; ++pos) {
+				node *np = n.get(this->my_pool_uuid);
+
+				if (f(pos) &&
+				    key_equal{}(key, np->item.first)) {
+					new (&copy) T(np->item.second);
+					consistent = lock.read_validate(s);
+					found = true;
+					break;
+				}
+
+				n = detail::static_persistent_pool_pointer_cast<
+					node>(np->next);
+			}
+
+			if (consistent) {
+				if (found) {
+					value = *reinterpret_cast<T *>(&copy);
+					return true;
+				}
+
+				/* Element was possibly relocated, try again */
+				if (check_mask_race(h, m))
+					continue;
+
+				return false;
+			}
+		}
+
+		if (!backoff.bounded_pause())
+			break;
+	}
+
+	/* Fall back to the locked lookup */
+	const_accessor acc;
+	if (!internal_find(key, &acc, false))
+		return false;
+
+	value = acc->second;
+
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename K>
+bool
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::internal_find_value(const K &key,
+							 mapped_type &value,
+							 std::true_type)
+{
+	static_assert(
+		optimistic_reads,
+		"Key and T must be trivially copyable to be read optimistically");
+
+	hashcode_type const h = hasher{}(key);
+
+	/* Copy of the value, it is discarded if the read turns out to be
+	 * inconsistent */
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type copy;
+
+	for (detail::atomic_backoff backoff;;) {
+		hashcode_type m = mask().load(std::memory_order_acquire);
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		ANNOTATE_HAPPENS_AFTER(&(this->my_mask));
+#endif
+
+		bucket *b = get_bucket(h & m);
+
+		/* Items of a bucket which is not rehashed yet are still
+		 * stored in one of its parents */
+		if (!b->is_rehashed(std::memory_order_acquire))
+			break;
+
+		/* Nodes are linked, unlinked and moved to other buckets under
+		 * exclusive locks of their buckets */
+		uint64_t s = b->mutex.read_begin();
+
+		if (s) {
+			bool consistent, found = false;
+			persistent_node_ptr_t n =
+				detail::static_persistent_pool_pointer_cast<
+					node>(b->node_list);
+
+			fingerprints_t::filter f(
+				b->fingerprints(std::memory_order_acquire), h);
+			if (f.none())
+				n = nullptr;
+
+			/* Each pointer is validated before it is followed, so
+			 * only nodes which were not freed at the time of
+			 * validation are accessed */
+			for (size_t pos = 0;
+			     (consistent = b->mutex.read_validate(s)) && n;
+			     ++pos) {
+				node *np = n.get(this->my_pool_uuid);
+
+				if (f(pos) &&
+				    key_equal{}(key, np->item.first)) {
+					/* Values are modified under exclusive
+					 * locks of their nodes */
+					uint64_t t = np->mutex.read_begin();
+					if (t) {
+						new (&copy) T(np->item.second);
+						consistent =
+							np->mutex.read_validate(
+								t) &&
+							b->mutex.read_validate(
+								s);
+					} else {
+						consistent = false;
+					}
+
+					found = true;
+					break;
+				}
+
+				n = detail::static_persistent_pool_pointer_cast<
+					node>(np->next);
+			}
+
+			if (consistent) {
+				if (found) {
+					value = *reinterpret_cast<T *>(&copy);
+					return true;
+				}
+
+				/* Element was possibly relocated, try again */
+				if (check_mask_race(h, m))
+					continue;
+
+				return false;
+			}
+		}
+
+		if (!backoff.bounded_pause())
+			break;
+	}
+
+	/* Fall back to the locked lookup */
+	const_accessor acc;
+	if (!internal_find(key, &acc, false))
+		return false;
+
+	value = acc->second;
+
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename I>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::internal_insert_batch(I first, I last)
+{
+	using item_type = typename std::iterator_traits<I>::value_type;
+
+	size_type n_items = static_cast<size_type>(std::distance(first, last));
+	if (n_items == 0)
+		return 0;
+
+	/* Grow the table upfront, so the batch can be grouped using the final
+	 * mask and no bucket has to be split while the batch is inserted */
+	hashcode_type m = mask().load(std::memory_order_acquire);
+	while (check_growth(m, this->approximate_size() + n_items))
+		m = mask().load(std::memory_order_acquire);
+
+	m = mask().load(std::memory_order_acquire);
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+	ANNOTATE_HAPPENS_AFTER(&(this->my_mask));
+#endif
+
+	assert((m & (m + 1)) == 0);
+
+	auto entries = prepare_batch(
+		first, last, m,
+		[](const item_type &item) -> const decltype(item.first) & {
+			return item.first;
+		});
+
+	pool_base pop = get_pool_base();
+	auto &size_diff = this->thread_size_diff();
+	auto cache = this->thread_node_cache();
+
+	/* Items which must be inserted one by one due to mask race */
+	std::vector<I> retry;
+	size_type inserted = 0;
+
+	for (auto it = entries.begin(); it != entries.end();) {
+		auto group_end = batch_group_end(it, entries.end(), m);
+		size_type group_inserted = 0;
+
+		bucket_accessor b(this, it->first & m, /*writer=*/true);
+
+		this->reuse_retired_nodes(cache);
+
+		optimistic_write_guard_t guard(
+			optimistic_lock_for(it->first & m));
+
+		/* All new nodes of the bucket are allocated in one
+		 * transaction */
+		flat_transaction::run(pop, [&] {
+			for (auto e = it; e != group_end; ++e) {
+				if (search_bucket(e->second->first, b.get(),
+						  e->first))
+					continue;
+
+				hashcode_type m_now = m;
+
+				/* Element was possibly relocated */
+				if (check_mask_race(e->first, m_now)) {
+					retry.push_back(e->second);
+					continue;
+				}
+
+				persistent_node_ptr_t new_node;
+				this->insert_new_node_internal(
+					b.get(), e->first, new_node, cache,
+					*e->second);
+
+				++size_diff;
+				++group_inserted;
+			}
+		});
+
+		this->add_size(static_cast<int64_t>(group_inserted));
+		inserted += group_inserted;
+
+		it = group_end;
+	}
+
+	for (auto &item : retry) {
+		if (internal_insert(item->first, nullptr, false, *item))
+			++inserted;
+	}
+
+	check_growth(mask().load(std::memory_order_acquire), this->size());
+
+	return inserted;
+}
+
 template <typename Key, typename T, typename Hash, typename KeyEqual,
 	  typename MutexType, typename ScopedLockType>
 template <typename K>
@@ -3207,6 +5583,9 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 
 	pool_base pop = get_pool_base();
 
+	auto &size_diff = this->thread_size_diff();
+	auto cache = this->thread_node_cache();
+
 restart : {
 	/* lock scope */
 	/* get bucket */
@@ -3217,13 +5596,21 @@ search:
 	node_ptr_t *p = &b->node_list;
 	n = *p;
 
+	fingerprints_t::filter f(b->fingerprints(std::memory_order_relaxed), h);
+	size_t pos = 0;
+
+	if (f.none())
+		n = nullptr;
+
 	while (n &&
-	       !key_equal{}(key,
-			    detail::static_persistent_pool_pointer_cast<node>(
-				    n)(this->my_pool_uuid)
-				    ->item.first)) {
+	       !(f(pos) &&
+		 key_equal{}(key,
+			     detail::static_persistent_pool_pointer_cast<node>(
+				     n)(this->my_pool_uuid)
+				     ->item.first))) {
 		p = &n(this->my_pool_uuid)->next;
 		n = *p;
+		++pos;
 	}
 
 	if (!n) {
@@ -3242,11 +5629,10 @@ search:
 
 	persistent_ptr<node> del = n(this->my_pool_uuid);
 
-	{
-		/* We cannot remove this element immediately because
-		 * other threads might work with this element via
-		 * accessors. The item_locker required to wait while
-		 * other threads use the node. */
+	/* Other threads might work with this element via accessors. With
+	 * node caches, the node is retired and destroyed later, when it is
+	 * not used anymore. Otherwise, we have to wait for the accessors. */
+	if (!cache) {
 		const_accessor acc;
 		if (!try_acquire_item(&acc, del->mutex, true)) {
 			/* the wait takes really long, restart the operation */
@@ -3262,20 +5648,34 @@ search:
 
 	assert(pmemobj_tx_stage() == TX_STAGE_NONE);
 
-	auto &size_diff = this->thread_size_diff();
+	optimistic_write_guard_t guard(optimistic_lock_for(h & m));
 
 	/* Only one thread can delete it due to write lock on the bucket
 	 */
 	flat_transaction::run(pop, [&] {
 		*p = del->next;
-		delete_node(del);
+		if (cache)
+			this->retire_node(cache, del);
+		else
+			this->deallocate_node(cache, del);
+
+		uint64_t s = b->fingerprints(std::memory_order_relaxed);
+		uint64_t s_new = fingerprints_t::erase(s, pos);
+		if (s_new != s && fingerprints_t::is_valid(s_new))
+			b->set_fingerprints(s_new, std::memory_order_release);
+		else if (s_new != s)
+			rebuild_fingerprints(b.get());
 
 		--size_diff;
 	});
 
-	--(this->my_size);
+	this->add_size(-1);
 }
 
+	if (cache)
+		this->reclaim_retired_nodes(cache,
+					    hash_map_base::node_retire_batch);
+
 	return true;
 }
 
@@ -3288,6 +5688,216 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::swap(
 	internal_swap(table);
 }
 
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename I>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::
+	bulk_load_entries(const std::vector<batch_entry_t<I>> &entries,
+			  size_type first, size_type last, hashcode_type m)
+{
+	pool_base pop = get_pool_base();
+	auto &size_diff = this->thread_size_diff();
+	auto cache = this->thread_node_cache();
+
+	size_type inserted = 0;
+
+	while (first != last) {
+		size_type tx_end = (std::min)(last, first + bulk_load_tx_size);
+		int64_t tx_inserted = 0;
+
+		flat_transaction::run(pop, [&] {
+			tx_inserted = 0;
+
+			for (size_type i = first; i != tx_end; ++i) {
+				auto &e = entries[i];
+				bucket *b = get_bucket(e.first & m);
+
+				if (search_bucket(e.second->first, b, e.first))
+					continue;
+
+				persistent_node_ptr_t new_node;
+				this->insert_new_node_internal(
+					b, e.first, new_node, cache, *e.second);
+
+				++size_diff;
+				++tx_inserted;
+			}
+		});
+
+		this->add_size(tx_inserted);
+		inserted += static_cast<size_type>(tx_inserted);
+
+		first = tx_end;
+	}
+
+	return inserted;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename I>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::bulk_load(I first, I last,
+					       size_type num_threads)
+{
+	using item_type = typename std::iterator_traits<I>::value_type;
+
+	concurrent_hash_map_internal::check_outside_tx();
+
+	size_type n_items = static_cast<size_type>(std::distance(first, last));
+	if (n_items == 0)
+		return 0;
+
+	/* Presize the table and rehash all buckets which are not rehashed
+	 * yet, also in a map which is empty, but had items before */
+	reserve(this->approximate_size() + n_items + 1);
+
+	hashcode_type m = mask().load(std::memory_order_acquire);
+
+	for (hashcode_type i = 2; i <= m; ++i) {
+		bucket *bp = get_bucket(i);
+		if (!bp->is_rehashed(std::memory_order_relaxed))
+			rehash_bucket<true>(bp, i);
+	}
+
+	auto entries = prepare_batch(
+		first, last, m,
+		[](const item_type &item) -> const decltype(item.first) & {
+			return item.first;
+		});
+
+	num_threads = (std::max)(size_type(1),
+				 (std::min)(num_threads, size_type(m + 1)));
+
+	/* Entries are sorted by bucket, so each thread gets entries of a
+	 * disjoint range of buckets */
+	std::vector<size_type> bounds(num_threads + 1);
+	for (size_type t = 0; t <= num_threads; ++t) {
+		hashcode_type bucket_idx = (m + 1) * t / num_threads;
+
+		auto it = std::lower_bound(
+			entries.begin(), entries.end(), bucket_idx,
+			[m](const batch_entry_t<I> &e, hashcode_type idx) {
+				return (e.first & m) < idx;
+			});
+		bounds[t] = static_cast<size_type>(it - entries.begin());
+	}
+
+	std::vector<size_type> inserted(num_threads, 0);
+
+	detail::run_in_threads(num_threads, [&](size_type t) {
+		inserted[t] = bulk_load_entries(entries, bounds[t],
+						bounds[t + 1], m);
+	});
+
+	size_type result = 0;
+	for (auto n : inserted)
+		result += n;
+
+	return result;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename F, typename G>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::snapshot(F f, G bucket_done)
+{
+	concurrent_hash_map_internal::check_outside_tx();
+
+	/*
+	 * Items are visited in groups of items with the same hash & m0,
+	 * which do not change when the table grows. An item of group i is in
+	 * one of the buckets i, i + m0 + 1, ... up to the current mask (or in
+	 * their parents, if they are not rehashed yet).
+	 */
+	hashcode_type m0 = mask().load(std::memory_order_acquire);
+
+	size_type visited = 0;
+	std::vector<node *> done;
+
+	for (hashcode_type i = 0; i <= m0; ++i) {
+		/* check_growth() does not enable new segments while the
+		 * mutex is held, so items of the group are not moved to
+		 * buckets above the mask while they are visited */
+		std::unique_lock<typename hash_map_base::segment_enable_mutex_t>
+			growth_lock(this->my_segment_enable_mutex);
+
+		hashcode_type m = mask().load(std::memory_order_acquire);
+
+		for (hashcode_type j = i; j <= m; j += m0 + 1) {
+			/* A rehashed bucket may also keep items of its
+			 * descendants which are not rehashed yet, they are
+			 * skipped here and visited with the descendant (which
+			 * is rehashed first) */
+			hashcode_type bucket_mask = j < 2
+				? hashcode_type(1)
+				: (hashcode_type(2) << detail::Log2(j)) - 1;
+			bool filter = bucket_mask != m;
+			bool retry = false;
+
+			done.clear();
+
+			for (;;) {
+				bucket_accessor b(this, j);
+				bool complete = true;
+
+				node *np = static_cast<node *>(
+					b->node_list.get(this->my_pool_uuid));
+
+				for (; np; np = static_cast<node *>(
+						   np->next.get(
+							   this->my_pool_uuid))) {
+					if (filter &&
+					    (hasher{}(np->item.first) & m) != j)
+						continue;
+
+					if (retry &&
+					    std::find(done.begin(), done.end(),
+						      np) != done.end())
+						continue;
+
+					/* Released when it goes out of scope */
+					const_accessor item_lock;
+					if (!try_acquire_item(&item_lock,
+							      np->mutex, false)) {
+						complete = false;
+						break;
+					}
+
+					f(static_cast<const value_type &>(
+						np->item));
+					done.push_back(np);
+				}
+
+				if (complete)
+					break;
+
+				/* The item is locked for a long time, do not
+				 * block writers of the bucket meanwhile */
+				b.release();
+				std::this_thread::yield();
+				retry = true;
+			}
+
+			visited += done.size();
+		}
+
+		/* The table can grow while bucket_done() is called */
+		growth_lock.unlock();
+
+		bucket_done();
+	}
+
+	return visited;
+}
+
 template <typename Key, typename T, typename Hash, typename KeyEqual,
 	  typename MutexType, typename ScopedLockType>
 void
@@ -3318,6 +5928,28 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::rehash(
 	}
 }
 
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+void
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::rehash_down(size_type n)
+{
+	concurrent_hash_map_internal::check_outside_tx();
+
+	std::unique_lock<typename hash_map_base::segment_enable_mutex_t> lock(
+		this->my_segment_enable_mutex);
+
+	hashcode_type m = mask().load(std::memory_order_relaxed);
+	segment_index_t s = segment_traits_t::segment_index_of(m);
+
+	/* Segments of the first block are never freed separately */
+	while (s >= hash_map_base::first_block &&
+	       segment_traits_t::segment_base(s) >= n) {
+		merge_segment(s);
+		--s;
+	}
+}
+
 template <typename Key, typename T, typename Hash, typename KeyEqual,
 	  typename MutexType, typename ScopedLockType>
 void
@@ -3344,6 +5976,7 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::clear()
 
 		assert(this->tls_ptr != nullptr);
 		this->tls_ptr->clear();
+		this->free_node_caches();
 
 		this->on_init_size = 0;
 
@@ -3362,6 +5995,8 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::clear()
 		 * transaction we must make sure that mask and size
 		 * changes are transactional
 		 */
+		this->fold_size();
+
 		flat_transaction::snapshot((size_t *)&this->my_mask);
 		flat_transaction::snapshot((size_t *)&this->my_size);
 
@@ -3384,17 +6019,75 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 
 	size_type sz = segment.size();
 	for (segment_index_t i = 0; i < sz; ++i) {
+		if (!segment[i].node_list)
+			continue;
+
 		for (node_ptr_t n = segment[i].node_list; n;
 		     n = segment[i].node_list) {
 			segment[i].node_list = n(this->my_pool_uuid)->next;
 			delete_node(n);
 		}
+
+		/* Embedded buckets are reused */
+		if (s < segment_traits_t::embedded_segments)
+			segment[i].set_fingerprints(
+				fingerprints_t::empty(),
+				std::memory_order_relaxed);
 	}
 
 	if (s >= segment_traits_t::embedded_segments)
 		segment.disable();
 }
 
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+void
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::merge_segment(segment_index_t s)
+{
+	pool_base pop = get_pool_base();
+	segment_facade_t segment(this->my_table, s);
+
+	assert(segment.is_valid());
+	assert(mask().load(std::memory_order_relaxed) ==
+	       segment_traits_t::segment_base(s) + segment.size() - 1);
+
+	size_type sz = segment.size();
+	for (segment_index_t i = 0; i < sz; ++i) {
+		bucket *b = &segment[i];
+
+		/* Items of a bucket which is not rehashed are still in its
+		 * parent */
+		if (!b->node_list)
+			continue;
+
+		/* Parent of every bucket in the last segment */
+		bucket *parent = get_bucket(i);
+
+		flat_transaction::run(pop, [&] {
+			node_ptr_t *tail = &b->node_list;
+			while (*tail)
+				tail = &(*tail)(this->my_pool_uuid)->next;
+
+			*tail = parent->node_list;
+			parent->node_list = b->node_list;
+			b->node_list = nullptr;
+
+			/* The bucket is rehashed again on demand if the
+			 * segment is not freed due to a failure */
+			b->set_fingerprints(0, std::memory_order_relaxed);
+
+			if (parent->is_rehashed(std::memory_order_relaxed))
+				rebuild_fingerprints(parent);
+		});
+	}
+
+	flat_transaction::run(pop, [&] { segment.disable(); });
+
+	mask().store(segment_traits_t::segment_base(s) - 1,
+		     std::memory_order_release);
+}
+
 template <typename Key, typename T, typename Hash, typename KeyEqual,
 	  typename MutexType, typename ScopedLockType>
 void
@@ -3423,10 +6116,90 @@ concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
 		assert(b->is_rehashed(std::memory_order_relaxed));
 
 		detail::persistent_pool_ptr<node> p;
-		insert_new_node(b, p, *first);
+		insert_new_node(b, h, p, *first);
 	}
 }
 
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+typename concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+			     ScopedLockType>::size_type
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType,
+		    ScopedLockType>::internal_count(size_type num_threads) const
+{
+	size_type n_buckets = mask().load(std::memory_order_relaxed) + 1;
+
+	num_threads =
+		(std::max)(size_type(1), (std::min)(num_threads, n_buckets));
+
+	/* Each thread writes its own counter only once */
+	std::vector<size_type> counts(num_threads, 0);
+
+	detail::run_in_threads(num_threads, [&](size_type t) {
+		hashcode_type begin = n_buckets * t / num_threads;
+		hashcode_type end = n_buckets * (t + 1) / num_threads;
+		size_type cnt = 0;
+
+		for (hashcode_type i = begin; i < end; ++i) {
+			const bucket *b = get_bucket(i);
+
+			for (auto n = b->node_list.get(this->my_pool_uuid); n;
+			     n = n->next.get(this->my_pool_uuid))
+				++cnt;
+		}
+
+		counts[t] = cnt;
+	});
+
+	size_type result = 0;
+	for (auto c : counts)
+		result += c;
+
+	return result;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	  typename MutexType, typename ScopedLockType>
+template <typename Range, typename F>
+void
+concurrent_hash_map<Key, T, Hash, KeyEqual, MutexType, ScopedLockType>::
+	internal_parallel_for_each(Range r, size_type num_threads, F &f)
+{
+	num_threads = (std::max)(size_type(1), num_threads);
+
+	/* Several subranges per thread balance the load between threads */
+	std::vector<Range> ranges;
+	ranges.reserve(8 * num_threads);
+	ranges.push_back(r);
+
+	bool divisible = true;
+	while (divisible && ranges.size() < 4 * num_threads) {
+		divisible = false;
+
+		for (size_type i = 0, n = ranges.size(); i < n; ++i) {
+			if (ranges[i].is_divisible()) {
+				ranges.emplace_back(ranges[i], split());
+				divisible = true;
+			}
+		}
+	}
+
+	std::atomic<size_type> next(0);
+
+	num_threads = (std::min)(num_threads, ranges.size());
+
+	detail::run_in_threads(
+		num_threads,
+		[&](size_type) {
+			for (size_type i = next++; i < ranges.size();
+			     i = next++) {
+				for (auto &v : ranges[i])
+					f(v);
+			}
+		},
+		[&] { next = ranges.size(); });
+}
+
 template <typename Key, typename T, typename Hash, typename KeyEqual,
 	  typename MutexType, typename ScopedLockType>
 inline bool
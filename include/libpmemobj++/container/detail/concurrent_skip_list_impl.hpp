@@ -8,15 +8,21 @@
 #include <array>
 #include <atomic>
 #include <cstdlib>
+#include <exception>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <mutex> /* for std::unique_lock */
 #include <random>
 #include <type_traits>
+#include <vector>
 
 #include <libpmemobj++/detail/common.hpp>
 #include <libpmemobj++/detail/enumerable_thread_specific.hpp>
 #include <libpmemobj++/detail/life.hpp>
 #include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/detail/pool_data.hpp>
+#include <libpmemobj++/detail/run_in_threads.hpp>
 #include <libpmemobj++/detail/template_helpers.hpp>
 #include <libpmemobj++/mutex.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
@@ -25,6 +31,7 @@
 
 #include <libpmemobj++/experimental/atomic_self_relative_ptr.hpp>
 #include <libpmemobj++/experimental/self_relative_ptr.hpp>
+#include <libpmemobj++/experimental/v.hpp>
 
 /* Windows has a max and a min macros which collides with min() and max()
  * methods of default_random_generator */
@@ -115,9 +122,329 @@ allocator_swap(MyAlloc &, OtherAlloc &, std::false_type)
 { /* NO SWAP */
 }
 
-template <typename Value, typename Mutex = pmem::obj::mutex,
+/**
+ * Storage of levels above 0 of skip_list_node. By default, all levels are
+ * stored in the node, in persistent memory.
+ */
+template <typename AtomicNodePointer, bool VolatileUpperLevels>
+class skip_list_upper_levels {
+public:
+	explicit skip_list_upper_levels(AtomicNodePointer *levels)
+	{
+		assert(levels == nullptr);
+		(void)levels;
+	}
+
+	AtomicNodePointer *
+	upper_levels() const
+	{
+		return nullptr;
+	}
+
+	void
+	set_upper_levels(AtomicNodePointer *levels)
+	{
+		assert(levels == nullptr);
+		(void)levels;
+	}
+};
+
+/**
+ * Storage of levels above 0 of skip_list_node in volatile memory. Only the
+ * pointer to the array resides in persistent memory. It is never persisted
+ * and it is not valid after restart.
+ */
+template <typename AtomicNodePointer>
+class skip_list_upper_levels<AtomicNodePointer, true> {
+public:
+	explicit skip_list_upper_levels(AtomicNodePointer *levels)
+	    : upper(levels)
+	{
+	}
+
+	AtomicNodePointer *
+	upper_levels() const
+	{
+		return upper;
+	}
+
+	void
+	set_upper_levels(AtomicNodePointer *levels)
+	{
+		upper = levels;
+#if LIBPMEMOBJ_CPP_VG_PMEMCHECK_ENABLED
+		VALGRIND_PMC_DO_FLUSH(&upper, sizeof(upper));
+#endif
+	}
+
+private:
+	AtomicNodePointer *upper;
+};
+
+/**
+ * Arrays of pointers to next nodes on levels above 0, for skip lists which
+ * store these levels in volatile memory. Arrays are allocated from chunks
+ * and released arrays are reused for nodes of the same height. All chunks
+ * are freed when the storage is destroyed, together with the skip list or
+ * on pool close.
+ */
+template <typename AtomicNodePointer>
+class skip_list_volatile_levels {
+public:
+	/** @return array of n null pointers */
+	AtomicNodePointer *
+	allocate(std::size_t n)
+	{
+		assert(n > 0 && n <= chunk_size);
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (free_lists.size() <= n)
+			free_lists.resize(n + 1);
+
+		AtomicNodePointer *levels;
+		auto &free_list = free_lists[n];
+		if (!free_list.empty()) {
+			levels = free_list.back();
+			free_list.pop_back();
+		} else {
+			if (chunk_used + n > chunk_size) {
+				chunks.emplace_back(
+					new AtomicNodePointer[chunk_size]);
+				chunk_used = 0;
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+				VALGRIND_HG_DISABLE_CHECKING(
+					chunks.back().get(),
+					sizeof(AtomicNodePointer) * chunk_size);
+#endif
+			}
+
+			levels = chunks.back().get() + chunk_used;
+			chunk_used += n;
+		}
+
+		for (std::size_t i = 0; i < n; ++i)
+			levels[i].store(nullptr, std::memory_order_relaxed);
+
+		return levels;
+	}
+
+	void
+	deallocate(AtomicNodePointer *levels, std::size_t n)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		free_lists[n].push_back(levels);
+	}
+
+private:
+	enum : std::size_t { chunk_size = 4096 };
+
+	std::mutex mtx;
+	std::vector<std::unique_ptr<AtomicNodePointer[]>> chunks;
+	std::size_t chunk_used = chunk_size;
+	std::vector<std::vector<AtomicNodePointer *>> free_lists;
+};
+
+/**
+ * Epochs of threads accessing a concurrent_skip_list, used to decide when
+ * memory of erased nodes can be freed (epoch-based reclamation).
+ *
+ * A thread pins the global epoch for the duration of an operation. The
+ * global epoch is advanced only if all pinned threads observed the current
+ * one. A node unlinked from the list before the global epoch e was read can
+ * be accessed only by threads which pinned e or an earlier epoch, so it can
+ * be freed once the global epoch is e + 2.
+ *
+ * Records of threads are indexed by thread ids and allocated in chunks of
+ * growing size, which are never freed before the whole object.
+ */
+class skip_list_epochs {
+public:
+	skip_list_epochs() : global(1)
+	{
+		for (auto &c : chunks)
+			c.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~skip_list_epochs()
+	{
+		for (auto &c : chunks)
+			delete[] c.load(std::memory_order_relaxed);
+	}
+
+	skip_list_epochs(const skip_list_epochs &) = delete;
+	skip_list_epochs &operator=(const skip_list_epochs &) = delete;
+
+	/** Pins the current global epoch. Calls can be nested. */
+	void
+	pin()
+	{
+		record &r = local();
+		if (r.nesting++ > 0)
+			return;
+
+		r.epoch.store(global.load(std::memory_order_relaxed),
+			      std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void
+	unpin()
+	{
+		record &r = local();
+		assert(r.nesting > 0);
+		if (--r.nesting == 0)
+			r.epoch.store(0, std::memory_order_release);
+	}
+
+	/**
+	 * @return global epoch, which should be read after a node is
+	 * unlinked and which is recorded as the retire epoch of the node.
+	 */
+	uint64_t
+	retire_epoch() const
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return global.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Counts modifications of the calling thread.
+	 * @return true once every reclaim_period calls.
+	 */
+	bool
+	tick()
+	{
+		return ++local().ops % reclaim_period == 0;
+	}
+
+	/**
+	 * Advances the global epoch if no thread has pinned an older one.
+	 * @return the global epoch.
+	 */
+	uint64_t
+	try_advance()
+	{
+		uint64_t e = global.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		for (std::size_t k = 0; k < max_chunks; ++k) {
+			record *c = chunks[k].load(std::memory_order_acquire);
+			if (c == nullptr)
+				continue;
+
+			record *recs = aligned(c);
+			for (std::size_t i = 0; i < chunk_records(k); ++i) {
+				uint64_t pinned = recs[i].epoch.load(
+					std::memory_order_relaxed);
+				if (pinned != 0 && pinned != e)
+					return e;
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (global.compare_exchange_strong(e, e + 1,
+						   std::memory_order_release,
+						   std::memory_order_relaxed))
+			return e + 1;
+
+		return e;
+	}
+
+	/**
+	 * @return true if a node with the retire epoch can be freed when the
+	 * global epoch is equal to global. Epoch 0 means that the node was
+	 * not unlinked.
+	 */
+	static bool
+	can_free(uint64_t retired, uint64_t global)
+	{
+		return retired != 0 && global >= retired + 2;
+	}
+
+private:
+	struct record {
+		std::atomic<uint64_t> epoch;
+		std::size_t nesting;
+		std::size_t ops;
+		char padding[64 - sizeof(std::atomic<uint64_t>) -
+			     2 * sizeof(std::size_t)];
+	};
+
+	enum : std::size_t {
+		/* Number of records in the first chunk */
+		first_chunk_records = 64,
+		max_chunks = 48,
+		/* Retired nodes are reclaimed every reclaim_period erases
+		 * and inserts of a thread */
+		reclaim_period = 64
+	};
+
+	static constexpr std::size_t
+	chunk_records(std::size_t k)
+	{
+		return std::size_t(first_chunk_records) << k;
+	}
+
+	/* Chunks are over-allocated by one record to align them to 64 bytes */
+	static record *
+	aligned(record *c)
+	{
+		auto addr = reinterpret_cast<uintptr_t>(c);
+		return reinterpret_cast<record *>((addr + 63) & ~uintptr_t(63));
+	}
+
+	record &
+	local()
+	{
+		static thread_local thread_id_type tid;
+		std::size_t index = tid.get();
+
+		std::size_t k = 0;
+		while (index >= chunk_records(k)) {
+			index -= chunk_records(k);
+			++k;
+		}
+		assert(k < max_chunks);
+
+		record *c = chunks[k].load(std::memory_order_acquire);
+		if (c == nullptr) {
+			record *allocated = new record[chunk_records(k) + 1];
+			for (std::size_t i = 0; i <= chunk_records(k); ++i) {
+				allocated[i].epoch.store(
+					0, std::memory_order_relaxed);
+				allocated[i].nesting = 0;
+				allocated[i].ops = 0;
+			}
+
+			if (chunks[k].compare_exchange_strong(
+				    c, allocated, std::memory_order_acq_rel,
+				    std::memory_order_acquire)) {
+				c = allocated;
+			} else {
+				delete[] allocated;
+			}
+		}
+
+		return aligned(c)[index];
+	}
+
+	std::atomic<uint64_t> global;
+	std::array<std::atomic<record *>, max_chunks> chunks;
+};
+
+template <typename Value, bool VolatileUpperLevels = false,
+	  typename Mutex = pmem::obj::mutex,
 	  typename LockType = std::unique_lock<Mutex>>
-class skip_list_node {
+class skip_list_node
+    : public skip_list_upper_levels<
+	      std::atomic<obj::experimental::self_relative_ptr<skip_list_node<
+		      Value, VolatileUpperLevels, Mutex, LockType>>>,
+	      VolatileUpperLevels> {
+	using base_type = skip_list_upper_levels<
+		std::atomic<obj::experimental::self_relative_ptr<
+			skip_list_node>>,
+		VolatileUpperLevels>;
+
 public:
 	using value_type = Value;
 	using size_type = std::size_t;
@@ -131,9 +458,24 @@ public:
 	using mutex_type = Mutex;
 	using lock_type = LockType;
 
-	skip_list_node(size_type levels) : height_(levels)
+	/**
+	 * If true, only level 0 is stored in persistent memory, the other
+	 * levels are stored in volatile memory.
+	 */
+	static constexpr bool volatile_upper_levels = VolatileUpperLevels;
+
+	/**
+	 * @param[in] levels height of the node.
+	 * @param[in] upper array of levels above 0 in volatile memory, if the
+	 * node stores them there.
+	 */
+	skip_list_node(size_type levels, atomic_node_pointer *upper)
+	    : base_type(upper),
+	      height_(levels),
+	      state_(0),
+	      retired_next_(nullptr)
 	{
-		for (size_type lev = 0; lev < height_; ++lev)
+		for (size_type lev = 0; lev < persistent_height(height_); ++lev)
 			detail::create<atomic_node_pointer>(&get_next(lev),
 							    nullptr);
 
@@ -143,39 +485,68 @@ public:
 		 * Valgrind does not understand atomic semantic and reports
 		 * false-postives in drd and helgrind tools.
 		 */
-		for (size_type lev = 0; lev < height_; ++lev) {
+		for (size_type lev = 0; lev < persistent_height(height_);
+		     ++lev) {
 			VALGRIND_HG_DISABLE_CHECKING(&get_next(lev),
 						     sizeof(get_next(lev)));
 		}
 #endif
 	}
 
-	skip_list_node(size_type levels, const node_pointer *new_nexts)
-	    : height_(levels)
+	skip_list_node(size_type levels, atomic_node_pointer *upper,
+		       const node_pointer *new_nexts)
+	    : base_type(upper),
+	      height_(levels),
+	      state_(0),
+	      retired_next_(nullptr)
 	{
-		for (size_type lev = 0; lev < height_; ++lev)
+		for (size_type lev = 0; lev < persistent_height(height_); ++lev)
 			detail::create<atomic_node_pointer>(&get_next(lev),
 							    new_nexts[lev]);
 
+		for (size_type lev = persistent_height(height_); lev < height_;
+		     ++lev)
+			get_next(lev).store(new_nexts[lev],
+					    std::memory_order_relaxed);
+
 		assert(height() == levels);
 #if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
 		/*
 		 * Valgrind does not understand atomic semantic and reports
 		 * false-postives in drd and helgrind tools.
 		 */
-		for (size_type lev = 0; lev < height_; ++lev) {
+		for (size_type lev = 0; lev < persistent_height(height_);
+		     ++lev) {
 			VALGRIND_HG_DISABLE_CHECKING(&get_next(lev),
 						     sizeof(get_next(lev)));
 		}
 #endif
 	}
 
+	/**
+	 * Levels in volatile memory are not freed, the skip list frees them
+	 * when deallocation of the node is committed.
+	 */
 	~skip_list_node()
 	{
-		for (size_type lev = 0; lev < height_; ++lev)
+		for (size_type lev = 0; lev < persistent_height(height_); ++lev)
 			detail::destroy<atomic_node_pointer>(get_next(lev));
 	}
 
+	/** @return number of levels of the node stored in persistent memory */
+	static constexpr size_type
+	persistent_height(size_type levels)
+	{
+		return volatile_upper_levels ? 1 : levels;
+	}
+
+	/** @return true if the level is stored in persistent memory */
+	static constexpr bool
+	is_persistent_level(size_type level)
+	{
+		return !volatile_upper_levels || level == 0;
+	}
+
 	skip_list_node(const skip_list_node &) = delete;
 
 	skip_list_node &operator=(const skip_list_node &) = delete;
@@ -208,6 +579,8 @@ public:
 	/**
 	 * Can`t be called concurrently
 	 * Should be called inside a transaction
+	 * Levels in volatile memory are not snapshotted, the skip list
+	 * restores them if the transaction is aborted.
 	 */
 	void
 	set_next_tx(size_type level, node_pointer next)
@@ -215,7 +588,9 @@ public:
 		assert(level < height());
 		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 		auto &node = get_next(level);
-		obj::flat_transaction::snapshot<atomic_node_pointer>(&node);
+		if (is_persistent_level(level))
+			obj::flat_transaction::snapshot<atomic_node_pointer>(
+				&node);
 		node.store(next, std::memory_order_release);
 	}
 
@@ -225,6 +600,34 @@ public:
 		assert(level < height());
 		auto &node = get_next(level);
 		node.store(next, std::memory_order_release);
+		if (is_persistent_level(level))
+			pop.persist(&node, sizeof(node));
+	}
+
+	/**
+	 * Sets the pointer on the level to @arg desired if it is equal to
+	 * @arg expected, otherwise loads the current pointer to
+	 * @arg expected. The pointer is not persisted.
+	 *
+	 * @return true if the pointer was set.
+	 */
+	bool
+	cas_next(size_type level, node_pointer &expected, node_pointer desired)
+	{
+		assert(level < height());
+		return get_next(level).compare_exchange_strong(
+			expected, desired, std::memory_order_acq_rel,
+			std::memory_order_acquire);
+	}
+
+	void
+	persist_next(obj::pool_base pop, size_type level)
+	{
+		assert(level < height());
+		if (!is_persistent_level(level))
+			return;
+
+		auto &node = get_next(level);
 		pop.persist(&node, sizeof(node));
 	}
 
@@ -232,10 +635,10 @@ public:
 	set_nexts(const node_pointer *new_nexts, size_type h)
 	{
 		assert(h == height());
-		auto *nexts = get_nexts();
 
 		for (size_type i = 0; i < h; i++) {
-			nexts[i].store(new_nexts[i], std::memory_order_relaxed);
+			get_next(i).store(new_nexts[i],
+					  std::memory_order_relaxed);
 		}
 	}
 
@@ -246,7 +649,7 @@ public:
 		set_nexts(new_nexts, h);
 
 		auto *nexts = get_nexts();
-		pop.persist(nexts, sizeof(nexts[0]) * h);
+		pop.persist(nexts, sizeof(nexts[0]) * persistent_height(h));
 	}
 
 	/** @return number of layers */
@@ -262,6 +665,79 @@ public:
 		return lock_type(mutex);
 	}
 
+	/** @return true if the node was removed by a thread-safe erase */
+	bool
+	erased() const
+	{
+		return state_.load(std::memory_order_acquire) & erased_bit;
+	}
+
+	/**
+	 * Marks the node as erased. The mark is not persisted, the node
+	 * is recorded as erased in the list of retired nodes.
+	 */
+	void
+	set_erased()
+	{
+		state_.fetch_or(erased_bit, std::memory_order_release);
+	}
+
+	/**
+	 * Records that the erase of the node completed. The node is not
+	 * reachable since the global epoch retire_epoch was read.
+	 *
+	 * @param[in] unlinked true if all unlinks of the node from the
+	 * levels in persistent memory were persisted by the erase.
+	 */
+	void
+	set_retired(obj::pool_base pop, uint64_t retire_epoch, bool unlinked)
+	{
+		uint64_t state = erased_bit | (retire_epoch << epoch_shift);
+		if (unlinked)
+			state |= unlinked_bit;
+
+		state_.store(state, std::memory_order_release);
+		pop.persist(&state_, sizeof(state_));
+	}
+
+	/**
+	 * @return epoch in which the erase of the node completed or 0 if it
+	 * did not complete.
+	 */
+	uint64_t
+	retire_epoch() const
+	{
+		return state_.load(std::memory_order_acquire) >> epoch_shift;
+	}
+
+	/**
+	 * @return true if the node was durably unlinked from all levels in
+	 * persistent memory by its erase.
+	 */
+	bool
+	unlinked() const
+	{
+		return state_.load(std::memory_order_acquire) & unlinked_bit;
+	}
+
+	node_pointer
+	retired_next() const
+	{
+		return retired_next_;
+	}
+
+	/**
+	 * Links the node to the list of retired nodes.
+	 * Should be called inside a transaction
+	 */
+	void
+	set_retired_next_tx(node_pointer next)
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+		detail::conditional_add_to_tx(&retired_next_);
+		retired_next_ = next;
+	}
+
 private:
 	atomic_node_pointer *
 	get_nexts()
@@ -272,6 +748,9 @@ private:
 	atomic_node_pointer &
 	get_next(size_type level)
 	{
+		if (!is_persistent_level(level))
+			return this->upper_levels()[level - 1];
+
 		auto *arr = get_nexts();
 		return arr[level];
 	}
@@ -279,18 +758,30 @@ private:
 	const atomic_node_pointer &
 	get_next(size_type level) const
 	{
+		if (!is_persistent_level(level))
+			return this->upper_levels()[level - 1];
+
 		auto *arr =
 			reinterpret_cast<const atomic_node_pointer *>(this + 1);
 		return arr[level];
 	}
 
+protected:
 	mutex_type mutex;
 	union {
 		value_type val;
 	};
+	/* Bits of state_ */
+	enum : uint64_t { erased_bit = 1, unlinked_bit = 2, epoch_shift = 2 };
+
 	size_type height_;
+	std::atomic<uint64_t> state_;
+	node_pointer retired_next_;
 };
 
+template <typename Iterator>
+class skip_list_range;
+
 template <typename NodeType, bool is_const>
 class skip_list_iterator {
 	using node_type = NodeType;
@@ -298,6 +789,9 @@ class skip_list_iterator {
 						   node_type *>::type;
 	friend class skip_list_iterator<node_type, true>;
 
+	template <typename Iterator>
+	friend class skip_list_range;
+
 public:
 	using value_type = typename node_type::value_type;
 	using iterator_category = std::forward_iterator_tag;
@@ -340,7 +834,12 @@ public:
 	operator++()
 	{
 		assert(node != nullptr);
-		node = node->next(0).get();
+
+		/* Erased nodes may be linked until the erase completes */
+		do {
+			node = node->next(0).get();
+		} while (node != nullptr && node->erased());
+
 		return *this;
 	}
 
@@ -400,6 +899,152 @@ operator!=(const skip_list_iterator<T, M> &lhs,
 	return lhs.node != rhs.node;
 }
 
+/**
+ * Range of elements of concurrent_skip_list which can be recursively split
+ * into subranges (like TBB's ranges, see is_divisible() and the splitting
+ * constructor) and iterated independently, e.g. by different threads.
+ *
+ * Nodes from upper levels of the skip list serve as split points: a range
+ * is split at the middle node between its bounds on the highest level which
+ * has such nodes, so subranges hold similar numbers of elements without
+ * walking level 0.
+ *
+ * Iterating over a range is thread-safe with respect to concurrent insert,
+ * but not erase.
+ */
+template <typename Iterator>
+class skip_list_range {
+public:
+	using iterator = Iterator;
+	using value_type = typename iterator::value_type;
+	using reference = typename iterator::reference;
+	using difference_type = typename iterator::difference_type;
+	using size_type = size_t;
+
+	/**
+	 * Splitting constructor. Takes the upper part of r, which is left
+	 * with the lower part.
+	 *
+	 * @pre r.is_divisible()
+	 */
+	skip_list_range(skip_list_range &r, pmem::obj::split)
+	    : my_end_node(r.my_end_node), my_end(r.my_end)
+	{
+		assert(r.is_divisible());
+
+		size_type level = r.my_level;
+		node_ptr mid = r.middle(level);
+		while (mid == nullptr) {
+			assert(level > 1);
+			mid = r.middle(--level);
+		}
+
+		my_begin_node = mid;
+		my_level = level;
+		my_begin = first_from(mid);
+
+		r.my_end_node = mid;
+		r.my_level = level;
+		r.my_end = my_begin;
+	}
+
+	/** @returns true if the range contains no elements. */
+	bool
+	empty() const
+	{
+		return my_begin == my_end;
+	}
+
+	/**
+	 * @returns true if there is a node of an upper level between bounds
+	 * of the range.
+	 */
+	bool
+	is_divisible() const
+	{
+		if (my_level == 0)
+			return false;
+
+		node_ptr next = my_begin_node->next(1).get();
+		return next != nullptr && next != my_end_node;
+	}
+
+	/** @returns an iterator to the first element of the range. */
+	iterator
+	begin() const
+	{
+		return my_begin;
+	}
+
+	/** @returns an iterator past the last element of the range. */
+	iterator
+	end() const
+	{
+		return my_end;
+	}
+
+#if !defined(_MSC_VER) || defined(__INTEL_COMPILER)
+private:
+	template <typename Traits>
+	friend class concurrent_skip_list;
+#else
+public: /* workaround */
+#endif
+	using node_ptr = typename iterator::node_ptr;
+
+	explicit skip_list_range(node_ptr head)
+	    : my_begin_node(head),
+	      my_end_node(nullptr),
+	      my_level(head->height() - 1),
+	      my_begin(first_from(head->next(0).get())),
+	      my_end(nullptr)
+	{
+	}
+
+private:
+	/**
+	 * Returns the middle node on the given level between bounds of the
+	 * range or nullptr if there are no nodes between them.
+	 */
+	node_ptr
+	middle(size_type level) const
+	{
+		size_type count = 0;
+		for (node_ptr n = my_begin_node->next(level).get();
+		     n != my_end_node; n = n->next(level).get())
+			++count;
+
+		if (count == 0)
+			return nullptr;
+
+		node_ptr n = my_begin_node->next(level).get();
+		for (count /= 2; count > 0; --count)
+			n = n->next(level).get();
+
+		return n;
+	}
+
+	/* Erased nodes may be linked until the erase completes */
+	static iterator
+	first_from(node_ptr n)
+	{
+		while (n != nullptr && n->erased())
+			n = n->next(0).get();
+
+		return iterator(n);
+	}
+
+	/* Bounds of the range: the head or a node higher than my_level and
+	 * a node higher than my_level or nullptr */
+	node_ptr my_begin_node;
+	node_ptr my_end_node;
+	size_type my_level;
+
+	/* First elements at or after the bounds which are not erased */
+	iterator my_begin;
+	iterator my_end;
+};
+
 struct default_random_generator {
 	using gen_type = std::mt19937_64;
 	using result_type = typename gen_type::result_type;
@@ -447,15 +1092,164 @@ public:
 	}
 };
 
+/**
+ * Runtime state of levels of concurrent_skip_list stored in volatile memory.
+ * Empty if all levels are stored in persistent memory.
+ */
+template <typename Node, bool VolatileUpperLevels>
+class skip_list_upper_levels_state {
+protected:
+	using atomic_node_pointer = typename Node::atomic_node_pointer;
+
+	bool
+	upper_levels_valid()
+	{
+		return true;
+	}
+
+	void
+	init_upper_levels_state()
+	{
+	}
+
+	void
+	destroy_upper_levels_state()
+	{
+	}
+
+	atomic_node_pointer *
+	allocate_upper_levels(std::size_t)
+	{
+		return nullptr;
+	}
+
+	std::function<void()>
+	upper_levels_deleter(atomic_node_pointer *, std::size_t)
+	{
+		return std::function<void()>();
+	}
+};
+
+/**
+ * Levels of nodes in volatile memory are allocated from a storage bound to
+ * the skip list and owned by the pool, so that they are freed on pool close.
+ * The pointer to the storage is cached in a v<> property, so it is null in
+ * each new run of the application, until runtime_initialize() is called.
+ */
+template <typename Node>
+class skip_list_upper_levels_state<Node, true> {
+protected:
+	using atomic_node_pointer = typename Node::atomic_node_pointer;
+	using levels_type = skip_list_volatile_levels<atomic_node_pointer>;
+
+	/**
+	 * @return true if levels in volatile memory were allocated in this
+	 * run of the application.
+	 */
+	bool
+	upper_levels_valid()
+	{
+		return storage.get() != nullptr;
+	}
+
+	void
+	init_upper_levels_state()
+	{
+		storage.get() =
+			get_pool_data()->template get_volatile<levels_type>(
+				offset());
+	}
+
+	/**
+	 * Destroys the storage when the transaction is committed.
+	 * Should be called inside a transaction.
+	 */
+	void
+	destroy_upper_levels_state()
+	{
+		pool_data *data = get_pool_data();
+		uint64_t off = offset();
+
+		obj::flat_transaction::register_callback(
+			obj::flat_transaction::stage::oncommit,
+			[data, off] { data->destroy_volatile(off); });
+	}
+
+	/** @return levels for a node of the given height */
+	atomic_node_pointer *
+	allocate_upper_levels(std::size_t height)
+	{
+		if (height < 2)
+			return nullptr;
+
+		return storage.get()->allocate(height - 1);
+	}
+
+	/**
+	 * @return function which deallocates the levels. It can be called
+	 * after the skip list is destroyed.
+	 */
+	std::function<void()>
+	upper_levels_deleter(atomic_node_pointer *levels, std::size_t height)
+	{
+		pool_data *data = get_pool_data();
+		uint64_t off = offset();
+
+		return [data, off, levels, height] {
+			auto *storage =
+				data->template get_volatile_if_exists<
+					levels_type>(off);
+			if (storage != nullptr)
+				storage->deallocate(levels, height - 1);
+		};
+	}
+
+private:
+	pool_data *
+	get_pool_data() const
+	{
+		auto *data = static_cast<pool_data *>(
+			pmemobj_get_user_data(pmemobj_pool_by_ptr(this)));
+		assert(data != nullptr);
+
+		return data;
+	}
+
+	uint64_t
+	offset() const
+	{
+		return pmemobj_oid(this).off;
+	}
+
+	obj::experimental::v<levels_type *> storage;
+};
+
+/**
+ * Tag type of constructors, which take a range of elements sorted by keys.
+ */
+struct sorted_range_t {
+};
+
 /**
  * Persistent memory aware implementation of the concurrent skip list. The
  * implementation is based on the lock-based concurrent skip list algorithm
  * described in
  * https://www.cs.tau.ac.il/~shanir/nir-pubs-web/Papers/OPODIS2006-BA.pdf.
  *
- * Our concurrent skip list implementation supports concurrent insertion and
- * traversal, but not concurrent erasure. The erase method is prefixed with
- * unsafe_, to indicate that there is no concurrency safety.
+ * Our concurrent skip list implementation supports concurrent insertion,
+ * traversal and erasure by key (erase). Erased nodes are marked first and
+ * unlinked afterwards. By default, their memory is freed only by
+ * unsafe_reclaim, clear or runtime_initialize, so iterators and references to
+ * erased elements stay valid until then. If epoch_reclamation is enabled in
+ * the traits, memory of erased nodes is freed by the erasing thread in one of
+ * its later inserts or erases, once no other thread can access them
+ * (epoch-based reclamation). Lookups, inserts and erases protect the nodes
+ * they visit by themselves, but iterators and references to elements which
+ * may be erased concurrently stay valid only while the thread holds an
+ * epoch_guard created before they were obtained. Nodes retired by a thread
+ * which stopped modifying the skip list are freed by unsafe_reclaim, clear or
+ * runtime_initialize. The other erase methods are prefixed with unsafe_, to
+ * indicate that there is no concurrency safety.
  *
  * Each time, the pool with concurrent_skip_list is being opened, the
  * concurrent_skip_list requires runtime_initialize() to be called in order to
@@ -474,9 +1268,18 @@ public:
  * skip list.
  * * random_generator_type - The type of random generator used by the skip list.
  * It should be thread-safe.
+ * * volatile_upper_levels - If true, only level 0 of the skip list is stored
+ * in persistent memory. Levels above 0 are stored in volatile memory and they
+ * are rebuilt by runtime_initialize() after restart.
+ * * epoch_reclamation - If true, memory of erased nodes is freed while the
+ * skip list is in use, see epoch_guard.
  */
 template <typename Traits>
-class concurrent_skip_list {
+class concurrent_skip_list
+    : private skip_list_upper_levels_state<
+	      skip_list_node<typename Traits::value_type,
+			     Traits::volatile_upper_levels>,
+	      Traits::volatile_upper_levels> {
 protected:
 	using traits_type = Traits;
 	using key_type = typename traits_type::key_type;
@@ -493,11 +1296,15 @@ protected:
 	using pointer = typename allocator_traits_type::pointer;
 	using const_pointer = typename allocator_traits_type::const_pointer;
 
-	using list_node_type = skip_list_node<value_type>;
+	using list_node_type =
+		skip_list_node<value_type, traits_type::volatile_upper_levels>;
 
 	using iterator = skip_list_iterator<list_node_type, false>;
 	using const_iterator = skip_list_iterator<list_node_type, true>;
 
+	using range_type = skip_list_range<iterator>;
+	using const_range_type = skip_list_range<const_iterator>;
+
 	static constexpr size_type MAX_LEVEL = traits_type::max_level;
 
 	using random_level_generator_type = geometric_level_generator<
@@ -514,12 +1321,51 @@ protected:
 	using prev_array_type = std::array<node_ptr, MAX_LEVEL>;
 	using next_array_type = std::array<persistent_node_ptr, MAX_LEVEL>;
 	using node_lock_type = typename list_node_type::lock_type;
-	using lock_array = std::array<node_lock_type, MAX_LEVEL>;
 
 public:
 	static constexpr bool allow_multimapping =
 		traits_type::allow_multimapping;
 
+	static constexpr bool volatile_upper_levels =
+		traits_type::volatile_upper_levels;
+
+	static constexpr bool epoch_reclamation =
+		traits_type::epoch_reclamation;
+
+protected:
+	/**
+	 * RAII guard, which keeps nodes erased concurrently from being freed.
+	 * Iterators and references to elements obtained while the guard is
+	 * held by the thread stay valid until the guard is destroyed, even if
+	 * the elements are erased in the meantime. Guards can be nested.
+	 *
+	 * A held guard delays freeing of all nodes erased in the meantime,
+	 * so it should not be held longer than necessary. If
+	 * epoch_reclamation is false, the guard does nothing.
+	 */
+	class epoch_guard {
+	public:
+		explicit epoch_guard(const concurrent_skip_list &list)
+		    : epochs(epoch_reclamation ? list.get_epochs() : nullptr)
+		{
+			if (epochs != nullptr)
+				epochs->pin();
+		}
+
+		~epoch_guard()
+		{
+			if (epochs != nullptr)
+				epochs->unpin();
+		}
+
+		epoch_guard(const epoch_guard &) = delete;
+		epoch_guard &operator=(const epoch_guard &) = delete;
+
+	private:
+		skip_list_epochs *epochs;
+	};
+
+public:
 	/**
 	 * Default constructor. Construct empty skip list.
 	 *
@@ -594,6 +1440,40 @@ public:
 			internal_unsafe_emplace(*first++);
 	}
 
+	/**
+	 * Constructs the container with the contents of the range [first,
+	 * last), which should be sorted by keys. Nodes are linked in one pass,
+	 * as in bulk_insert_sorted().
+	 *
+	 * @param[in] first first iterator of inserted range.
+	 * @param[in] last last iterator of inserted range.
+	 * @param[in] comp comparison function object to use for all comparisons
+	 * of keys.
+	 * @param[in] alloc allocator to use for all memory allocations of this
+	 * container.
+	 *
+	 * InputIt must meet the requirements of LegacyInputIterator.
+	 *
+	 * @pre must be called in transaction scope.
+	 *
+	 * @throw pmem::pool_error if an object is not in persistent memory.
+	 * @throw pmem::transaction_scope_error if constructor wasn't called in
+	 * transaction.
+	 * @throw pmem::transaction_alloc_error when allocating memory for
+	 * inserted elements in transaction failed.
+	 * @throw rethrows element constructor exception.
+	 */
+	template <class InputIt>
+	concurrent_skip_list(sorted_range_t, InputIt first, InputIt last,
+			     const key_compare &comp = key_compare(),
+			     const allocator_type &alloc = allocator_type())
+	    : _node_allocator(alloc), _compare(comp)
+	{
+		check_tx_stage_work();
+		init();
+		internal_bulk_insert_sorted(first, last);
+	}
+
 	/**
 	 * Copy constructor. Constructs the container with the copy of the
 	 * contents of other.
@@ -724,11 +1604,42 @@ public:
 	 * MUST be called everytime after process restart.
 	 * Not thread safe.
 	 *
+	 * Levels which have to be rebuilt are rebuilt by the calling thread,
+	 * see runtime_initialize(size_type).
+	 *
+	 * @throw pmem::layout_error if the skip list was created using
+	 * incompatible version of libpmemobj-cpp.
 	 */
 	void
 	runtime_initialize()
 	{
-		tls_restore();
+		runtime_initialize(size_type(1));
+	}
+
+	/**
+	 * Intialize concurrent_skip_list after process restart, using up to
+	 * num_threads threads (including the calling one).
+	 * MUST be called everytime after process restart.
+	 * Not thread safe.
+	 *
+	 * If levels above 0 are stored in volatile memory, they are rebuilt
+	 * after restart using num_threads threads. Otherwise, levels are
+	 * rebuilt only if an insert or erase was interrupted.
+	 *
+	 * @param[in] num_threads maximal number of threads used to rebuild
+	 * the levels, 0 is treated as 1.
+	 *
+	 * @throw pmem::layout_error if the skip list was created using
+	 * incompatible version of libpmemobj-cpp.
+	 * @throw std::system_error if a thread could not be started.
+	 */
+	void
+	runtime_initialize(size_type num_threads)
+	{
+		check_layout_version();
+		init_epochs();
+		bool rebuild = restore_upper_levels();
+		tls_restore(rebuild, num_threads);
 
 		assert(this->size() ==
 		       size_type(std::distance(this->begin(), this->end())));
@@ -756,6 +1667,8 @@ public:
 		obj::flat_transaction::run(pop, [&] {
 			clear();
 			delete_dummy_head();
+			this->destroy_upper_levels_state();
+			destroy_epochs();
 		});
 	}
 
@@ -1051,6 +1964,43 @@ public:
 		insert(ilist.begin(), ilist.end());
 	}
 
+	/**
+	 * Inserts elements from range [first, last), which should be sorted
+	 * by keys, e.g. restored from a snapshot. Each node is linked after
+	 * the node inserted before it, so no search from the top of the skip
+	 * list is needed and the nodes are linked in one pass from left to
+	 * right. Heights of the nodes are assigned deterministically: every
+	 * second node is linked on level 1, every fourth on level 2 etc.
+	 * Nodes are allocated and linked in transactions of up to
+	 * bulk_batch_size elements. If multiple elements have keys that
+	 * compare equivalent to each other or to an element of the container,
+	 * the first one is inserted.
+	 *
+	 * If an element is less than the previous one, its position is searched
+	 * from the head of the list, so unsorted input is inserted correctly,
+	 * but slower.
+	 *
+	 * Not thread-safe but can be called within a transaction. Otherwise,
+	 * if a batch is interrupted by a crash, elements of the previous
+	 * batches stay inserted.
+	 *
+	 * @param[in] first first iterator of inserted range.
+	 * @param[in] last last iterator of inserted range.
+	 *
+	 * @return number of inserted elements.
+	 *
+	 * @throw pmem::transaction_error when snapshotting failed.
+	 * @throw pmem::transaction_alloc_error when allocating new memory
+	 * failed.
+	 * @throw rethrows constructor exception.
+	 */
+	template <typename InputIterator>
+	size_type
+	bulk_insert_sorted(InputIterator first, InputIterator last)
+	{
+		return internal_bulk_insert_sorted(first, last);
+	}
+
 	/**
 	 * Inserts a new element into the container constructed in-place with
 	 * the given args if there is no element with the key in the container.
@@ -1354,6 +2304,98 @@ public:
 		return sz;
 	}
 
+	/**
+	 * Removes the element (if one exists) with the key equivalent to key
+	 * in a thread-safe way. It can be called concurrently with inserts,
+	 * lookups, traversals and other erase calls.
+	 *
+	 * The element is marked as erased first, which makes it invisible to
+	 * lookups and iterators, and then it is unlinked from the list.
+	 * Memory of erased elements is freed by unsafe_reclaim(), clear() or
+	 * runtime_initialize(), so iterators and references to them remain
+	 * dereferenceable until then. If epoch_reclamation is true, it is
+	 * freed earlier, by inserts and erases of the calling thread, once no
+	 * thread holds an epoch_guard created before the element was
+	 * unlinked. Iterators and references to erased elements then remain
+	 * dereferenceable as long as the epoch_guard held when they were
+	 * obtained exists.
+	 *
+	 * @param[in] key key value of the elements to remove.
+	 *
+	 * @return Number of elements removed.
+	 *
+	 * @throw pmem::transaction_error when snapshotting failed.
+	 * @throw pmem::transaction_scope_error if called inside transaction.
+	 */
+	size_type
+	erase(const key_type &key)
+	{
+		return internal_concurrent_erase(key);
+	}
+
+	/**
+	 * Removes the element (if one exists) with the key equivalent to key
+	 * in a thread-safe way, see erase(const key_type &).
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Compare::is_transparent is valid and denotes a type and
+	 * std::is_convertible<K, iterator>::value != true &&
+	 * std::is_convertible<K, const_iterator>::value != true.
+	 * It allows calling this function without constructing an instance of
+	 * Key.
+	 *
+	 * @param[in] key key value of the elements to remove.
+	 *
+	 * @return Number of elements removed.
+	 *
+	 * @throw pmem::transaction_error when snapshotting failed.
+	 * @throw pmem::transaction_scope_error if called inside transaction.
+	 */
+	template <
+		typename K,
+		typename = typename std::enable_if<
+			has_is_transparent<key_compare>::value &&
+				!std::is_convertible<K, iterator>::value &&
+				!std::is_convertible<K, const_iterator>::value,
+			K>::type>
+	size_type
+	erase(const K &key)
+	{
+		return internal_concurrent_erase(key);
+	}
+
+	/**
+	 * Frees memory of all elements removed by erase(), which were not
+	 * freed yet. If epoch_reclamation is true, erasing threads free
+	 * memory of erased elements by themselves, so it is needed only to
+	 * free elements erased by threads which stopped modifying the
+	 * container. Not thread safe, no other method can be called
+	 * concurrently.
+	 *
+	 * @throw pmem::transaction_error when snapshotting failed.
+	 * @throw pmem::transaction_free_error when freeing underlying memory
+	 * failed.
+	 * @throw pmem::transaction_scope_error if called inside transaction.
+	 * @throw rethrows destructor exception.
+	 */
+	void
+	unsafe_reclaim()
+	{
+		check_outside_tx();
+
+		if (!has_retired_nodes())
+			return;
+
+		/* An erase which threw might have left the node linked */
+		if (has_retired_nodes(
+			    [](node_ptr n) { return n->retire_epoch() == 0; })) {
+			unlink_retired_nodes();
+			rebuild_upper_levels();
+		}
+
+		obj::pool_base pop = get_pool_base();
+		obj::flat_transaction::run(pop, [&] { free_retired_nodes(); });
+	}
+
 	/**
 	 * Returns an iterator pointing to the first element that is not less
 	 * than (i.e. greater or equal to) key.
@@ -1894,6 +2936,58 @@ public:
 		return internal_find(x);
 	}
 
+	/**
+	 * Calls f(const_reference) for at most limit elements with keys not
+	 * less than from and less than to, in ascending order of keys.
+	 *
+	 * The first element is found with a search from the top of the skip
+	 * list, and the following ones along level 0. A second cursor runs a
+	 * few nodes ahead of the processed element and prefetches the nodes
+	 * it reaches, together with successors of tall nodes on their upper
+	 * levels, which are further ahead. Loads of the following nodes thus
+	 * overlap with processing of the current one.
+	 *
+	 * Thread-safe like iteration: elements inserted or erased
+	 * concurrently may or may not be visited.
+	 *
+	 * @param[in] from key of the first element.
+	 * @param[in] to key of the first element, which is not visited.
+	 * @param[in] limit max number of visited elements.
+	 * @param[in] f function called for every visited element.
+	 *
+	 * @return number of visited elements.
+	 */
+	template <typename F>
+	size_type
+	scan(const key_type &from, const key_type &to, size_type limit,
+	     F f) const
+	{
+		return internal_scan(from, to, limit, f);
+	}
+
+	/**
+	 * Calls f(const_reference) for at most limit elements with keys not
+	 * less than from and less than to, in ascending order of keys. This
+	 * overload only participates in overload resolution if the
+	 * qualified-id Compare::is_transparent is valid and denotes a type.
+	 *
+	 * @param[in] from alternative value of the first key.
+	 * @param[in] to alternative value of the first key, which is not
+	 * visited.
+	 * @param[in] limit max number of visited elements.
+	 * @param[in] f function called for every visited element.
+	 *
+	 * @return number of visited elements.
+	 */
+	template <typename K, typename F,
+		  typename = typename std::enable_if<
+			  has_is_transparent<key_compare>::value, K>::type>
+	size_type
+	scan(const K &from, const K &to, size_type limit, F f) const
+	{
+		return internal_scan(from, to, limit, f);
+	}
+
 	/**
 	 * Returns the number of elements with key that compares equivalent to
 	 * the specified argument.
@@ -1982,6 +3076,8 @@ public:
 		persistent_node_ptr current = dummy_head->next(0);
 
 		obj::flat_transaction::run(pop, [&] {
+			rebuild_upper_levels_on_abort();
+
 			while (current) {
 				assert(current->height() > 0);
 				persistent_node_ptr next = current->next(0);
@@ -1989,12 +3085,19 @@ public:
 				current = next;
 			}
 
+			/* Levels in volatile memory are not valid if the skip
+			 * list was not initialized after restart */
 			node_ptr head = dummy_head.get();
-			for (size_type i = 0; i < head->height(); ++i) {
+			size_type height = this->upper_levels_valid()
+				? head->height()
+				: list_node_type::persistent_height(
+					  head->height());
+			for (size_type i = 0; i < height; ++i) {
 				head->set_next_tx(i, nullptr);
 			}
 
 			on_init_size = 0;
+			free_retired_nodes();
 			tls_data.clear();
 			obj::flat_transaction::snapshot((size_t *)&_size);
 			_size = 0;
@@ -2010,7 +3113,8 @@ public:
 	iterator
 	begin()
 	{
-		return iterator(dummy_head.get()->next(0).get());
+		iterator it(dummy_head.get());
+		return ++it;
 	}
 
 	/**
@@ -2022,7 +3126,8 @@ public:
 	const_iterator
 	begin() const
 	{
-		return const_iterator(dummy_head.get()->next(0).get());
+		const_iterator it(dummy_head.get());
+		return ++it;
 	}
 
 	/**
@@ -2034,7 +3139,7 @@ public:
 	const_iterator
 	cbegin() const
 	{
-		return const_iterator(dummy_head.get()->next(0).get());
+		return begin();
 	}
 
 	/**
@@ -2076,6 +3181,69 @@ public:
 		return const_iterator(nullptr);
 	}
 
+	/**
+	 * Returns a range over all elements of the container, which can be
+	 * split into subranges at nodes from upper levels of the skip list.
+	 *
+	 * @return Splittable range of all elements.
+	 */
+	range_type
+	range()
+	{
+		return range_type(dummy_head.get());
+	}
+
+	/**
+	 * Returns a range over all elements of the container, which can be
+	 * split into subranges at nodes from upper levels of the skip list.
+	 *
+	 * @return Splittable range of all elements.
+	 */
+	const_range_type
+	range() const
+	{
+		return const_range_type(dummy_head.get());
+	}
+
+	/**
+	 * Calls f for every element of the container, using num_threads
+	 * threads (including the calling one). The container is split into
+	 * subranges which are processed by threads in turns. Elements within
+	 * a subrange are visited in ascending order of keys.
+	 * Thread-safe with respect to concurrent insert, but not erase. If f
+	 * throws, remaining subranges are skipped and the first exception is
+	 * rethrown after all threads finish.
+	 *
+	 * @param[in] num_threads number of threads to use.
+	 * @param[in] f function object called with reference to an element.
+	 */
+	template <typename F>
+	void
+	parallel_for_each(size_type num_threads, F &&f)
+	{
+		internal_parallel_for_each(range(), num_threads, f);
+	}
+
+	/**
+	 * Calls f for every element of the container, using num_threads
+	 * threads (including the calling one). The container is split into
+	 * subranges which are processed by threads in turns. Elements within
+	 * a subrange are visited in ascending order of keys.
+	 * Thread-safe with respect to concurrent insert, but not erase. If f
+	 * throws, remaining subranges are skipped and the first exception is
+	 * rethrown after all threads finish.
+	 *
+	 * @param[in] num_threads number of threads to use.
+	 * @param[in] f function object called with const reference to an
+	 * element.
+	 */
+	template <typename F>
+	void
+	parallel_for_each(size_type num_threads, F &&f) const
+	{
+		internal_parallel_for_each(range(), num_threads, f);
+	}
+
 	/**
 	 * Returns the number of elements in the container, i.e.
 	 * std::distance(begin(), end()).
@@ -2285,25 +3453,34 @@ public:
 		return _compare;
 	}
 
-private:
+protected:
 	/* Status flags stored in insert_stage field */
 	enum insert_stage_type : uint8_t { not_started = 0, in_progress = 1 };
 	/*
 	 * Structure of thread local data.
 	 * Size should be 64 bytes.
+	 *
+	 * retired is a list (linked by retired_next) of nodes erased by the
+	 * thread, which are not freed yet, starting from the last erased one.
+	 * It is placed after insert_stage, so offsets of the other fields are
+	 * the same as in skip lists without thread-safe erase.
 	 */
 	struct tls_entry_type {
 		persistent_node_ptr ptr;
 		obj::p<difference_type> size_diff;
 		obj::p<insert_stage_type> insert_stage;
+		persistent_node_ptr retired;
 
+		/* insert_stage is padded up to alignment of retired */
 		char reserved[64 - sizeof(decltype(ptr)) -
 			      sizeof(decltype(size_diff)) -
-			      sizeof(decltype(insert_stage))];
+			      alignof(decltype(retired)) -
+			      sizeof(decltype(retired))];
 	};
 	static_assert(sizeof(tls_entry_type) == 64,
 		      "The size of tls_entry_type should be 64 bytes.");
 
+private:
 	/**
 	 * Private helper function. Checks if current transaction stage is equal
 	 * to TX_STAGE_WORK and throws an exception otherwise.
@@ -2336,9 +3513,75 @@ private:
 
 		_size = 0;
 		on_init_size = 0;
+		layout_version = current_layout_version;
+		this->init_upper_levels_state();
+		init_epochs();
 		create_dummy_head();
 	}
 
+	/**
+	 * Checks if the skip list was created with the layout used by this
+	 * version of libpmemobj-cpp.
+	 *
+	 * @throw pmem::layout_error if the layouts are different.
+	 */
+	void
+	check_layout_version() const
+	{
+		if (layout_version != current_layout_version)
+			throw pmem::layout_error(
+				"Layout version mismatch, for more details go to: https://pmem.io/pmdk/cpp_obj/ \n");
+	}
+
+	/**
+	 * Epochs of threads are bound to the skip list and owned by the pool,
+	 * like levels in volatile memory. The pointer to them is cached in a
+	 * v<> property, so it is null in each new run of the application,
+	 * until runtime_initialize() is called. It stays null if
+	 * epoch_reclamation is false.
+	 */
+	void
+	init_epochs()
+	{
+		if (!epoch_reclamation)
+			return;
+
+		pool_data *data = static_cast<pool_data *>(
+			pmemobj_get_user_data(pmemobj_pool_by_ptr(this)));
+		assert(data != nullptr);
+
+		epochs.get() = data->template get_volatile<skip_list_epochs>(
+			pmemobj_oid(&epochs).off);
+	}
+
+	/**
+	 * Destroys the epochs when the transaction is committed.
+	 * Should be called inside a transaction.
+	 */
+	void
+	destroy_epochs()
+	{
+		if (!epoch_reclamation)
+			return;
+
+		pool_data *data = static_cast<pool_data *>(
+			pmemobj_get_user_data(pmemobj_pool_by_ptr(this)));
+		uint64_t off = pmemobj_oid(&epochs).off;
+
+		obj::flat_transaction::register_callback(
+			obj::flat_transaction::stage::oncommit,
+			[data, off] { data->destroy_volatile(off); });
+	}
+
+	skip_list_epochs *
+	get_epochs() const
+	{
+		skip_list_epochs *e = epochs.get();
+		assert(e != nullptr);
+
+		return e;
+	}
+
 	void
 	internal_move(concurrent_skip_list &&other)
 	{
@@ -2378,6 +3621,7 @@ private:
 	iterator
 	internal_find(const K &key)
 	{
+		epoch_guard guard(*this);
 		iterator it = lower_bound(key);
 		return (it == end() || _compare(key, traits_type::get_key(*it)))
 			? end()
@@ -2388,6 +3632,7 @@ private:
 	const_iterator
 	internal_find(const K &key) const
 	{
+		epoch_guard guard(*this);
 		const_iterator it = lower_bound(key);
 		return (it == end() || _compare(key, traits_type::get_key(*it)))
 			? end()
@@ -2398,6 +3643,7 @@ private:
 	size_type
 	internal_count(const K &key) const
 	{
+		epoch_guard guard(*this);
 		if (allow_multimapping) {
 			std::pair<const_iterator, const_iterator> range =
 				equal_range(key);
@@ -2416,6 +3662,11 @@ private:
 	 *  (_compare member is default comparator)
 	 * @returns pointer to the node which is not satisfy the comparison with
 	 * @arg key
+	 *
+	 * Erased nodes are passed, but never become @arg prev, so the search
+	 * does not descend from a node which is being unlinked. Therefore,
+	 * prev->next(level) may differ from the returned pointer while an
+	 * erase is in progress.
 	 */
 	template <typename K, typename pointer_type, typename comparator>
 	persistent_node_ptr
@@ -2427,9 +3678,10 @@ private:
 		pointer_type curr = next.get();
 
 		while (curr && cmp(get_key(curr), key)) {
-			prev = curr;
-			assert(level < prev->height());
-			next = prev->next(level);
+			if (!curr->erased())
+				prev = curr;
+			assert(level < curr->height());
+			next = curr->next(level);
 			curr = next.get();
 		}
 
@@ -2546,6 +3798,8 @@ private:
 		}
 
 		assert(tls_entry.ptr == nullptr);
+		reclaim_retired_nodes(tls_entry);
+
 		return insert_result;
 	}
 
@@ -2622,6 +3876,7 @@ private:
 			});
 
 		assert(tls_entry.ptr == nullptr);
+		reclaim_retired_nodes(tls_entry);
 
 		return insert_result;
 	}
@@ -2634,6 +3889,7 @@ private:
 	internal_insert_node(const K &key, size_type height,
 			     PrepareNode &&prepare_new_node)
 	{
+		epoch_guard guard(*this);
 		prev_array_type prev_nodes;
 		next_array_type next_nodes;
 		node_ptr n = nullptr;
@@ -2641,8 +3897,10 @@ private:
 		do {
 			find_insert_pos(prev_nodes, next_nodes, key);
 
+			/* The new node is inserted before an erased node with
+			 * the same key */
 			node_ptr next = next_nodes[0].get();
-			if (next && !allow_multimapping &&
+			if (next && !allow_multimapping && !next->erased() &&
 			    !_compare(key, get_key(next))) {
 
 				return std::pair<iterator, bool>(iterator(next),
@@ -2671,8 +3929,19 @@ private:
 	{
 		assert(dummy_head->height() >= height);
 
-		lock_array locks;
-		if (!try_lock_nodes(height, prev_nodes, next_nodes, locks)) {
+		/*
+		 * Only the predecessor on level 0 is locked. Position of the
+		 * new node on level 0 decides whether it is inserted, upper
+		 * levels are linked afterwards with CAS (see link_level).
+		 */
+		assert(check_prev_array(prev_nodes, height));
+
+		node_lock_type prev_lock = prev_nodes[0]->acquire();
+		if (prev_nodes[0]->erased() ||
+		    prev_nodes[0]->next(0) != next_nodes[0]) {
+			/* Other thread inserted to or erased from this position
+			 * and modified the pointer before we acquired the lock
+			 */
 			return nullptr;
 		}
 
@@ -2683,31 +3952,31 @@ private:
 		node_ptr n = new_node.get();
 
 		/*
-		 * We need to hold lock to the new node until changes
-		 * are committed to persistent domain. Otherwise, the
-		 * new node would be visible to concurrent inserts
-		 * before it is persisted.
+		 * We need to hold lock to the new node until it is linked
+		 * on level 0 and the link is committed to persistent domain.
+		 * Otherwise, the new node would be visible to concurrent
+		 * inserts before it is persisted. The lock is held until all
+		 * levels are linked, so the node is not erased before.
 		 */
 		new_node_lock = n->acquire();
 
 		obj::pool_base pop = get_pool_base();
+
+		assert(prev_nodes[0]->next(0) == next_nodes[0]);
+		assert(prev_nodes[0]->next(0) == n->next(0));
+		prev_nodes[0]->set_next(pop, 0, new_node);
+
+		prev_lock.unlock();
+
 		/*
-		 * In the loop below we are linking a new node to all layers of
-		 * the skip list. Transaction is not required because in case of
-		 * failure the node is reachable via a pointer from persistent
-		 * TLS. During recovery, we will complete the insert. It is also
-		 * OK if concurrent readers will see not a fully-linked node
-		 * because during recovery the insert procedure will be
-		 * completed.
+		 * Transaction is not required to link the upper levels because
+		 * in case of failure the node is reachable via a pointer from
+		 * persistent TLS. During recovery, upper levels are rebuilt.
+		 * It is also OK if concurrent readers will see not a
+		 * fully-linked node, as upper levels only speed up the search.
 		 */
-		for (size_type level = 0; level < height; ++level) {
-			assert(prev_nodes[level]->height() > level);
-			assert(prev_nodes[level]->next(level) ==
-			       next_nodes[level]);
-			assert(prev_nodes[level]->next(level) ==
-			       n->next(level));
-			prev_nodes[level]->set_next(pop, level, new_node);
-		}
+		for (size_type level = 1; level < height; ++level)
+			link_level(pop, prev_nodes[level], n, level);
 
 #ifndef NDEBUG
 		try_insert_node_finish_marker();
@@ -2724,10 +3993,90 @@ private:
 		VALGRIND_PMC_DO_FLUSH(&_size, sizeof(_size));
 #endif
 
+		new_node_lock.unlock();
+
 		assert(n);
 		return n;
 	}
 
+	/**
+	 * Links node @arg n, which is already linked on level 0, on the
+	 * @arg level > 0 after @arg prev using CAS. If the successor of prev
+	 * changed, the position is searched again starting from prev. Erased
+	 * nodes between prev and the position are unlinked by the same CAS,
+	 * as their erase might have missed them on this level.
+	 *
+	 * If prev was erased concurrently, it might have been unlinked before
+	 * n was linked after it. In such case the position is searched again
+	 * from the head, unless n is already reachable on the level.
+	 *
+	 * The link is persisted before the insert completes, so the level
+	 * may be incomplete after a crash only if an insert was in
+	 * progress, which makes tls_restore rebuild upper levels.
+	 */
+	void
+	link_level(obj::pool_base &pop, node_ptr prev, node_ptr n,
+		   size_type level)
+	{
+		assert(level > 0 && level < n->height());
+
+		persistent_node_ptr node = n;
+		size_type from = level + 1;
+
+		for (;;) {
+			persistent_node_ptr next = find_level_position(
+				prev, from, level, get_key(n));
+			if (prev == n || next == node)
+				return;
+
+			persistent_node_ptr expected = prev->next(level);
+			if (!erased_until(expected.get(), next.get(), level))
+				continue;
+
+			/* The node is not reachable on this level yet */
+			n->set_next(pop, level, next);
+
+			if (!prev->cas_next(level, expected, node))
+				continue;
+
+			prev->persist_next(pop, level);
+
+			/* Pairs with the fence in erase_node */
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!prev->erased())
+				return;
+
+			prev = dummy_head.get();
+			from = prev->height();
+		}
+	}
+
+	/**
+	 * Finds position of @arg key on the @arg level, descending from
+	 * @arg prev on levels below @arg from.
+	 * @returns successor of the position, prev is set to the predecessor.
+	 */
+	template <typename K>
+	persistent_node_ptr
+	find_level_position(node_ptr &prev, size_type from, size_type level,
+			    const K &key)
+	{
+		assert(from <= prev->height());
+		persistent_node_ptr next = nullptr;
+
+		for (size_type h = from; h > level; --h) {
+			if (allow_multimapping)
+				next = internal_find_position(
+					h - 1, prev, key,
+					not_greater_compare(_compare));
+			else
+				next = internal_find_position(h - 1, prev, key,
+							      _compare);
+		}
+
+		return next;
+	}
+
 	/**
 	 * Used only inside asserts.
 	 * Checks that prev_array is filled with correct values.
@@ -2748,28 +4097,6 @@ private:
 		return true;
 	}
 
-	bool
-	try_lock_nodes(size_type height, prev_array_type &prevs,
-		       const next_array_type &nexts, lock_array &locks)
-	{
-		assert(check_prev_array(prevs, height));
-
-		for (size_type l = 0; l < height; ++l) {
-			if (l == 0 || prevs[l] != prevs[l - 1]) {
-				locks[l] = prevs[l]->acquire();
-			}
-
-			persistent_node_ptr next = prevs[l]->next(l);
-			if (next != nexts[l])
-				/* Other thread inserted to this position and
-				 * modified the pointer before we acquired the
-				 * lock */
-				return false;
-		}
-
-		return true;
-	}
-
 	/**
 	 * Returns an iterator pointing to the first element from the list for
 	 * which cmp(element, key) is false.
@@ -2785,6 +4112,7 @@ private:
 	const_iterator
 	internal_get_bound(const K &key, const comparator &cmp) const
 	{
+		epoch_guard guard(*this);
 		const_node_ptr prev = dummy_head.get();
 		assert(prev->height() > 0);
 		persistent_node_ptr next = nullptr;
@@ -2793,7 +4121,113 @@ private:
 			next = internal_find_position(h - 1, prev, key, cmp);
 		}
 
-		return const_iterator(next.get());
+		const_node_ptr n = next.get();
+		while (n != nullptr && n->erased())
+			n = n->next(0).get();
+
+		return const_iterator(n);
+	}
+
+	template <typename K, typename F>
+	size_type
+	internal_scan(const K &from, const K &to, size_type limit, F &f) const
+	{
+		epoch_guard guard(*this);
+		const_node_ptr n = internal_get_bound(from, _compare).node;
+		size_type visited = 0;
+
+		/* Runs up to scan_prefetch_distance nodes ahead of n, nodes
+		 * past the limit are not prefetched */
+		const_node_ptr ahead = n;
+		size_type prefetched = 0;
+		while (ahead != nullptr && prefetched < limit &&
+		       prefetched < size_type(scan_prefetch_distance)) {
+			ahead = scan_prefetch(ahead);
+			++prefetched;
+		}
+
+		for (; n != nullptr && visited < limit; n = n->next(0).get()) {
+			if (ahead != nullptr && prefetched < limit) {
+				ahead = scan_prefetch(ahead);
+				++prefetched;
+			}
+
+			if (n->erased())
+				continue;
+
+			if (!_compare(get_key(n), to))
+				break;
+
+			f(*n->get());
+			++visited;
+		}
+
+		return visited;
+	}
+
+	template <typename Range, typename F>
+	static void
+	internal_parallel_for_each(Range r, size_type num_threads, F &f)
+	{
+		num_threads = (std::max)(size_type(1), num_threads);
+
+		/* Several subranges per thread balance the load between
+		 * threads */
+		std::vector<Range> ranges;
+		ranges.reserve(8 * num_threads);
+		ranges.push_back(r);
+
+		bool divisible = true;
+		while (divisible && ranges.size() < 4 * num_threads) {
+			divisible = false;
+
+			for (size_type i = 0, n = ranges.size(); i < n; ++i) {
+				if (ranges[i].is_divisible()) {
+					ranges.emplace_back(ranges[i],
+							    obj::split());
+					divisible = true;
+				}
+			}
+		}
+
+		std::atomic<size_type> next(0);
+
+		num_threads = (std::min)(num_threads, ranges.size());
+
+		detail::run_in_threads(
+			num_threads,
+			[&](size_type) {
+				for (size_type i = next++; i < ranges.size();
+				     i = next++) {
+					for (auto &v : ranges[i])
+						f(v);
+				}
+			},
+			[&] { next = ranges.size(); });
+	}
+
+	/**
+	 * Prefetches the next node of n on level 0 and its successors on
+	 * levels below scan_prefetch_height.
+	 *
+	 * @return next node of n on level 0.
+	 */
+	static const_node_ptr
+	scan_prefetch(const_node_ptr n)
+	{
+		size_type height = (std::min)(n->height(),
+					      size_type(scan_prefetch_height));
+
+		for (size_type level = 0; level < height; ++level) {
+			const_node_ptr next = n->next(level).get();
+			if (next == nullptr)
+				break;
+
+			detail::prefetch(next);
+			detail::prefetch(next->get());
+		}
+
+		return n->next(0).get();
 	}
 
 	/**
@@ -2811,44 +4245,215 @@ private:
 	iterator
 	internal_get_bound(const K &key, const comparator &cmp)
 	{
+		epoch_guard guard(*this);
 		node_ptr prev = dummy_head.get();
 		assert(prev->height() > 0);
 		persistent_node_ptr next = nullptr;
 
-		for (size_type h = prev->height(); h > 0; --h) {
-			next = internal_find_position(h - 1, prev, key, cmp);
+		for (size_type h = prev->height(); h > 0; --h) {
+			next = internal_find_position(h - 1, prev, key, cmp);
+		}
+
+		node_ptr n = next.get();
+		while (n != nullptr && n->erased())
+			n = n->next(0).get();
+
+		return iterator(n);
+	}
+
+	/**
+	 * Returns an iterator pointing to the last element from the list for
+	 * which cmp(element, key) is true.
+	 *
+	 * @param[in] key key value to compare the elements to.
+	 * @param[in] cmp comparator functor used for the search.
+	 *
+	 * @return Iterator pointing to the first element for which
+	 * cmp(element, key) is false. If no such element is found, a
+	 * past-the-end iterator is returned.
+	 */
+	template <typename K, typename comparator>
+	const_iterator
+	internal_get_biggest_less_than(const K &key,
+				       const comparator &cmp) const
+	{
+		epoch_guard guard(*this);
+		const_node_ptr prev = dummy_head.get();
+		assert(prev->height() > 0);
+
+		for (size_type h = prev->height(); h > 0; --h) {
+			internal_find_position(h - 1, prev, key, cmp);
+		}
+
+		if (prev == dummy_head.get())
+			return end();
+
+		return const_iterator(prev);
+	}
+
+	template <typename K>
+	size_type
+	internal_concurrent_erase(const K &key)
+	{
+		check_outside_tx();
+		tls_entry_type &tls_entry = tls_data.local();
+		size_type count = 0;
+
+		{
+			epoch_guard guard(*this);
+
+			do {
+				iterator it = internal_find(key);
+				if (it == end())
+					break;
+
+				/* The node might have been erased by other
+				 * thread */
+				if (erase_node(tls_entry, it.node))
+					++count;
+			} while (allow_multimapping || count == 0);
+		}
+
+		reclaim_retired_nodes(tls_entry);
+
+		return count;
+	}
+
+	/**
+	 * Erases node @arg n in a thread-safe way.
+	 *
+	 * The node is added to the retired list of the thread in a
+	 * transaction, which makes the erase durable - on restart, all
+	 * retired nodes are unlinked and freed. Then the node is marked as
+	 * erased and unlinked from the top level down to level 0, each level
+	 * under the lock of the predecessor. Finally, the current global epoch
+	 * is recorded in the node, which can be freed two epochs later. If
+	 * epoch_reclamation is false, epoch 1 is recorded only to mark the
+	 * erase as completed.
+	 *
+	 * The lock of the node is held during the whole erase. Inserts hold
+	 * it until the node is linked on all levels and inserts after the
+	 * node need it, so the node is neither erased before it is fully
+	 * linked nor becomes a predecessor of a new node when it is erased.
+	 *
+	 * @returns false if the node was already erased.
+	 */
+	bool
+	erase_node(tls_entry_type &tls_entry, node_ptr n)
+	{
+		obj::pool_base pop = get_pool_base();
+
+		node_lock_type lock = n->acquire();
+		if (n->erased())
+			return false;
+
+		obj::flat_transaction::run(pop, [&] {
+			n->set_retired_next_tx(tls_entry.retired);
+			tls_entry.retired = n;
+			--tls_entry.size_diff;
+		});
+
+		n->set_erased();
+		--_size;
+
+		/* Pairs with the fence in link_level */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		/*
+		 * If other thread unlinked the node on a level, its unlink
+		 * might not be persisted yet, so the node has to be unlinked
+		 * again on restart.
+		 */
+		bool unlinked = true;
+		for (size_type level = n->height(); level > 0; --level) {
+			if (!unlink_level(pop, n, level - 1) &&
+			    list_node_type::is_persistent_level(level - 1))
+				unlinked = false;
+		}
+
+		uint64_t retire_epoch =
+			epoch_reclamation ? get_epochs()->retire_epoch() : 1;
+		n->set_retired(pop, retire_epoch, unlinked);
+
+		return true;
+	}
+
+	/**
+	 * Unlinks erased node @arg n on the @arg level, together with other
+	 * erased nodes between n and its predecessor. Pointers of erased
+	 * nodes on level 0 do not change, as they are not used as
+	 * predecessors.
+	 *
+	 * The node might not be reachable if it was unlinked together with
+	 * other erased node.
+	 *
+	 * @returns true if the node was unlinked by this call.
+	 */
+	bool
+	unlink_level(obj::pool_base &pop, node_ptr n, size_type level)
+	{
+		for (;;) {
+			node_ptr prev = find_prev(n, level);
+			if (prev == nullptr)
+				return false;
+
+			node_lock_type prev_lock = prev->acquire();
+			if (prev->erased())
+				continue;
+
+			persistent_node_ptr first = prev->next(level);
+			if (!erased_until(first.get(), n, level))
+				continue;
+
+			if (prev->cas_next(level, first, n->next(level))) {
+				prev->persist_next(pop, level);
+				return true;
+			}
+		}
+	}
+
+	/**
+	 * Checks if @arg n is reachable from @arg first on the @arg level
+	 * through erased nodes only.
+	 */
+	static bool
+	erased_until(node_ptr first, node_ptr n, size_type level)
+	{
+		for (node_ptr curr = first; curr != n;
+		     curr = curr->next(level).get()) {
+			if (curr == nullptr || !curr->erased())
+				return false;
 		}
 
-		return iterator(next.get());
+		return true;
 	}
 
 	/**
-	 * Returns an iterator pointing to the last element from the list for
-	 * which cmp(element, key) is true.
-	 *
-	 * @param[in] key key value to compare the elements to.
-	 * @param[in] cmp comparator functor used for the search.
-	 *
-	 * @return Iterator pointing to the first element for which
-	 * cmp(element, key) is false. If no such element is found, a
-	 * past-the-end iterator is returned.
+	 * Finds the predecessor of node @arg n on the @arg level.
+	 * @returns nullptr if n is not reachable on the level.
 	 */
-	template <typename K, typename comparator>
-	const_iterator
-	internal_get_biggest_less_than(const K &key,
-				       const comparator &cmp) const
+	node_ptr
+	find_prev(node_ptr n, size_type level)
 	{
-		const_node_ptr prev = dummy_head.get();
-		assert(prev->height() > 0);
+		const key_type &key = get_key(n);
+		node_ptr prev = dummy_head.get();
+		persistent_node_ptr next = nullptr;
 
-		for (size_type h = prev->height(); h > 0; --h) {
-			internal_find_position(h - 1, prev, key, cmp);
-		}
+		for (size_type h = prev->height(); h > level; --h)
+			next = internal_find_position(h - 1, prev, key,
+						      _compare);
 
-		if (prev == dummy_head.get())
-			return end();
+		/* Pass other nodes with the same key */
+		while (next.get() != n) {
+			if (!next || _compare(key, get_key(next.get())))
+				return nullptr;
 
-		return const_iterator(prev);
+			if (!next->erased())
+				prev = next.get();
+			next = next->next(level);
+		}
+
+		return prev;
 	}
 
 	iterator
@@ -2915,6 +4520,9 @@ private:
 	{
 		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 		assert(erase_node != nullptr);
+
+		rebuild_upper_levels_on_abort();
+
 		for (size_type level = 0; level < erase_node->height();
 		     ++level) {
 			assert(prev_nodes[level]->height() > level);
@@ -2954,6 +4562,8 @@ private:
 		prev_nodes.fill(dummy_head.get());
 		size_type sz = 0;
 
+		rebuild_upper_levels_on_abort();
+
 		for (; first != last; ++first, ++sz) {
 			persistent_node_ptr new_node = create_node(*first);
 			node_ptr n = new_node.get();
@@ -2979,6 +4589,130 @@ private:
 			}));
 	}
 
+	template <typename Iterator>
+	size_type
+	internal_bulk_insert_sorted(Iterator first, Iterator last)
+	{
+		obj::pool_base pop = get_pool_base();
+
+		prev_array_type prev_nodes;
+		prev_nodes.fill(dummy_head.get());
+		size_type inserted = 0;
+
+		while (first != last) {
+			obj::flat_transaction::run(pop, [&] {
+				size_type batch_inserted = 0;
+
+				rebuild_upper_levels_on_abort();
+
+				for (size_type i = 0;
+				     first != last && i < bulk_batch_size;
+				     ++first, ++i) {
+					size_type height = bulk_level(
+						inserted + batch_inserted + 1);
+
+					if (bulk_insert_node(prev_nodes,
+							     height, *first))
+						++batch_inserted;
+				}
+
+				on_init_size += batch_inserted;
+				obj::flat_transaction::snapshot(
+					(size_type *)&_size);
+				_size += batch_inserted;
+
+				inserted += batch_inserted;
+			});
+		}
+
+		return inserted;
+	}
+
+	/**
+	 * Creates a node of the given height and links it after the nodes in
+	 * prev_nodes, which are moved forward to the position of the new
+	 * node on all its levels.
+	 *
+	 * @return false if the element was not inserted, because of a
+	 * duplicated key.
+	 *
+	 * @pre Should be called inside transaction.
+	 */
+	template <typename Arg>
+	bool
+	bulk_insert_node(prev_array_type &prev_nodes, size_type height,
+			 Arg &&arg)
+	{
+		persistent_node_ptr new_node = create_node(
+			std::forward_as_tuple(height),
+			std::forward_as_tuple(std::forward<Arg>(arg)));
+		node_ptr n = new_node.get();
+		const key_type &key = get_key(n);
+
+		/* Unsorted input: search from the head */
+		if (prev_nodes[0] != dummy_head.get() &&
+		    _compare(key, get_key(prev_nodes[0])))
+			prev_nodes.fill(dummy_head.get());
+
+		/* With multimapping, the node is linked after equal keys */
+		auto precedes = [&](node_ptr next) {
+			return allow_multimapping
+				? !_compare(key, get_key(next))
+				: _compare(get_key(next), key);
+		};
+
+		next_array_type next_nodes;
+		for (size_type level = height; level-- > 0;) {
+			/* The predecessor on the level above can be further */
+			node_ptr &prev = prev_nodes[level];
+			if (level + 1 < MAX_LEVEL &&
+			    (prev == dummy_head.get() ||
+			     (prev_nodes[level + 1] != dummy_head.get() &&
+			      _compare(get_key(prev),
+				       get_key(prev_nodes[level + 1])))))
+				prev = prev_nodes[level + 1];
+
+			node_ptr next = prev->next(level).get();
+			while (next != nullptr && precedes(next)) {
+				prev = next;
+				next = prev->next(level).get();
+			}
+
+			next_nodes[level] = next;
+		}
+
+		/* The key can be equal to the key of the previous element */
+		node_ptr prev = prev_nodes[0];
+		node_ptr next = next_nodes[0].get();
+		if (!allow_multimapping &&
+		    ((next != nullptr && !_compare(key, get_key(next))) ||
+		     (prev != dummy_head.get() &&
+		      !_compare(get_key(prev), key)))) {
+			delete_node(new_node);
+			return false;
+		}
+
+		n->set_nexts(next_nodes.data(), height);
+
+		for (size_type level = 0; level < height; ++level) {
+			prev_nodes[level]->set_next_tx(level, new_node);
+			prev_nodes[level] = n;
+		}
+
+		return true;
+	}
+
+	/** Height of the pos-th node inserted by bulk_insert_sorted */
+	static size_type
+	bulk_level(size_type pos)
+	{
+		size_type height = 1;
+		for (; height < MAX_LEVEL && pos % 2 == 0; pos /= 2)
+			++height;
+
+		return height;
+	}
+
 	/** Generate random level */
 	size_type
 	random_level()
@@ -2990,7 +4724,8 @@ private:
 	calc_node_size(size_type height)
 	{
 		return sizeof(list_node_type) +
-			height * sizeof(typename list_node_type::node_pointer);
+			list_node_type::persistent_height(height) *
+			sizeof(typename list_node_type::node_pointer);
 	}
 
 	/** Creates new node */
@@ -3077,8 +4812,16 @@ private:
 
 		assert(n != nullptr);
 
+		/* Levels in volatile memory are freed if allocation of the
+		 * node is rolled back */
+		auto *levels = this->allocate_upper_levels(height);
+		if (levels != nullptr)
+			obj::flat_transaction::register_callback(
+				obj::flat_transaction::stage::onabort,
+				this->upper_levels_deleter(levels, height));
+
 		node_allocator_traits::construct(_node_allocator, n.get(),
-						 height,
+						 height, levels,
 						 std::forward<Args>(args)...);
 
 		return n;
@@ -3092,6 +4835,17 @@ private:
 		node_ptr n = node.get();
 		size_type sz = calc_node_size(n->height());
 
+		/* Levels in volatile memory are freed when deallocation of the
+		 * node is committed. They are not valid if the skip list was
+		 * not initialized after restart. */
+		auto *levels = this->upper_levels_valid() ? n->upper_levels()
+							  : nullptr;
+		if (levels != nullptr)
+			obj::flat_transaction::register_callback(
+				obj::flat_transaction::stage::oncommit,
+				this->upper_levels_deleter(levels,
+							   n->height()));
+
 		/* Destroy value */
 		if (!is_dummy)
 			node_allocator_traits::destroy(_node_allocator,
@@ -3132,13 +4886,31 @@ private:
 			const_cast<typename iterator::node_ptr>(it.node));
 	}
 
-	/** Process any information which was saved to tls and clears tls */
+	/**
+	 * Process any information which was saved to tls and clears tls.
+	 *
+	 * @param[in] allocate_levels true if levels in volatile memory have to
+	 * be allocated for all nodes.
+	 * @param[in] num_threads maximal number of threads used to rebuild
+	 * the levels.
+	 */
 	void
-	tls_restore()
+	tls_restore(bool allocate_levels, size_type num_threads)
 	{
 		int64_t last_run_size = 0;
+		bool insert_interrupted = false;
 		obj::pool_base pop = get_pool_base();
 
+		/*
+		 * Erases which were in progress are completed before inserts,
+		 * so the inserted nodes are linked between live nodes. Nodes,
+		 * which were durably unlinked by their erase, are only freed.
+		 */
+		bool erased = has_retired_nodes(
+			[](node_ptr n) { return !n->unlinked(); });
+		if (erased)
+			unlink_retired_nodes();
+
 		for (auto &tls_entry : tls_data) {
 			persistent_node_ptr &node = tls_entry.ptr;
 			auto &size_diff = tls_entry.size_diff;
@@ -3155,6 +4927,7 @@ private:
 				 */
 				if (tls_entry.insert_stage == in_progress) {
 					complete_insert(tls_entry);
+					insert_interrupted = true;
 				} else {
 					obj::flat_transaction::run(pop, [&] {
 						--(tls_entry.size_diff);
@@ -3169,11 +4942,15 @@ private:
 			last_run_size += size_diff;
 		}
 
+		if (allocate_levels || insert_interrupted || erased)
+			rebuild_upper_levels(num_threads, allocate_levels);
+
 		/* Make sure that on_init_size + last_run_size >= 0 */
 		assert(last_run_size >= 0 ||
 		       on_init_size >
 			       static_cast<size_type>(std::abs(last_run_size)));
 		obj::flat_transaction::run(pop, [&] {
+			free_retired_nodes();
 			tls_data.clear();
 			on_init_size += static_cast<size_t>(last_run_size);
 		});
@@ -3183,6 +4960,10 @@ private:
 #endif
 	}
 
+	/**
+	 * Links the node from tls on level 0, if it is not linked yet. Upper
+	 * levels are rebuilt afterwards by rebuild_upper_levels().
+	 */
 	void
 	complete_insert(tls_entry_type &tls_entry)
 	{
@@ -3193,29 +4974,334 @@ private:
 		next_array_type next_nodes;
 		node_ptr n = node.get();
 		const key_type &key = get_key(n);
-		size_type height = n->height();
 
 		fill_prev_next_arrays(prev_nodes, next_nodes, key, _compare);
 		obj::pool_base pop = get_pool_base();
 
-		/* Node was partially linked */
-		for (size_type level = 0; level < height; ++level) {
-			assert(prev_nodes[level]->height() > level);
-			assert(prev_nodes[level]->next(level) ==
-			       next_nodes[level]);
-
-			if (prev_nodes[level]->next(level) != node) {
-				/* Otherwise, node already linked on
-				 * this layer */
-				assert(n->next(level) == next_nodes[level]);
-				prev_nodes[level]->set_next(pop, level, node);
-			}
+		assert(prev_nodes[0]->next(0) == next_nodes[0]);
+
+		if (prev_nodes[0]->next(0) != node) {
+			/* Otherwise, node already linked on level 0. The old
+			 * successor might have been erased. */
+			n->set_next(pop, 0, next_nodes[0]);
+			prev_nodes[0]->set_next(pop, 0, node);
 		}
 
 		node = nullptr;
 		pop.persist(&node, sizeof(node));
 	}
 
+	/**
+	 * Links all nodes on levels above 0 again, in the order of level 0.
+	 * Upper levels are linked with CAS after level 0, so they may miss
+	 * nodes after a crash during an insert.
+	 *
+	 * With more than one thread, nodes are collected from level 0 first
+	 * and split into parts. Each thread links nodes of its part and the
+	 * parts are joined afterwards.
+	 *
+	 * @param[in] num_threads maximal number of threads.
+	 * @param[in] allocate_levels true if levels in volatile memory have to
+	 * be allocated for all nodes.
+	 */
+	void
+	rebuild_upper_levels(size_type num_threads = 1,
+			     bool allocate_levels = false)
+	{
+		obj::pool_base pop = get_pool_base();
+
+		prev_array_type last;
+		last.fill(dummy_head.get());
+
+		if (num_threads < 2) {
+			for (node_ptr n = dummy_head->next(0).get();
+			     n != nullptr; n = n->next(0).get()) {
+				if (allocate_levels)
+					allocate_node_upper_levels(n);
+
+				for (size_type l = 1; l < n->height(); ++l) {
+					relink(pop, last[l], l, n);
+					last[l] = n;
+				}
+			}
+		} else {
+			rebuild_upper_levels_parts(pop, last, num_threads,
+						   allocate_levels);
+		}
+
+		for (size_type l = 1; l < dummy_head->height(); ++l)
+			relink(pop, last[l], l, nullptr);
+	}
+
+	/**
+	 * Links nodes on levels above 0 using up to num_threads threads.
+	 * Stores the last node of each level in last.
+	 */
+	void
+	rebuild_upper_levels_parts(obj::pool_base &pop, prev_array_type &last,
+				   size_type num_threads, bool allocate_levels)
+	{
+		/* Nodes of height 1 are not linked on levels above 0 */
+		std::vector<node_ptr> nodes;
+		for (node_ptr n = dummy_head->next(0).get(); n != nullptr;
+		     n = n->next(0).get()) {
+			if (n->height() > 1)
+				nodes.push_back(n);
+			else if (allocate_levels)
+				n->set_upper_levels(nullptr);
+		}
+
+		num_threads = (std::max)(
+			size_type(1),
+			(std::min)(num_threads,
+				   nodes.size() / rebuild_min_part_size));
+
+		std::vector<prev_array_type> firsts(num_threads);
+		std::vector<prev_array_type> lasts(num_threads);
+
+		detail::run_in_threads(num_threads, [&](size_type t) {
+			prev_array_type &first = firsts[t];
+			prev_array_type &part_last = lasts[t];
+			first.fill(nullptr);
+			part_last.fill(nullptr);
+
+			size_type size = nodes.size();
+			size_type begin = size * t / num_threads;
+			size_type end = size * (t + 1) / num_threads;
+
+			for (size_type i = begin; i < end; ++i) {
+				node_ptr n = nodes[i];
+				if (allocate_levels)
+					allocate_node_upper_levels(n);
+
+				for (size_type l = 1; l < n->height(); ++l) {
+					if (part_last[l] == nullptr)
+						first[l] = n;
+					else
+						relink(pop, part_last[l], l, n);
+					part_last[l] = n;
+				}
+			}
+		});
+
+		/* Joins the parts in order */
+		for (size_type t = 0; t < num_threads; ++t) {
+			for (size_type l = 1; l < MAX_LEVEL; ++l) {
+				if (firsts[t][l] == nullptr)
+					continue;
+
+				relink(pop, last[l], l, firsts[t][l]);
+				last[l] = lasts[t][l];
+			}
+		}
+	}
+
+	/** Sets next node of prev on the level, if it is different */
+	static void
+	relink(obj::pool_base &pop, node_ptr prev, size_type level,
+	       node_ptr next)
+	{
+		if (prev->next(level).get() != next)
+			prev->set_next(pop, level, next);
+	}
+
+	/**
+	 * Levels in volatile memory are not valid after restart. Pointers to
+	 * them are reset in nodes which might not be reachable on level 0 and
+	 * levels of the head are allocated again. Levels of other nodes are
+	 * allocated when the levels are rebuilt.
+	 *
+	 * @return true if levels of nodes have to be allocated.
+	 */
+	bool
+	restore_upper_levels()
+	{
+		if (!volatile_upper_levels || this->upper_levels_valid())
+			return false;
+
+		for (auto &tls_entry : tls_data) {
+			if (tls_entry.ptr != nullptr)
+				tls_entry.ptr->set_upper_levels(nullptr);
+
+			for (node_ptr n = tls_entry.retired.get(); n != nullptr;
+			     n = n->retired_next().get())
+				n->set_upper_levels(nullptr);
+		}
+
+		this->init_upper_levels_state();
+		allocate_node_upper_levels(dummy_head.get());
+
+		return true;
+	}
+
+	void
+	allocate_node_upper_levels(node_ptr n)
+	{
+		n->set_upper_levels(this->allocate_upper_levels(n->height()));
+	}
+
+	/**
+	 * Levels in volatile memory are not snapshotted. If the transaction
+	 * is aborted, they are rebuilt from level 0, which is rolled back.
+	 * Should be called inside a transaction.
+	 */
+	void
+	rebuild_upper_levels_on_abort()
+	{
+		if (!volatile_upper_levels || !this->upper_levels_valid())
+			return;
+
+		obj::flat_transaction::register_callback(
+			obj::flat_transaction::stage::onabort,
+			[this] { rebuild_upper_levels(); });
+	}
+
+	bool
+	has_retired_nodes()
+	{
+		for (auto &tls_entry : tls_data) {
+			if (tls_entry.retired != nullptr)
+				return true;
+		}
+
+		return false;
+	}
+
+	/** @return true if pred is true for any retired node */
+	template <typename Pred>
+	bool
+	has_retired_nodes(Pred pred)
+	{
+		for (auto &tls_entry : tls_data) {
+			for (node_ptr n = tls_entry.retired.get(); n != nullptr;
+			     n = n->retired_next().get()) {
+				if (pred(n))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Marks all retired nodes as erased and unlinks them on level 0.
+	 * Used on restart, as erases might have been interrupted. Upper levels
+	 * should be rebuilt afterwards.
+	 */
+	void
+	unlink_retired_nodes()
+	{
+		obj::pool_base pop = get_pool_base();
+
+		for (auto &tls_entry : tls_data) {
+			for (node_ptr n = tls_entry.retired.get(); n != nullptr;
+			     n = n->retired_next().get())
+				n->set_erased();
+		}
+
+		node_ptr prev = dummy_head.get();
+		for (persistent_node_ptr next = prev->next(0); next;) {
+			if (next->erased()) {
+				next = next->next(0);
+				prev->set_next(pop, 0, next);
+			} else {
+				prev = next.get();
+				next = prev->next(0);
+			}
+		}
+	}
+
+	/**
+	 * Frees nodes from the retired list of the calling thread, which no
+	 * other thread can access anymore. It is done only once in a number
+	 * of inserts and erases of the thread, so that the global epoch can
+	 * advance in the meantime and the nodes are freed in batches.
+	 *
+	 * Should be called outside of a transaction, without an epoch_guard.
+	 * Does nothing if epoch_reclamation is false.
+	 */
+	void
+	reclaim_retired_nodes(tls_entry_type &tls_entry)
+	{
+		if (!epoch_reclamation)
+			return;
+
+		skip_list_epochs *e = get_epochs();
+		if (!e->tick() || tls_entry.retired == nullptr)
+			return;
+
+		uint64_t global = e->try_advance();
+
+		/* Retire epochs do not increase along the list, so nodes after
+		 * the first one which can be freed can be freed too, except
+		 * for nodes whose erase did not complete */
+		node_ptr kept = nullptr;
+		persistent_node_ptr first = tls_entry.retired;
+		while (first != nullptr &&
+		       !e->can_free(first->retire_epoch(), global)) {
+			kept = first.get();
+			first = first->retired_next();
+		}
+
+		if (first == nullptr)
+			return;
+
+		obj::pool_base pop = get_pool_base();
+		obj::flat_transaction::run(pop, [&] {
+			persistent_node_ptr next = nullptr;
+			for (; first != nullptr; first = next) {
+				next = first->retired_next();
+
+				if (first->retire_epoch() != 0) {
+					delete_node(first);
+					continue;
+				}
+
+				/* Such nodes stay on the list until
+				 * unsafe_reclaim() or restart */
+				link_retired(tls_entry, kept, first);
+				kept = first.get();
+			}
+
+			link_retired(tls_entry, kept, nullptr);
+		});
+	}
+
+	/**
+	 * Links node n after node prev on the retired list of tls_entry or
+	 * at the beginning of the list if prev is nullptr.
+	 * Should be called inside a transaction.
+	 */
+	void
+	link_retired(tls_entry_type &tls_entry, node_ptr prev,
+		     persistent_node_ptr n)
+	{
+		if (prev != nullptr) {
+			prev->set_retired_next_tx(n);
+		} else {
+			detail::conditional_add_to_tx(&tls_entry.retired);
+			tls_entry.retired = n;
+		}
+	}
+
+	/**
+	 * Frees nodes from the retired lists, which must not be reachable.
+	 * Should be called inside a transaction.
+	 */
+	void
+	free_retired_nodes()
+	{
+		assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+		for (auto &tls_entry : tls_data) {
+			while (tls_entry.retired != nullptr) {
+				persistent_node_ptr node = tls_entry.retired;
+				tls_entry.retired = node->retired_next();
+				delete_node(node);
+			}
+		}
+	}
+
 	struct not_greater_compare {
 		const key_compare &my_less_compare;
 
@@ -3232,6 +5318,33 @@ private:
 		}
 	};
 
+	enum rebuild_limits : size_type {
+		/* Minimal number of nodes linked by a thread in a rebuild */
+		rebuild_min_part_size = 4096
+	};
+
+	enum scan_limits : size_type {
+		/* Successors of a scanned node are prefetched on levels below
+		 * this one, i.e. up to about 2^3 nodes ahead */
+		scan_prefetch_height = 4,
+		/* Number of nodes the prefetching cursor runs ahead of the
+		 * scanned node */
+		scan_prefetch_distance = 8
+	};
+
+	/* "SKIPLST" followed by the version number. The version is
+	 * incremented when the layout of the skip list or its nodes changes */
+	enum layout_version_type : uint64_t {
+		current_layout_version = 0x534B49504C535401ULL
+	};
+
+	enum bulk_limits : size_type {
+		/* Max number of elements inserted in a transaction by
+		 * bulk_insert_sorted */
+		bulk_batch_size = 1024
+	};
+
+protected:
 	const uint64_t pool_uuid = pmemobj_oid(this).pool_uuid_lo;
 	node_allocator_type _node_allocator;
 	key_compare _compare;
@@ -3248,11 +5361,21 @@ private:
 	 * insert/remove).
 	 */
 	obj::p<size_type> on_init_size;
+
+	/**
+	 * Version of the layout of the skip list and its nodes, checked by
+	 * runtime_initialize(). Skip lists created by releases without
+	 * thread-safe erase do not have this field.
+	 */
+	obj::p<uint64_t> layout_version;
+
+	mutable obj::experimental::v<skip_list_epochs *> epochs;
 }; /* class concurrent_skip_list */
 
 template <typename Key, typename Value, typename KeyCompare,
 	  typename RND_GENERATOR, typename Allocator, bool AllowMultimapping,
-	  size_t MAX_LEVEL>
+	  size_t MAX_LEVEL, bool VolatileUpperLevels = false,
+	  bool EpochReclamation = false>
 class map_traits {
 public:
 	static constexpr size_t max_level = MAX_LEVEL;
@@ -3273,6 +5396,18 @@ public:
 	 */
 	constexpr static bool allow_multimapping = AllowMultimapping;
 
+	/**
+	 * If true, only level 0 of the skip list is stored in persistent
+	 * memory.
+	 */
+	constexpr static bool volatile_upper_levels = VolatileUpperLevels;
+
+	/**
+	 * If true, memory of erased nodes is freed while the skip list is in
+	 * use, so iterators stay valid only under an epoch_guard.
+	 */
+	constexpr static bool epoch_reclamation = EpochReclamation;
+
 	static const key_type &
 	get_key(const_reference val)
 	{
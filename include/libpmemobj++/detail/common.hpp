@@ -19,6 +19,10 @@
 #include <windows.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 #define POBJ_CPP_DEPRECATED __attribute__((deprecated))
 #elif defined(_MSC_VER)
@@ -106,6 +110,13 @@ namespace obj
 template <typename T>
 class persistent_ptr;
 
+/**
+ * Tag type which selects the splitting constructor of ranges, e.g.
+ * concurrent_hash_map::range_type. It plays the role of tbb::split.
+ */
+struct split {
+};
+
 /*! \namespace pmem::obj::experimental
  * \brief Experimental implementations.
  *
@@ -280,6 +291,49 @@ mssb_index64(uint64_t value)
 
 #endif
 
+/**
+ * Hints the processor to fetch the cache line containing @p addr.
+ * It is only a hint, no memory access is performed.
+ */
+static inline void
+prefetch(const void *addr)
+{
+#if _MSC_VER && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char *>(addr), _MM_HINT_T0);
+#elif __GNUC__ || __clang__
+	__builtin_prefetch(addr);
+#else
+	(void)addr;
+#endif
+}
+
+/**
+ * Compares each byte of @p word with @p byte.
+ *
+ * @returns mask with bit n set if n-th least significant byte of @p word
+ * is equal to @p byte.
+ */
+static inline unsigned
+match_bytes(uint64_t word, uint8_t byte)
+{
+#if (defined(__SSE2__) && defined(__x86_64__)) || defined(_M_X64)
+	__m128i cmp = _mm_cmpeq_epi8(
+		_mm_cvtsi64_si128(static_cast<long long>(word)),
+		_mm_set1_epi8(static_cast<char>(byte)));
+	return static_cast<unsigned>(_mm_movemask_epi8(cmp)) & 0xFFu;
+#else
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+	uint64_t x = word ^ (0x0101010101010101ULL * byte);
+
+	/* 0x80 in every byte of x which is zero, 0x00 in the others */
+	uint64_t zero = ~(((x & low7) + low7) | x | low7);
+
+	/* gather the top bits of all bytes in the most significant byte */
+	return static_cast<unsigned>(((zero >> 7) * 0x0102040810204080ULL) >>
+				     56);
+#endif
+}
+
 } /* namespace detail */
 
 } /* namespace pmem */
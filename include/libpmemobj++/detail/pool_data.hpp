@@ -4,14 +4,19 @@
 /**
  * @file
  * A volatile data stored along with pmemobjpool. Stores cleanup function which
- * is called on pool close.
+ * is called on pool close and volatile objects which are destroyed on pool
+ * close.
  */
 
 #ifndef LIBPMEMOBJ_CPP_POOL_DATA_HPP
 #define LIBPMEMOBJ_CPP_POOL_DATA_HPP
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace pmem
 {
@@ -40,8 +45,63 @@ struct pool_data {
 		}
 	}
 
+	/**
+	 * Returns volatile object of type T bound to the persistent object at
+	 * offset off. The object is created on the first call. Unlike
+	 * volatile_state, it can be called inside a transaction.
+	 */
+	template <typename T>
+	T *
+	get_volatile(uint64_t off)
+	{
+		std::lock_guard<std::mutex> lock(volatile_mutex);
+
+		auto it = volatile_objects.find(off);
+		if (it == volatile_objects.end()) {
+			auto deleter = [](void *data) {
+				delete static_cast<T *>(data);
+			};
+
+			it = volatile_objects
+				     .emplace(off, volatile_ptr(new T, deleter))
+				     .first;
+		}
+
+		return static_cast<T *>(it->second.get());
+	}
+
+	/**
+	 * @return volatile object bound to the persistent object at offset
+	 * off or nullptr if it does not exist.
+	 */
+	template <typename T>
+	T *
+	get_volatile_if_exists(uint64_t off)
+	{
+		std::lock_guard<std::mutex> lock(volatile_mutex);
+
+		auto it = volatile_objects.find(off);
+		return it == volatile_objects.end()
+			? nullptr
+			: static_cast<T *>(it->second.get());
+	}
+
+	/** Destroys volatile object bound to the persistent object at off */
+	void
+	destroy_volatile(uint64_t off)
+	{
+		std::lock_guard<std::mutex> lock(volatile_mutex);
+		volatile_objects.erase(off);
+	}
+
 	std::atomic<bool> initialized;
 	std::function<void()> cleanup;
+
+private:
+	using volatile_ptr = std::unique_ptr<void, void (*)(void *)>;
+
+	std::mutex volatile_mutex;
+	std::unordered_map<uint64_t, volatile_ptr> volatile_objects;
 };
 
 } /* namespace detail */
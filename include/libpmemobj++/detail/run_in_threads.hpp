@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Helper which runs a function in several threads, used by parallel
+ * operations of containers.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_RUN_IN_THREADS_HPP
+#define LIBPMEMOBJ_CPP_RUN_IN_THREADS_HPP
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+
+namespace detail
+{
+
+/**
+ * Calls worker(t) for each t in [0, num_threads): worker(0) in the
+ * calling thread and the others in new threads, and waits until all of
+ * them return.
+ *
+ * stop() is called when a worker throws or a thread cannot be started, so
+ * that the remaining workers can finish early. The exception is rethrown
+ * after all started threads are joined, if several workers throw, the one
+ * with the lowest t is rethrown.
+ *
+ * @throw std::system_error if a thread could not be started.
+ * @throw rethrows exception thrown by worker.
+ */
+template <typename Worker, typename Stop>
+void
+run_in_threads(std::size_t num_threads, Worker worker, Stop stop)
+{
+	if (num_threads == 0)
+		return;
+
+	std::vector<std::exception_ptr> errors(num_threads);
+
+	auto run = [&](std::size_t t) {
+		try {
+			worker(t);
+		} catch (...) {
+			errors[t] = std::current_exception();
+			stop();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+
+	try {
+		for (std::size_t t = 1; t < num_threads; ++t)
+			threads.emplace_back(run, t);
+	} catch (...) {
+		stop();
+		for (auto &t : threads)
+			t.join();
+		throw;
+	}
+
+	run(0);
+
+	for (auto &t : threads)
+		t.join();
+
+	for (auto &e : errors) {
+		if (e)
+			std::rethrow_exception(e);
+	}
+}
+
+/**
+ * Like run_in_threads(num_threads, worker, stop), for workers which
+ * cannot finish early.
+ */
+template <typename Worker>
+void
+run_in_threads(std::size_t num_threads, Worker worker)
+{
+	run_in_threads(num_threads, worker, [] {});
+}
+
+} /* namespace detail */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_RUN_IN_THREADS_HPP */
@@ -0,0 +1,1302 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Persistent memory aware implementation of a concurrent cuckoo hash map.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_CONCURRENT_CUCKOO_MAP_HPP
+#define LIBPMEMOBJ_CPP_CONCURRENT_CUCKOO_MAP_HPP
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/detail/enumerable_thread_specific.hpp>
+#include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/detail/persistent_pool_ptr.hpp>
+#include <libpmemobj++/experimental/spin_shared_mutex.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+
+namespace obj
+{
+
+namespace experimental
+{
+
+/**
+ * Persistent memory aware implementation of a concurrent hash map with
+ * bounded probe length, based on (partial-key) cuckoo hashing.
+ *
+ * Every item is stored in one of its two candidate buckets and every bucket
+ * has 4 slots, so a lookup locks at most two buckets and compares at most 8
+ * one-byte fingerprints of hash codes, regardless of the load of the table.
+ * Only nodes with a matching fingerprint are read. The second hash code of
+ * an item is the first one XORed with a function of its fingerprint, so the
+ * other candidate bucket of an item can be computed from the index of its
+ * bucket and its fingerprint alone.
+ *
+ * If both candidate buckets of a new item are full, a path of items which
+ * can be moved to their other buckets is searched (breadth-first) and the
+ * items are moved, starting from the end of the path. Each move is a
+ * separate transaction, performed with both buckets locked, so every item is
+ * always in one of its buckets, also after a crash. If no path is found, the
+ * number of buckets is doubled and items of each old bucket are split
+ * between it and its new buckets. All buckets are locked while the table
+ * grows. Growth interrupted by a crash is completed by runtime_initialize().
+ *
+ * Segments of buckets are managed the same way as in concurrent_hash_map
+ * and the size is kept consistent by per-thread counters, which are
+ * modified in the transactions of inserts and erases. Buckets are locked by
+ * spin_shared_mutex, which does not have to be reset after restart.
+ *
+ * There are no accessors: find() and update() call a function with the
+ * bucket of the item locked.
+ *
+ * runtime_initialize() MUST be called every time after process restart and
+ * free_data() should be called before the map is deleted, as for
+ * concurrent_hash_map.
+ */
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+	  typename KeyEqual = std::equal_to<Key>>
+class concurrent_cuckoo_map {
+public:
+	using key_type = Key;
+	using mapped_type = T;
+	using value_type = detail::pair<const Key, T>;
+	using size_type = size_t;
+	using hasher = Hash;
+	using key_equal = typename concurrent_hash_map_internal::key_equal_type<
+		Hash, KeyEqual>::type;
+
+private:
+	using hashcode_type = size_t;
+
+	struct node {
+		template <typename... Args>
+		node(hashcode_type h, Args &&... args)
+		    : hash(h), item(std::forward<Args>(args)...)
+		{
+		}
+
+		/* Hash code of the key, needed to split buckets */
+		p<hashcode_type> hash;
+
+		value_type item;
+	};
+
+	using node_ptr_t = detail::persistent_pool_ptr<node>;
+
+	enum cuckoo_limits : size_type {
+		/** Number of slots in a bucket */
+		bucket_slots = 4,
+		/** Max number of buckets visited by a search of a free slot */
+		max_search_entries = 256,
+		/** Number of buckets split in one transaction */
+		split_batch = 64,
+		/** Marks the beginning of a search path */
+		no_parent = ~size_type(0)
+	};
+
+	struct bucket {
+		bucket() : fingerprints(0)
+		{
+		}
+
+		spin_shared_mutex mutex;
+
+		/* Fingerprints of the nodes, byte s for slot s, 0 if the slot
+		 * is empty */
+		p<uint64_t> fingerprints;
+
+		node_ptr_t slots[bucket_slots];
+	};
+
+	using segment_traits_t =
+		concurrent_hash_map_internal::segment_traits<bucket>;
+
+	using segment_index_t = typename segment_traits_t::segment_index_t;
+
+	using blocks_table_t =
+		persistent_ptr<bucket[]>[segment_traits_t::number_of_blocks()];
+
+	using segment_facade_t =
+		concurrent_hash_map_internal::segment_facade_impl<
+			blocks_table_t, segment_traits_t, false>;
+
+	using const_segment_facade_t =
+		concurrent_hash_map_internal::segment_facade_impl<
+			blocks_table_t, segment_traits_t, true>;
+
+	/** Data specific for every thread using concurrent_cuckoo_map */
+	struct tls_data_t {
+		p<int64_t> size_diff = 0;
+		std::aligned_storage<56, 8> padding;
+	};
+
+	using tls_t = detail::enumerable_thread_specific<tls_data_t>;
+
+	/*
+	 * Locks up to two buckets for shared or exclusive access, in the
+	 * order of their indexes.
+	 */
+	class bucket_pair_lock {
+	public:
+		bucket_pair_lock() : locked{nullptr, nullptr}, writer(false)
+		{
+		}
+
+		bucket_pair_lock(const concurrent_cuckoo_map *map,
+				 hashcode_type i1, hashcode_type i2, bool w)
+		    : bucket_pair_lock()
+		{
+			acquire(map, i1, i2, w);
+		}
+
+		bucket_pair_lock(const bucket_pair_lock &) = delete;
+		bucket_pair_lock &operator=(const bucket_pair_lock &) = delete;
+
+		~bucket_pair_lock()
+		{
+			release();
+		}
+
+		void
+		acquire(const concurrent_cuckoo_map *map, hashcode_type i1,
+			hashcode_type i2, bool w)
+		{
+			assert(!locked[0]);
+
+			writer = w;
+			locked[0] = map->get_bucket((std::min)(i1, i2));
+			lock(locked[0]);
+
+			if (i1 != i2) {
+				locked[1] = map->get_bucket((std::max)(i1, i2));
+				lock(locked[1]);
+			}
+		}
+
+		void
+		release()
+		{
+			for (bucket *&b : locked) {
+				if (!b)
+					continue;
+
+				if (writer)
+					b->mutex.unlock();
+				else
+					b->mutex.unlock_shared();
+
+				b = nullptr;
+			}
+		}
+
+	private:
+		void
+		lock(bucket *b)
+		{
+			if (writer)
+				b->mutex.lock();
+			else
+				b->mutex.lock_shared();
+		}
+
+		bucket *locked[2];
+		bool writer;
+	};
+
+	/* Element of a path of moves searched by make_room() */
+	struct path_entry {
+		/* Index of the bucket */
+		hashcode_type index;
+
+		/* Entry of the bucket from which a node is moved to this one */
+		size_type parent;
+
+		/* Slot and fingerprint of the node in the parent bucket */
+		size_type slot;
+		uint64_t fingerprint;
+	};
+
+public:
+	/**
+	 * Constructs an empty map.
+	 * Should be called inside a transaction (e.g. by make_persistent).
+	 *
+	 * @throw pmem::transaction_alloc_error when allocation fails.
+	 */
+	concurrent_cuckoo_map()
+	{
+		static_assert(
+			sizeof(size_type) == sizeof(std::atomic<size_type>),
+			"std::atomic should have the same layout as underlying integral type");
+
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		VALGRIND_HG_DISABLE_CHECKING(&my_mask, sizeof(my_mask));
+#endif
+
+		PMEMoid oid = pmemobj_oid(this);
+
+		assert(!OID_IS_NULL(oid));
+
+		my_pool_uuid = oid.pool_uuid_lo;
+
+		for (size_type i = 0; i < segment_traits_t::embedded_segments;
+		     ++i)
+			my_table[i] =
+				pmemobj_oid(my_embedded_segment +
+					    segment_traits_t::segment_base(i));
+
+		on_init_size = 0;
+		my_resize_mask = 0;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(
+			pop, [&] { tls_ptr = make_persistent<tls_t>(); });
+
+		runtime_initialize();
+	}
+
+	concurrent_cuckoo_map(const concurrent_cuckoo_map &) = delete;
+	concurrent_cuckoo_map &
+	operator=(const concurrent_cuckoo_map &) = delete;
+
+	/**
+	 * free_data should be called before the destructor is called.
+	 * Otherwise, program can terminate if an exception occurs while
+	 * freeing memory inside dtor.
+	 */
+	~concurrent_cuckoo_map()
+	{
+		try {
+			free_data();
+		} catch (...) {
+			std::terminate();
+		}
+	}
+
+	/**
+	 * Initialize persistent map after process restart: recalculates the
+	 * number of buckets, completes growth interrupted by a crash and
+	 * restores the size.
+	 * MUST be called every time after process restart.
+	 * Not thread safe.
+	 *
+	 * @throw pmem::transaction_error when a transaction fails.
+	 */
+	void
+	runtime_initialize()
+	{
+		calculate_mask();
+
+		pool_base pop = get_pool_base();
+
+		if (my_resize_mask != 0) {
+			split(pop, my_resize_mask, mask().load());
+
+			my_resize_mask = 0;
+			pop.persist(my_resize_mask);
+		}
+
+		tls_restore();
+	}
+
+	/**
+	 * Removes all items and frees all memory of the map, except the
+	 * map object itself. The map can NOT be used afterwards (unless it
+	 * was called in a transaction and that transaction aborted).
+	 * Not thread safe.
+	 *
+	 * @throw pmem::transaction_error when a transaction fails.
+	 */
+	void
+	free_data()
+	{
+		if (!tls_ptr)
+			return;
+
+		pool_base pop = get_pool_base();
+
+		flat_transaction::run(pop, [&] {
+			clear();
+			delete_persistent<tls_t>(tls_ptr);
+			tls_ptr = nullptr;
+		});
+	}
+
+	/**
+	 * Removes all items and frees all buckets except the embedded ones.
+	 * Not thread safe.
+	 *
+	 * @throw pmem::transaction_error when a transaction fails.
+	 */
+	void
+	clear()
+	{
+		hashcode_type m = mask().load(std::memory_order_relaxed);
+		pool_base pop = get_pool_base();
+
+		flat_transaction::run(pop, [&] {
+			for (hashcode_type i = 0; i <= m; ++i) {
+				bucket *b = get_bucket(i);
+
+				for (auto &slot : b->slots) {
+					if (!slot)
+						continue;
+
+					delete_persistent<node>(
+						slot.get_persistent_ptr(
+							my_pool_uuid));
+					slot = nullptr;
+				}
+
+				b->fingerprints = 0;
+			}
+
+			for (segment_index_t s =
+				     segment_traits_t::segment_index_of(m);
+			     s >= segment_traits_t::embedded_segments; --s)
+				segment_facade_t(my_table, s).disable();
+
+			tls_ptr->clear();
+			on_init_size = 0;
+
+			/* The map may be cleared in an outer transaction */
+			flat_transaction::snapshot((size_t *)&my_mask);
+			flat_transaction::snapshot((size_t *)&my_size);
+
+			mask().store(segment_traits_t::embedded_buckets - 1,
+				     std::memory_order_relaxed);
+			my_size.store(0, std::memory_order_relaxed);
+		});
+	}
+
+	/**
+	 * Inserts a copy of @p value if there is no item with the same key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted.
+	 * @throw pmem::transaction_alloc_error when allocation fails.
+	 * @throw std::length_error if the table cannot grow anymore.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	insert(const value_type &value)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		return internal_insert(value.first, do_nothing{}, value);
+	}
+
+	/**
+	 * Moves @p value into the map if there is no item with the same key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted.
+	 * @throw pmem::transaction_alloc_error when allocation fails.
+	 * @throw std::length_error if the table cannot grow anymore.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	insert(value_type &&value)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		return internal_insert(value.first, do_nothing{},
+				       std::move(value));
+	}
+
+	/**
+	 * Inserts an item with @p key and @p obj or, if the key is already
+	 * present, assigns @p obj to its mapped value in a transaction.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted, false if it was assigned.
+	 * @throw pmem::transaction_alloc_error when allocation fails.
+	 * @throw std::length_error if the table cannot grow anymore.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename M>
+	bool
+	insert_or_assign(const key_type &key, M &&obj)
+	{
+		return internal_insert_or_assign(key, std::forward<M>(obj));
+	}
+
+	/**
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 * The item is constructed from @p key only if it is inserted.
+	 *
+	 * @return true if the item was inserted, false if it was assigned.
+	 * @throw pmem::transaction_alloc_error when allocation fails.
+	 * @throw std::length_error if the table cannot grow anymore.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename K, typename M,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	insert_or_assign(K &&key, M &&obj)
+	{
+		return internal_insert_or_assign(std::forward<K>(key),
+						 std::forward<M>(obj));
+	}
+
+	/**
+	 * Calls f(const value_type &) for the item with @p key, with its
+	 * bucket locked for shared access. f must not access the map.
+	 * Thread safe.
+	 *
+	 * @return true if the item was found.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename F>
+	bool
+	find(const key_type &key, F f) const
+	{
+		return internal_find(key, f);
+	}
+
+	/**
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 *
+	 * @return true if the item was found.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename K, typename F,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	find(const K &key, F f) const
+	{
+		return internal_find(key, f);
+	}
+
+	/**
+	 * Calls f(mapped_type &) for the item with @p key in a transaction,
+	 * with its bucket locked for exclusive access, so modifications of
+	 * p<> members are persisted atomically. f must not access the map.
+	 * Thread safe.
+	 *
+	 * @return true if the item was found.
+	 * @throw pmem::transaction_error when the transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw rethrows exception thrown by f.
+	 */
+	template <typename F>
+	bool
+	update(const key_type &key, F f)
+	{
+		return internal_update(key, f);
+	}
+
+	/**
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 *
+	 * @return true if the item was found.
+	 * @throw pmem::transaction_error when the transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw rethrows exception thrown by f.
+	 */
+	template <typename K, typename F,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	update(const K &key, F f)
+	{
+		return internal_update(key, f);
+	}
+
+	/**
+	 * @return 1 if an item with @p key is present, 0 otherwise.
+	 * Thread safe.
+	 *
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	size_type
+	count(const key_type &key) const
+	{
+		return internal_find(key, [](const value_type &) {}) ? 1 : 0;
+	}
+
+	/**
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 *
+	 * @return 1 if an item with @p key is present, 0 otherwise.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	size_type
+	count(const K &key) const
+	{
+		return internal_find(key, [](const value_type &) {}) ? 1 : 0;
+	}
+
+	/**
+	 * Removes the item with @p key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was removed.
+	 * @throw pmem::transaction_free_error when freeing the node fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	erase(const key_type &key)
+	{
+		return internal_erase(key);
+	}
+
+	/**
+	 * This overload only participates in overload resolution if the
+	 * qualified-id Hash::transparent_key_equal is valid and denotes a type.
+	 *
+	 * @return true if the item was removed.
+	 * @throw pmem::transaction_free_error when freeing the node fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	erase(const K &key)
+	{
+		return internal_erase(key);
+	}
+
+	/**
+	 * @return number of items in the map.
+	 */
+	size_type
+	size() const
+	{
+		return my_size.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * @return true if the map is empty.
+	 */
+	bool
+	empty() const
+	{
+		return size() == 0;
+	}
+
+	/**
+	 * @return current number of buckets.
+	 */
+	size_type
+	bucket_count() const
+	{
+		return mask().load(std::memory_order_relaxed) + 1;
+	}
+
+	/**
+	 * @return max number of items in a bucket.
+	 */
+	static constexpr size_type
+	bucket_size()
+	{
+		return bucket_slots;
+	}
+
+private:
+	struct do_nothing {
+		void
+		operator()(pool_base &, node *) const
+		{
+		}
+	};
+
+	pool_base
+	get_pool_base() const
+	{
+		PMEMobjpool *pop =
+			pmemobj_pool_by_oid(PMEMoid{my_pool_uuid, 0});
+
+		return pool_base(pop);
+	}
+
+	std::atomic<hashcode_type> &
+	mask() noexcept
+	{
+		return my_mask;
+	}
+
+	const std::atomic<hashcode_type> &
+	mask() const noexcept
+	{
+		return my_mask;
+	}
+
+	/* Hash codes are mixed, so that fingerprints (the upper bits) and
+	 * bucket indexes (the lower bits) of identity hashes vary */
+	template <typename K>
+	static hashcode_type
+	hash_of(const K &key)
+	{
+		return static_cast<hashcode_type>(
+			static_cast<uint64_t>(hasher{}(key)) *
+			0x9E3779B97F4A7C15ULL);
+	}
+
+	static uint64_t
+	fingerprint(hashcode_type h)
+	{
+		return (static_cast<uint64_t>(h) >> 56) % 255 + 1;
+	}
+
+	static hashcode_type
+	fingerprint_hash(uint64_t fp)
+	{
+		return static_cast<hashcode_type>(fp * 0xC6A4A7935BD1E995ULL);
+	}
+
+	/* Hash code which selects the second candidate bucket */
+	static hashcode_type
+	alternate_hash(hashcode_type h)
+	{
+		return h ^ fingerprint_hash(fingerprint(h));
+	}
+
+	/* Index of the other candidate bucket of a node with fingerprint fp
+	 * which is in bucket i */
+	static hashcode_type
+	alternate_index(hashcode_type i, uint64_t fp, hashcode_type m)
+	{
+		return (i ^ fingerprint_hash(fp)) & m;
+	}
+
+	static uint64_t
+	slot_fingerprint(uint64_t fps, size_type s)
+	{
+		return (fps >> (s * 8)) & 0xff;
+	}
+
+	/* Returns bucket_slots if there is no free slot */
+	static size_type
+	free_slot(uint64_t fps)
+	{
+		for (size_type s = 0; s < bucket_slots; ++s) {
+			if (!slot_fingerprint(fps, s))
+				return s;
+		}
+
+		return bucket_slots;
+	}
+
+	/* Must be called in a transaction */
+	static void
+	set_fingerprint(bucket *b, size_type s, uint64_t fp)
+	{
+		uint64_t fps = b->fingerprints.get_ro();
+
+		fps &= ~(uint64_t(0xff) << (s * 8));
+		fps |= fp << (s * 8);
+
+		b->fingerprints = fps;
+	}
+
+	/* Must be called outside of a transaction */
+	p<int64_t> &
+	thread_size_diff()
+	{
+		assert(tls_ptr != nullptr);
+		return tls_ptr->local().size_diff;
+	}
+
+	/* Process size changes which were saved to tls and clears tls */
+	void
+	tls_restore()
+	{
+		assert(tls_ptr != nullptr);
+
+		pool_base pop = get_pool_base();
+
+		int64_t last_run_size = 0;
+		for (auto &data : *tls_ptr)
+			last_run_size += data.size_diff;
+
+		flat_transaction::run(pop, [&] {
+			on_init_size += static_cast<size_t>(last_run_size);
+			tls_ptr->clear();
+		});
+
+		my_size.store(on_init_size, std::memory_order_relaxed);
+	}
+
+	/* Re-calculate mask value on each process restart */
+	void
+	calculate_mask()
+	{
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		VALGRIND_HG_DISABLE_CHECKING(&my_size, sizeof(my_size));
+		VALGRIND_HG_DISABLE_CHECKING(&my_mask, sizeof(my_mask));
+#endif
+#if LIBPMEMOBJ_CPP_VG_PMEMCHECK_ENABLED
+		VALGRIND_PMC_REMOVE_PMEM_MAPPING(&my_size, sizeof(my_size));
+		VALGRIND_PMC_REMOVE_PMEM_MAPPING(&my_mask, sizeof(my_mask));
+#endif
+
+		hashcode_type m = segment_traits_t::embedded_buckets - 1;
+
+		const_segment_facade_t segment(
+			my_table, segment_traits_t::embedded_segments);
+
+		while (segment.is_valid()) {
+			m += segment.size();
+			++segment;
+		}
+
+		mask().store(m, std::memory_order_relaxed);
+	}
+
+	bucket *
+	get_bucket(hashcode_type h) const
+	{
+		segment_index_t s = segment_traits_t::segment_index_of(h);
+
+		h -= segment_traits_t::segment_base(s);
+
+		const_segment_facade_t segment(my_table, s);
+
+		assert(segment.is_valid());
+
+		return &(segment[h]);
+	}
+
+	/*
+	 * Locks both candidate buckets of hash code h. The table grows with
+	 * all buckets locked, so the mask cannot change once they are locked
+	 * for the mask read before.
+	 *
+	 * @return mask for which the buckets were selected.
+	 */
+	hashcode_type
+	lock_candidates(hashcode_type h, bool writer, bucket_pair_lock &lock,
+			bucket *(&b)[2]) const
+	{
+		for (;;) {
+			hashcode_type m =
+				mask().load(std::memory_order_acquire);
+			hashcode_type i1 = h & m;
+			hashcode_type i2 = alternate_hash(h) & m;
+
+			lock.acquire(this, i1, i2, writer);
+
+			if (mask().load(std::memory_order_acquire) == m) {
+				b[0] = get_bucket(i1);
+				b[1] = get_bucket(i2);
+
+				return m;
+			}
+
+			lock.release();
+		}
+	}
+
+	template <typename K>
+	node *
+	find_in_bucket(bucket *b, hashcode_type h, const K &key,
+		       size_type &slot) const
+	{
+		uint64_t fp = fingerprint(h);
+		uint64_t fps = b->fingerprints.get_ro();
+
+		for (size_type s = 0; s < bucket_slots; ++s) {
+			if (slot_fingerprint(fps, s) != fp)
+				continue;
+
+			node *n = b->slots[s].get(my_pool_uuid);
+			if (n->hash == h && key_equal{}(n->item.first, key)) {
+				slot = s;
+				return n;
+			}
+		}
+
+		return nullptr;
+	}
+
+	template <typename K>
+	node *
+	find_node(bucket *(&b)[2], hashcode_type h, const K &key,
+		  size_type &slot) const
+	{
+		node *n = find_in_bucket(b[0], h, key, slot);
+		if (!n && b[1] != b[0])
+			n = find_in_bucket(b[1], h, key, slot);
+
+		return n;
+	}
+
+	template <typename K, typename M>
+	bool
+	internal_insert_or_assign(K &&key, M &&obj)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		auto assign = [&](pool_base &pop, node *n) {
+			flat_transaction::run(pop, [&] {
+				n->item.second = std::forward<M>(obj);
+			});
+		};
+
+		/* key is forwarded only when the node is constructed, after
+		 * the lookup */
+		return internal_insert(key, assign, std::piecewise_construct,
+				       std::forward_as_tuple(
+					       std::forward<K>(key)),
+				       std::forward_as_tuple(
+					       std::forward<M>(obj)));
+	}
+
+	template <typename K, typename F>
+	bool
+	internal_find(const K &key, F f) const
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		hashcode_type h = hash_of(key);
+
+		bucket_pair_lock lock;
+		bucket *b[2];
+		lock_candidates(h, false, lock, b);
+
+		size_type slot;
+		node *n = find_node(b, h, key, slot);
+		if (!n)
+			return false;
+
+		f(static_cast<const value_type &>(n->item));
+
+		return true;
+	}
+
+	template <typename K, typename F>
+	bool
+	internal_update(const K &key, F f)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		hashcode_type h = hash_of(key);
+
+		bucket_pair_lock lock;
+		bucket *b[2];
+		lock_candidates(h, true, lock, b);
+
+		size_type slot;
+		node *n = find_node(b, h, key, slot);
+		if (!n)
+			return false;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] { f(n->item.second); });
+
+		return true;
+	}
+
+	template <typename K>
+	bool
+	internal_erase(const K &key)
+	{
+		concurrent_hash_map_internal::check_outside_tx();
+
+		hashcode_type h = hash_of(key);
+
+		bucket_pair_lock lock;
+		bucket *b[2];
+		lock_candidates(h, true, lock, b);
+
+		for (bucket *c : b) {
+			size_type slot;
+			node *n = find_in_bucket(c, h, key, slot);
+			if (!n)
+				continue;
+
+			pool_base pop = get_pool_base();
+			auto &size_diff = thread_size_diff();
+
+			flat_transaction::run(pop, [&] {
+				delete_persistent<node>(
+					c->slots[slot].get_persistent_ptr(
+						my_pool_uuid));
+				c->slots[slot] = nullptr;
+				set_fingerprint(c, slot, 0);
+				--size_diff;
+			});
+
+			my_size.fetch_sub(1, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	/*
+	 * Inserts a node constructed from args, if there is no node with
+	 * the key, otherwise calls on_found(pop, node) with the buckets
+	 * locked.
+	 */
+	template <typename K, typename OnFound, typename... Args>
+	bool
+	internal_insert(const K &key, OnFound on_found, Args &&... args)
+	{
+		hashcode_type h = hash_of(key);
+		pool_base pop = get_pool_base();
+
+		for (;;) {
+			hashcode_type m;
+
+			{
+				bucket_pair_lock lock;
+				bucket *b[2];
+				m = lock_candidates(h, true, lock, b);
+
+				size_type slot;
+				node *n = find_node(b, h, key, slot);
+				if (n) {
+					on_found(pop, n);
+					return false;
+				}
+
+				for (bucket *c : b) {
+					slot = free_slot(c->fingerprints);
+					if (slot == bucket_slots)
+						continue;
+
+					insert_node(
+						pop, c, slot, h,
+						std::forward<Args>(args)...);
+
+					return true;
+				}
+			}
+
+			if (!make_room(h, m))
+				grow(m);
+		}
+	}
+
+	/* Inserts a new node to a free slot of locked bucket b */
+	template <typename... Args>
+	void
+	insert_node(pool_base &pop, bucket *b, size_type slot, hashcode_type h,
+		    Args &&... args)
+	{
+		auto &size_diff = thread_size_diff();
+
+		flat_transaction::run(pop, [&] {
+			b->slots[slot] = make_persistent<node>(
+				h, std::forward<Args>(args)...);
+			set_fingerprint(b, slot, fingerprint(h));
+			++size_diff;
+		});
+
+		my_size.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+	 * Searches for a path of nodes, which ends with a free slot and
+	 * starts in a candidate bucket of h, and moves the nodes along it.
+	 * Buckets are read one by one, so the path may become invalid
+	 * before it is used - then the caller just tries again.
+	 *
+	 * @return false if no path was found.
+	 */
+	bool
+	make_room(hashcode_type h, hashcode_type m)
+	{
+		std::vector<path_entry> path;
+		path.reserve(max_search_entries);
+
+		hashcode_type i1 = h & m;
+		hashcode_type i2 = alternate_hash(h) & m;
+
+		path.push_back({i1, no_parent, 0, 0});
+		if (i2 != i1)
+			path.push_back({i2, no_parent, 0, 0});
+
+		for (size_type e = 0; e < path.size(); ++e) {
+			hashcode_type i = path[e].index;
+			uint64_t fps;
+
+			{
+				bucket_pair_lock lock(this, i, i, false);
+				fps = get_bucket(i)->fingerprints.get_ro();
+			}
+
+			if (free_slot(fps) != bucket_slots) {
+				move_along(path, e, m);
+				return true;
+			}
+
+			if (path.size() + bucket_slots > max_search_entries)
+				continue;
+
+			for (size_type s = 0; s < bucket_slots; ++s) {
+				uint64_t fp = slot_fingerprint(fps, s);
+				hashcode_type alt = alternate_index(i, fp, m);
+
+				if (alt != i)
+					path.push_back({alt, e, s, fp});
+			}
+		}
+
+		return false;
+	}
+
+	/*
+	 * Moves nodes along the path, starting from the entry e (which has a
+	 * free slot). A node may be moved if its slot still holds a node
+	 * with the same fingerprint - which has the same other bucket.
+	 */
+	void
+	move_along(const std::vector<path_entry> &path, size_type e,
+		   hashcode_type m)
+	{
+		pool_base pop = get_pool_base();
+
+		for (; path[e].parent != no_parent; e = path[e].parent) {
+			const path_entry &to = path[e];
+			const path_entry &from = path[to.parent];
+
+			bucket_pair_lock lock(this, from.index, to.index, true);
+
+			if (mask().load(std::memory_order_acquire) != m)
+				return;
+
+			bucket *src = get_bucket(from.index);
+			bucket *dst = get_bucket(to.index);
+
+			size_type d = free_slot(dst->fingerprints);
+
+			if (slot_fingerprint(src->fingerprints, to.slot) !=
+				    to.fingerprint ||
+			    d == bucket_slots)
+				return;
+
+			flat_transaction::run(pop, [&] {
+				move_node(src, to.slot, dst, d);
+			});
+		}
+	}
+
+	/* Must be called in a transaction */
+	static void
+	move_node(bucket *src, size_type s, bucket *dst, size_type d)
+	{
+		dst->slots[d] = src->slots[s];
+		set_fingerprint(dst, d, slot_fingerprint(src->fingerprints, s));
+
+		src->slots[s] = nullptr;
+		set_fingerprint(src, s, 0);
+	}
+
+	/*
+	 * Doubles the number of buckets of the table with mask m (unless
+	 * another thread already did it). All buckets are locked, in the
+	 * order of their indexes, until the new mask is published.
+	 */
+	void
+	grow(hashcode_type m)
+	{
+		hashcode_type locked = 0;
+
+		auto unlock = [&] {
+			for (hashcode_type i = 0; i < locked; ++i)
+				get_bucket(i)->mutex.unlock();
+		};
+
+		try {
+			get_bucket(0)->mutex.lock();
+			locked = 1;
+
+			if (mask().load(std::memory_order_acquire) != m) {
+				unlock();
+				return;
+			}
+
+			for (; locked <= m; ++locked)
+				get_bucket(locked)->mutex.lock();
+
+			pool_base pop = get_pool_base();
+			hashcode_type new_mask;
+
+			flat_transaction::run(pop, [&] {
+				new_mask = enable_segments(pop, m);
+				my_resize_mask = m;
+			});
+
+			split(pop, m, new_mask);
+
+			my_resize_mask = 0;
+			pop.persist(my_resize_mask);
+
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+			ANNOTATE_HAPPENS_BEFORE(&my_mask);
+#endif
+			mask().store(new_mask, std::memory_order_release);
+		} catch (...) {
+			unlock();
+			throw;
+		}
+
+		unlock();
+	}
+
+	/*
+	 * Allocates buckets which follow the table with mask m, must be
+	 * called in a transaction.
+	 *
+	 * @return new mask.
+	 */
+	hashcode_type
+	enable_segments(pool_base &pop, hashcode_type m)
+	{
+		segment_index_t k = segment_traits_t::segment_index_of(m + 1);
+
+		if (k >= segment_traits_t::number_of_segments)
+			throw std::length_error(
+				"concurrent_cuckoo_map cannot grow");
+
+		if (k >= segment_traits_t::first_block) {
+			segment_facade_t segment(my_table, k);
+
+			if (!segment.is_valid())
+				segment.enable(pop);
+
+			return 2 * segment.size() - 1;
+		}
+
+		/* the first block */
+		assert(k == segment_traits_t::embedded_segments);
+
+		for (segment_index_t i = k; i < segment_traits_t::first_block;
+		     ++i) {
+			segment_facade_t segment(my_table, i);
+
+			if (!segment.is_valid())
+				segment.enable(pop);
+		}
+
+		return segment_traits_t::segment_size(
+			       segment_traits_t::first_block) -
+			1;
+	}
+
+	/*
+	 * Moves nodes of buckets of the table with mask m to their buckets
+	 * in the table with new_mask. Nodes of bucket i can only move to
+	 * buckets whose index is i modulo m + 1, which are empty otherwise,
+	 * so they always fit. Nodes which were moved already stay where they
+	 * are, so an interrupted split can be repeated.
+	 */
+	void
+	split(pool_base &pop, hashcode_type m, hashcode_type new_mask)
+	{
+		for (hashcode_type first = 0; first <= m;
+		     first += split_batch) {
+			hashcode_type last = (std::min)(
+				m, first + hashcode_type(split_batch) - 1);
+
+			flat_transaction::run(pop, [&] {
+				for (hashcode_type i = first; i <= last; ++i)
+					split_bucket(i, m, new_mask);
+			});
+		}
+	}
+
+	/* Must be called in a transaction */
+	void
+	split_bucket(hashcode_type i, hashcode_type m, hashcode_type new_mask)
+	{
+		bucket *src = get_bucket(i);
+
+		for (size_type s = 0; s < bucket_slots; ++s) {
+			if (!slot_fingerprint(src->fingerprints, s))
+				continue;
+
+			hashcode_type h = src->slots[s].get(my_pool_uuid)->hash;
+			hashcode_type target = (h & m) == i
+				? (h & new_mask)
+				: (alternate_hash(h) & new_mask);
+
+			if (target == i)
+				continue;
+
+			bucket *dst = get_bucket(target);
+			size_type d = free_slot(dst->fingerprints);
+
+			assert(d != bucket_slots);
+
+			move_node(src, s, dst, d);
+		}
+	}
+
+	/* ID of persistent memory pool where the map resides */
+	p<uint64_t> my_pool_uuid;
+
+	/* Hash mask = number of buckets - 1, volatile */
+	std::atomic<hashcode_type> my_mask;
+
+	/* Size of the map, volatile */
+	std::atomic<size_type> my_size;
+
+	/* Size of the map as of the last runtime_initialize() */
+	p<size_type> on_init_size;
+
+	/* Mask of the table before the growth in progress, 0 if none */
+	p<hashcode_type> my_resize_mask;
+
+	/* Per-thread size changes since the last runtime_initialize() */
+	persistent_ptr<tls_t> tls_ptr;
+
+	/* Segment pointers table */
+	blocks_table_t my_table;
+
+	/* Zero segment */
+	bucket my_embedded_segment[segment_traits_t::embedded_buckets];
+};
+
+} /* namespace experimental */
+
+} /* namespace obj */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_CONCURRENT_CUCKOO_MAP_HPP */
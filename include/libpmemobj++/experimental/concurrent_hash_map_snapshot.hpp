@@ -0,0 +1,471 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Export of concurrent_hash_map to a flat binary stream and import of it.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_CONCURRENT_HASH_MAP_SNAPSHOT_HPP
+#define LIBPMEMOBJ_CPP_CONCURRENT_HASH_MAP_SNAPSHOT_HPP
+
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/string_view.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+
+namespace obj
+{
+
+namespace experimental
+{
+
+namespace snapshot_internal
+{
+
+/* Magic number and version of the format */
+static constexpr char magic[8] = {'P', 'M', 'C', 'H', 'M', 'S', 'S', '1'};
+
+/* Key size of the record which ends the snapshot */
+static constexpr uint32_t end_marker = UINT32_MAX;
+
+struct record_header {
+	uint32_t key_size;
+	uint32_t value_size;
+};
+
+template <typename T>
+struct raw_type {
+	using type = T;
+};
+
+template <typename T>
+struct raw_type<pmem::obj::p<T>> {
+	using type = T;
+};
+
+/*
+ * Buffers data written to the stream. write() only appends to the buffer,
+ * so it can be called with locks of the map held, the stream is written
+ * by flush() and flush_if_full().
+ */
+class writer {
+public:
+	writer(std::ostream &s, size_t buffer_size)
+	    : stream(s), capacity(buffer_size)
+	{
+		buffer.reserve(buffer_size);
+	}
+
+	void
+	write(const void *data, size_t size)
+	{
+		auto p = static_cast<const char *>(data);
+		buffer.insert(buffer.end(), p, p + size);
+	}
+
+	/* Writes the buffer to the stream if it holds at least buffer_size
+	 * bytes */
+	void
+	flush_if_full()
+	{
+		if (buffer.size() >= capacity)
+			flush();
+	}
+
+	void
+	flush()
+	{
+		stream.write(buffer.data(),
+			     static_cast<std::streamsize>(buffer.size()));
+		if (!stream)
+			throw std::runtime_error("Failed to write snapshot.");
+
+		buffer.clear();
+	}
+
+private:
+	std::ostream &stream;
+	std::vector<char> buffer;
+	size_t capacity;
+};
+
+/*
+ * Reads data from the stream in chunks of buffer_size bytes.
+ */
+class reader {
+public:
+	reader(std::istream &s, size_t buffer_size)
+	    : stream(s), buffer(buffer_size), begin(0), end(0)
+	{
+	}
+
+	/*
+	 * Returns view of the next size bytes. It points to the buffer (if
+	 * the data is there) or to scratch, and is valid until the next
+	 * call.
+	 */
+	string_view
+	read(size_t size, std::string &scratch)
+	{
+		if (end - begin >= size || fill(size)) {
+			string_view v(buffer.data() + begin, size);
+			begin += size;
+			return v;
+		}
+
+		scratch.assign(buffer.data() + begin, end - begin);
+		begin = end;
+
+		size_t missing = size - scratch.size();
+		scratch.resize(size);
+		read_stream(&scratch[size - missing], missing);
+
+		return string_view(scratch.data(), size);
+	}
+
+	/* Skips the next size bytes */
+	void
+	skip(size_t size)
+	{
+		size_t n = (std::min)(size, end - begin);
+		begin += n;
+		size -= n;
+
+		if (size == 0)
+			return;
+
+		stream.ignore(static_cast<std::streamsize>(size));
+		if (static_cast<size_t>(stream.gcount()) != size)
+			throw std::runtime_error("Snapshot is truncated.");
+	}
+
+	template <typename U>
+	U
+	read()
+	{
+		std::string scratch;
+		string_view v = read(sizeof(U), scratch);
+
+		U result;
+		std::memcpy(&result, v.data(), sizeof(U));
+
+		return result;
+	}
+
+private:
+	/* Moves the remaining data to the front of the buffer and reads
+	 * more, returns false if size bytes do not fit the buffer */
+	bool
+	fill(size_t size)
+	{
+		if (size > buffer.size())
+			return false;
+
+		std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+		end -= begin;
+		begin = 0;
+
+		while (end < size) {
+			stream.read(buffer.data() + end,
+				    static_cast<std::streamsize>(buffer.size() -
+								 end));
+			size_t n = static_cast<size_t>(stream.gcount());
+			if (n == 0)
+				throw std::runtime_error(
+					"Snapshot is truncated.");
+			end += n;
+		}
+
+		return true;
+	}
+
+	void
+	read_stream(char *data, size_t size)
+	{
+		stream.read(data, static_cast<std::streamsize>(size));
+		if (static_cast<size_t>(stream.gcount()) != size)
+			throw std::runtime_error("Snapshot is truncated.");
+	}
+
+	std::istream &stream;
+	std::vector<char> buffer;
+	size_t begin;
+	size_t end;
+};
+
+static inline void
+read_magic(reader &r)
+{
+	std::string scratch;
+	string_view m = r.read(sizeof(magic), scratch);
+	if (std::memcmp(m.data(), magic, m.size()) != 0)
+		throw std::runtime_error("Invalid snapshot header.");
+}
+
+/*
+ * Checks the header, sizes of the records and the trailer of the snapshot
+ * without deserializing the records.
+ */
+static inline void
+check_framing(std::istream &in, size_t buffer_size)
+{
+	reader r(in, buffer_size);
+	read_magic(r);
+
+	uint64_t records = 0;
+	for (;;) {
+		auto h = r.read<record_header>();
+		if (h.key_size == end_marker)
+			break;
+
+		r.skip(size_t(h.key_size) + size_t(h.value_size));
+		++records;
+	}
+
+	if (r.read<uint64_t>() != records)
+		throw std::runtime_error("Invalid number of snapshot records.");
+}
+
+} /* namespace snapshot_internal */
+
+/** Default size of buffers used by export_snapshot and import_snapshot. */
+static constexpr size_t snapshot_buffer_size = 1 << 20;
+
+/** Default number of items bulk-loaded at once by import_snapshot. */
+static constexpr size_t snapshot_batch_size = 1 << 20;
+
+/**
+ * Serializer of trivially copyable keys and values (possibly wrapped in
+ * pmem::obj::p), it copies their object representation.
+ */
+struct trivial_snapshot_serializer {
+	template <typename Item>
+	void
+	operator()(const Item &item, std::string &key,
+		   std::string &value) const
+	{
+		assign(item.first, key);
+		assign(item.second, value);
+	}
+
+private:
+	template <typename U>
+	static void
+	assign(const pmem::obj::p<U> &v, std::string &out)
+	{
+		assign(v.get_ro(), out);
+	}
+
+	template <typename U>
+	static void
+	assign(const U &v, std::string &out)
+	{
+		static_assert(LIBPMEMOBJ_CPP_IS_TRIVIALLY_COPYABLE(U),
+			      "Type must be trivially copyable");
+
+		out.assign(reinterpret_cast<const char *>(&v), sizeof(U));
+	}
+};
+
+/**
+ * Deserializer matching trivial_snapshot_serializer. It returns
+ * std::pair of the key and the value (without pmem::obj::p wrappers).
+ */
+template <typename Key, typename T>
+struct trivial_snapshot_deserializer {
+	using key_type = typename snapshot_internal::raw_type<Key>::type;
+	using mapped_type = typename snapshot_internal::raw_type<T>::type;
+
+	std::pair<key_type, mapped_type>
+	operator()(string_view key, string_view value) const
+	{
+		return {get<key_type>(key), get<mapped_type>(value)};
+	}
+
+private:
+	template <typename U>
+	static U
+	get(string_view v)
+	{
+		static_assert(LIBPMEMOBJ_CPP_IS_TRIVIALLY_COPYABLE(U),
+			      "Type must be trivially copyable");
+
+		if (v.size() != sizeof(U))
+			throw std::runtime_error(
+				"Invalid size of a snapshot record.");
+
+		U result;
+		std::memcpy(&result, v.data(), sizeof(U));
+
+		return result;
+	}
+};
+
+/**
+ * Writes all items of the map to the stream, without stopping other
+ * threads which use the map, see concurrent_hash_map::snapshot for the
+ * consistency guarantees.
+ *
+ * serialize(const value_type &item, std::string &key, std::string &value)
+ * is called for each item and should assign bytes of its key and value.
+ * It is called with the item locked, so it should be fast and must not
+ * access the map. Records are appended to a buffer, which is written to
+ * the stream after a bucket of the map is visited (and its locks are
+ * released) if it holds at least buffer_size bytes.
+ *
+ * The snapshot consists of a header, records (sizes of the key and the
+ * value followed by their bytes) and a trailer with the number of records.
+ * Sizes are written in the native byte order.
+ *
+ * @return number of exported items.
+ * @throw std::runtime_error if writing to the stream fails.
+ * @throw std::length_error if a key or a value has more than 2^32 - 2
+ * bytes.
+ * @throw pmem::transaction_scope_error if called inside transaction
+ * @throw rethrows exception thrown by serialize.
+ */
+template <typename Map, typename Serializer>
+typename Map::size_type
+export_snapshot(Map &map, std::ostream &out, Serializer serialize,
+		size_t buffer_size = snapshot_buffer_size)
+{
+	snapshot_internal::writer w(out, buffer_size);
+	w.write(snapshot_internal::magic, sizeof(snapshot_internal::magic));
+
+	std::string key, value;
+
+	uint64_t n = map.snapshot(
+		[&](const typename Map::value_type &item) {
+			key.clear();
+			value.clear();
+			serialize(item, key, value);
+
+			if (key.size() >= snapshot_internal::end_marker ||
+			    value.size() >= snapshot_internal::end_marker)
+				throw std::length_error(
+					"Snapshot record is too long.");
+
+			snapshot_internal::record_header h;
+			h.key_size = static_cast<uint32_t>(key.size());
+			h.value_size = static_cast<uint32_t>(value.size());
+
+			w.write(&h, sizeof(h));
+			w.write(key.data(), key.size());
+			w.write(value.data(), value.size());
+		},
+		[&] { w.flush_if_full(); });
+
+	snapshot_internal::record_header end;
+	end.key_size = snapshot_internal::end_marker;
+	end.value_size = 0;
+
+	w.write(&end, sizeof(end));
+	w.write(&n, sizeof(n));
+	w.flush();
+
+	return static_cast<typename Map::size_type>(n);
+}
+
+/**
+ * Loads items written by export_snapshot to the map, using
+ * Map::bulk_load with num_threads threads for each batch of batch_size
+ * items. Like bulk_load, it is intended for the initial load of the map
+ * and is not thread safe. Items with keys which are already present in
+ * the map are not inserted.
+ *
+ * deserialize(string_view key, string_view value) is called for each
+ * record and should return an item which can be inserted by bulk_load,
+ * e.g. std::pair of the key and the value. The views are valid only
+ * during the call.
+ *
+ * The stream must be seekable. The framing of the whole snapshot (the
+ * header, sizes of the records and the trailer) is checked before the map
+ * is modified, so a truncated or corrupted snapshot leaves the map
+ * unchanged. If deserialize or bulk_load throws, items of batches which
+ * were already loaded stay in the map.
+ *
+ * @return number of inserted items.
+ * @throw std::runtime_error if the stream does not contain a valid
+ * snapshot or is not seekable.
+ * @throw pmem::transaction_alloc_error on allocation failure.
+ * @throw pmem::transaction_scope_error if called inside transaction
+ * @throw rethrows exception thrown by deserialize.
+ */
+template <typename Map, typename Deserializer>
+typename Map::size_type
+import_snapshot(Map &map, std::istream &in, Deserializer deserialize,
+		typename Map::size_type num_threads,
+		size_t batch_size = snapshot_batch_size,
+		size_t buffer_size = snapshot_buffer_size)
+{
+	using item_type = typename std::decay<decltype(
+		deserialize(string_view(), string_view()))>::type;
+
+	auto start = in.tellg();
+	if (start == std::istream::pos_type(-1))
+		throw std::runtime_error("Snapshot stream is not seekable.");
+
+	snapshot_internal::check_framing(in, buffer_size);
+
+	in.clear();
+	in.seekg(start);
+	if (!in)
+		throw std::runtime_error("Failed to rewind snapshot stream.");
+
+	snapshot_internal::reader r(in, buffer_size);
+	snapshot_internal::read_magic(r);
+
+	std::string scratch;
+	std::vector<item_type> batch;
+	batch.reserve(batch_size);
+
+	typename Map::size_type inserted = 0;
+
+	auto load = [&] {
+		inserted +=
+			map.bulk_load(batch.begin(), batch.end(), num_threads);
+		batch.clear();
+	};
+
+	for (;;) {
+		auto h = r.read<snapshot_internal::record_header>();
+		if (h.key_size == snapshot_internal::end_marker)
+			break;
+
+		string_view data = r.read(
+			size_t(h.key_size) + size_t(h.value_size), scratch);
+
+		batch.emplace_back(deserialize(
+			string_view(data.data(), h.key_size),
+			string_view(data.data() + h.key_size, h.value_size)));
+
+		if (batch.size() >= batch_size)
+			load();
+	}
+
+	load();
+
+	return inserted;
+}
+
+} /* namespace experimental */
+
+} /* namespace obj */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_CONCURRENT_HASH_MAP_SNAPSHOT_HPP */
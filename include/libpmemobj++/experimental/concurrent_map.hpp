@@ -14,6 +14,13 @@ namespace obj
 {
 namespace experimental
 {
+
+/**
+ * Tag of constructors of concurrent maps, which take a range of elements
+ * sorted by keys.
+ */
+using sorted_range_t = pmem::detail::sorted_range_t;
+
 /**
  * Persistent memory aware implementation of Intel TBB concurrent_map. It is a
  * sorted associative container that contains key-value pairs with unique keys.
@@ -27,9 +34,19 @@ namespace experimental
  * The implementation is based on the lock-based concurrent skip list algorithm
  * described in
  * https://www.cs.tau.ac.il/~shanir/nir-pubs-web/Papers/OPODIS2006-BA.pdf.
- * Our concurrent skip list implementation supports concurrent insertion and
- * traversal, but not concurrent erasure. The erase method is prefixed with
- * unsafe_, to indicate that there is no concurrency safety.
+ * Our concurrent skip list implementation supports concurrent insertion,
+ * traversal and erasure by key (erase). Memory of erased elements is freed by
+ * unsafe_reclaim(), clear() or runtime_initialize(), so iterators and
+ * references to erased elements stay valid until then (see
+ * reclaiming_concurrent_map, which frees it while the map is in use). The
+ * other erase methods are prefixed with unsafe_, to indicate that there is no
+ * concurrency safety.
+ *
+ * Nodes of the skip list store the state of thread-safe erase, so the layout
+ * of concurrent_map differs from the layout used by releases without
+ * thread-safe erase. The map stores the version of its layout and
+ * runtime_initialize() throws pmem::layout_error if the map was created with
+ * a different one.
  *
  * Each time, the pool with concurrent_map is being opened, the concurrent_map
  * requires runtime_initialize() to be called in order to restore the map state
@@ -106,6 +123,18 @@ public:
 	{
 	}
 
+	/**
+	 * Constructs the map with the contents of the range [first, last),
+	 * which should be sorted by keys. See bulk_insert_sorted().
+	 */
+	template <class InputIt>
+	concurrent_map(sorted_range_t tag, InputIt first, InputIt last,
+		       const key_compare &comp = Comp(),
+		       const allocator_type &alloc = allocator_type())
+	    : base_type(tag, first, last, comp, alloc)
+	{
+	}
+
 	/**
 	 * Constructs the map with initializer list
 	 */
@@ -430,6 +430,17 @@ struct total_sizeof<basic_inline_string<CharT, Traits>> {
 		return sizeof(basic_inline_string<CharT, Traits>) +
 			(s.size() + 1 /* '\0' */) * sizeof(CharT);
 	}
+
+	/**
+	 * Copy of an inline_string has the same capacity as the original,
+	 * which may be bigger than its size.
+	 */
+	static size_t
+	value(const basic_inline_string<CharT, Traits> &s)
+	{
+		return sizeof(basic_inline_string<CharT, Traits>) +
+			(s.capacity() + 1 /* '\0' */) * sizeof(CharT);
+	}
 };
 } /* namespace experimental */
 } /* namespace obj */
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Concurrent map which frees memory of erased elements while it is in use.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_RECLAIMING_CONCURRENT_MAP_HPP
+#define LIBPMEMOBJ_CPP_RECLAIMING_CONCURRENT_MAP_HPP
+
+#include <libpmemobj++/allocator.hpp>
+#include <libpmemobj++/container/detail/concurrent_skip_list_impl.hpp>
+#include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Variant of concurrent_map which frees memory of elements erased by erase()
+ * while the map is in use, instead of keeping it until unsafe_reclaim(),
+ * clear() or runtime_initialize().
+ *
+ * Each thread pins the current epoch of the map for the duration of a lookup,
+ * insert or erase. An erased element is freed by a later insert or erase of
+ * the erasing thread, once no thread holds a pin taken before the element was
+ * unlinked (epoch-based reclamation). If no thread holds a pin for long, each
+ * thread keeps at most a few hundred erased elements, which are not freed yet.
+ *
+ * The cost is that iterators and references to elements, which may be erased
+ * concurrently, are valid only as long as the thread holds an epoch_guard
+ * created before they were obtained. Elements erased by a thread which stopped
+ * modifying the map are freed by unsafe_reclaim(), clear() or
+ * runtime_initialize().
+ *
+ * The layout is the same as the layout of concurrent_map. The interface,
+ * thread safety and requirements for template parameters are the same as in
+ * concurrent_map. runtime_initialize() must be called each time the pool is
+ * opened, before any other method.
+ */
+template <typename Key, typename Value, typename Comp = std::less<Key>,
+	  typename Allocator =
+		  pmem::obj::allocator<detail::pair<const Key, Value>>>
+class reclaiming_concurrent_map
+    : public detail::concurrent_skip_list<detail::map_traits<
+	      Key, Value, Comp, detail::default_random_generator, Allocator,
+	      false, 64, false, true>> {
+	using traits_type = detail::map_traits<Key, Value, Comp,
+					       detail::default_random_generator,
+					       Allocator, false, 64, false,
+					       true>;
+	using base_type = pmem::detail::concurrent_skip_list<traits_type>;
+
+public:
+	using key_type = typename base_type::key_type;
+	using mapped_type = typename base_type::mapped_type;
+	using value_type = typename base_type::value_type;
+	using size_type = typename base_type::size_type;
+	using difference_type = typename base_type::difference_type;
+	using key_compare = Comp;
+	using allocator_type = Allocator;
+	using reference = typename base_type::reference;
+	using const_reference = typename base_type::const_reference;
+	using pointer = typename base_type::pointer;
+	using const_pointer = typename base_type::const_pointer;
+	using iterator = typename base_type::iterator;
+	using const_iterator = typename base_type::const_iterator;
+	using epoch_guard = typename base_type::epoch_guard;
+
+	/**
+	 * Default constructor.
+	 */
+	reclaiming_concurrent_map() = default;
+
+	/**
+	 * Copy constructor.
+	 */
+	reclaiming_concurrent_map(
+		const reclaiming_concurrent_map &table)
+	    : base_type(table)
+	{
+	}
+
+	/**
+	 * Move constructor.
+	 */
+	reclaiming_concurrent_map(reclaiming_concurrent_map &&table)
+	    : base_type(std::move(table))
+	{
+	}
+
+	/**
+	 * Construct the empty map
+	 */
+	explicit reclaiming_concurrent_map(
+		const key_compare &comp,
+		const allocator_type &alloc = allocator_type())
+	    : base_type(comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with the contents of the range [first, last).
+	 */
+	template <class InputIt>
+	reclaiming_concurrent_map(
+		InputIt first, InputIt last, const key_compare &comp = Comp(),
+		const allocator_type &alloc = allocator_type())
+	    : base_type(first, last, comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with the contents of the range [first, last),
+	 * which should be sorted by keys. See bulk_insert_sorted().
+	 */
+	template <class InputIt>
+	reclaiming_concurrent_map(
+		sorted_range_t tag, InputIt first, InputIt last,
+		const key_compare &comp = Comp(),
+		const allocator_type &alloc = allocator_type())
+	    : base_type(tag, first, last, comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with initializer list
+	 */
+	reclaiming_concurrent_map(std::initializer_list<value_type> ilist)
+	    : base_type(ilist.begin(), ilist.end())
+	{
+	}
+
+	/**
+	 * Assignment operator
+	 */
+	reclaiming_concurrent_map &
+	operator=(const reclaiming_concurrent_map &other)
+	{
+		return static_cast<reclaiming_concurrent_map &>(
+			base_type::operator=(other));
+	}
+
+	/**
+	 * Move-assignment operator
+	 */
+	reclaiming_concurrent_map &
+	operator=(reclaiming_concurrent_map &&other)
+	{
+		return static_cast<reclaiming_concurrent_map &>(
+			base_type::operator=(std::move(other)));
+	}
+
+	/**
+	 * Assignment from initializer list
+	 */
+	reclaiming_concurrent_map &
+	operator=(std::initializer_list<value_type> ilist)
+	{
+		return static_cast<reclaiming_concurrent_map &>(
+			base_type::operator=(ilist));
+	}
+};
+
+/** Non-member swap */
+template <typename Key, typename Value, typename Comp, typename Allocator>
+void
+swap(reclaiming_concurrent_map<Key, Value, Comp, Allocator> &lhs,
+     reclaiming_concurrent_map<Key, Value, Comp, Allocator> &rhs)
+{
+	lhs.swap(rhs);
+}
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_RECLAIMING_CONCURRENT_MAP_HPP */
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Pmem-resident, volatile-reinitialized sequence lock.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_SEQ_SHARED_MUTEX_HPP
+#define LIBPMEMOBJ_CPP_SEQ_SHARED_MUTEX_HPP
+
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/experimental/spin_shared_mutex.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace pmem
+{
+
+namespace obj
+{
+
+namespace experimental
+{
+
+/**
+ * Persistent memory resident sequence lock.
+ *
+ * It is a spin_shared_mutex (and can be used wherever a SharedMutex is
+ * expected, e.g. as the MutexType of concurrent_hash_map) with a sequence
+ * counter, which is odd while the mutex is locked for exclusive access and
+ * is incremented by each writer. It enables optimistic readers, which do
+ * not write to the mutex at all:
+ *
+ *	for (;;) {
+ *		uint64_t s = m.read_begin();
+ *		if (!s)
+ *			continue; // writer in progress, back off
+ *		T copy = data;
+ *		if (m.read_validate(s))
+ *			break; // copy is consistent
+ *	}
+ *
+ * Data read this way may be modified concurrently, so it must be safe to
+ * copy it regardless (e.g. it must be trivially copyable) and the copy may
+ * be used only after successful validation. concurrent_hash_map::find_value()
+ * reads buckets and items this way when seq_shared_mutex is its MutexType.
+ *
+ * Like spin_shared_mutex, the counter is tagged with an identifier of the
+ * process, so a counter left odd by a crashed process does not block
+ * readers. It takes 16 bytes.
+ */
+class seq_shared_mutex {
+public:
+	/**
+	 * Default constructor, the mutex is unlocked.
+	 */
+	constexpr seq_shared_mutex() noexcept : mutex(), seq(0)
+	{
+	}
+
+	/**
+	 * Defaulted destructor.
+	 */
+	~seq_shared_mutex() = default;
+
+	/**
+	 * Deleted assignment operator.
+	 */
+	seq_shared_mutex &operator=(const seq_shared_mutex &) = delete;
+
+	/**
+	 * Deleted copy constructor.
+	 */
+	seq_shared_mutex(const seq_shared_mutex &) = delete;
+
+	/**
+	 * Lock the mutex for exclusive access, see spin_shared_mutex::lock.
+	 * Invalidates all optimistic reads in progress.
+	 */
+	void
+	lock() noexcept
+	{
+		mutex.lock();
+		write_begin();
+	}
+
+	/**
+	 * Lock the mutex for shared access, see
+	 * spin_shared_mutex::lock_shared.
+	 */
+	void
+	lock_shared() noexcept
+	{
+		mutex.lock_shared();
+	}
+
+	/**
+	 * Try to lock the mutex for exclusive access, see
+	 * spin_shared_mutex::try_lock.
+	 *
+	 * @return true on successful lock acquisition, false otherwise.
+	 */
+	bool
+	try_lock() noexcept
+	{
+		if (!mutex.try_lock())
+			return false;
+
+		write_begin();
+
+		return true;
+	}
+
+	/**
+	 * Try to lock the mutex for shared access, see
+	 * spin_shared_mutex::try_lock_shared.
+	 *
+	 * @return true on successful lock acquisition, false otherwise.
+	 */
+	bool
+	try_lock_shared() noexcept
+	{
+		return mutex.try_lock_shared();
+	}
+
+	/**
+	 * Unlock a mutex locked for exclusive access.
+	 */
+	void
+	unlock() noexcept
+	{
+		write_end();
+		mutex.unlock();
+	}
+
+	/**
+	 * Unlock a mutex locked for shared access.
+	 */
+	void
+	unlock_shared() noexcept
+	{
+		mutex.unlock_shared();
+	}
+
+	/**
+	 * Starts an optimistic read.
+	 *
+	 * @return token which should be passed to read_validate() or 0 if
+	 * the mutex is locked for exclusive access.
+	 */
+	uint64_t
+	read_begin() const noexcept
+	{
+		uint64_t w = seq.load(std::memory_order_acquire);
+
+		if (current(w) && (w & 1))
+			return 0;
+
+		return w | token_bit;
+	}
+
+	/**
+	 * @return true if the mutex was not locked for exclusive access since
+	 * read_begin() returned @p s.
+	 */
+	bool
+	read_validate(uint64_t s) const noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		return (seq.load(std::memory_order_relaxed) | token_bit) == s;
+	}
+
+private:
+	enum : uint64_t {
+		counter_mask = (1ULL << 32) - 1,
+		token_bit = 1ULL << 63
+	};
+
+	static uint64_t
+	tag() noexcept
+	{
+		return static_cast<uint64_t>(detail::lock_generation()) << 32;
+	}
+
+	static bool
+	current(uint64_t w) noexcept
+	{
+		return (w & ~counter_mask) == tag();
+	}
+
+	/* Called with the mutex locked for exclusive access */
+	void
+	write_begin() noexcept
+	{
+		uint64_t w = seq.load(std::memory_order_relaxed);
+		uint64_t c = current(w) ? (w & counter_mask) : 0;
+
+#if LIBPMEMOBJ_CPP_VG_PMEMCHECK_ENABLED
+		VALGRIND_PMC_REMOVE_PMEM_MAPPING(&seq, sizeof(seq));
+#endif
+
+		seq.store(tag() | ((c + 1) & counter_mask),
+			  std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void
+	write_end() noexcept
+	{
+		uint64_t w = seq.load(std::memory_order_relaxed);
+
+		seq.store(tag() | ((w + 1) & counter_mask),
+			  std::memory_order_release);
+	}
+
+	spin_shared_mutex mutex;
+	std::atomic<uint64_t> seq;
+};
+
+} /* namespace experimental */
+
+} /* namespace obj */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_SEQ_SHARED_MUTEX_HPP */
@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Pmem-resident, volatile-reinitialized shared spin mutex.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_SPIN_SHARED_MUTEX_HPP
+#define LIBPMEMOBJ_CPP_SPIN_SHARED_MUTEX_HPP
+
+#include <libpmemobj++/detail/atomic_backoff.hpp>
+#include <libpmemobj++/detail/common.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+namespace pmem
+{
+
+namespace detail
+{
+
+/**
+ * Returns a random, non-zero identifier of the current process instance.
+ *
+ * Lock words tagged with a different identifier were written by a process
+ * which does not exist anymore, so they are treated as unlocked.
+ */
+inline uint32_t
+lock_generation()
+{
+	static const uint32_t generation = [] {
+		uint64_t seed = static_cast<uint64_t>(
+			std::chrono::steady_clock::now()
+				.time_since_epoch()
+				.count());
+
+		try {
+			std::random_device rd;
+			seed ^= static_cast<uint64_t>(rd()) << 16;
+		} catch (...) {
+			/* Fall back to the clock only */
+		}
+
+		seed *= 0x9E3779B97F4A7C15ULL;
+
+		/* The highest bit is never set, it marks valid read tokens
+		 * of seq_shared_mutex */
+		return (static_cast<uint32_t>(seed >> 32) & 0x7FFFFFFFU) | 1U;
+	}();
+
+	return generation;
+}
+
+} /* namespace detail */
+
+namespace obj
+{
+
+namespace experimental
+{
+
+/**
+ * Persistent memory resident shared (readers-writer) spin mutex.
+ *
+ * This is a lightweight alternative to pmem::obj::shared_mutex for very
+ * short critical sections, e.g. as the MutexType of concurrent_hash_map.
+ * It takes 8 bytes and never calls into libpmemobj: all operations are
+ * test-and-test-and-set loops on a single atomic word, with exponential
+ * backoff. A waiting writer blocks new readers, so writers are not starved.
+ *
+ * The upper half of the word holds an identifier of the process which
+ * last acquired the mutex (see detail::lock_generation()). State written
+ * by another process (e.g. one that crashed while holding the mutex) is
+ * ignored, so the mutex needs no reinitialization after the pool is
+ * reopened. It is never flushed. Waiting threads do not sleep, hence this
+ * mutex should not be held for a long time nor across blocking calls.
+ *
+ * This class satisfies all requirements of the SharedMutex and
+ * StandardLayoutType concepts. Unlike pmem::obj::shared_mutex, it can be
+ * constructed in volatile memory as well.
+ */
+class spin_shared_mutex {
+public:
+	/**
+	 * Default constructor, the mutex is unlocked.
+	 */
+	constexpr spin_shared_mutex() noexcept : word(0)
+	{
+	}
+
+	/**
+	 * Defaulted destructor.
+	 */
+	~spin_shared_mutex() = default;
+
+	/**
+	 * Deleted assignment operator.
+	 */
+	spin_shared_mutex &operator=(const spin_shared_mutex &) = delete;
+
+	/**
+	 * Deleted copy constructor.
+	 */
+	spin_shared_mutex(const spin_shared_mutex &) = delete;
+
+	/**
+	 * Lock the mutex for exclusive access.
+	 *
+	 * If a different thread already locked this mutex, the calling
+	 * thread will spin. If the same thread tries to lock a mutex
+	 * it already owns, either in exclusive or shared mode,
+	 * the behavior is undefined.
+	 */
+	void
+	lock() noexcept
+	{
+		annotate_pmem();
+
+		for (detail::atomic_backoff backoff;; backoff.pause()) {
+			uint64_t w = word.load(std::memory_order_relaxed);
+			uint64_t s = state(w);
+
+			if ((s & ~writer_pending) == 0) {
+				if (word.compare_exchange_strong(
+					    w, tag() | writer,
+					    std::memory_order_acquire,
+					    std::memory_order_relaxed))
+					break;
+			} else if (!(s & writer_pending)) {
+				/* Block new readers */
+				word.compare_exchange_strong(
+					w, w | writer_pending,
+					std::memory_order_relaxed);
+			}
+		}
+
+		annotate_acquired(true);
+	}
+
+	/**
+	 * Lock the mutex for shared access.
+	 *
+	 * If a different thread already locked this mutex for exclusive
+	 * access or waits to do so, the calling thread will spin. If it was
+	 * locked for shared access by a different thread, the lock will
+	 * succeed. The mutex can be locked for shared access multiple times
+	 * by different threads.
+	 */
+	void
+	lock_shared() noexcept
+	{
+		annotate_pmem();
+
+		for (detail::atomic_backoff backoff; !acquire_shared();
+		     backoff.pause())
+			;
+
+		annotate_acquired(false);
+	}
+
+	/**
+	 * Try to lock the mutex for exclusive access, returns regardless if
+	 * the lock succeeds.
+	 *
+	 * @return true on successful lock acquisition, false otherwise.
+	 */
+	bool
+	try_lock() noexcept
+	{
+		annotate_pmem();
+
+		uint64_t w = word.load(std::memory_order_relaxed);
+		if (state(w) & ~writer_pending)
+			return false;
+
+		if (!word.compare_exchange_strong(w, tag() | writer,
+						  std::memory_order_acquire,
+						  std::memory_order_relaxed))
+			return false;
+
+		annotate_acquired(true);
+
+		return true;
+	}
+
+	/**
+	 * Try to lock the mutex for shared access, returns regardless if the
+	 * lock succeeds.
+	 *
+	 * @return false if a writer holds or waits for the lock, true on
+	 * successful lock acquisition.
+	 */
+	bool
+	try_lock_shared() noexcept
+	{
+		annotate_pmem();
+
+		if (!acquire_shared())
+			return false;
+
+		annotate_acquired(false);
+
+		return true;
+	}
+
+	/**
+	 * Unlock a mutex locked for exclusive access.
+	 *
+	 * If the mutex was not locked for exclusive access, the behavior is
+	 * undefined.
+	 */
+	void
+	unlock() noexcept
+	{
+		annotate_released(true);
+
+		/* Also clears the writer_pending bit, waiting writers set it
+		 * again */
+		word.store(tag(), std::memory_order_release);
+	}
+
+	/**
+	 * Unlock a mutex locked for shared access.
+	 *
+	 * If the mutex was not locked for shared access, the behavior is
+	 * undefined.
+	 */
+	void
+	unlock_shared() noexcept
+	{
+		annotate_released(false);
+
+		word.fetch_sub(1, std::memory_order_release);
+	}
+
+private:
+	enum : uint64_t {
+		writer = 1ULL << 31,
+		writer_pending = 1ULL << 30,
+		readers_mask = writer_pending - 1,
+		state_mask = (1ULL << 32) - 1
+	};
+
+	static uint64_t
+	tag() noexcept
+	{
+		return static_cast<uint64_t>(detail::lock_generation()) << 32;
+	}
+
+	/* State of the mutex in this process, stale state is ignored */
+	static uint64_t
+	state(uint64_t w) noexcept
+	{
+		return (w & ~state_mask) == tag() ? (w & state_mask) : 0;
+	}
+
+	bool
+	acquire_shared() noexcept
+	{
+		uint64_t w = word.load(std::memory_order_relaxed);
+
+		/* w is reloaded by a failed compare_exchange */
+		while (!(state(w) & (writer | writer_pending))) {
+			if (word.compare_exchange_weak(
+				    w, tag() | (state(w) + 1),
+				    std::memory_order_acquire,
+				    std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+
+	void
+	annotate_pmem() noexcept
+	{
+#if LIBPMEMOBJ_CPP_VG_PMEMCHECK_ENABLED
+		/* The word is never flushed, its state is volatile */
+		VALGRIND_PMC_REMOVE_PMEM_MAPPING(&word, sizeof(word));
+#endif
+	}
+
+	void
+	annotate_acquired(bool is_writer) noexcept
+	{
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		ANNOTATE_RWLOCK_ACQUIRED(this, is_writer);
+#else
+		(void)is_writer;
+#endif
+	}
+
+	void
+	annotate_released(bool is_writer) noexcept
+	{
+#if LIBPMEMOBJ_CPP_VG_HELGRIND_ENABLED
+		ANNOTATE_RWLOCK_RELEASED(this, is_writer);
+#else
+		(void)is_writer;
+#endif
+	}
+
+	std::atomic<uint64_t> word;
+};
+
+} /* namespace experimental */
+
+} /* namespace obj */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_SPIN_SHARED_MUTEX_HPP */
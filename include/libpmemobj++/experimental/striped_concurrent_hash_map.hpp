@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Concurrent hash map striped over multiple pools.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_STRIPED_CONCURRENT_HASH_MAP_HPP
+#define LIBPMEMOBJ_CPP_STRIPED_CONCURRENT_HASH_MAP_HPP
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/detail/run_in_threads.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Volatile front-end which stripes items over several
+ * pmem::obj::concurrent_hash_map instances (stripes) by hash range.
+ *
+ * Every stripe may reside in a different pool, e.g. one pool per NUMA node,
+ * so that segments and nodes of each stripe come from memory local to that
+ * node. Hash codes are mixed by multiplication with a 64-bit odd constant
+ * (so that identity hashes of integers are spread as well) and each stripe
+ * owns a contiguous range of the upper 32 bits of the result. Bits of the
+ * original hash code, which select buckets within a stripe, stay uniformly
+ * distributed.
+ *
+ * Operations on a single key have the same semantics and thread safety as
+ * the corresponding operations of concurrent_hash_map, they are just routed
+ * to one stripe. Threads pinned to a NUMA node touch mostly local memory if
+ * the work is partitioned with stripe_of(), e.g. requests for a key are
+ * dispatched to a thread of the node which holds its stripe.
+ *
+ * The stripes are persistent and must be created by the application (in
+ * the pools of its choice). This object only keeps pointers to them, so it
+ * has to be recreated, with stripes in the same order, each time the pools
+ * are opened. runtime_initialize() must be called afterwards, as for
+ * concurrent_hash_map.
+ */
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+	  typename KeyEqual = std::equal_to<Key>,
+	  typename MutexType = pmem::obj::shared_mutex,
+	  typename ScopedLockType = concurrent_hash_map_internal::
+		  shared_mutex_scoped_lock<MutexType>>
+class striped_concurrent_hash_map {
+public:
+	using map_type = concurrent_hash_map<Key, T, Hash, KeyEqual,
+					     MutexType, ScopedLockType>;
+	using key_type = typename map_type::key_type;
+	using mapped_type = typename map_type::mapped_type;
+	using value_type = typename map_type::value_type;
+	using size_type = typename map_type::size_type;
+	using hasher = typename map_type::hasher;
+	using key_equal = typename map_type::key_equal;
+	using accessor = typename map_type::accessor;
+	using const_accessor = typename map_type::const_accessor;
+
+	/**
+	 * Constructs the front-end for given stripes. The order of stripes
+	 * defines hash ranges of items, it must be the same each time the
+	 * stripes are used.
+	 *
+	 * @throw std::invalid_argument if stripes is empty, contains a null
+	 * pointer or has more than 2^32 elements.
+	 */
+	explicit striped_concurrent_hash_map(
+		std::vector<persistent_ptr<map_type>> stripes)
+	    : my_stripes(std::move(stripes))
+	{
+		if (my_stripes.empty())
+			throw std::invalid_argument(
+				"striped_concurrent_hash_map needs at least one stripe");
+
+		if (static_cast<uint64_t>(my_stripes.size()) > max_stripes)
+			throw std::invalid_argument(
+				"too many stripes for striped_concurrent_hash_map");
+
+		for (auto &s : my_stripes) {
+			if (s == nullptr)
+				throw std::invalid_argument(
+					"null stripe of striped_concurrent_hash_map");
+		}
+	}
+
+	/**
+	 * Calls runtime_initialize() of all stripes, each in a separate
+	 * thread.
+	 *
+	 * @throw any exception thrown by runtime_initialize() of a stripe.
+	 */
+	void
+	runtime_initialize()
+	{
+		for_each_stripe([](map_type &m) { m.runtime_initialize(); });
+	}
+
+	/**
+	 * @returns number of stripes.
+	 */
+	size_type
+	stripes_count() const
+	{
+		return my_stripes.size();
+	}
+
+	/**
+	 * @returns stripe number i.
+	 */
+	map_type &
+	stripe(size_type i)
+	{
+		return *my_stripes[i];
+	}
+
+	/**
+	 * @returns stripe number i.
+	 */
+	const map_type &
+	stripe(size_type i) const
+	{
+		return *my_stripes[i];
+	}
+
+	/**
+	 * @returns number of the stripe which keeps an item with given key.
+	 */
+	template <typename K>
+	size_type
+	stripe_of(const K &key) const
+	{
+		uint64_t h = static_cast<uint64_t>(hasher{}(key)) *
+			0x9E3779B97F4A7C15ULL;
+		uint64_t n = static_cast<uint64_t>(my_stripes.size());
+
+		return static_cast<size_type>(((h >> 32) * n) >> 32);
+	}
+
+	/**
+	 * Finds item and acquires lock on it, see concurrent_hash_map::find.
+	 */
+	bool
+	find(const_accessor &result, const key_type &key) const
+	{
+		return route(key).find(result, key);
+	}
+
+	/**
+	 * Finds item and acquires lock on it, see concurrent_hash_map::find.
+	 */
+	bool
+	find(accessor &result, const key_type &key)
+	{
+		return route(key).find(result, key);
+	}
+
+	/**
+	 * Finds item by key-comparable type and acquires lock on it, see
+	 * concurrent_hash_map::find.
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	find(const_accessor &result, const K &key) const
+	{
+		return route(key).find(result, key);
+	}
+
+	/**
+	 * Finds item by key-comparable type and acquires lock on it, see
+	 * concurrent_hash_map::find.
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	find(accessor &result, const K &key)
+	{
+		return route(key).find(result, key);
+	}
+
+	/**
+	 * @returns 1 if item with given key exists, 0 otherwise.
+	 */
+	size_type
+	count(const key_type &key) const
+	{
+		return route(key).count(key);
+	}
+
+	/**
+	 * @returns 1 if item with key equivalent to given key exists, 0
+	 * otherwise.
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	size_type
+	count(const K &key) const
+	{
+		return route(key).count(key);
+	}
+
+	/**
+	 * Inserts item with given key (if not present) and acquires lock on
+	 * it, see concurrent_hash_map::insert.
+	 */
+	bool
+	insert(const_accessor &result, const key_type &key)
+	{
+		return route(key).insert(result, key);
+	}
+
+	/**
+	 * Inserts item with given key (if not present) and acquires lock on
+	 * it, see concurrent_hash_map::insert.
+	 */
+	bool
+	insert(accessor &result, const key_type &key)
+	{
+		return route(key).insert(result, key);
+	}
+
+	/**
+	 * Inserts item (if not present) and acquires lock on it, see
+	 * concurrent_hash_map::insert.
+	 */
+	bool
+	insert(const_accessor &result, const value_type &value)
+	{
+		return route(value.first).insert(result, value);
+	}
+
+	/**
+	 * Inserts item (if not present) and acquires lock on it, see
+	 * concurrent_hash_map::insert.
+	 */
+	bool
+	insert(accessor &result, const value_type &value)
+	{
+		return route(value.first).insert(result, value);
+	}
+
+	/**
+	 * Inserts item if not present, see concurrent_hash_map::insert.
+	 */
+	bool
+	insert(const value_type &value)
+	{
+		return route(value.first).insert(value);
+	}
+
+	/**
+	 * Inserts item if there is no such key present already, assigns
+	 * provided value otherwise, see concurrent_hash_map::insert_or_assign.
+	 */
+	template <typename M>
+	bool
+	insert_or_assign(const key_type &key, M &&obj)
+	{
+		return route(key).insert_or_assign(key, std::forward<M>(obj));
+	}
+
+	/**
+	 * Inserts item if there is no such key-comparable type present
+	 * already, assigns provided value otherwise, see
+	 * concurrent_hash_map::insert_or_assign.
+	 */
+	template <
+		typename K, typename M,
+		typename = typename std::enable_if<
+			concurrent_hash_map_internal::has_transparent_key_equal<
+				hasher>::value &&
+				std::is_constructible<key_type, K>::value,
+			K>::type>
+	bool
+	insert_or_assign(K &&key, M &&obj)
+	{
+		return route(key).insert_or_assign(std::forward<K>(key),
+						   std::forward<M>(obj));
+	}
+
+	/**
+	 * Removes item with given key, see concurrent_hash_map::erase.
+	 */
+	bool
+	erase(const key_type &key)
+	{
+		return route(key).erase(key);
+	}
+
+	/**
+	 * Removes item with key equivalent to given key, see
+	 * concurrent_hash_map::erase.
+	 */
+	template <typename K,
+		  typename = typename std::enable_if<
+			  concurrent_hash_map_internal::
+				  has_transparent_key_equal<hasher>::value,
+			  K>::type>
+	bool
+	erase(const K &key)
+	{
+		return route(key).erase(key);
+	}
+
+	/**
+	 * @returns number of items in all stripes.
+	 */
+	size_type
+	size() const
+	{
+		size_type sz = 0;
+		for (auto &s : my_stripes)
+			sz += s->size();
+
+		return sz;
+	}
+
+	/**
+	 * @returns sum of approximate sizes of all stripes, see
+	 * concurrent_hash_map::approximate_size.
+	 */
+	size_type
+	approximate_size() const
+	{
+		size_type sz = 0;
+		for (auto &s : my_stripes)
+			sz += s->approximate_size();
+
+		return sz;
+	}
+
+	/**
+	 * @returns true if size()==0.
+	 */
+	bool
+	empty() const
+	{
+		return size() == 0;
+	}
+
+	/**
+	 * Clears all stripes, each in a separate thread. Not thread safe.
+	 *
+	 * @throw any exception thrown by clear() of a stripe.
+	 */
+	void
+	clear()
+	{
+		for_each_stripe([](map_type &m) { m.clear(); });
+	}
+
+	/**
+	 * Calls f for each stripe, in a separate thread per stripe. Can be
+	 * used for operations which are not provided by this front-end, e.g.
+	 * iteration, defragmentation or free_data().
+	 *
+	 * @throw the first exception thrown by f, after all threads finished.
+	 */
+	template <typename F>
+	void
+	for_each_stripe(F f)
+	{
+		detail::run_in_threads(my_stripes.size(), [&](size_type i) {
+			f(*my_stripes[i]);
+		});
+	}
+
+private:
+	enum : uint64_t { max_stripes = uint64_t(1) << 32 };
+
+	template <typename K>
+	map_type &
+	route(const K &key) const
+	{
+		return *my_stripes[stripe_of(key)];
+	}
+
+	std::vector<persistent_ptr<map_type>> my_stripes;
+};
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_STRIPED_CONCURRENT_HASH_MAP_HPP */
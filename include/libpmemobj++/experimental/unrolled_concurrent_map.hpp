@@ -0,0 +1,749 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Concurrent map which stores sorted blocks of items in nodes of a skip list.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_UNROLLED_CONCURRENT_MAP_HPP
+#define LIBPMEMOBJ_CPP_UNROLLED_CONCURRENT_MAP_HPP
+
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/pexceptions.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/shared_mutex.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace pmem
+{
+
+namespace obj
+{
+
+namespace experimental
+{
+
+/**
+ * Persistent memory aware concurrent ordered map, which stores items in
+ * sorted blocks of up to BlockSize items (an unrolled skip list).
+ *
+ * Blocks are values of a concurrent_map, keyed by their fence key: every key
+ * in a block is greater than the fence key of the previous block and not
+ * greater than the fence key of the block. Keys greater than all fence keys
+ * are stored in the tail block, which is not in the map. A full block is
+ * split in two steps: the lower half of its items is copied to a new block,
+ * which is inserted into the map with the largest of those keys as its fence
+ * key, and then the items are removed from the old block, in a transaction.
+ * Items are never moved between blocks otherwise and blocks are not freed
+ * before clear(). If a split is interrupted by a crash, the items copied to
+ * the new block are removed from the old one by runtime_initialize().
+ *
+ * Compared to concurrent_map, there is one allocation, one lock and one
+ * tower of skip list pointers per block instead of per item and a scan
+ * reads items stored next to each other in a block. The cost is that
+ * inserts and erases move up to BlockSize items within the block, in a
+ * transaction.
+ *
+ * Every block is protected by a shared_mutex. A lookup of a block is
+ * repeated after the block is locked, and if another block is found, because
+ * the block was split in the meantime, the lookup is retried. Items can move
+ * when blocks are modified, so there are no iterators: find(), update(),
+ * for_each() and scan() call a function with the block of the item locked.
+ *
+ * Key and T must be copy constructible, to be copied when a block is split,
+ * and move constructible, to be moved within a block.
+ *
+ * runtime_initialize() MUST be called every time after process restart.
+ */
+template <typename Key, typename T, typename Comp = std::less<Key>,
+	  std::size_t BlockSize = 16>
+class unrolled_concurrent_map {
+	static_assert(BlockSize >= 2, "Block must hold at least 2 items");
+
+public:
+	using key_type = Key;
+	using mapped_type = T;
+	using value_type = detail::pair<const Key, T>;
+	using size_type = std::size_t;
+	using key_compare = Comp;
+
+private:
+	using storage_type =
+		typename std::aligned_storage<sizeof(value_type),
+					      alignof(value_type)>::type;
+
+	struct block {
+		block() : count(0)
+		{
+		}
+
+		/* Copies n items starting at first */
+		block(const value_type *first, size_type n) : count(0)
+		{
+			for (size_type i = 0; i < n; ++i)
+				new (data() + i) value_type(first[i]);
+
+			count = n;
+		}
+
+		block(const block &) = delete;
+		block &operator=(const block &) = delete;
+
+		~block()
+		{
+			clear();
+		}
+
+		value_type *
+		data()
+		{
+			return reinterpret_cast<value_type *>(&entries[0]);
+		}
+
+		const value_type *
+		data() const
+		{
+			return reinterpret_cast<const value_type *>(
+				&entries[0]);
+		}
+
+		/* Returns position of the first item not less than key */
+		template <typename K>
+		size_type
+		lower_bound(const K &key, const key_compare &comp) const
+		{
+			return static_cast<size_type>(
+				std::lower_bound(data(), data() + count, key,
+						 [&](const value_type &v,
+						     const K &k) {
+							 return comp(v.first,
+								     k);
+						 }) -
+				data());
+		}
+
+		/* Should be called inside a transaction */
+		template <typename... Args>
+		void
+		insert_at(size_type pos, Args &&... args)
+		{
+			assert(count < BlockSize);
+
+			size_type n = count;
+
+			detail::conditional_add_to_tx(&entries[pos],
+						      n + 1 - pos);
+			detail::conditional_add_to_tx(&count);
+
+			for (size_type i = n; i > pos; --i) {
+				new (data() + i) value_type(
+					std::move(data()[i - 1]));
+				data()[i - 1].~value_type();
+			}
+
+			new (data() + pos) value_type(
+				std::forward<Args>(args)...);
+
+			count = n + 1;
+		}
+
+		/* Removes n items starting at pos. Should be called inside a
+		 * transaction */
+		void
+		erase(size_type pos, size_type n)
+		{
+			size_type c = count;
+
+			assert(pos + n <= c);
+
+			detail::conditional_add_to_tx(&entries[pos], c - pos);
+			detail::conditional_add_to_tx(&count);
+
+			for (size_type i = pos; i < pos + n; ++i)
+				data()[i].~value_type();
+
+			for (size_type i = pos + n; i < c; ++i) {
+				new (data() + i - n)
+					value_type(std::move(data()[i]));
+				data()[i].~value_type();
+			}
+
+			count = c - n;
+		}
+
+		/* Should be called inside a transaction */
+		void
+		clear()
+		{
+			erase(0, count);
+		}
+
+		mutable obj::shared_mutex mutex;
+
+		p<size_type> count;
+
+		storage_type entries[BlockSize];
+	};
+
+	using block_map_type = concurrent_map<Key, block, Comp>;
+	using block_map_iterator = typename block_map_type::iterator;
+
+	struct do_nothing {
+		void
+		operator()(value_type &) const
+		{
+		}
+	};
+
+	class block_lock {
+	public:
+		explicit block_lock(bool writer) : b(nullptr), writer(writer)
+		{
+		}
+
+		block_lock(const block_lock &) = delete;
+		block_lock &operator=(const block_lock &) = delete;
+
+		~block_lock()
+		{
+			release();
+		}
+
+		void
+		acquire(block *blk)
+		{
+			assert(b == nullptr);
+
+			if (writer)
+				blk->mutex.lock();
+			else
+				blk->mutex.lock_shared();
+
+			b = blk;
+		}
+
+		void
+		release()
+		{
+			if (b == nullptr)
+				return;
+
+			if (writer)
+				b->mutex.unlock();
+			else
+				b->mutex.unlock_shared();
+
+			b = nullptr;
+		}
+
+	private:
+		block *b;
+		bool writer;
+	};
+
+public:
+	/**
+	 * Constructs an empty map.
+	 * Should be called inside a transaction (e.g. by make_persistent).
+	 */
+	unrolled_concurrent_map() = default;
+
+	unrolled_concurrent_map(const unrolled_concurrent_map &) = delete;
+	unrolled_concurrent_map &
+	operator=(const unrolled_concurrent_map &) = delete;
+
+	/**
+	 * Initialize persistent map after process restart: restores the map
+	 * of blocks and removes items which were copied by a split
+	 * interrupted by a crash from the split block.
+	 * MUST be called every time after process restart.
+	 * Not thread safe.
+	 *
+	 * @throw pmem::transaction_error when a transaction fails.
+	 */
+	void
+	runtime_initialize()
+	{
+		blocks.runtime_initialize();
+
+		pool_base pop = get_pool_base();
+		const key_type *prev_fence = nullptr;
+
+		auto restore = [&](block &b) {
+			if (prev_fence == nullptr)
+				return;
+
+			size_type n = 0;
+			while (n < b.count &&
+			       !comp(*prev_fence, b.data()[n].first))
+				++n;
+
+			if (n == 0)
+				return;
+
+			flat_transaction::run(pop, [&] { b.erase(0, n); });
+		};
+
+		for (auto &e : blocks) {
+			restore(e.second);
+			prev_fence = &e.first;
+		}
+
+		restore(tail);
+	}
+
+	/**
+	 * Removes all items and frees all blocks.
+	 * Not thread safe.
+	 *
+	 * @throw pmem::transaction_error when a transaction fails.
+	 */
+	void
+	clear()
+	{
+		pool_base pop = get_pool_base();
+
+		flat_transaction::run(pop, [&] {
+			blocks.clear();
+			tail.clear();
+		});
+	}
+
+	/**
+	 * Inserts a copy of @p value if there is no item with the same key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted.
+	 * @throw pmem::transaction_error when a transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	insert(const value_type &value)
+	{
+		return internal_insert(value.first, do_nothing{}, value);
+	}
+
+	/**
+	 * Moves @p value into the map if there is no item with the same key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted.
+	 * @throw pmem::transaction_error when a transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	insert(value_type &&value)
+	{
+		return internal_insert(value.first, do_nothing{},
+				       std::move(value));
+	}
+
+	/**
+	 * Inserts an item with @p key and @p obj or, if the key is already
+	 * present, assigns @p obj to its mapped value in a transaction.
+	 * Thread safe.
+	 *
+	 * @return true if the item was inserted, false if it was assigned.
+	 * @throw pmem::transaction_error when a transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	template <typename M>
+	bool
+	insert_or_assign(const key_type &key, M &&obj)
+	{
+		return internal_insert(
+			key,
+			[&](value_type &v) { v.second = std::forward<M>(obj); },
+			key, std::forward<M>(obj));
+	}
+
+	/**
+	 * Calls f(const value_type &) for the item with @p key, with its
+	 * block locked for shared access. f must not access the map.
+	 * Thread safe.
+	 *
+	 * @return true if the item was found.
+	 */
+	template <typename F>
+	bool
+	find(const key_type &key, F f) const
+	{
+		auto self = const_cast<unrolled_concurrent_map *>(this);
+
+		block_lock lock(false);
+		block *b = self->lock_block(key, lock);
+		size_type pos = b->lower_bound(key, comp);
+
+		if (!found(b, pos, key))
+			return false;
+
+		f(static_cast<const value_type &>(b->data()[pos]));
+
+		return true;
+	}
+
+	/**
+	 * Calls f(mapped_type &) for the item with @p key in a transaction,
+	 * with its block locked for exclusive access, so modifications of
+	 * p<> members are persisted atomically. f must not access the map.
+	 * Thread safe.
+	 *
+	 * @return true if the item was found.
+	 * @throw pmem::transaction_error when the transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 * @throw rethrows exception thrown by f.
+	 */
+	template <typename F>
+	bool
+	update(const key_type &key, F f)
+	{
+		check_outside_tx();
+
+		block_lock lock(true);
+		block *b = lock_block(key, lock);
+		size_type pos = b->lower_bound(key, comp);
+
+		if (!found(b, pos, key))
+			return false;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] { f(b->data()[pos].second); });
+
+		return true;
+	}
+
+	/**
+	 * @return 1 if an item with @p key is present, 0 otherwise.
+	 * Thread safe.
+	 */
+	size_type
+	count(const key_type &key) const
+	{
+		return find(key, [](const value_type &) {}) ? 1 : 0;
+	}
+
+	/**
+	 * Removes the item with @p key.
+	 * Thread safe.
+	 *
+	 * @return true if the item was removed.
+	 * @throw pmem::transaction_error when a transaction fails.
+	 * @throw pmem::transaction_scope_error if called inside transaction
+	 */
+	bool
+	erase(const key_type &key)
+	{
+		check_outside_tx();
+
+		block_lock lock(true);
+		block *b = lock_block(key, lock);
+		size_type pos = b->lower_bound(key, comp);
+
+		if (!found(b, pos, key))
+			return false;
+
+		pool_base pop = get_pool_base();
+		flat_transaction::run(pop, [&] { b->erase(pos, 1); });
+
+		return true;
+	}
+
+	/**
+	 * Calls f(const value_type &) for items with keys not less than
+	 * @p key, in ascending order of keys, until f returns false. Blocks
+	 * are locked for shared access one at a time, so items inserted or
+	 * erased concurrently may or may not be visited. f must not access
+	 * the map.
+	 * Thread safe.
+	 */
+	template <typename F>
+	void
+	scan(const key_type &key, F f) const
+	{
+		auto self = const_cast<unrolled_concurrent_map *>(this);
+
+		block_lock lock(false);
+		const key_type *fence = nullptr;
+		block *b = self->lock_block(
+			[&] { return self->blocks.lower_bound(key); }, lock,
+			fence);
+
+		for (size_type pos = b->lower_bound(key, comp);;) {
+			for (; pos < b->count; ++pos)
+				if (!f(static_cast<const value_type &>(
+					    b->data()[pos])))
+					return;
+
+			if (fence == nullptr)
+				return;
+
+			/* Next block is looked up by the fence key of the
+			 * current one, which is never erased */
+			const key_type &prev = *fence;
+
+			lock.release();
+			b = self->lock_block(
+				[&] { return self->blocks.upper_bound(prev); },
+				lock, fence);
+			pos = 0;
+		}
+	}
+
+	/**
+	 * Calls f(const value_type &) for all items, in ascending order of
+	 * keys. Blocks are locked for shared access one at a time.
+	 * f must not access the map.
+	 * Thread safe.
+	 */
+	template <typename F>
+	void
+	for_each(F f) const
+	{
+		auto self = const_cast<unrolled_concurrent_map *>(this);
+
+		block_lock lock(false);
+		const key_type *fence = nullptr;
+		block *b = self->lock_block(
+			[&] { return self->blocks.begin(); }, lock, fence);
+
+		while (true) {
+			for (size_type pos = 0; pos < b->count; ++pos)
+				f(static_cast<const value_type &>(
+					b->data()[pos]));
+
+			if (fence == nullptr)
+				return;
+
+			const key_type &prev = *fence;
+
+			lock.release();
+			b = self->lock_block(
+				[&] { return self->blocks.upper_bound(prev); },
+				lock, fence);
+		}
+	}
+
+	/**
+	 * @return number of items in the map. If the map is modified
+	 * concurrently, the result is approximate.
+	 */
+	size_type
+	size() const
+	{
+		size_type result = 0;
+
+		auto count_block = [&](const block &b) {
+			b.mutex.lock_shared();
+			result += b.count;
+			b.mutex.unlock_shared();
+		};
+
+		for (auto &e : blocks)
+			count_block(e.second);
+
+		count_block(tail);
+
+		return result;
+	}
+
+	/**
+	 * @return true if the map is empty.
+	 */
+	bool
+	empty() const
+	{
+		return size() == 0;
+	}
+
+	/**
+	 * @return number of blocks, including the tail block.
+	 */
+	size_type
+	block_count() const
+	{
+		return blocks.size() + 1;
+	}
+
+	/**
+	 * @return max number of items in a block.
+	 */
+	static constexpr size_type
+	block_size()
+	{
+		return BlockSize;
+	}
+
+private:
+	pool_base
+	get_pool_base() const
+	{
+		PMEMobjpool *pop = pmemobj_pool_by_ptr(this);
+
+		return pool_base(pop);
+	}
+
+	void
+	check_outside_tx() const
+	{
+		if (pmemobj_tx_stage() != TX_STAGE_NONE)
+			throw pmem::transaction_scope_error(
+				"Function called inside transaction scope.");
+	}
+
+	bool
+	found(const block *b, size_type pos, const key_type &key) const
+	{
+		return pos < b->count && !comp(key, b->data()[pos].first);
+	}
+
+	block *
+	block_of(block_map_iterator it, const key_type *&fence)
+	{
+		if (it == blocks.end()) {
+			fence = nullptr;
+			return &tail;
+		}
+
+		fence = &it->first;
+		return &it->second;
+	}
+
+	/*
+	 * Locks the block found by lookup, which returns an iterator of
+	 * the map of blocks. The lookup is repeated after the block is
+	 * locked, to check that the block was not split in the meantime.
+	 */
+	template <typename Lookup>
+	block *
+	lock_block(Lookup lookup, block_lock &lock, const key_type *&fence)
+	{
+		while (true) {
+			block *b = block_of(lookup(), fence);
+
+			lock.acquire(b);
+
+			const key_type *f;
+			if (block_of(lookup(), f) == b)
+				return b;
+
+			lock.release();
+		}
+	}
+
+	/* Locks the block, to which key belongs */
+	block *
+	lock_block(const key_type &key, block_lock &lock)
+	{
+		const key_type *fence;
+
+		return lock_block([&] { return blocks.lower_bound(key); },
+				  lock, fence);
+	}
+
+	/*
+	 * Inserts an item constructed from args to the block of key or, if
+	 * the key is already present, calls on_found(value_type &) in a
+	 * transaction. A full block is split before the item is inserted.
+	 */
+	template <typename OnFound, typename... Args>
+	bool
+	internal_insert(const key_type &key, OnFound on_found,
+			Args &&... args)
+	{
+		check_outside_tx();
+
+		pool_base pop = get_pool_base();
+
+		while (true) {
+			block_lock lock(true);
+			const key_type *fence;
+			block *b = lock_block(
+				[&] { return blocks.lower_bound(key); }, lock,
+				fence);
+
+			size_type pos = b->lower_bound(key, comp);
+
+			if (found(b, pos, key)) {
+				call_on_found(pop, on_found, b->data()[pos]);
+				return false;
+			}
+
+			if (b->count < BlockSize) {
+				flat_transaction::run(pop, [&] {
+					b->insert_at(
+						pos,
+						std::forward<Args>(args)...);
+				});
+
+				return true;
+			}
+
+			split(pop, b);
+		}
+	}
+
+	template <typename OnFound>
+	void
+	call_on_found(pool_base &pop, OnFound &on_found, value_type &v)
+	{
+		flat_transaction::run(pop, [&] { on_found(v); });
+	}
+
+	void
+	call_on_found(pool_base &, do_nothing &, value_type &)
+	{
+	}
+
+	/*
+	 * Moves the lower half of items of the full, locked block b to a new
+	 * block. Items are copied to the new block, which becomes visible
+	 * to lookups when it is inserted into the map, and then removed from
+	 * b, so each item is in at least one block at any time. Both blocks
+	 * contain copied items only while b is locked.
+	 */
+	void
+	split(pool_base &pop, block *b)
+	{
+		size_type half = BlockSize / 2;
+
+		auto result = blocks.emplace(
+			std::piecewise_construct,
+			std::forward_as_tuple(b->data()[half - 1].first),
+			std::forward_as_tuple(
+				static_cast<const value_type *>(b->data()),
+				half));
+
+		assert(result.second);
+		(void)result;
+
+		flat_transaction::run(pop, [&] { b->erase(0, half); });
+	}
+
+	block_map_type blocks;
+
+	/* Block of keys greater than all fence keys */
+	block tail;
+
+	key_compare comp;
+};
+
+} /* namespace experimental */
+
+} /* namespace obj */
+
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_UNROLLED_CONCURRENT_MAP_HPP */
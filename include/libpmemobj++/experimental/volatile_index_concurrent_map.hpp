@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/**
+ * @file
+ * Concurrent map with levels of the skip list above 0 in volatile memory.
+ */
+
+#ifndef LIBPMEMOBJ_CPP_VOLATILE_INDEX_CONCURRENT_MAP_HPP
+#define LIBPMEMOBJ_CPP_VOLATILE_INDEX_CONCURRENT_MAP_HPP
+
+#include <libpmemobj++/allocator.hpp>
+#include <libpmemobj++/container/detail/concurrent_skip_list_impl.hpp>
+#include <libpmemobj++/detail/pair.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Variant of concurrent_map which stores only level 0 of the skip list (the
+ * sorted linked list of all elements) in persistent memory. Levels above 0,
+ * which are used only to speed up searches, are stored in volatile memory.
+ *
+ * An insert persists only the pointers of level 0 and searches follow
+ * pointers in volatile memory until they reach level 0. The cost is that
+ * levels above 0 are lost on restart. runtime_initialize() rebuilds them
+ * from level 0, so it takes time linear in the size of the map.
+ * runtime_initialize(num_threads) rebuilds them in parallel.
+ *
+ * The interface, thread safety and requirements for template parameters are
+ * the same as in concurrent_map. runtime_initialize() must be called each
+ * time the pool is opened, before any other method.
+ */
+template <typename Key, typename Value, typename Comp = std::less<Key>,
+	  typename Allocator =
+		  pmem::obj::allocator<detail::pair<const Key, Value>>>
+class volatile_index_concurrent_map
+    : public detail::concurrent_skip_list<detail::map_traits<
+	      Key, Value, Comp, detail::default_random_generator, Allocator,
+	      false, 64, true>> {
+	using traits_type = detail::map_traits<Key, Value, Comp,
+					       detail::default_random_generator,
+					       Allocator, false, 64, true>;
+	using base_type = pmem::detail::concurrent_skip_list<traits_type>;
+
+public:
+	using key_type = typename base_type::key_type;
+	using mapped_type = typename base_type::mapped_type;
+	using value_type = typename base_type::value_type;
+	using size_type = typename base_type::size_type;
+	using difference_type = typename base_type::difference_type;
+	using key_compare = Comp;
+	using allocator_type = Allocator;
+	using reference = typename base_type::reference;
+	using const_reference = typename base_type::const_reference;
+	using pointer = typename base_type::pointer;
+	using const_pointer = typename base_type::const_pointer;
+	using iterator = typename base_type::iterator;
+	using const_iterator = typename base_type::const_iterator;
+
+	/**
+	 * Default constructor.
+	 */
+	volatile_index_concurrent_map() = default;
+
+	/**
+	 * Copy constructor.
+	 */
+	volatile_index_concurrent_map(
+		const volatile_index_concurrent_map &table)
+	    : base_type(table)
+	{
+	}
+
+	/**
+	 * Move constructor.
+	 */
+	volatile_index_concurrent_map(volatile_index_concurrent_map &&table)
+	    : base_type(std::move(table))
+	{
+	}
+
+	/**
+	 * Construct the empty map
+	 */
+	explicit volatile_index_concurrent_map(
+		const key_compare &comp,
+		const allocator_type &alloc = allocator_type())
+	    : base_type(comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with the contents of the range [first, last).
+	 */
+	template <class InputIt>
+	volatile_index_concurrent_map(
+		InputIt first, InputIt last, const key_compare &comp = Comp(),
+		const allocator_type &alloc = allocator_type())
+	    : base_type(first, last, comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with the contents of the range [first, last),
+	 * which should be sorted by keys. See bulk_insert_sorted().
+	 */
+	template <class InputIt>
+	volatile_index_concurrent_map(
+		sorted_range_t tag, InputIt first, InputIt last,
+		const key_compare &comp = Comp(),
+		const allocator_type &alloc = allocator_type())
+	    : base_type(tag, first, last, comp, alloc)
+	{
+	}
+
+	/**
+	 * Constructs the map with initializer list
+	 */
+	volatile_index_concurrent_map(std::initializer_list<value_type> ilist)
+	    : base_type(ilist.begin(), ilist.end())
+	{
+	}
+
+	/**
+	 * Assignment operator
+	 */
+	volatile_index_concurrent_map &
+	operator=(const volatile_index_concurrent_map &other)
+	{
+		return static_cast<volatile_index_concurrent_map &>(
+			base_type::operator=(other));
+	}
+
+	/**
+	 * Move-assignment operator
+	 */
+	volatile_index_concurrent_map &
+	operator=(volatile_index_concurrent_map &&other)
+	{
+		return static_cast<volatile_index_concurrent_map &>(
+			base_type::operator=(std::move(other)));
+	}
+
+	/**
+	 * Assignment from initializer list
+	 */
+	volatile_index_concurrent_map &
+	operator=(std::initializer_list<value_type> ilist)
+	{
+		return static_cast<volatile_index_concurrent_map &>(
+			base_type::operator=(ilist));
+	}
+};
+
+/** Non-member swap */
+template <typename Key, typename Value, typename Comp, typename Allocator>
+void
+swap(volatile_index_concurrent_map<Key, Value, Comp, Allocator> &lhs,
+     volatile_index_concurrent_map<Key, Value, Comp, Allocator> &rhs)
+{
+	lhs.swap(rhs);
+}
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* LIBPMEMOBJ_CPP_VOLATILE_INDEX_CONCURRENT_MAP_HPP */
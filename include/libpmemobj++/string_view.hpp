@@ -10,9 +10,11 @@
 #define LIBPMEMOBJ_CPP_STRING_VIEW
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 
 #if __cpp_lib_string_view
@@ -1329,6 +1331,67 @@ operator>=(
 }
 #endif
 
+/**
+ * Hash function object for strings of a given character type.
+ *
+ * Every argument is hashed through its basic_string_view, so
+ * pmem::obj::basic_string, std::basic_string, basic_string_view and
+ * null-terminated character arrays of the same content produce the same
+ * hash value. Together with the nested transparent_key_equal this allows
+ * heterogeneous, allocation-free lookups in containers such as
+ * pmem::obj::concurrent_hash_map, e.g.
+ * concurrent_hash_map<string, V, string_hash>::find(acc, "key").
+ *
+ * The hash is 64-bit FNV-1a and does not depend on the program run, so it
+ * may be used for keys of persistent containers.
+ */
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+struct basic_string_hash {
+	using view_type = basic_string_view<CharT, Traits>;
+
+	/**
+	 * Equality comparator for any pair of types convertible to view_type.
+	 */
+	struct transparent_key_equal {
+		template <typename L, typename R>
+		bool
+		operator()(const L &lhs, const R &rhs) const
+		{
+			view_type l(lhs), r(rhs);
+			return l.size() == r.size() && l.compare(r) == 0;
+		}
+	};
+
+	/**
+	 * Returns hash of the characters referenced by str.
+	 */
+	template <typename S>
+	std::size_t
+	operator()(const S &str) const
+	{
+		return hash(view_type(str));
+	}
+
+private:
+	static std::size_t
+	hash(view_type sv) noexcept
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (auto c : sv) {
+			h ^= static_cast<uint64_t>(
+				static_cast<typename std::make_unsigned<
+					CharT>::type>(c));
+			h *= 1099511628211ULL;
+		}
+		return static_cast<std::size_t>(h);
+	}
+};
+
+using string_hash = basic_string_hash<char>;
+using wstring_hash = basic_string_hash<wchar_t>;
+using u16string_hash = basic_string_hash<char16_t>;
+using u32string_hash = basic_string_hash<char32_t>;
+
 } /* namespace obj */
 } /* namespace pmem */
 
@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_cuckoo_map.cpp -- pmem::obj::experimental::concurrent_cuckoo_map
+ * test of single-threaded and concurrent operations, growth of the table and
+ * reopen of the pool.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/concurrent_cuckoo_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <string>
+
+#define LAYOUT "concurrent_cuckoo_map"
+
+namespace nvobj = pmem::obj;
+namespace nvobjex = pmem::obj::experimental;
+
+namespace
+{
+
+typedef nvobjex::concurrent_cuckoo_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+typedef nvobjex::concurrent_cuckoo_map<nvobj::string, nvobj::string,
+				       nvobj::string_hash>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<string_map_type> string_map;
+};
+
+int
+value_of(persistent_map_type &map, int key)
+{
+	int result = -1;
+	map.find(key, [&](const value_type &v) { result = v.second; });
+
+	return result;
+}
+
+/*
+ * basic_test -- (internal) test single-threaded operations, which grow the
+ * table from the embedded buckets
+ */
+void
+basic_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	UT_ASSERT(map->empty());
+	UT_ASSERTeq(map->bucket_count(), 2);
+	UT_ASSERTeq(map->count(0), 0);
+	UT_ASSERT(!map->erase(0));
+
+	const int n = 50000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	UT_ASSERTeq(map->size(), size_t(n));
+	UT_ASSERT(map->bucket_count() * map->bucket_size() >= size_t(n));
+
+	for (int i = 0; i < n; ++i) {
+		UT_ASSERT(!map->insert(value_type(i, i + 1)));
+		UT_ASSERTeq(value_of(*map, i), i);
+	}
+
+	UT_ASSERTeq(map->count(n), 0);
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(!map->insert_or_assign(i, i + 1));
+	UT_ASSERT(map->insert_or_assign(n, n));
+
+	for (int i = 1; i < n; i += 2)
+		UT_ASSERT(map->update(
+			i, [](nvobj::p<int> &v) { v = v.get_ro() + 1; }));
+	UT_ASSERT(!map->update(n + 1, [](nvobj::p<int> &) {}));
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(value_of(*map, i), i + 1);
+
+	for (int i = 0; i <= n; i += 2)
+		UT_ASSERT(map->erase(i));
+
+	UT_ASSERTeq(map->size(), size_t(n / 2));
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(map->count(i), size_t(i % 2));
+
+	map->clear();
+
+	UT_ASSERT(map->empty());
+	UT_ASSERTeq(map->bucket_count(), 2);
+	UT_ASSERTeq(map->count(1), 0);
+}
+
+/*
+ * concurrent_test -- (internal) test concurrent inserts, lookups and erases,
+ * and that the map is consistent after the pool is reopened
+ */
+void
+concurrent_test(nvobj::pool<root> &pop, const std::string &path,
+		size_t concurrency)
+{
+	const int thread_items = 5000;
+	const int n = static_cast<int>(concurrency) * thread_items;
+
+	{
+		auto map = pop.root()->cons;
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+			for (int i = begin; i < begin + thread_items; ++i) {
+				UT_ASSERT(map->insert(value_type(i, i)));
+
+				/* Items of this thread are never missed,
+				 * while other threads move and split them */
+				int key = begin + (i - begin) / 2;
+				UT_ASSERTeq(value_of(*map, key), key);
+			}
+		});
+
+		UT_ASSERTeq(map->size(), size_t(n));
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+
+			/* Odd keys are not erased, so each of them is
+			 * updated by every thread */
+			for (int i = 0; i < n; ++i)
+				map->update(i, [](nvobj::p<int> &v) {
+					v = v.get_ro() + 1;
+				});
+
+			for (int i = begin; i < begin + thread_items; i += 2)
+				UT_ASSERT(map->erase(i));
+		});
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		for (int i = 0; i < n; ++i) {
+			if (i % 2 == 0)
+				UT_ASSERTeq(map->count(i), 0);
+			else
+				UT_ASSERTeq(value_of(*map, i),
+					    i + static_cast<int>(concurrency));
+		}
+
+		map->clear();
+	}
+}
+
+/*
+ * string_test -- (internal) test keys and values which are not trivially
+ * copyable
+ */
+void
+string_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->string_map;
+
+	const int n = 2000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert_or_assign("key-" + std::to_string(i),
+						std::to_string(i)));
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(!map->insert_or_assign("key-" + std::to_string(i),
+						 "updated"));
+
+	UT_ASSERTeq(map->size(), size_t(n));
+
+	for (int i = 0; i < n; ++i) {
+		std::string expected = i % 2 ? std::to_string(i) : "updated";
+
+		UT_ASSERT(map->find("key-" + std::to_string(i),
+				    [&](const string_map_type::value_type &v) {
+					    UT_ASSERT(v.second.compare(
+							      expected) == 0);
+				    }));
+	}
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 40, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->string_map =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	basic_test(pop);
+	concurrent_test(pop, path, concurrency);
+	string_test(pop);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<string_map_type>(
+			pop.root()->string_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
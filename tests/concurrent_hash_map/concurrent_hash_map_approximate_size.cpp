@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_approximate_size.cpp -- pmem::obj::concurrent_hash_map
+ * test of size() and approximate_size().
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<persistent_map_type> cons2;
+};
+
+/* Upper bound of changes which are not visible in approximate_size() */
+const size_t max_unfolded = 64 * 32;
+
+size_t
+abs_diff(size_t a, size_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/*
+ * single_thread_test -- (internal) test both sizes in a single thread
+ */
+void
+single_thread_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	UT_ASSERTeq(map->size(), 0);
+	UT_ASSERTeq(map->approximate_size(), 0);
+
+	/* Changes below the fold threshold are not visible */
+	UT_ASSERT(map->insert(value_type(0, 0)));
+	UT_ASSERTeq(map->size(), 1);
+	UT_ASSERTeq(map->approximate_size(), 0);
+	UT_ASSERT(!map->empty());
+
+	const int n = 1000;
+	for (int i = 1; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	UT_ASSERTeq(map->size(), n);
+	UT_ASSERT(map->approximate_size() <= n);
+	UT_ASSERT(abs_diff(map->approximate_size(), n) < max_unfolded);
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(map->erase(i));
+
+	UT_ASSERTeq(map->size(), n / 2);
+	UT_ASSERT(abs_diff(map->approximate_size(), n / 2) < max_unfolded);
+
+	map->clear();
+	UT_ASSERTeq(map->size(), 0);
+	UT_ASSERTeq(map->approximate_size(), 0);
+	UT_ASSERT(map->empty());
+}
+
+/*
+ * mt_test -- (internal) test sizes after concurrent inserts and erases,
+ * swap and reopen of the pool
+ */
+void
+mt_test(nvobj::pool<root> &pop, const std::string &path, size_t concurrency)
+{
+	const int thread_items = 3000;
+	const size_t expected = concurrency * thread_items / 2;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+			for (int i = begin; i < begin + thread_items; ++i)
+				UT_ASSERT(map->insert(value_type(i, i)));
+
+			for (int i = begin; i < begin + thread_items; i += 2)
+				UT_ASSERT(map->erase(i));
+		});
+
+		UT_ASSERTeq(map->size(), expected);
+		UT_ASSERT(abs_diff(map->approximate_size(), expected) <
+			  max_unfolded);
+
+		/* Swap folds size counters of both maps */
+		auto map2 = pop.root()->cons2;
+		map2->runtime_initialize();
+		UT_ASSERT(map2->insert(value_type(-1, -1)));
+
+		map->swap(*map2);
+		UT_ASSERTeq(map->size(), 1);
+		UT_ASSERTeq(map->approximate_size(), 1);
+		UT_ASSERTeq(map2->size(), expected);
+		UT_ASSERTeq(map2->approximate_size(), expected);
+
+		map->swap(*map2);
+		UT_ASSERTeq(map->size(), expected);
+		UT_ASSERTeq(map2->size(), 1);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), expected);
+		UT_ASSERTeq(map->approximate_size(), expected);
+
+		size_t n = 0;
+		for (auto &e : *map) {
+			UT_ASSERTeq(e.first % 2, 1);
+			++n;
+		}
+		UT_ASSERTeq(n, expected);
+
+		map->clear();
+		UT_ASSERTeq(map->size(), 0);
+		UT_ASSERTeq(map->approximate_size(), 0);
+
+		auto map2 = pop.root()->cons2;
+		map2->runtime_initialize();
+		UT_ASSERTeq(map2->size(), 1);
+		map2->clear();
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->cons2 =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	single_thread_test(pop);
+	mt_test(pop, path, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<persistent_map_type>(
+			pop.root()->cons2);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
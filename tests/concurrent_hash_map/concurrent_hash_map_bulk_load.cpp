@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_bulk_load.cpp -- pmem::obj::concurrent_hash_map test
+ * of bulk_load.
+ *
+ */
+
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <vector>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+void
+check_items(persistent_map_type &map, int n, int step, int offset)
+{
+	for (int i = 0; i < n; ++i) {
+		persistent_map_type::const_accessor acc;
+		bool found = map.find(acc, i);
+
+		UT_ASSERT(found == (i % step == 0));
+		if (found)
+			UT_ASSERTeq(acc->second, i + offset);
+	}
+}
+
+/*
+ * empty_map_test -- (internal) test bulk_load to an empty map
+ */
+void
+empty_map_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	std::vector<value_type> items;
+	UT_ASSERTeq(map->bulk_load(items.begin(), items.end(), concurrency),
+		    0);
+
+	const int n = 10000;
+	for (int i = 0; i < n; ++i)
+		items.emplace_back(i, i + 1);
+
+	/* Only the first item with a given key is inserted */
+	for (int i = 0; i < n; i += 10)
+		items.emplace_back(i, -1);
+
+	size_t buckets = map->bucket_count();
+	UT_ASSERTeq(map->bulk_load(items.begin(), items.end(), concurrency),
+		    n);
+	UT_ASSERT(map->bucket_count() > buckets);
+
+	UT_ASSERTeq(map->size(), n);
+	check_items(*map, n, 1, 1);
+
+	size_t count = 0;
+	for (auto &e : *map) {
+		UT_ASSERTeq(e.second, e.first + 1);
+		++count;
+	}
+	UT_ASSERTeq(count, n);
+
+	/* The table was grown upfront */
+	buckets = map->bucket_count();
+	UT_ASSERT(map->insert(value_type(n, n + 1)));
+	UT_ASSERTeq(map->bucket_count(), buckets);
+
+	map->clear();
+}
+
+/*
+ * non_empty_map_test -- (internal) test bulk_load to a map which already
+ * contains items, including reopen of the pool
+ */
+void
+non_empty_map_test(nvobj::pool<root> &pop, const std::string &path,
+		   size_t concurrency)
+{
+	const int n = 20000;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		for (int i = 0; i < n; i += 4)
+			UT_ASSERT(map->insert(value_type(i, i + 2)));
+
+		std::vector<value_type> items;
+		for (int i = 0; i < n; i += 2)
+			items.emplace_back(i, i + 2);
+
+		UT_ASSERTeq(map->bulk_load(items.begin(), items.end(),
+					   concurrency),
+			    n / 4);
+		UT_ASSERTeq(map->size(), n / 2);
+		check_items(*map, n, 2, 2);
+
+		/* Single thread */
+		items.clear();
+		for (int i = 0; i < 2 * n; ++i)
+			items.emplace_back(i, i + 2);
+
+		UT_ASSERTeq(map->bulk_load(items.begin(), items.end(), 1),
+			    3 * n / 2);
+		UT_ASSERTeq(map->size(), 2 * n);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), 2 * n);
+		check_items(*map, 2 * n, 1, 2);
+
+		map->clear();
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	empty_map_test(pop, concurrency);
+	non_empty_map_test(pop, path, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
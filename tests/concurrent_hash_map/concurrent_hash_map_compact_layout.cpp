@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_compact_layout.cpp -- pmem::obj::concurrent_hash_map
+ * test of the compact node layout.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace pmem
+{
+namespace obj
+{
+template <>
+struct concurrent_hash_map_node_layout<p<uint64_t>, p<uint64_t>> {
+	using type = hash_map_layout::compact;
+};
+}
+}
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<uint64_t>, nvobj::p<uint64_t>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+typedef nvobj::concurrent_hash_map_internal::hash_map_node<
+	nvobj::p<uint64_t>, nvobj::p<uint64_t>, nvobj::shared_mutex,
+	nvobj::concurrent_hash_map_internal::shared_mutex_scoped_lock<
+		nvobj::shared_mutex>>
+	compact_node_type;
+
+typedef nvobj::concurrent_hash_map_internal::hash_map_node<
+	nvobj::p<int>, nvobj::p<int>, nvobj::shared_mutex,
+	nvobj::concurrent_hash_map_internal::shared_mutex_scoped_lock<
+		nvobj::shared_mutex>>
+	standard_node_type;
+
+static_assert(std::is_same<compact_node_type::layout_type,
+			   nvobj::hash_map_layout::compact>::value,
+	      "");
+static_assert(std::is_same<standard_node_type::layout_type,
+			   nvobj::hash_map_layout::standard>::value,
+	      "");
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+/*
+ * compact_layout_test -- (internal) test basic operations on a map with
+ * compact node layout, including reopen of the pool
+ */
+void
+compact_layout_test(nvobj::pool<root> &pop, const std::string &path,
+		    size_t concurrency)
+{
+	const uint64_t thread_items = 2000;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			uint64_t begin = thread_id * thread_items;
+			for (uint64_t i = begin; i < begin + thread_items; ++i)
+				UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+			for (uint64_t i = begin; i < begin + thread_items;
+			     i += 2)
+				UT_ASSERT(map->erase(i));
+		});
+
+		UT_ASSERTeq(map->size(), concurrency * thread_items / 2);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), concurrency * thread_items / 2);
+
+		for (uint64_t i = 0; i < concurrency * thread_items; ++i) {
+			persistent_map_type::const_accessor acc;
+			bool found = map->find(acc, i);
+
+			UT_ASSERT(found == (i % 2 == 1));
+			if (found) {
+				UT_ASSERTeq(acc->first, i);
+				UT_ASSERTeq(acc->second, i + 1);
+			}
+		}
+
+		size_t n = 0;
+		for (auto &e : *map) {
+			UT_ASSERTeq(e.second, e.first + 1);
+			++n;
+		}
+		UT_ASSERTeq(n, map->size());
+
+		map->clear();
+		UT_ASSERTeq(map->size(), 0);
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	compact_layout_test(pop, path, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
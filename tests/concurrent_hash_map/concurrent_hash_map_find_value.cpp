@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_find_value.cpp -- pmem::obj::concurrent_hash_map test
+ * of optimistic (lock-free) lookups.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+/* Both fields are always updated together, reading different values means
+ * that an inconsistent read was not detected */
+struct value_pair {
+	int first;
+	int second;
+};
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<value_pair>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+value_type
+make_value(int key, int val)
+{
+	return value_type(key, value_pair{val, val});
+}
+
+/*
+ * find_value_test -- (internal) test find_value in a single thread
+ */
+void
+find_value_test(nvobj::pool<root> &pop)
+{
+	auto &map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	nvobj::p<value_pair> v;
+	UT_ASSERT(!map->find_value(0, v));
+
+	/* Small table, lookups fall back to locks */
+	UT_ASSERT(map->insert(make_value(1, 11)));
+	UT_ASSERT(map->find_value(1, v));
+	UT_ASSERTeq(v.get_ro().first, 11);
+	UT_ASSERTeq(v.get_ro().second, 11);
+	UT_ASSERT(!map->find_value(2, v));
+
+	const int n = 10000;
+	for (int i = 0; i < n; ++i)
+		map->insert(make_value(i, i + 10));
+
+	for (int i = 0; i < n; ++i) {
+		UT_ASSERT(map->find_value(i, v));
+		UT_ASSERTeq(v.get_ro().first, i + 10);
+		UT_ASSERTeq(v.get_ro().second, i + 10);
+	}
+
+	for (int i = n; i < 2 * n; ++i)
+		UT_ASSERT(!map->find_value(i, v));
+
+	{
+		/* Lookups of an item held for write fall back to locks */
+		persistent_map_type::accessor acc;
+		UT_ASSERT(map->find(acc, 1));
+
+		std::thread t([&] {
+			nvobj::p<value_pair> tv;
+			UT_ASSERT(map->find_value(2, tv));
+			UT_ASSERTeq(tv.get_ro().first, 12);
+		});
+		t.join();
+	}
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(map->erase(i));
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->find_value(i, v) == (i % 2 == 1));
+
+	map->clear();
+}
+
+/*
+ * find_value_mt_test -- (internal) test find_value concurrently with
+ * updates, inserts, erases and rehashing
+ */
+void
+find_value_mt_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto &map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int stable_items = 512;
+	const int volatile_items = 4096;
+	const int updates = 200;
+
+	for (int i = 0; i < stable_items; ++i)
+		map->insert(make_value(i, 0));
+
+	std::atomic<size_t> writers_done(0);
+
+	size_t writers = concurrency / 2 > 0 ? concurrency / 2 : 1;
+
+	parallel_exec(writers + concurrency, [&](size_t thread_id) {
+		if (thread_id < writers) {
+			int begin = stable_items +
+				int(thread_id) * volatile_items;
+
+			for (int i = 1; i <= updates; ++i) {
+				int key = (i * 7 + int(thread_id)) %
+					stable_items;
+
+				persistent_map_type::accessor acc;
+				UT_ASSERT(map->find(acc, key));
+				nvobj::transaction::run(pop, [&] {
+					acc->second = value_pair{i, i};
+				});
+			}
+
+			/* grow the table and erase items */
+			for (int i = begin; i < begin + volatile_items; ++i)
+				map->insert(make_value(i, i));
+
+			for (int i = begin; i < begin + volatile_items; i += 2)
+				UT_ASSERT(map->erase(i));
+
+			++writers_done;
+		} else {
+			nvobj::p<value_pair> v;
+			int max_key = stable_items +
+				int(writers) * volatile_items;
+
+			while (writers_done.load() != writers) {
+				for (int i = 0; i < max_key; i += 13) {
+					if (!map->find_value(i, v)) {
+						UT_ASSERT(i >= stable_items);
+						continue;
+					}
+
+					UT_ASSERTeq(v.get_ro().first,
+						    v.get_ro().second);
+					if (i >= stable_items)
+						UT_ASSERTeq(v.get_ro().first,
+							    i);
+				}
+			}
+		}
+	});
+
+	for (int i = 0; i < stable_items; ++i) {
+		nvobj::p<value_pair> v;
+		UT_ASSERT(map->find_value(i, v));
+		UT_ASSERTeq(v.get_ro().first, v.get_ro().second);
+	}
+
+	size_t expected =
+		size_t(stable_items) + writers * size_t(volatile_items / 2);
+	UT_ASSERTeq(map->size(), expected);
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	find_value_test(pop);
+	find_value_mt_test(pop, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_fingerprints.cpp -- pmem::obj::concurrent_hash_map test
+ * of bucket fingerprints.
+ *
+ */
+
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+using fingerprints =
+	nvobj::concurrent_hash_map_internal::bucket_fingerprints;
+
+/* Places many keys in the same bucket */
+struct colliding_hash {
+	size_t
+	operator()(const nvobj::p<int> &key) const
+	{
+		return static_cast<size_t>(key.get_ro()) << 6;
+	}
+};
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>,
+				   colliding_hash>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+/*
+ * helpers_test -- (internal) test operations on fingerprints word
+ */
+void
+helpers_test()
+{
+	UT_ASSERTeq(pmem::detail::match_bytes(0x0011223344556677ULL, 0x44),
+		    0x08u);
+	UT_ASSERTeq(pmem::detail::match_bytes(0x4400000000000044ULL, 0x44),
+		    0x81u);
+	UT_ASSERTeq(pmem::detail::match_bytes(0x0101010101010101ULL, 0x00),
+		    0x00u);
+
+	uint64_t s = fingerprints::empty();
+	UT_ASSERT(fingerprints::is_valid(s));
+	UT_ASSERTeq(fingerprints::count(s), 0);
+	UT_ASSERT(fingerprints::filter(s, 1).none());
+
+	/* Fingerprints are listed from the first node of the bucket */
+	for (uint8_t fp = 1; fp <= 7; ++fp)
+		s = fingerprints::push_front(s, fp);
+
+	UT_ASSERTeq(fingerprints::count(s), 7);
+	UT_ASSERT(!(s & fingerprints::overflow));
+	UT_ASSERTeq(fingerprints::match(s, 7), 0x01u);
+	UT_ASSERTeq(fingerprints::match(s, 1), 0x40u);
+	UT_ASSERTeq(fingerprints::match(s, 8), 0x00u);
+
+	/* 7 6 5 4 3 2 1 -> 7 6 4 3 2 1 */
+	uint64_t e = fingerprints::erase(s, 2);
+	UT_ASSERTeq(fingerprints::count(e), 6);
+	UT_ASSERTeq(fingerprints::match(e, 7), 0x01u);
+	UT_ASSERTeq(fingerprints::match(e, 6), 0x02u);
+	UT_ASSERTeq(fingerprints::match(e, 5), 0x00u);
+	UT_ASSERTeq(fingerprints::match(e, 4), 0x04u);
+	UT_ASSERTeq(fingerprints::match(e, 1), 0x20u);
+
+	/* Erase of the last node */
+	e = fingerprints::erase(s, 6);
+	UT_ASSERTeq(fingerprints::count(e), 6);
+	UT_ASSERTeq(fingerprints::match(e, 1), 0x00u);
+	UT_ASSERTeq(fingerprints::match(e, 2), 0x20u);
+
+	/* The eighth node does not fit */
+	s = fingerprints::push_front(s, 8);
+	UT_ASSERTeq(fingerprints::count(s), 7);
+	UT_ASSERT(s & fingerprints::overflow);
+	UT_ASSERTeq(fingerprints::match(s, 1), 0x00u);
+	UT_ASSERT(!fingerprints::filter(s, 1).none());
+	UT_ASSERT(!fingerprints::is_valid(fingerprints::erase(s, 0)));
+
+	/* Old pools have only the rehashed flag set */
+	fingerprints::filter f(fingerprints::rehashed, 1);
+	UT_ASSERT(!f.none());
+	UT_ASSERT(f(0) && f(10));
+
+	fingerprints::builder b;
+	for (uint8_t fp = 1; fp <= 3; ++fp)
+		b.push_back(fp);
+	UT_ASSERTeq(fingerprints::count(b.get()), 3);
+	UT_ASSERTeq(fingerprints::match(b.get(), 1), 0x01u);
+	UT_ASSERTeq(fingerprints::match(b.get(), 3), 0x04u);
+}
+
+void
+check_items(persistent_map_type &map, int n, int step)
+{
+	for (int i = 0; i < n; ++i) {
+		persistent_map_type::const_accessor acc;
+		bool found = map.find(acc, i);
+
+		UT_ASSERT(found == (i % step == 0));
+		if (found)
+			UT_ASSERTeq(acc->second, i + 1);
+	}
+}
+
+/*
+ * collisions_test -- (internal) test operations on long bucket chains
+ */
+void
+collisions_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 4000;
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+	UT_ASSERTeq(map->size(), n);
+	check_items(*map, n, 1);
+
+	for (int i = n; i < 2 * n; ++i)
+		UT_ASSERTeq(map->count(i), 0);
+
+	/* Erase nodes at different positions of the chains */
+	for (int i = 1; i < n; i += 2)
+		UT_ASSERT(map->erase(i));
+
+	UT_ASSERTeq(map->size(), n / 2);
+	check_items(*map, n, 2);
+
+	for (int i = 0; i < n; ++i) {
+		if (i % 2 == 0 && i % 3 != 0)
+			UT_ASSERT(map->erase(i));
+	}
+
+	check_items(*map, n, 6);
+
+	/* Insert the erased items back */
+	for (int i = 0; i < n; ++i) {
+		if (i % 6 != 0)
+			UT_ASSERT(map->insert(value_type(i, i + 1)));
+	}
+
+	UT_ASSERTeq(map->size(), n);
+	check_items(*map, n, 1);
+
+	map->clear();
+	UT_ASSERTeq(map->size(), 0);
+	UT_ASSERTeq(map->count(1), 0);
+
+	for (int i = 0; i < 100; ++i)
+		UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+	check_items(*map, 100, 1);
+	UT_ASSERTeq(map->count(100), 0);
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	helpers_test();
+	collisions_test(pop);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,281 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_inline_string.cpp -- pmem::obj::concurrent_hash_map
+ * test of inline_string mapped values.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/inline_string.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <string>
+#include <tuple>
+#include <utility>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>,
+				   nvobj::experimental::inline_string>
+	int_map_type;
+
+typedef nvobj::concurrent_hash_map<nvobj::string,
+				   nvobj::experimental::inline_string,
+				   nvobj::string_hash>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<int_map_type> int_map;
+	nvobj::persistent_ptr<string_map_type> string_map;
+};
+
+size_t
+count_objects(nvobj::pool<root> &pop)
+{
+	size_t n = 0;
+	for (PMEMoid oid = pmemobj_first(pop.handle()); !OID_IS_NULL(oid);
+	     oid = pmemobj_next(oid))
+		++n;
+
+	return n;
+}
+
+std::string
+make_value(int i)
+{
+	return std::string(static_cast<size_t>(i % 100), 'a' + char(i % 26));
+}
+
+/*
+ * int_key_test -- (internal) test basic operations on a map with
+ * inline_string values, including reopen of the pool
+ */
+void
+int_key_test(nvobj::pool<root> &pop, const std::string &path,
+	     size_t concurrency)
+{
+	const int thread_items = 500;
+	const int n = static_cast<int>(concurrency) * thread_items;
+
+	{
+		auto map = pop.root()->int_map;
+
+		map->runtime_initialize();
+
+		{
+			/* Value of an item inserted by key is empty */
+			int_map_type::accessor acc;
+			UT_ASSERT(map->insert(acc, -1));
+			UT_ASSERTeq(acc->second.size(), 0u);
+			UT_ASSERTeq(acc->second.capacity(), 0u);
+		}
+		UT_ASSERT(map->erase(-1));
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+			for (int i = begin; i < begin + thread_items; ++i)
+				UT_ASSERT(map->insert_or_assign(i,
+								make_value(i)));
+
+			for (int i = begin; i < begin + thread_items; i += 2)
+				UT_ASSERT(map->erase(i));
+		});
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		/* Values fitting in the capacity are assigned in place */
+		UT_ASSERT(!map->insert_or_assign(1, std::string("x")));
+		{
+			int_map_type::const_accessor acc;
+			UT_ASSERT(map->find(acc, 1));
+			UT_ASSERT(nvobj::string_view(acc->second) == "x");
+			UT_ASSERTeq(acc->second.capacity(), 1u);
+		}
+
+		try {
+			map->insert_or_assign(1, std::string("too long"));
+			UT_ASSERT(0);
+		} catch (std::out_of_range &) {
+		} catch (...) {
+			UT_ASSERT(0);
+		}
+
+		UT_ASSERT(!map->insert_or_assign(1, make_value(1)));
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->int_map;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		for (int i = 0; i < n; ++i) {
+			int_map_type::const_accessor acc;
+			bool found = map->find(acc, i);
+
+			UT_ASSERT(found == (i % 2 == 1));
+			if (found)
+				UT_ASSERT(nvobj::string_view(acc->second) ==
+					  nvobj::string_view(make_value(i)));
+		}
+
+		/* Copies of values keep their capacity */
+		nvobj::persistent_ptr<int_map_type> copy;
+		nvobj::transaction::run(pop, [&] {
+			copy = nvobj::make_persistent<int_map_type>(*map);
+		});
+
+		UT_ASSERTeq(copy->size(), size_t(n / 2));
+		{
+			int_map_type::const_accessor acc;
+			UT_ASSERT(copy->find(acc, 99));
+			UT_ASSERT(nvobj::string_view(acc->second) ==
+				  nvobj::string_view(make_value(99)));
+		}
+
+		copy->free_data();
+		nvobj::transaction::run(pop, [&] {
+			nvobj::delete_persistent<int_map_type>(copy);
+		});
+
+		map->clear();
+	}
+}
+
+/*
+ * tail_size_test -- (internal) test size of storage allocated after a node
+ * for each way the node can be constructed
+ */
+void
+tail_size_test()
+{
+	using tail_type =
+		nvobj::concurrent_hash_map_internal::hash_map_node_tail<
+			nvobj::experimental::inline_string>;
+
+	const size_t empty = sizeof(char);
+	const size_t abc = 4 * sizeof(char);
+
+	UT_ASSERTeq(tail_type::size(1), empty);
+	UT_ASSERTeq(tail_type::size(1, nvobj::string_view("abc")), abc);
+	UT_ASSERTeq(tail_type::size(std::make_pair(1, std::string("abc"))),
+		    abc);
+	UT_ASSERTeq(tail_type::size(std::piecewise_construct,
+				    std::forward_as_tuple(1),
+				    std::forward_as_tuple(std::string("abc"))),
+		    abc);
+	UT_ASSERTeq(tail_type::size(std::piecewise_construct,
+				    std::forward_as_tuple(1),
+				    std::forward_as_tuple()),
+		    empty);
+}
+
+/*
+ * string_key_test -- (internal) test that each item of a string to
+ * inline_string map takes a single allocation
+ */
+void
+string_key_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->string_map;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+
+	/* Enable all segments upfront, so only nodes are allocated */
+	map->rehash(4 * n);
+
+	/* The first insert also allocates thread-local data of the map */
+	UT_ASSERT(map->insert_or_assign("key-0", make_value(0)));
+
+	size_t objects = count_objects(pop) - 1;
+
+	for (int i = 1; i < n; ++i)
+		UT_ASSERT(map->insert_or_assign("key-" + std::to_string(i),
+						make_value(i)));
+
+	UT_ASSERTeq(count_objects(pop), objects + n);
+
+	for (int i = 0; i < n; ++i) {
+		string_map_type::const_accessor acc;
+		UT_ASSERT(map->find(acc, "key-" + std::to_string(i)));
+		UT_ASSERT(nvobj::string_view(acc->second) ==
+			  nvobj::string_view(make_value(i)));
+	}
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->erase("key-" + std::to_string(i)));
+
+	UT_ASSERTeq(count_objects(pop), objects);
+	UT_ASSERTeq(map->size(), 0);
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->int_map =
+				nvobj::make_persistent<int_map_type>();
+			pop.root()->string_map =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	tail_size_test();
+	int_key_test(pop, path, concurrency);
+	string_key_test(pop);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<int_map_type>(pop.root()->int_map);
+		nvobj::delete_persistent<string_map_type>(
+			pop.root()->string_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -83,6 +83,8 @@ test(int argc, char *argv[])
 
 	insert_and_lookup_iterator_test(pop, concurrency);
 
+	insert_and_lookup_batch_test(pop, concurrency);
+
 	pop.close();
 }
 
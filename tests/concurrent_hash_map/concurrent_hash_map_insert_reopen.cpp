@@ -17,6 +17,26 @@
 #define RUNTIME_INITIALIZE runtime_initialize()
 #endif
 
+/*
+ * legacy_map -- (internal) makes a map look like it was created before
+ * FEATURE_CONSISTENT_SIZE was introduced, so that runtime_initialize()
+ * has to count its elements
+ */
+struct legacy_map : public persistent_map_type {
+	static void
+	clear_consistent_size(nvobj::pool<root> &pop, persistent_map_type &map)
+	{
+		auto &m = static_cast<legacy_map &>(map);
+
+		pmem::obj::transaction::run(pop, [&] {
+			nvobj::delete_persistent<tls_t>(m.tls_ptr);
+			m.tls_ptr = nullptr;
+			m.layout_features.compat &=
+				~static_cast<uint32_t>(FEATURE_CONSISTENT_SIZE);
+		});
+	}
+};
+
 /*
  * insert_reopen_test -- (internal) test insert operations and verify
  * consistency after reopen
@@ -81,6 +101,30 @@ insert_reopen_test(nvobj::pool<root> &pop, std::string path,
 		});
 
 		test.check_items_count(already_inserted_num * 2);
+
+		pop.close();
+	}
+
+	{
+		size_t already_inserted_num = 2 * concurrency * thread_items;
+
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		legacy_map::clear_consistent_size(pop, *pop.root()->cons);
+
+		pop.close();
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		ConcurrentHashMapTestPrimitives<root, persistent_map_type> test(
+			pop, pop.root()->cons, already_inserted_num);
+
+		auto map = pop.root()->cons;
+
+		UT_ASSERT(map != nullptr);
+
+		map->runtime_initialize(concurrency);
+
+		test.check_items_count();
 	}
 }
 
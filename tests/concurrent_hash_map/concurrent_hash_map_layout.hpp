@@ -49,6 +49,8 @@ struct hashmap_test : public MapType {
 		ASSERT_OFFSET_CHECKPOINT(T, 16 * CACHELINE_SIZE);
 		ASSERT_ALIGNED_FIELD(T, t, tls_ptr);
 		ASSERT_ALIGNED_FIELD(T, t, on_init_size);
+		ASSERT_ALIGNED_FIELD(T, t, node_cache_ptr);
+		ASSERT_ALIGNED_FIELD(T, t, size_shards);
 		ASSERT_ALIGNED_FIELD(T, t, reserved);
 		ASSERT_OFFSET_CHECKPOINT(T, 17 * CACHELINE_SIZE);
 		ASSERT_ALIGNED_FIELD(T, t, my_segment_enable_mutex);
@@ -122,6 +124,15 @@ struct hashmap_test : public MapType {
 			map = nvobj::make_persistent<hashmap_test>();
 		});
 
+		UT_ASSERT(map->layout_features.incompat &
+			  hashmap_test::FEATURE_FINGERPRINTS);
+
+		/* Hash map created before fingerprints were introduced */
+		map->layout_features.incompat = 0;
+		map->runtime_initialize();
+		UT_ASSERT(map->layout_features.incompat &
+			  hashmap_test::FEATURE_FINGERPRINTS);
+
 		map->layout_features.incompat = static_cast<uint32_t>(-1);
 
 		try {
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_lock_policies.cpp -- pmem::obj::concurrent_hash_map
+ * test with spin_shared_mutex and seq_shared_mutex as bucket locks, including
+ * find_value() validated by seq_shared_mutex.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/experimental/seq_shared_mutex.hpp>
+#include <libpmemobj++/experimental/spin_shared_mutex.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+namespace nvobjex = pmem::obj::experimental;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>,
+				   std::hash<nvobj::p<int>>,
+				   std::equal_to<nvobj::p<int>>,
+				   nvobjex::spin_shared_mutex>
+	spin_map_type;
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>,
+				   std::hash<nvobj::p<int>>,
+				   std::equal_to<nvobj::p<int>>,
+				   nvobjex::seq_shared_mutex>
+	seq_map_type;
+
+struct root {
+	nvobj::persistent_ptr<spin_map_type> spin_map;
+	nvobj::persistent_ptr<seq_map_type> seq_map;
+};
+
+/*
+ * stale_lock_test -- (internal) test that state of a mutex written by
+ * another process is ignored
+ */
+template <typename Mutex>
+void
+stale_lock_test()
+{
+	typename std::aligned_storage<sizeof(Mutex), alignof(Mutex)>::type buf;
+
+	/* Locked for exclusive access by a process with other identifier */
+	uint64_t stale = (uint64_t(pmem::detail::lock_generation() ^ 2U)
+			  << 32) |
+		(1ULL << 31);
+	std::memset(&buf, 0xff, sizeof(buf));
+	std::memcpy(&buf, &stale, sizeof(stale));
+
+	Mutex &m = *reinterpret_cast<Mutex *>(&buf);
+
+	UT_ASSERT(m.try_lock());
+	UT_ASSERT(!m.try_lock());
+	UT_ASSERT(!m.try_lock_shared());
+	m.unlock();
+
+	UT_ASSERT(m.try_lock_shared());
+	UT_ASSERT(m.try_lock_shared());
+	UT_ASSERT(!m.try_lock());
+	m.unlock_shared();
+	m.unlock_shared();
+
+	m.lock();
+	m.unlock();
+}
+
+/*
+ * seq_lock_test -- (internal) test optimistic readers of seq_shared_mutex
+ */
+void
+seq_lock_test(size_t concurrency)
+{
+	nvobjex::seq_shared_mutex m;
+
+	uint64_t s = m.read_begin();
+	UT_ASSERT(s != 0);
+	UT_ASSERT(m.read_validate(s));
+
+	m.lock_shared();
+	UT_ASSERT(m.read_validate(s));
+	m.unlock_shared();
+
+	m.lock();
+	UT_ASSERTeq(m.read_begin(), 0);
+	UT_ASSERT(!m.read_validate(s));
+	m.unlock();
+
+	UT_ASSERT(!m.read_validate(s));
+	s = m.read_begin();
+	UT_ASSERT(s != 0);
+	UT_ASSERT(m.read_validate(s));
+
+	/* Writers keep both values equal, validated copies must be equal
+	 * as well */
+	std::atomic<int> a(0), b(0);
+	const int n_writes = 10000;
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		if (thread_id % 2 == 0) {
+			for (int i = 0; i < n_writes; ++i) {
+				m.lock();
+				a.store(a.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+				b.store(b.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+				m.unlock();
+			}
+			return;
+		}
+
+		for (int i = 0; i < n_writes; ++i) {
+			uint64_t t = m.read_begin();
+			if (!t)
+				continue;
+
+			int x = a.load(std::memory_order_relaxed);
+			int y = b.load(std::memory_order_relaxed);
+			if (m.read_validate(t))
+				UT_ASSERTeq(x, y);
+		}
+	});
+
+	UT_ASSERTeq(a.load(), b.load());
+}
+
+/*
+ * map_test -- (internal) test concurrent operations on a map with given
+ * bucket lock type, including reopen of the pool
+ */
+template <typename MapType>
+void
+map_test(nvobj::pool<root> &pop, const std::string &path,
+	 nvobj::persistent_ptr<MapType> root::*field, size_t concurrency)
+{
+	typedef typename MapType::value_type value_type;
+
+	const int thread_items = 2000;
+	const int n = static_cast<int>(concurrency) * thread_items;
+
+	{
+		auto map = pop.root().get()->*field;
+
+		map->runtime_initialize();
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+			for (int i = begin; i < begin + thread_items; ++i)
+				UT_ASSERT(map->insert(value_type(i, i)));
+
+			/* Increment values of all items by all threads */
+			for (int i = 0; i < n; ++i) {
+				typename MapType::accessor acc;
+				if (map->find(acc, i))
+					acc->second = acc->second + 1;
+			}
+
+			for (int i = begin; i < begin + thread_items; i += 2)
+				UT_ASSERT(map->erase(i));
+		});
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root().get()->*field;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), size_t(n / 2));
+
+		for (int i = 0; i < n; ++i) {
+			typename MapType::const_accessor acc;
+			bool found = map->find(acc, i);
+
+			UT_ASSERT(found == (i % 2 == 1));
+			if (found)
+				UT_ASSERT(acc->second >= i + 1);
+		}
+
+		nvobj::p<int> v = 0;
+		UT_ASSERT(map->find_value(1, v));
+		UT_ASSERT(v >= 2);
+
+		map->clear();
+	}
+}
+}
+
+/*
+ * find_value_test -- (internal) test find_value() validated by bucket and
+ * item locks of type seq_shared_mutex, while items are modified, erased,
+ * inserted and the table grows
+ */
+void
+find_value_test(nvobj::persistent_ptr<seq_map_type> map, size_t concurrency)
+{
+	typedef seq_map_type::value_type value_type;
+
+	static_assert(nvobj::concurrent_hash_map_internal::has_optimistic_reads<
+			      nvobjex::seq_shared_mutex>::value,
+		      "");
+
+	const int items = 1000;
+	const int updates = 200;
+
+	map->runtime_initialize();
+
+	for (int i = 0; i < items; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	std::atomic<size_t> running_writers(concurrency);
+
+	parallel_exec(concurrency * 2, [&](size_t thread_id) {
+		if (thread_id < concurrency) {
+			int begin = items * static_cast<int>(thread_id + 1);
+
+			for (int r = 0; r < updates; ++r) {
+				/* Values stay congruent to their keys */
+				for (int i = r % 10; i < items; i += 10) {
+					seq_map_type::accessor acc;
+					UT_ASSERT(map->find(acc, i));
+					acc->second = acc->second + items;
+				}
+
+				int k = begin + r;
+				UT_ASSERT(map->insert(value_type(k, k)));
+				if (r % 2)
+					UT_ASSERT(map->erase(k));
+			}
+
+			--running_writers;
+		} else {
+			do {
+				for (int i = 0; i < items; ++i) {
+					nvobj::p<int> v = -1;
+					UT_ASSERT(map->find_value(i, v));
+					UT_ASSERT(v >= i);
+					UT_ASSERTeq(v % items, i);
+				}
+			} while (running_writers.load() > 0);
+		}
+	});
+
+	for (int i = 0; i < items; ++i) {
+		nvobj::p<int> v = -1;
+		UT_ASSERT(map->find_value(i, v));
+		UT_ASSERTeq(v, i + items * updates / 10 * static_cast<int>(
+							   concurrency));
+	}
+
+	map->clear();
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->spin_map =
+				nvobj::make_persistent<spin_map_type>();
+			pop.root()->seq_map =
+				nvobj::make_persistent<seq_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	stale_lock_test<nvobjex::spin_shared_mutex>();
+	stale_lock_test<nvobjex::seq_shared_mutex>();
+	seq_lock_test(concurrency);
+
+	map_test(pop, path, &root::spin_map, concurrency);
+	map_test(pop, path, &root::seq_map, concurrency);
+	find_value_test(pop.root()->seq_map, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<spin_map_type>(pop.root()->spin_map);
+		nvobj::delete_persistent<seq_map_type>(pop.root()->seq_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_node_cache.cpp -- pmem::obj::concurrent_hash_map test
+ * of per-thread node caches and deferred reclamation of erased nodes.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <stdexcept>
+#include <thread>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+/* When this is defined, the pool is reopened using deprecated
+ * runtime_initialize(bool), which has to enable the node cache and reclaim
+ * retired nodes as well. */
+#ifdef USE_DEPRECATED_RUNTIME_INITIALIZE
+#define RUNTIME_INITIALIZE runtime_initialize(true)
+#else
+#define RUNTIME_INITIALIZE runtime_initialize()
+#endif
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+typedef nvobj::concurrent_hash_map_internal::hash_map_base<
+	nvobj::p<int>, nvobj::p<int>, nvobj::shared_mutex,
+	nvobj::concurrent_hash_map_internal::shared_mutex_scoped_lock<
+		nvobj::shared_mutex>>
+	hash_map_base;
+
+/* Value which can be made to throw when it is copied */
+struct throwing_value {
+	static bool throw_on_copy;
+
+	throwing_value(int v) : value(v)
+	{
+	}
+
+	throwing_value(const throwing_value &other) : value(other.value)
+	{
+		if (throw_on_copy)
+			throw std::runtime_error("throwing_value copy");
+	}
+
+	nvobj::p<int> value;
+};
+
+bool throwing_value::throw_on_copy = false;
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, throwing_value>
+	throwing_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<throwing_map_type> throwing;
+};
+
+size_t
+count_objects(nvobj::pool<root> &pop)
+{
+	size_t n = 0;
+	for (PMEMoid oid = pmemobj_first(pop.handle()); !OID_IS_NULL(oid);
+	     oid = pmemobj_next(oid))
+		++n;
+
+	return n;
+}
+
+/*
+ * reuse_test -- (internal) test that storage of erased nodes is reused,
+ * also after reopen of the pool
+ */
+void
+reuse_test(nvobj::pool<root> &pop, const std::string &path)
+{
+	const int n = 1000;
+	const size_t capacity = hash_map_base::node_cache_capacity;
+	const size_t batch = hash_map_base::node_cache_batch;
+	const size_t retire_batch = hash_map_base::node_retire_batch;
+
+	size_t objects = 0;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERT(map->insert(value_type(i, i)));
+
+		objects = count_objects(pop);
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERT(map->erase(i));
+
+		/* The cache of this thread is full, some of erased nodes
+		 * can be still retired */
+		size_t after_erase = count_objects(pop);
+		UT_ASSERT(after_erase >= objects - size_t(n) + capacity);
+		UT_ASSERT(after_erase < objects - size_t(n) + capacity +
+			      retire_batch);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->RUNTIME_INITIALIZE;
+
+		UT_ASSERTeq(map->size(), 0);
+
+		/* All retired nodes are reclaimed on restart */
+		size_t before = count_objects(pop);
+		UT_ASSERTeq(before, objects - size_t(n) + capacity);
+
+		for (int i = 0; i < int(capacity); ++i)
+			UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+		UT_ASSERTeq(count_objects(pop), before);
+
+		for (int i = int(capacity); i < n; ++i)
+			UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+		UT_ASSERT(count_objects(pop) <= objects + batch);
+
+		for (int i = 0; i < n; ++i) {
+			persistent_map_type::const_accessor acc;
+			UT_ASSERT(map->find(acc, i));
+			UT_ASSERTeq(acc->second, i + 1);
+		}
+
+		map->clear();
+		UT_ASSERTeq(map->size(), 0);
+	}
+}
+
+/*
+ * abort_test -- (internal) test that storage taken from the node cache
+ * by an aborted insert is still correctly linked in the cache
+ */
+void
+abort_test(nvobj::pool<root> &pop)
+{
+	nvobj::transaction::run(pop, [&] {
+		pop.root()->throwing =
+			nvobj::make_persistent<throwing_map_type>();
+	});
+
+	auto map = pop.root()->throwing;
+
+	map->runtime_initialize();
+
+	const int n = 100;
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(throwing_map_type::value_type(i, i)));
+
+	/* Put some storage in the cache of this thread */
+	for (int i = 0; i < n / 2; ++i)
+		UT_ASSERT(map->erase(i));
+
+	size_t objects = count_objects(pop);
+
+	throwing_map_type::value_type item(n, n);
+
+	throwing_value::throw_on_copy = true;
+	bool exception_thrown = false;
+	try {
+		map->insert(item);
+	} catch (std::runtime_error &) {
+		exception_thrown = true;
+	}
+	throwing_value::throw_on_copy = false;
+
+	UT_ASSERT(exception_thrown);
+	UT_ASSERTeq(map->size(), size_t(n / 2));
+	UT_ASSERTeq(map->count(n), 0);
+	UT_ASSERTeq(count_objects(pop), objects);
+
+	/* Inserts must not reuse storage of existing items */
+	for (int i = 0; i < n / 2; ++i)
+		UT_ASSERT(map->insert(
+			throwing_map_type::value_type(i, i + 1)));
+	for (int i = n; i < 2 * n; ++i)
+		UT_ASSERT(map->insert(
+			throwing_map_type::value_type(i, i + 1)));
+
+	UT_ASSERTeq(map->size(), size_t(n / 2 + n + n / 2));
+
+	for (int i = 0; i < 2 * n; ++i) {
+		/* Items which were not erased keep their original values */
+		int expected = (i >= n / 2 && i < n) ? i : i + 1;
+
+		throwing_map_type::const_accessor acc;
+		UT_ASSERT(map->find(acc, i));
+		UT_ASSERTeq(acc->second.value, expected);
+	}
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<throwing_map_type>(map);
+		pop.root()->throwing = nullptr;
+	});
+}
+
+/*
+ * erase_held_test -- (internal) test erase of items held by accessors
+ */
+void
+erase_held_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 100;
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i + 1)));
+
+	{
+		persistent_map_type::accessor acc;
+		UT_ASSERT(map->find(acc, 0));
+
+		persistent_map_type::const_accessor cacc;
+		UT_ASSERT(map->find(cacc, 1));
+
+		/* Erase does not wait for the accessors */
+		std::thread t([&] {
+			for (int i = 0; i < n; ++i)
+				UT_ASSERT(map->erase(i));
+		});
+		t.join();
+
+		/* This thread can erase item held by itself too */
+		UT_ASSERT(map->insert(value_type(0, 10)));
+		UT_ASSERT(map->erase(0));
+
+		UT_ASSERTeq(map->size(), 0);
+		UT_ASSERTeq(map->count(0), 0);
+		UT_ASSERT(!map->erase(1));
+
+		/* Nodes held by accessors are still valid */
+		UT_ASSERTeq(acc->first, 0);
+		UT_ASSERTeq(acc->second, 1);
+		UT_ASSERTeq(cacc->first, 1);
+		UT_ASSERTeq(cacc->second, 2);
+
+		nvobj::transaction::run(pop, [&] { acc->second = 100; });
+		UT_ASSERTeq(acc->second, 100);
+	}
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->erase(i));
+
+	UT_ASSERTeq(map->size(), 0);
+
+	map->clear();
+}
+
+/*
+ * retired_reuse_test -- (internal) test that an insert reuses storage of
+ * retired nodes when the node cache is empty
+ */
+void
+retired_reuse_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 200;
+	const int retired = int(hash_map_base::node_retire_batch) / 2;
+
+	/* Enable all segments upfront, so only nodes are allocated */
+	map->rehash(4 * n);
+
+	/* Drains the cache of this thread, fewer than node_cache_batch
+	 * nodes are left in it */
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	/* Too few to be reclaimed by the erases */
+	for (int i = 0; i < retired; ++i)
+		UT_ASSERT(map->erase(i));
+
+	size_t objects = count_objects(pop);
+
+	for (int i = n; i < n + retired; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	UT_ASSERTeq(count_objects(pop), objects);
+	UT_ASSERTeq(map->size(), size_t(n));
+
+	map->clear();
+}
+
+/*
+ * mt_test -- (internal) test inserts and erases in many threads
+ */
+void
+mt_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int thread_items = 500;
+	const int rounds = 4;
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		int begin = int(thread_id) * thread_items;
+		int end = begin + thread_items;
+
+		for (int r = 0; r < rounds; ++r) {
+			for (int i = begin; i < end; ++i)
+				UT_ASSERT(map->insert(value_type(i, i + r)));
+
+			for (int i = begin; i < end; ++i) {
+				persistent_map_type::const_accessor acc;
+				UT_ASSERT(map->find(acc, i));
+				UT_ASSERTeq(acc->second, i + r);
+			}
+
+			/* Leave every second item in the last round */
+			for (int i = begin; i < end; ++i) {
+				if (r < rounds - 1 || i % 2 == 0)
+					UT_ASSERT(map->erase(i));
+			}
+		}
+	});
+
+	UT_ASSERTeq(map->size(), concurrency * thread_items / 2);
+
+	for (int i = 0; i < int(concurrency) * thread_items; ++i)
+		UT_ASSERTeq(map->count(i), size_t(i % 2));
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	reuse_test(pop, path);
+	abort_test(pop);
+	erase_held_test(pop);
+	retired_reuse_test(pop);
+	mt_test(pop, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	/* Cached nodes are freed together with the map */
+	UT_ASSERT(OID_IS_NULL(pmemobj_first(pop.handle())));
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
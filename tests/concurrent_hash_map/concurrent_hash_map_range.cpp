@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_range.cpp -- pmem::obj::concurrent_hash_map test
+ * of splittable ranges and parallel_for_each.
+ *
+ */
+
+#include "unittest.hpp"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+/*
+ * split_all -- (internal) split the range until no subrange is divisible
+ */
+template <typename Range>
+std::vector<Range>
+split_all(Range r)
+{
+	std::vector<Range> done;
+	std::vector<Range> todo(1, r);
+
+	while (!todo.empty()) {
+		Range cur = todo.back();
+		todo.pop_back();
+
+		if (!cur.is_divisible()) {
+			done.push_back(cur);
+			continue;
+		}
+
+		Range upper(cur, nvobj::split());
+		todo.push_back(cur);
+		todo.push_back(upper);
+	}
+
+	return done;
+}
+
+/*
+ * range_test -- (internal) test that subranges cover all elements once
+ */
+void
+range_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	UT_ASSERT(map->range().empty());
+
+	const int n = 5000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	auto r = map->range();
+	UT_ASSERT(!r.empty());
+	UT_ASSERT(r.is_divisible());
+	UT_ASSERTeq(r.grainsize(), 1);
+
+	for (size_t grainsize : {size_t(1), size_t(16), size_t(1) << 20}) {
+		const persistent_map_type &cmap = *map;
+		auto subranges = split_all(cmap.range(grainsize));
+
+		if (grainsize > map->bucket_count())
+			UT_ASSERTeq(subranges.size(), 1);
+		else
+			UT_ASSERT(subranges.size() >=
+				  map->bucket_count() / grainsize);
+
+		std::vector<int> seen(n, 0);
+		for (auto &sub : subranges) {
+			for (auto &e : sub)
+				++seen[static_cast<size_t>(e.first.get_ro())];
+		}
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERTeq(seen[static_cast<size_t>(i)], 1);
+	}
+
+	map->clear();
+}
+
+/*
+ * parallel_for_each_test -- (internal) test parallel_for_each
+ */
+void
+parallel_for_each_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	std::atomic<size_t> calls(0);
+	map->parallel_for_each(concurrency, [&](value_type &) { ++calls; });
+	UT_ASSERTeq(calls.load(), 0);
+
+	const int n = 10000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	std::vector<std::atomic<int>> seen(n);
+	for (auto &s : seen)
+		s = 0;
+
+	for (size_t threads : {size_t(0), size_t(1), concurrency}) {
+		map->parallel_for_each(threads, [&](value_type &e) {
+			UT_ASSERTeq(e.first, e.second);
+			++seen[static_cast<size_t>(e.first.get_ro())];
+		});
+	}
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(seen[static_cast<size_t>(i)].load(), 3);
+
+	/* Modify values in place */
+	map->parallel_for_each(concurrency, [&](value_type &e) {
+		nvobj::transaction::run(pop, [&] { e.second = e.second + 1; });
+	});
+
+	std::atomic<long long> sum(0);
+	const persistent_map_type &cmap = *map;
+	cmap.parallel_for_each(concurrency, [&](const value_type &e) {
+		UT_ASSERTeq(e.second, e.first + 1);
+		sum += e.second;
+	});
+	UT_ASSERTeq(sum.load(), (long long)n * (n + 1) / 2);
+
+	/* Exceptions are propagated to the caller */
+	calls = 0;
+	try {
+		map->parallel_for_each(concurrency, [&](value_type &e) {
+			++calls;
+			if (e.first == n / 2)
+				throw std::runtime_error("test");
+		});
+		UT_ASSERT(0);
+	} catch (std::runtime_error &e) {
+		UT_ASSERT(std::string(e.what()) == "test");
+	} catch (...) {
+		UT_ASSERT(0);
+	}
+	UT_ASSERT(calls.load() >= 1);
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	range_test(pop);
+	parallel_for_each_test(pop, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
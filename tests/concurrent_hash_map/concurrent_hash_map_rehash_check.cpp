@@ -14,6 +14,7 @@
 #include <libpmemobj++/persistent_ptr.hpp>
 #include <libpmemobj++/pool.hpp>
 
+#include <chrono>
 #include <iterator>
 #include <thread>
 #include <vector>
@@ -104,6 +105,73 @@ rehash_test(nvobj::pool<root> &pop)
 	map->rehash(1024 * (1 << 3));
 	check_elements(pop, 2248);
 }
+
+/*
+ * background_rehash_test -- (internal) test inserts running concurrently
+ * with background rehasher and verify all elements are accessible.
+ */
+void
+background_rehash_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	persistent_map_type::background_rehasher rehasher(
+		*map, 64, std::chrono::microseconds(10));
+
+	run_inserts(pop, 2248, 20000);
+
+	/* Buckets above the largest key are never accessed by inserts */
+	while (rehasher.rehashed_count() == 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	check_elements(pop, 22248);
+
+	rehasher.stop();
+	UT_ASSERT(rehasher.rehashed_count() > 0);
+
+	check_elements(pop, 22248);
+	UT_ASSERTeq(map->size(), 22248);
+}
+
+/*
+ * rehash_down_test -- (internal) test shrinking the table and verify all
+ * elements are accessible.
+ */
+void
+rehash_down_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	size_t n = map->size();
+	size_t buckets = map->bucket_count();
+
+	for (int i = 1000; i < static_cast<int>(n); ++i)
+		UT_ASSERT(map->erase(i));
+
+	map->shrink_to_fit();
+	UT_ASSERT(map->bucket_count() < buckets);
+	UT_ASSERTeq(map->bucket_count(), 1024);
+	UT_ASSERTeq(map->size(), 1000);
+	check_elements(pop, 1000);
+
+	/* The table grows again */
+	run_inserts(pop, 1000, 9000);
+	UT_ASSERTeq(map->size(), 10000);
+	check_elements(pop, 10000);
+
+	/* Not all buckets are rehashed yet */
+	map->rehash_down(2048);
+	UT_ASSERTeq(map->bucket_count(), 2048);
+	check_elements(pop, 10000);
+
+	map->rehash_down(0);
+	UT_ASSERTeq(map->bucket_count(), 256);
+	UT_ASSERTeq(map->size(), 10000);
+	check_elements(pop, 10000);
+
+	run_inserts(pop, 10000, 1000);
+	check_elements(pop, 11000);
+}
 }
 
 static void
@@ -129,6 +197,8 @@ test(int argc, char *argv[])
 	}
 
 	rehash_test(pop);
+	background_rehash_test(pop);
+	rehash_down_test(pop);
 
 	pop.close();
 }
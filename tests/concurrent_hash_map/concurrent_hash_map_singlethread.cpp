@@ -479,6 +479,72 @@ insert_test(nvobj::pool<root> &pop)
 	pmem::detail::destroy<persistent_map_move_type>(*map_move);
 }
 
+/*
+ * batch_test -- (internal) test find_batch/insert_batch methods
+ * pmem::obj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int> >
+ */
+void
+batch_test(nvobj::pool<root> &pop)
+{
+	auto &map1 = pop.root()->map1;
+
+	tx_alloc_wrapper<persistent_map_type>(pop, map1);
+
+	map1->runtime_initialize();
+
+	const int n = 1000;
+
+	{
+		std::vector<value_type> v;
+		for (int i = 0; i < n; ++i)
+			v.emplace_back(i, i);
+
+		/* duplicated key within the batch */
+		v.emplace_back(0, 100);
+
+		UT_ASSERTeq(map1->insert_batch(v.begin(), v.end()),
+			    static_cast<size_t>(n));
+		UT_ASSERTeq(map1->size(), static_cast<size_t>(n));
+
+		/* all keys are already present */
+		UT_ASSERT(map1->insert_batch(v.begin(), v.end()) == 0);
+		UT_ASSERTeq(map1->size(), static_cast<size_t>(n));
+
+		UT_ASSERT(map1->insert_batch(v.end(), v.end()) == 0);
+	}
+
+	verify_elements(*map1, static_cast<size_t>(n));
+
+	{
+		std::vector<int> keys;
+		for (int i = n / 2; i < n + n / 2; ++i)
+			keys.push_back(i);
+
+		std::vector<int> found(static_cast<size_t>(n), 0);
+		auto ret = map1->find_batch(
+			keys.begin(), keys.end(),
+			[&](persistent_map_type::const_reference e) {
+				UT_ASSERTeq(e.first, e.second);
+				++found[static_cast<size_t>(e.first.get_ro())];
+			});
+
+		UT_ASSERTeq(ret, static_cast<size_t>(n / 2));
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERTeq(found[static_cast<size_t>(i)],
+				    i < n / 2 ? 0 : 1);
+
+		ret = map1->find_batch(
+			keys.end(), keys.end(),
+			[](persistent_map_type::const_reference) {
+				UT_ASSERT(0);
+			});
+		UT_ASSERT(ret == 0);
+	}
+
+	pmem::detail::destroy<persistent_map_type>(*map1);
+}
+
 /*
  * hetero_test -- (internal) test heterogeneous count/find/erase methods
  * pmem::obj::concurrent_hash_map<nvobj::string, nvobj::p<int>, string_hasher >
@@ -632,6 +698,7 @@ test(int argc, char *argv[])
 	access_test(pop);
 	swap_test(pop);
 	insert_test(pop);
+	batch_test(pop);
 	hetero_test(pop);
 	iterator_test(pop);
 
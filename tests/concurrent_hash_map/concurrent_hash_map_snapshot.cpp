@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_snapshot.cpp -- pmem::obj::concurrent_hash_map test
+ * of snapshot, export_snapshot and import_snapshot.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/concurrent_hash_map_snapshot.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+namespace nvobjex = pmem::obj::experimental;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+typedef nvobj::concurrent_hash_map<nvobj::string, nvobj::string,
+				   nvobj::string_hash>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<persistent_map_type> copy;
+	nvobj::persistent_ptr<string_map_type> string_map;
+	nvobj::persistent_ptr<string_map_type> string_copy;
+};
+
+typedef nvobjex::trivial_snapshot_deserializer<nvobj::p<int>, nvobj::p<int>>
+	deserializer_type;
+
+/*
+ * snapshot_test -- (internal) test export of a map modified concurrently
+ * and import of the snapshot to another map
+ */
+void
+snapshot_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+	auto copy = pop.root()->copy;
+
+	map->runtime_initialize();
+	copy->runtime_initialize();
+
+	/* Keys of the second half are erased during the export */
+	const int n = 20000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	size_t count = 0;
+	UT_ASSERTeq(map->snapshot([&](const value_type &) { ++count; }),
+		    size_t(n));
+	UT_ASSERTeq(count, size_t(n));
+
+	std::stringstream stream;
+	std::atomic<bool> done(false);
+
+	/* Small buffer, so the stream is written many times */
+	size_t exported = 0;
+	parallel_exec(concurrency + 1, [&](size_t thread_id) {
+		if (thread_id == 0) {
+			exported = nvobjex::export_snapshot(
+				*map, stream,
+				nvobjex::trivial_snapshot_serializer{}, 4096);
+			done = true;
+			return;
+		}
+
+		/* Inserts grow the table, which must not break the
+		 * snapshot */
+		int begin = n + static_cast<int>(thread_id) * n;
+		for (int i = begin; i < begin + n && !done; ++i) {
+			UT_ASSERT(map->insert(value_type(i, i)));
+
+			persistent_map_type::accessor acc;
+			int key = i % (n / 2);
+			UT_ASSERT(map->find(acc, key));
+			acc->second = key;
+		}
+
+		for (int i = n / 2 + static_cast<int>(thread_id); i < n;
+		     i += static_cast<int>(concurrency))
+			map->erase(i);
+	});
+
+	UT_ASSERTeq(nvobjex::import_snapshot(*copy, stream,
+					      deserializer_type{}, concurrency,
+					      1000, 4096),
+		    exported);
+	UT_ASSERTeq(copy->size(), exported);
+
+	/* Items which were not erased are in the snapshot */
+	for (int i = 0; i < n / 2; ++i) {
+		persistent_map_type::const_accessor acc;
+		UT_ASSERT(copy->find(acc, i));
+		UT_ASSERTeq(acc->second, i);
+	}
+
+	for (auto &e : *copy) {
+		persistent_map_type::const_accessor acc;
+		UT_ASSERT(e.first < n || map->find(acc, e.first));
+		UT_ASSERTeq(e.second, e.first);
+	}
+
+	map->clear();
+	copy->clear();
+}
+
+/*
+ * growth_test -- (internal) test that the table can grow between buckets
+ * visited by snapshot and items are still visited once
+ */
+void
+growth_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	size_t buckets = map->bucket_count();
+
+	/* No locks are held by snapshot when bucket_done is called */
+	std::vector<int> seen(n, 0);
+	int next = n;
+	size_t visited = map->snapshot(
+		[&](const value_type &v) {
+			if (v.first < n)
+				++seen[static_cast<size_t>(v.first)];
+		},
+		[&] {
+			for (int i = 0; i < 8; ++i, ++next)
+				UT_ASSERT(map->insert(value_type(next, next)));
+		});
+
+	UT_ASSERT(map->bucket_count() > buckets);
+	UT_ASSERT(visited >= size_t(n));
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(seen[static_cast<size_t>(i)], 1);
+
+	map->clear();
+}
+
+/*
+ * invalid_snapshot_test -- (internal) test import of invalid snapshots
+ */
+void
+invalid_snapshot_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+	auto copy = pop.root()->copy;
+
+	for (int i = 0; i < 100; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	std::stringstream stream;
+	UT_ASSERTeq(nvobjex::export_snapshot(
+			    *map, stream,
+			    nvobjex::trivial_snapshot_serializer{}),
+		    100);
+
+	std::string data = stream.str();
+
+	std::string invalid[] = {data.substr(0, data.size() - 1),
+				 data.substr(0, data.size() / 2),
+				 "not a snapshot", ""};
+
+	for (auto &s : invalid) {
+		std::stringstream in(s);
+		try {
+			nvobjex::import_snapshot(*copy, in, deserializer_type{},
+						 2, 10);
+			UT_ASSERT(0);
+		} catch (std::runtime_error &) {
+		} catch (...) {
+			UT_ASSERT(0);
+		}
+
+		/* The map is not modified if the snapshot is invalid */
+		UT_ASSERTeq(copy->size(), 0);
+	}
+
+	/* Records of a different size */
+	std::stringstream in(data);
+	try {
+		using long_deserializer_type =
+			nvobjex::trivial_snapshot_deserializer<int, long long>;
+
+		nvobjex::import_snapshot(*copy, in, long_deserializer_type{},
+					 2);
+		UT_ASSERT(0);
+	} catch (std::runtime_error &) {
+	} catch (...) {
+		UT_ASSERT(0);
+	}
+
+	map->clear();
+	copy->clear();
+}
+
+/*
+ * string_test -- (internal) test export and import with custom serializer
+ * and deserializer, including items bigger than the buffer
+ */
+void
+string_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->string_map;
+	auto copy = pop.root()->string_copy;
+
+	map->runtime_initialize();
+	copy->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert_or_assign(
+			"key-" + std::to_string(i),
+			std::string(static_cast<size_t>(i) * 10, 'x')));
+
+	std::stringstream stream;
+	UT_ASSERTeq(nvobjex::export_snapshot(
+			    *map, stream,
+			    [](const string_map_type::value_type &item,
+			       std::string &key, std::string &value) {
+				    key.assign(item.first.cbegin(),
+					       item.first.cend());
+				    value.assign(item.second.cbegin(),
+						 item.second.cend());
+			    },
+			    1024),
+		    n);
+
+	UT_ASSERTeq(nvobjex::import_snapshot(
+			    *copy, stream,
+			    [](nvobj::string_view key,
+			       nvobj::string_view value) {
+				    return std::make_pair(
+					    std::string(key.data(), key.size()),
+					    std::string(value.data(),
+							value.size()));
+			    },
+			    concurrency, 100, 1024),
+		    n);
+
+	for (int i = 0; i < n; ++i) {
+		string_map_type::const_accessor acc;
+		UT_ASSERT(copy->find(acc, "key-" + std::to_string(i)));
+		UT_ASSERTeq(acc->second.size(), static_cast<size_t>(i) * 10);
+	}
+
+	map->clear();
+	copy->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 40, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			auto r = pop.root();
+			r->cons = nvobj::make_persistent<persistent_map_type>();
+			r->copy = nvobj::make_persistent<persistent_map_type>();
+			r->string_map =
+				nvobj::make_persistent<string_map_type>();
+			r->string_copy =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 4;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	snapshot_test(pop, concurrency);
+	growth_test(pop);
+	invalid_snapshot_test(pop);
+	string_test(pop, concurrency);
+
+	pmem::obj::transaction::run(pop, [&] {
+		auto r = pop.root();
+		nvobj::delete_persistent<persistent_map_type>(r->cons);
+		nvobj::delete_persistent<persistent_map_type>(r->copy);
+		nvobj::delete_persistent<string_map_type>(r->string_map);
+		nvobj::delete_persistent<string_map_type>(r->string_copy);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_string_hash.cpp -- pmem::obj::concurrent_hash_map test
+ * of heterogeneous lookups with pmem::obj::string_hash.
+ *
+ */
+
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/concurrent_hash_map.hpp>
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/string_view.hpp>
+
+#include <string>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::concurrent_hash_map<nvobj::string, nvobj::p<int>,
+				   nvobj::string_hash>
+	persistent_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<nvobj::string> str;
+};
+
+/*
+ * hash_test -- (internal) test that all string representations of the same
+ * content have the same hash
+ */
+void
+hash_test(nvobj::pool<root> &pop)
+{
+	auto r = pop.root();
+
+	nvobj::transaction::run(pop, [&] {
+		r->str = nvobj::make_persistent<nvobj::string>("key-1234");
+	});
+
+	nvobj::string_hash h;
+	nvobj::string_hash::transparent_key_equal eq;
+
+	const char *cstr = "key-1234";
+	std::string sstr(cstr);
+	nvobj::string_view sv(cstr);
+
+	UT_ASSERTeq(h(*r->str), h(cstr));
+	UT_ASSERTeq(h(*r->str), h(sstr));
+	UT_ASSERTeq(h(*r->str), h(sv));
+	UT_ASSERTeq(h(*r->str), h("key-1234"));
+	UT_ASSERT(h(*r->str) != h("key-1235"));
+	UT_ASSERT(h(nvobj::string_view()) != h(nvobj::string_view("\0", 1)));
+
+	UT_ASSERT(eq(*r->str, cstr));
+	UT_ASSERT(eq(sv, *r->str));
+	UT_ASSERT(eq(*r->str, *r->str));
+	UT_ASSERT(!eq(*r->str, "key-123"));
+	UT_ASSERT(!eq(*r->str, std::string("key-12345")));
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<nvobj::string>(r->str);
+	});
+}
+
+/*
+ * lookup_test -- (internal) test lookups and erase with keys which are not
+ * pmem::obj::string
+ */
+void
+lookup_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert_or_assign(std::to_string(i), i));
+
+	UT_ASSERT(!map->insert_or_assign("0", 100));
+	UT_ASSERTeq(map->size(), n);
+
+	for (int i = 0; i < n; ++i) {
+		std::string key = std::to_string(i);
+
+		{
+			persistent_map_type::const_accessor acc;
+			UT_ASSERT(map->find(acc, key.c_str()));
+			UT_ASSERT(acc->first == key);
+			UT_ASSERTeq(acc->second, i == 0 ? 100 : i);
+		}
+
+		UT_ASSERTeq(map->count(nvobj::string_view(key)), 1);
+		UT_ASSERTeq(map->count(key), 1);
+
+		/* Prefixes and extensions of existing keys */
+		UT_ASSERTeq(map->count(key + "x"), 0);
+		UT_ASSERTeq(
+			map->count(nvobj::string_view(key.data(), 0)), 0);
+	}
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(map->erase(nvobj::string_view(std::to_string(i))));
+
+	UT_ASSERT(!map->erase("0"));
+	UT_ASSERTeq(map->size(), n / 2);
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(map->count(std::to_string(i).c_str()),
+			    size_t(i % 2));
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		pmem::obj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	hash_test(pop);
+	lookup_test(pop);
+
+	pmem::obj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_hash_map_striped.cpp --
+ * pmem::obj::experimental::striped_concurrent_hash_map test
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/experimental/striped_concurrent_hash_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <string>
+#include <vector>
+
+#define LAYOUT "concurrent_hash_map"
+
+namespace nvobj = pmem::obj;
+namespace nvobjex = pmem::obj::experimental;
+
+namespace
+{
+
+typedef nvobjex::striped_concurrent_hash_map<nvobj::p<int>, nvobj::p<int>>
+	striped_map_type;
+
+typedef striped_map_type::map_type persistent_map_type;
+
+typedef striped_map_type::value_type value_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+const size_t n_pools = 3;
+
+std::vector<nvobj::pool<root>>
+open_pools(const std::string &path, bool create)
+{
+	std::vector<nvobj::pool<root>> pools;
+
+	for (size_t i = 0; i < n_pools; ++i) {
+		std::string p = path + "_" + std::to_string(i);
+
+		if (!create) {
+			pools.push_back(nvobj::pool<root>::open(p, LAYOUT));
+			continue;
+		}
+
+		auto pop = nvobj::pool<root>::create(
+			p, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+		});
+
+		pools.push_back(pop);
+	}
+
+	return pools;
+}
+
+std::vector<nvobj::persistent_ptr<persistent_map_type>>
+get_stripes(std::vector<nvobj::pool<root>> &pools)
+{
+	std::vector<nvobj::persistent_ptr<persistent_map_type>> stripes;
+	for (auto &pop : pools)
+		stripes.push_back(pop.root()->cons);
+
+	return stripes;
+}
+
+/*
+ * ctor_test -- (internal) test invalid arguments of the constructor
+ */
+void
+ctor_test(std::vector<nvobj::pool<root>> &pools)
+{
+	try {
+		striped_map_type map({});
+		UT_ASSERT(0);
+	} catch (std::invalid_argument &) {
+	} catch (...) {
+		UT_ASSERT(0);
+	}
+
+	try {
+		striped_map_type map({pools[0].root()->cons, nullptr});
+		UT_ASSERT(0);
+	} catch (std::invalid_argument &) {
+	} catch (...) {
+		UT_ASSERT(0);
+	}
+}
+
+/*
+ * striped_test -- (internal) test operations routed to stripes in
+ * different pools, including reopen of the pools
+ */
+void
+striped_test(const std::string &path, size_t concurrency)
+{
+	const int thread_items = 2000;
+	const int n = static_cast<int>(concurrency) * thread_items;
+
+	{
+		auto pools = open_pools(path, true);
+
+		ctor_test(pools);
+
+		striped_map_type map(get_stripes(pools));
+		map.runtime_initialize();
+
+		UT_ASSERTeq(map.stripes_count(), n_pools);
+		UT_ASSERT(map.empty());
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int begin = static_cast<int>(thread_id) * thread_items;
+			for (int i = begin; i < begin + thread_items; ++i)
+				UT_ASSERT(map.insert(value_type(i, i + 1)));
+
+			for (int i = begin; i < begin + thread_items; i += 2)
+				UT_ASSERT(map.erase(i));
+		});
+
+		UT_ASSERTeq(map.size(), size_t(n / 2));
+
+		/* Items are spread over all stripes by hash */
+		for (size_t s = 0; s < n_pools; ++s) {
+			UT_ASSERT(map.stripe(s).size() > 0);
+
+			for (auto &e : map.stripe(s))
+				UT_ASSERTeq(map.stripe_of(e.first), s);
+		}
+
+		{
+			striped_map_type::accessor acc;
+			UT_ASSERT(map.find(acc, 1));
+			UT_ASSERTeq(acc->second, 2);
+			UT_ASSERT(!map.insert(acc, 1));
+		}
+
+		UT_ASSERT(!map.insert_or_assign(1, 10));
+		UT_ASSERT(map.insert_or_assign(n, n + 1));
+		UT_ASSERT(map.erase(n));
+
+		for (auto &pop : pools)
+			pop.close();
+	}
+
+	{
+		auto pools = open_pools(path, false);
+
+		striped_map_type map(get_stripes(pools));
+		map.runtime_initialize();
+
+		UT_ASSERTeq(map.size(), size_t(n / 2));
+
+		for (int i = 0; i < n; ++i) {
+			striped_map_type::const_accessor acc;
+			bool found = map.find(acc, i);
+
+			UT_ASSERT(found == (i % 2 == 1));
+			UT_ASSERTeq(map.count(i), found ? 1u : 0u);
+			if (found)
+				UT_ASSERTeq(acc->second, i == 1 ? 10 : i + 1);
+		}
+
+		map.clear();
+		UT_ASSERT(map.empty());
+
+		map.for_each_stripe(
+			[](persistent_map_type &m) { m.free_data(); });
+
+		for (auto &pop : pools) {
+			nvobj::transaction::run(pop, [&] {
+				nvobj::delete_persistent<persistent_map_type>(
+					pop.root()->cons);
+			});
+			pop.close();
+		}
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	try {
+		striped_test(path, concurrency);
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool: %s %s", pe.what(), path);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
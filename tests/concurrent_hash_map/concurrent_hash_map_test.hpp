@@ -253,6 +253,41 @@ insert_and_lookup_iterator_test(nvobj::pool<root> &pop, size_t concurrency = 8,
 	test.clear();
 }
 
+/*
+ * insert_and_lookup_batch_test -- test batched insert and lookup
+ * Implements tests for:
+ * size_type pmem::obj::concurrent_hash_map< Key, T, Hash,
+ *	KeyEqual>::insert_batch(I first, I last)
+ * size_type pmem::obj::concurrent_hash_map< Key, T, Hash,
+ *	KeyEqual>::find_batch(I first, I last, F f)
+ */
+void
+insert_and_lookup_batch_test(nvobj::pool<root> &pop, size_t concurrency = 8,
+			     size_t thread_items = 50)
+{
+	PRINT_TEST_PARAMS;
+
+	ConcurrentHashMapTestPrimitives<root, persistent_map_type> test(
+		pop, pop.root()->cons, (concurrency + 1) * thread_items);
+	std::atomic<size_t> inserted(0);
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		/* batches of neighbouring threads overlap */
+		int begin = int(thread_id * thread_items);
+		int end = begin + 2 * int(thread_items);
+		std::vector<persistent_map_type::value_type> v;
+		std::vector<int> keys;
+		for (int i = begin; i < end; ++i) {
+			v.push_back(persistent_map_type::value_type(i, i));
+			keys.push_back(i);
+		}
+		inserted += test.insert_batch(v);
+		test.check_batch(keys);
+	});
+	UT_ASSERTeq(inserted.load(), (concurrency + 1) * thread_items);
+	test.check_consistency();
+	test.clear();
+}
+
 /*
  * insert_mt_test -- test insert for small number of elements
  * Implements tests for:
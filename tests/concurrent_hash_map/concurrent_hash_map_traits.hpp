@@ -205,6 +205,32 @@ public:
 		}
 	}
 
+	size_t
+	insert_batch(const std::vector<value_type> &v)
+	{
+		size_t ret = map->insert_batch(v.begin(), v.end());
+		for (auto &i : v) {
+			auto key = i.first;
+			UT_ASSERTeq(map->count(key), 1);
+		}
+		return ret;
+	}
+
+	template <typename Key>
+	void
+	check_batch(const std::vector<Key> &keys)
+	{
+		size_t calls = 0;
+		size_t ret = map->find_batch(
+			keys.begin(), keys.end(),
+			[&](typename MapType::const_reference e) {
+				UT_ASSERT(e.first == e.second);
+				++calls;
+			});
+		UT_ASSERT(ret == keys.size());
+		UT_ASSERT(calls == keys.size());
+	}
+
 	template <typename K, typename M>
 	bool
 	insert_or_assign(K &&key, M &&obj)
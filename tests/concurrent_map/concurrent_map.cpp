@@ -203,6 +203,47 @@ emplace_and_lookup_duplicates_test(nvobj::pool<root> &pop, MapType *map)
 
 	check_sorted(map);
 }
+
+/*
+ * interleaved_emplace_test -- (internal) test concurrent emplace of adjacent
+ * keys, which link the same predecessors on all levels
+ */
+template <typename MapType>
+void
+interleaved_emplace_test(nvobj::pool<root> &pop, MapType *map)
+{
+	const int NUMBER_ITEMS_INSERT = 500;
+
+	// Adding more concurrency will increase DRD test time
+	const int concurrency = 8;
+
+	const int TOTAL_ITEMS = NUMBER_ITEMS_INSERT * concurrency;
+
+	map->runtime_initialize();
+	map->clear();
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		for (int i = int(thread_id); i < TOTAL_ITEMS;
+		     i += concurrency) {
+			auto ret = map->emplace(gen_key(*map, i),
+						gen_key(*map, i));
+			UT_ASSERT(ret.second == true);
+		}
+	});
+
+	UT_ASSERT(map->size() == size_t(TOTAL_ITEMS));
+	UT_ASSERT(std::distance(map->begin(), map->end()) == TOTAL_ITEMS);
+
+	check_sorted(map);
+
+	for (int i = 0; i < TOTAL_ITEMS; ++i) {
+		auto it = map->find(gen_key(*map, i));
+		UT_ASSERT(it != map->end());
+		UT_ASSERT(it->second == gen_key(*map, i));
+	}
+
+	map->clear();
+}
 }
 
 static void
@@ -231,9 +272,11 @@ test(int argc, char *argv[])
 
 	emplace_and_lookup_test(pop, pop.root()->cons1.get());
 	emplace_and_lookup_duplicates_test(pop, pop.root()->cons1.get());
+	interleaved_emplace_test(pop, pop.root()->cons1.get());
 
 	emplace_and_lookup_test(pop, pop.root()->cons2.get());
 	emplace_and_lookup_duplicates_test(pop, pop.root()->cons2.get());
+	interleaved_emplace_test(pop, pop.root()->cons2.get());
 
 	nvobj::transaction::run(pop, [&] {
 		nvobj::delete_persistent<persistent_map_type_int>(
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_bulk_insert.cpp -- pmem::obj::experimental::concurrent_map
+ * test of construction from sorted ranges and of bulk_insert_sorted.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/experimental/volatile_index_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::concurrent_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef nvobj::experimental::volatile_index_concurrent_map<nvobj::p<int>,
+							    nvobj::p<int>>
+	volatile_index_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<volatile_index_map_type> volatile_index_map;
+};
+
+typedef std::vector<std::pair<int, int>> input_type;
+
+/*
+ * make_input -- (internal) returns pairs (i, i) for i in [first, last) with
+ * the given step
+ */
+input_type
+make_input(int first, int last, int step)
+{
+	input_type input;
+	for (int i = first; i < last; i += step)
+		input.emplace_back(i, i);
+
+	return input;
+}
+
+/*
+ * check_map -- (internal) check that the map contains exactly keys from
+ * [0, n) for which pred is true, with values equal to keys
+ */
+template <typename MapType, typename Pred>
+void
+check_map(MapType &map, int n, Pred pred)
+{
+	using value_type = typename MapType::value_type;
+
+	size_t expected = 0;
+	for (int i = 0; i < n; ++i) {
+		auto it = map.find(i);
+		if (pred(i)) {
+			++expected;
+			UT_ASSERT(it != map.end());
+			UT_ASSERT(it->second == i);
+		} else {
+			UT_ASSERT(it == map.end());
+		}
+
+		auto lb = map.lower_bound(i);
+		if (lb != map.end())
+			UT_ASSERT(lb->first >= i);
+	}
+
+	UT_ASSERTeq(map.size(), expected);
+	UT_ASSERTeq(static_cast<size_t>(std::distance(map.begin(), map.end())),
+		    expected);
+	UT_ASSERT(std::is_sorted(map.begin(), map.end(),
+				 [](const value_type &lhs,
+				    const value_type &rhs) {
+					 return lhs.first < rhs.first;
+				 }));
+}
+
+/*
+ * ctor_test -- (internal) test construction from a sorted range
+ */
+void
+ctor_test(nvobj::pool<root> &pop)
+{
+	const int n = 5000;
+	input_type input = make_input(0, n, 1);
+
+	nvobj::transaction::run(pop, [&] {
+		pop.root()->cons = nvobj::make_persistent<persistent_map_type>(
+			nvobj::experimental::sorted_range_t{}, input.begin(),
+			input.end());
+	});
+
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	check_map(*map, n, [](int) { return true; });
+
+	/* The map can be modified concurrently afterwards */
+	parallel_exec(4, [&](size_t thread_id) {
+		int id = static_cast<int>(thread_id);
+		for (int i = n + id; i < 2 * n; i += 4)
+			UT_ASSERT(map->insert(
+					      persistent_map_type::value_type(
+						      i, i))
+					  .second);
+		for (int i = id; i < n; i += 4)
+			UT_ASSERTeq(map->erase(i), 1);
+	});
+
+	check_map(*map, 2 * n, [](int i) { return i >= n; });
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		pop.root()->cons = nullptr;
+	});
+}
+
+/*
+ * bulk_insert_test -- (internal) test bulk_insert_sorted into empty and
+ * non-empty maps, with duplicated keys and unsorted input
+ */
+template <typename MapType>
+void
+bulk_insert_test(nvobj::pool<root> &pop, nvobj::persistent_ptr<MapType> map)
+{
+	map->runtime_initialize();
+
+	const int n = 3000;
+
+	/* Empty map, more than one batch */
+	input_type evens = make_input(0, n, 2);
+	size_t inserted = map->bulk_insert_sorted(evens.begin(), evens.end());
+	UT_ASSERTeq(inserted, evens.size());
+	check_map(*map, n, [](int i) { return i % 2 == 0; });
+
+	/* Keys between existing ones, with duplicates */
+	input_type input = make_input(0, n, 3);
+	input_type dups = make_input(0, n, 9);
+	input.insert(input.end(), dups.begin(), dups.end());
+	std::stable_sort(input.begin(), input.end(),
+			 [](const std::pair<int, int> &lhs,
+			    const std::pair<int, int> &rhs) {
+				 return lhs.first < rhs.first;
+			 });
+
+	size_t expected = 0;
+	for (int i = 0; i < n; i += 3)
+		expected += i % 2 == 0 ? 0 : 1;
+
+	inserted = map->bulk_insert_sorted(input.begin(), input.end());
+	UT_ASSERTeq(inserted, expected);
+	check_map(*map, n, [](int i) { return i % 2 == 0 || i % 3 == 0; });
+
+	/* Unsorted input */
+	input_type rest;
+	for (int i = n - 1; i >= 0; --i)
+		if (i % 2 != 0 && i % 3 != 0)
+			rest.emplace_back(i, i);
+
+	inserted = map->bulk_insert_sorted(rest.begin(), rest.end());
+	UT_ASSERTeq(inserted, rest.size());
+	check_map(*map, n, [](int) { return true; });
+
+	/* Aborted transaction leaves the map unchanged */
+	input_type more = make_input(n, 2 * n, 1);
+	try {
+		nvobj::transaction::run(pop, [&] {
+			map->bulk_insert_sorted(more.begin(), more.end());
+			nvobj::transaction::abort(0);
+		});
+		UT_ASSERT(0);
+	} catch (pmem::manual_tx_abort &) {
+	}
+
+	check_map(*map, 2 * n, [&](int i) { return i < n; });
+
+	UT_ASSERT(map->insert(typename MapType::value_type(n, n)).second);
+	check_map(*map, 2 * n, [&](int i) { return i <= n; });
+}
+
+/*
+ * reopen_test -- (internal) test that bulk inserted elements are preserved
+ * after reopen
+ */
+template <typename MapType>
+void
+reopen_test(nvobj::pool<root> &pop, const std::string &path,
+	    nvobj::persistent_ptr<MapType> root::*map_ptr)
+{
+	const int n = 3000;
+
+	pop.close();
+	pop = nvobj::pool<root>::open(path, LAYOUT);
+
+	auto map = pop.root().get()->*map_ptr;
+
+	map->runtime_initialize();
+
+	check_map(*map, 2 * n, [&](int i) { return i <= n; });
+
+	input_type input = make_input(n + 1, 2 * n, 1);
+	size_t inserted = map->bulk_insert_sorted(input.begin(), input.end());
+	UT_ASSERTeq(inserted, input.size());
+
+	pop.close();
+	pop = nvobj::pool<root>::open(path, LAYOUT);
+
+	map = pop.root().get()->*map_ptr;
+
+	map->runtime_initialize();
+
+	check_map(*map, 2 * n, [](int) { return true; });
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	ctor_test(pop);
+
+	nvobj::transaction::run(pop, [&] {
+		pop.root()->cons =
+			nvobj::make_persistent<persistent_map_type>();
+		pop.root()->volatile_index_map =
+			nvobj::make_persistent<volatile_index_map_type>();
+	});
+
+	bulk_insert_test(pop, pop.root()->cons);
+	reopen_test(pop, path, &root::cons);
+
+	bulk_insert_test(pop, pop.root()->volatile_index_map);
+	reopen_test(pop, path, &root::volatile_index_map);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<volatile_index_map_type>(
+			pop.root()->volatile_index_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
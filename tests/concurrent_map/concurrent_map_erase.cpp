@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_erase.cpp -- pmem::obj::experimental::concurrent_map and
+ * reclaiming_concurrent_map test of thread-safe erase, concurrent with
+ * inserts, lookups and traversals, and of reclamation of erased elements,
+ * while the map is in use and on restart.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/experimental/reclaiming_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+struct hetero_less {
+	using is_transparent = void;
+	template <typename T1, typename T2>
+	bool
+	operator()(const T1 &lhs, const T2 &rhs) const
+	{
+		return lhs < rhs;
+	}
+};
+
+typedef nvobj::experimental::concurrent_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef nvobj::experimental::reclaiming_concurrent_map<nvobj::p<int>,
+							nvobj::p<int>>
+	reclaiming_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+typedef nvobj::experimental::concurrent_map<nvobj::string, nvobj::p<int>,
+					    hetero_less>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<reclaiming_map_type> reclaiming_map;
+	nvobj::persistent_ptr<string_map_type> string_map;
+};
+
+/* Elements of concurrent_map are not freed while the map is in use */
+struct no_guard {
+	explicit no_guard(const persistent_map_type &)
+	{
+	}
+};
+
+size_t
+count_objects(nvobj::pool<root> &pop)
+{
+	size_t n = 0;
+	for (PMEMoid oid = pmemobj_first(pop.handle()); !OID_IS_NULL(oid);
+	     oid = pmemobj_next(oid))
+		++n;
+
+	return n;
+}
+
+template <typename MapType>
+void
+check_size(MapType &map, size_t expected_size)
+{
+	UT_ASSERTeq(map.size(), expected_size);
+	UT_ASSERTeq(static_cast<size_t>(std::distance(map.begin(), map.end())),
+		    expected_size);
+}
+
+template <typename MapType>
+void
+check_sorted(MapType &map)
+{
+	UT_ASSERT(std::is_sorted(map.begin(), map.end(),
+				 [](const value_type &lhs,
+				    const value_type &rhs) {
+					 return lhs.first < rhs.first;
+				 }));
+}
+
+/*
+ * erase_test -- (internal) test erase concurrent with inserts, lookups and
+ * traversals
+ */
+template <typename MapType, typename GuardType>
+void
+erase_test(nvobj::persistent_ptr<MapType> map, size_t concurrency)
+{
+	map->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)).second);
+
+	parallel_exec(concurrency * 3, [&](size_t thread_id) {
+		int id = static_cast<int>(thread_id / 3);
+		int step = static_cast<int>(concurrency);
+
+		if (thread_id % 3 == 0) {
+			/* Even keys are erased */
+			for (int i = id * 2; i < n; i += step * 2) {
+				UT_ASSERTeq(map->erase(i), 1);
+				UT_ASSERT(map->find(i) == map->end());
+				UT_ASSERTeq(map->erase(i), 0);
+			}
+		} else if (thread_id % 3 == 1) {
+			for (int i = n + id; i < 2 * n; i += step)
+				UT_ASSERT(map->insert(value_type(i, i)).second);
+		} else {
+			/* Erased nodes are not freed while they can be
+			 * visited */
+			GuardType guard(*map);
+
+			/* Odd keys are never erased */
+			for (int i = 1; i < n; i += 2) {
+				auto it = map->find(i);
+				UT_ASSERT(it != map->end());
+				UT_ASSERT(it->second == i);
+			}
+
+			int prev = -1;
+			for (auto &e : *map) {
+				UT_ASSERT(prev < e.first);
+				prev = e.first;
+			}
+		}
+	});
+
+	check_size(*map, size_t(n + n / 2));
+	check_sorted(*map);
+
+	for (int i = 0; i < 2 * n; ++i) {
+		bool erased = i < n && i % 2 == 0;
+		UT_ASSERTeq(map->count(i), erased ? 0 : 1);
+	}
+
+	map->unsafe_reclaim();
+
+	check_size(*map, size_t(n + n / 2));
+
+	map->clear();
+}
+
+/*
+ * erase_insert_test -- (internal) test erase and insert of the same keys by
+ * many threads
+ */
+template <typename MapType>
+void
+erase_insert_test(nvobj::persistent_ptr<MapType> map, size_t concurrency)
+{
+	map->runtime_initialize();
+
+	const int n = 100;
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		for (int iter = 0; iter < 20; ++iter) {
+			for (int i = 0; i < n; ++i) {
+				if ((i + iter + static_cast<int>(thread_id)) %
+				    2)
+					map->insert(value_type(i, iter));
+				else
+					map->erase(i);
+			}
+		}
+	});
+
+	check_sorted(*map);
+	check_size(*map, map->size());
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->count(i) <= 1);
+
+	map->unsafe_reclaim();
+	map->clear();
+
+	check_size(*map, 0);
+}
+
+/*
+ * retain_test -- (internal) test that elements erased from concurrent_map are
+ * not freed before unsafe_reclaim()
+ */
+void
+retain_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	size_t objects = count_objects(pop);
+
+	const int n = 500;
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		int first = static_cast<int>(thread_id) * n;
+		for (int i = first; i < first + n; ++i) {
+			auto it = map->insert(value_type(i, i)).first;
+			UT_ASSERTeq(map->erase(i), 1);
+			/* Iterator to the erased element stays valid */
+			UT_ASSERT(it->first == i);
+			UT_ASSERT(it->second == i);
+		}
+	});
+
+	check_size(*map, 0);
+
+	size_t retained = count_objects(pop);
+	UT_ASSERT(retained >= objects + concurrency * n);
+
+	map->unsafe_reclaim();
+	UT_ASSERTeq(count_objects(pop), retained - concurrency * n);
+}
+
+/*
+ * online_reclaim_test -- (internal) test that erased elements are freed while
+ * the map is in use
+ */
+void
+online_reclaim_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->reclaiming_map;
+
+	map->runtime_initialize();
+
+	size_t objects = count_objects(pop);
+
+	const int n = 2000;
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		int first = static_cast<int>(thread_id) * n;
+		for (int i = first; i < first + n; ++i) {
+			UT_ASSERT(map->insert(value_type(i, i)).second);
+			UT_ASSERTeq(map->erase(i), 1);
+		}
+	});
+
+	check_size(*map, 0);
+
+	/* Without reclamation, all n * concurrency nodes would remain */
+	UT_ASSERT(count_objects(pop) < objects + concurrency * n / 2);
+
+	map->unsafe_reclaim();
+	map->clear();
+}
+
+/*
+ * erase_reopen_test -- (internal) test that erased elements are reclaimed
+ * after reopen
+ */
+void
+erase_reopen_test(nvobj::pool<root> &pop, const std::string &path,
+		  size_t concurrency)
+{
+	const int n = 1000;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERT(map->insert(value_type(i, i)).second);
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int step = static_cast<int>(concurrency);
+			for (int i = static_cast<int>(thread_id); i < n;
+			     i += step) {
+				if (i % 3 == 0)
+					UT_ASSERTeq(map->erase(i), 1);
+			}
+		});
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		check_size(*map, size_t(n - (n + 2) / 3));
+		check_sorted(*map);
+
+		for (int i = 0; i < n; ++i)
+			UT_ASSERTeq(map->count(i), i % 3 == 0 ? 0 : 1);
+
+		for (int i = 0; i < n; i += 3)
+			UT_ASSERT(map->insert(value_type(i, i)).second);
+
+		check_size(*map, size_t(n));
+
+		map->clear();
+	}
+}
+
+/*
+ * string_erase_test -- (internal) test erase with transparent comparator
+ */
+void
+string_erase_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->string_map;
+
+	map->runtime_initialize();
+
+	const int n = 200;
+	for (int i = 0; i < n; ++i)
+		map->try_emplace(std::to_string(i), i);
+
+	parallel_exec(concurrency, [&](size_t thread_id) {
+		int step = static_cast<int>(concurrency);
+		for (int i = static_cast<int>(thread_id); i < n; i += step)
+			UT_ASSERTeq(map->erase(std::to_string(i)), 1);
+	});
+
+	check_size(*map, 0);
+
+	map->unsafe_reclaim();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->reclaiming_map =
+				nvobj::make_persistent<reclaiming_map_type>();
+			pop.root()->string_map =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 4;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	erase_test<persistent_map_type, no_guard>(pop.root()->cons,
+						   concurrency);
+	erase_test<reclaiming_map_type, reclaiming_map_type::epoch_guard>(
+		pop.root()->reclaiming_map, concurrency);
+	erase_insert_test(pop.root()->cons, concurrency);
+	erase_insert_test(pop.root()->reclaiming_map, concurrency);
+	retain_test(pop, concurrency);
+	online_reclaim_test(pop, concurrency);
+	erase_reopen_test(pop, path, concurrency);
+	string_erase_test(pop, concurrency);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<reclaiming_map_type>(
+			pop.root()->reclaiming_map);
+		nvobj::delete_persistent<string_map_type>(
+			pop.root()->string_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
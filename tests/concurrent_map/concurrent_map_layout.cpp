@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_layout.cpp -- pmem::obj::experimental::concurrent_map test
+ * of the layout of the map, its nodes and thread local data, and of the check
+ * of the layout version by runtime_initialize().
+ *
+ */
+
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <cstddef>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+static constexpr std::size_t MAP_SIZE = 2192;
+static constexpr std::size_t TLS_ENTRY_SIZE = 64;
+
+/*
+ * Test is implemented in inherited class to get access to protected variables.
+ */
+template <typename MapType, std::size_t ValueSize>
+struct map_test : public MapType {
+	static constexpr std::size_t NODE_SIZE = 88 + ValueSize;
+
+	using list_node_type = typename MapType::list_node_type;
+	using tls_entry_type = typename MapType::tls_entry_type;
+
+	struct node_test : public list_node_type {
+		static void
+		check_layout()
+		{
+			static_assert(std::is_standard_layout<node_test>::value,
+				      "");
+
+			/* next pointers are stored right after the node */
+			static_assert(offsetof(node_test, mutex) == 0, "");
+			static_assert(offsetof(node_test, val) == 64, "");
+			static_assert(offsetof(node_test, height_) ==
+					      64 + ValueSize,
+				      "");
+			static_assert(offsetof(node_test, state_) ==
+					      72 + ValueSize,
+				      "");
+			static_assert(offsetof(node_test, retired_next_) ==
+					      80 + ValueSize,
+				      "");
+			static_assert(sizeof(node_test) == NODE_SIZE, "");
+		}
+	};
+
+	static void
+	check_layout()
+	{
+		static_assert(std::is_standard_layout<map_test>::value, "");
+
+		static_assert(offsetof(map_test, pool_uuid) == 0, "");
+		static_assert(offsetof(map_test, dummy_head) == 16, "");
+		static_assert(offsetof(map_test, tls_data) == 24, "");
+		static_assert(offsetof(map_test, _size) == 2152, "");
+		static_assert(offsetof(map_test, on_init_size) == 2160, "");
+		static_assert(offsetof(map_test, layout_version) == 2168, "");
+		/* volatile state is placed after the persistent fields */
+		static_assert(offsetof(map_test, epochs) == 2176, "");
+		static_assert(sizeof(map_test) == MAP_SIZE, "");
+
+		static_assert(offsetof(tls_entry_type, ptr) == 0, "");
+		static_assert(offsetof(tls_entry_type, size_diff) == 8, "");
+		static_assert(offsetof(tls_entry_type, insert_stage) == 16, "");
+		static_assert(offsetof(tls_entry_type, retired) == 24, "");
+		static_assert(offsetof(tls_entry_type, reserved) == 32, "");
+		static_assert(sizeof(tls_entry_type) == TLS_ENTRY_SIZE, "");
+
+		node_test::check_layout();
+	}
+
+	static void
+	check_layout_different_version(nvobj::pool_base &pop)
+	{
+		nvobj::persistent_ptr<map_test> map;
+		nvobj::transaction::run(
+			pop, [&] { map = nvobj::make_persistent<map_test>(); });
+
+		map->runtime_initialize();
+
+		uint64_t version = map->layout_version;
+		nvobj::transaction::run(pop, [&] { map->layout_version = 0; });
+
+		try {
+			map->runtime_initialize();
+			UT_ASSERT(0);
+		} catch (pmem::layout_error &) {
+		} catch (...) {
+			UT_ASSERT(0);
+		}
+
+		/* Different version of the layout */
+		nvobj::transaction::run(pop,
+					[&] { map->layout_version = version - 1; });
+
+		try {
+			map->runtime_initialize();
+			UT_ASSERT(0);
+		} catch (pmem::layout_error &) {
+		} catch (...) {
+			UT_ASSERT(0);
+		}
+
+		nvobj::transaction::run(pop,
+					[&] { map->layout_version = version; });
+		map->runtime_initialize();
+
+		nvobj::transaction::run(pop, [&] {
+			nvobj::delete_persistent<map_test>(map);
+		});
+	}
+};
+
+typedef nvobj::experimental::concurrent_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef nvobj::experimental::concurrent_map<nvobj::string, nvobj::string>
+	string_map_type;
+
+struct root {
+};
+
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	static_assert(sizeof(persistent_map_type::value_type) == 8, "");
+	map_test<persistent_map_type, 8>::check_layout();
+	map_test<persistent_map_type, 8>::check_layout_different_version(pop);
+
+	static_assert(sizeof(string_map_type::value_type) == 64, "");
+	map_test<string_map_type, 64>::check_layout();
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
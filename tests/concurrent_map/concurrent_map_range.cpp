@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_range.cpp -- pmem::obj::experimental::concurrent_map test
+ * of splittable ranges and parallel_for_each.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/experimental/volatile_index_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::concurrent_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef nvobj::experimental::volatile_index_concurrent_map<nvobj::p<int>,
+							    nvobj::p<int>>
+	volatile_index_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<volatile_index_map_type> volatile_index_map;
+};
+
+/*
+ * split_all -- (internal) split the range until no subrange is divisible,
+ * returns subranges in ascending order
+ */
+template <typename Range>
+std::vector<Range>
+split_all(Range r)
+{
+	std::vector<Range> done;
+	std::vector<Range> todo(1, r);
+
+	while (!todo.empty()) {
+		Range cur = todo.back();
+		todo.pop_back();
+
+		if (!cur.is_divisible()) {
+			done.push_back(cur);
+			continue;
+		}
+
+		Range upper(cur, nvobj::split());
+		todo.push_back(upper);
+		todo.push_back(cur);
+	}
+
+	return done;
+}
+
+/*
+ * range_test -- (internal) test that subranges cover all elements once, in
+ * order
+ */
+template <typename MapType>
+void
+range_test(nvobj::persistent_ptr<MapType> map)
+{
+	using value_type = typename MapType::value_type;
+
+	map->runtime_initialize();
+
+	UT_ASSERT(map->range().empty());
+	UT_ASSERT(!map->range().is_divisible());
+
+	const int n = 5000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)).second);
+
+	/* Erased elements, which may be bounds of subranges, are skipped */
+	for (int i = 0; i < n; i += 3)
+		UT_ASSERTeq(map->unsafe_erase(i), 1);
+
+	auto r = map->range();
+	UT_ASSERT(!r.empty());
+	UT_ASSERT(r.is_divisible());
+
+	const MapType &cmap = *map;
+	auto subranges = split_all(cmap.range());
+
+	/* Levels are generated randomly, but with n elements there should
+	 * be many nodes on upper levels */
+	UT_ASSERT(subranges.size() > 16);
+
+	std::vector<int> keys;
+	size_t max_size = 0;
+	for (auto &sub : subranges) {
+		size_t size = 0;
+		for (auto &e : sub) {
+			UT_ASSERT(e.first == e.second);
+			keys.push_back(e.first);
+			++size;
+		}
+		max_size = (std::max)(max_size, size);
+	}
+
+	UT_ASSERTeq(keys.size(), map->size());
+	UT_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+	UT_ASSERT(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+	UT_ASSERT(max_size < keys.size() / 2);
+
+	map->clear();
+}
+
+/*
+ * parallel_for_each_test -- (internal) test parallel_for_each
+ */
+template <typename MapType>
+void
+parallel_for_each_test(nvobj::pool<root> &pop,
+		       nvobj::persistent_ptr<MapType> map, size_t concurrency)
+{
+	using value_type = typename MapType::value_type;
+
+	map->runtime_initialize();
+
+	std::atomic<size_t> calls(0);
+	map->parallel_for_each(concurrency, [&](value_type &) { ++calls; });
+	UT_ASSERTeq(calls.load(), 0);
+
+	const int n = 10000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)).second);
+
+	std::vector<std::atomic<int>> seen(n);
+	for (auto &s : seen)
+		s = 0;
+
+	for (size_t threads : {size_t(0), size_t(1), concurrency}) {
+		map->parallel_for_each(threads, [&](value_type &e) {
+			UT_ASSERTeq(e.first, e.second);
+			++seen[static_cast<size_t>(e.first.get_ro())];
+		});
+	}
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(seen[static_cast<size_t>(i)].load(), 3);
+
+	/* Modify values in place */
+	map->parallel_for_each(concurrency, [&](value_type &e) {
+		nvobj::transaction::run(pop, [&] { e.second = e.second + 1; });
+	});
+
+	std::atomic<long long> sum(0);
+	const MapType &cmap = *map;
+	cmap.parallel_for_each(concurrency, [&](const value_type &e) {
+		UT_ASSERTeq(e.second, e.first + 1);
+		sum += e.second;
+	});
+	UT_ASSERTeq(sum.load(), (long long)n * (n + 1) / 2);
+
+	/* Concurrent inserts, elements which existed before are visited */
+	for (auto &s : seen)
+		s = 0;
+
+	parallel_exec(2, [&](size_t thread_id) {
+		if (thread_id == 0) {
+			for (int i = n; i < 2 * n; ++i)
+				UT_ASSERT(map->insert(value_type(i, i + 1))
+						  .second);
+		} else {
+			cmap.parallel_for_each(
+				concurrency, [&](const value_type &e) {
+					UT_ASSERTeq(e.second, e.first + 1);
+					if (e.first < n)
+						++seen[static_cast<size_t>(
+							e.first.get_ro())];
+				});
+		}
+	});
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERTeq(seen[static_cast<size_t>(i)].load(), 1);
+
+	/* Exceptions are propagated to the caller */
+	calls = 0;
+	try {
+		map->parallel_for_each(concurrency, [&](value_type &e) {
+			++calls;
+			if (e.first == n / 2)
+				throw std::runtime_error("test");
+		});
+		UT_ASSERT(0);
+	} catch (std::runtime_error &e) {
+		UT_ASSERT(std::string(e.what()) == "test");
+	} catch (...) {
+		UT_ASSERT(0);
+	}
+	UT_ASSERT(calls.load() >= 1);
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->volatile_index_map =
+				nvobj::make_persistent<volatile_index_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 8;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	range_test(pop.root()->cons);
+	range_test(pop.root()->volatile_index_map);
+	parallel_for_each_test(pop, pop.root()->cons, concurrency);
+	parallel_for_each_test(pop, pop.root()->volatile_index_map,
+			       concurrency);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<volatile_index_map_type>(
+			pop.root()->volatile_index_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
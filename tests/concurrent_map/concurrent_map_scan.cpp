@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_scan.cpp -- pmem::obj::experimental::concurrent_map test of
+ * range scans with bounds and limits, with heterogeneous keys and
+ * concurrent with inserts and erases.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/concurrent_map.hpp>
+#include <libpmemobj++/experimental/volatile_index_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+struct hetero_less {
+	using is_transparent = void;
+	template <typename T1, typename T2>
+	bool
+	operator()(const T1 &lhs, const T2 &rhs) const
+	{
+		return lhs < rhs;
+	}
+};
+
+typedef nvobj::experimental::concurrent_map<nvobj::p<int>, nvobj::p<int>>
+	persistent_map_type;
+
+typedef nvobj::experimental::volatile_index_concurrent_map<nvobj::p<int>,
+							    nvobj::p<int>>
+	volatile_index_map_type;
+
+typedef nvobj::experimental::concurrent_map<nvobj::string, nvobj::p<int>,
+					    hetero_less>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<volatile_index_map_type> volatile_index_map;
+	nvobj::persistent_ptr<string_map_type> string_map;
+};
+
+/*
+ * scan_keys -- (internal) returns keys of elements visited by scan
+ */
+template <typename MapType>
+std::vector<int>
+scan_keys(MapType &map, int from, int to, size_t limit)
+{
+	std::vector<int> keys;
+	size_t visited = map.scan(
+		from, to, limit,
+		[&](const typename MapType::value_type &v) {
+			UT_ASSERT(v.first == v.second);
+			keys.push_back(v.first);
+		});
+	UT_ASSERTeq(visited, keys.size());
+
+	return keys;
+}
+
+/*
+ * check_scan -- (internal) check that scan visits keys from [from, to)
+ * divisible by step, at most limit of them, in ascending order
+ */
+template <typename MapType>
+void
+check_scan(MapType &map, int from, int to, size_t limit, int step)
+{
+	std::vector<int> keys = scan_keys(map, from, to, limit);
+
+	std::vector<int> expected;
+	for (int i = from; i < to && expected.size() < limit; ++i)
+		if (i % step == 0)
+			expected.push_back(i);
+
+	UT_ASSERT(keys == expected);
+}
+
+/*
+ * basic_test -- (internal) test bounds and limits of scans
+ */
+template <typename MapType>
+void
+basic_test(nvobj::persistent_ptr<MapType> map)
+{
+	map->runtime_initialize();
+
+	const int n = 1000;
+
+	UT_ASSERTeq(scan_keys(*map, 0, n, size_t(n)).size(), 0);
+
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->emplace(i, i).second);
+
+	check_scan(*map, 0, n, size_t(n), 1);
+	check_scan(*map, 100, 200, size_t(n), 1);
+	check_scan(*map, 100, 200, 10, 1);
+	check_scan(*map, n - 5, n, size_t(n), 1);
+
+	/* Bounds outside of the range of keys */
+	UT_ASSERT(scan_keys(*map, n - 5, 2 * n, size_t(n)) ==
+		  scan_keys(*map, n - 5, n, size_t(n)));
+	UT_ASSERT(scan_keys(*map, -10, 10, size_t(n)) ==
+		  scan_keys(*map, 0, 10, size_t(n)));
+
+	/* Empty ranges and zero limit */
+	UT_ASSERTeq(scan_keys(*map, 10, 10, size_t(n)).size(), 0);
+	UT_ASSERTeq(scan_keys(*map, 20, 10, size_t(n)).size(), 0);
+	UT_ASSERTeq(scan_keys(*map, n, 2 * n, size_t(n)).size(), 0);
+	UT_ASSERTeq(scan_keys(*map, 0, n, 0).size(), 0);
+
+	/* Erased elements are skipped */
+	for (int i = 1; i < n; i += 2)
+		UT_ASSERTeq(map->unsafe_erase(i), 1);
+
+	check_scan(*map, 0, n, size_t(n), 2);
+	check_scan(*map, 1, 100, size_t(n), 2);
+	check_scan(*map, 101, n, 20, 2);
+
+	/* Whole map */
+	std::vector<int> keys =
+		scan_keys(*map, std::numeric_limits<int>::min(),
+			  std::numeric_limits<int>::max(),
+			  std::numeric_limits<size_t>::max());
+	UT_ASSERTeq(keys.size(), map->size());
+
+	map->clear();
+}
+
+/*
+ * hetero_test -- (internal) test scans with heterogeneous keys
+ */
+void
+hetero_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->string_map;
+
+	map->runtime_initialize();
+
+	for (int i = 0; i < 100; ++i)
+		map->try_emplace(std::to_string(i), i);
+
+	/* "10", "11", ..., "19", "2" */
+	std::vector<int> values;
+	size_t visited = map->scan(
+		std::string("10"), std::string("20"), 100,
+		[&](const string_map_type::value_type &v) {
+			UT_ASSERT(v.first == std::to_string(v.second));
+			values.push_back(v.second);
+		});
+	UT_ASSERTeq(visited, 11);
+	UT_ASSERTeq(values.size(), 11);
+	for (int i = 0; i < 10; ++i)
+		UT_ASSERTeq(values[static_cast<size_t>(i)], 10 + i);
+	UT_ASSERTeq(values.back(), 2);
+
+	visited = map->scan(std::string("5"), std::string("6"), 3,
+			    [&](const string_map_type::value_type &v) {
+				    UT_ASSERT(v.first.size() > 0);
+				    UT_ASSERT(v.first[0] == '5');
+			    });
+	UT_ASSERTeq(visited, 3);
+
+	map->clear();
+}
+
+/*
+ * concurrent_test -- (internal) test scans concurrent with inserts and erases
+ */
+template <typename MapType>
+void
+concurrent_test(nvobj::persistent_ptr<MapType> map, size_t concurrency)
+{
+	using value_type = typename MapType::value_type;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)).second);
+
+	parallel_exec(concurrency * 3, [&](size_t thread_id) {
+		int id = static_cast<int>(thread_id / 3);
+		int step = static_cast<int>(concurrency);
+
+		if (thread_id % 3 == 0) {
+			/* Even keys are erased */
+			for (int i = id * 2; i < n; i += step * 2)
+				UT_ASSERTeq(map->erase(i), 1);
+		} else if (thread_id % 3 == 1) {
+			for (int i = n + id; i < 2 * n; i += step)
+				UT_ASSERT(map->insert(value_type(i, i)).second);
+		} else {
+			/* Odd keys are never erased */
+			for (int from = 1; from < n; from += 97) {
+				int prev = from - 1;
+				int odd = from % 2 == 0 ? from + 1 : from;
+				map->scan(from, n, size_t(n),
+					  [&](const value_type &v) {
+						  UT_ASSERT(prev < v.first);
+						  prev = v.first;
+						  if (v.first == odd)
+							  odd += 2;
+					  });
+				UT_ASSERT(odd >= n);
+			}
+		}
+	});
+
+	std::vector<int> keys = scan_keys(*map, 0, 2 * n, size_t(2 * n));
+	UT_ASSERTeq(keys.size(), size_t(n + n / 2));
+	for (size_t i = 0; i < keys.size(); ++i) {
+		int expected = i < size_t(n / 2) ? 2 * static_cast<int>(i) + 1
+						 : static_cast<int>(i) + n / 2;
+		UT_ASSERTeq(keys[i], expected);
+	}
+
+	map->clear();
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->volatile_index_map =
+				nvobj::make_persistent<volatile_index_map_type>();
+			pop.root()->string_map =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 4;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	basic_test(pop.root()->cons);
+	basic_test(pop.root()->volatile_index_map);
+	hetero_test(pop);
+	concurrent_test(pop.root()->cons, concurrency);
+	concurrent_test(pop.root()->volatile_index_map, concurrency);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<volatile_index_map_type>(
+			pop.root()->volatile_index_map);
+		nvobj::delete_persistent<string_map_type>(
+			pop.root()->string_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_unrolled.cpp --
+ * pmem::obj::experimental::unrolled_concurrent_map test of single-threaded
+ * and concurrent operations, scans and reopen.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/experimental/unrolled_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::unrolled_concurrent_map<nvobj::p<int>,
+						      nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+/* Small blocks, to split blocks often */
+typedef nvobj::experimental::unrolled_concurrent_map<
+	nvobj::p<int>, nvobj::string, std::less<nvobj::p<int>>, 4>
+	string_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<string_map_type> string_map;
+};
+
+/*
+ * check_items -- (internal) check that for_each visits items in ascending
+ * order of keys and that keys are exactly those for which pred is true
+ */
+template <typename Pred>
+void
+check_items(persistent_map_type &map, int n, Pred pred)
+{
+	std::vector<int> keys;
+	map.for_each([&](const value_type &v) {
+		UT_ASSERT(v.first == v.second);
+		keys.push_back(v.first);
+	});
+
+	UT_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+	UT_ASSERT(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+
+	size_t expected = 0;
+	for (int i = 0; i < n; ++i) {
+		if (pred(i)) {
+			++expected;
+			UT_ASSERTeq(map.count(i), 1);
+		} else {
+			UT_ASSERTeq(map.count(i), 0);
+		}
+	}
+
+	UT_ASSERTeq(keys.size(), expected);
+	UT_ASSERTeq(map.size(), expected);
+}
+
+/*
+ * basic_test -- (internal) test inserts in random order, lookups, updates,
+ * erases and scans
+ */
+void
+basic_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	UT_ASSERT(map->empty());
+
+	const int n = 1000;
+	std::vector<int> keys(n);
+	for (int i = 0; i < n; ++i)
+		keys[static_cast<size_t>(i)] = i;
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+
+	for (int k : keys)
+		UT_ASSERT(map->insert(value_type(k, k)));
+	for (int k : keys)
+		UT_ASSERT(!map->insert(value_type(k, k + 1)));
+
+	check_items(*map, n, [](int) { return true; });
+
+	/* Blocks are at least half full after splits */
+	UT_ASSERT(map->block_count() <=
+		  2 * size_t(n) / persistent_map_type::block_size() + 1);
+
+	UT_ASSERT(!map->insert_or_assign(10, 11));
+	UT_ASSERT(map->find(10, [](const value_type &v) {
+		UT_ASSERT(v.second == 11);
+	}));
+	UT_ASSERT(map->update(10, [](nvobj::p<int> &v) { v = 10; }));
+	UT_ASSERT(!map->update(n, [](nvobj::p<int> &) { UT_ASSERT(0); }));
+	UT_ASSERT(!map->find(n, [](const value_type &) { UT_ASSERT(0); }));
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(map->erase(i));
+	UT_ASSERT(!map->erase(0));
+
+	check_items(*map, n, [](int i) { return i % 2 == 1; });
+
+	/* Scan from an erased key, stopped by the callback */
+	std::vector<int> scanned;
+	map->scan(100, [&](const value_type &v) {
+		scanned.push_back(v.first);
+		return scanned.size() < 50;
+	});
+	UT_ASSERTeq(scanned.size(), 50);
+	for (size_t i = 0; i < scanned.size(); ++i)
+		UT_ASSERT(scanned[i] == 101 + 2 * static_cast<int>(i));
+
+	scanned.clear();
+	map->scan(n - 10, [&](const value_type &v) {
+		scanned.push_back(v.first);
+		return true;
+	});
+	UT_ASSERTeq(scanned.size(), 5);
+
+	for (int i = 0; i < n; i += 2)
+		UT_ASSERT(map->insert_or_assign(i, i));
+
+	check_items(*map, n, [](int) { return true; });
+
+	map->clear();
+	UT_ASSERT(map->empty());
+	UT_ASSERTeq(map->block_count(), 1);
+}
+
+/*
+ * concurrent_test -- (internal) test inserts, erases, lookups and scans from
+ * many threads
+ */
+void
+concurrent_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)));
+
+	parallel_exec(concurrency * 3, [&](size_t thread_id) {
+		int id = static_cast<int>(thread_id / 3);
+		int step = static_cast<int>(concurrency);
+
+		if (thread_id % 3 == 0) {
+			/* Even keys are erased */
+			for (int i = id * 2; i < n; i += step * 2)
+				UT_ASSERT(map->erase(i));
+		} else if (thread_id % 3 == 1) {
+			for (int i = n + id; i < 2 * n; i += step)
+				UT_ASSERT(map->insert(value_type(i, i)));
+		} else {
+			/* Odd keys are never erased nor moved out of the
+			 * map */
+			for (int i = 1; i < n; i += 2) {
+				auto check = [&](const value_type &v) {
+					UT_ASSERT(v.second == i);
+				};
+				UT_ASSERT(map->find(i, check));
+			}
+
+			int prev = -1;
+			int odd = 1;
+			map->for_each([&](const value_type &v) {
+				UT_ASSERT(prev < v.first);
+				prev = v.first;
+				if (v.first == odd)
+					odd += 2;
+			});
+			UT_ASSERT(odd >= n);
+		}
+	});
+
+	check_items(*map, 2 * n, [](int i) { return i >= n || i % 2 == 1; });
+
+	map->clear();
+}
+
+/*
+ * reopen_test -- (internal) test that items with non-trivial mapped values
+ * are preserved after reopen
+ */
+void
+reopen_test(nvobj::pool<root> &pop, const std::string &path,
+	    size_t concurrency)
+{
+	const int n = 200;
+
+	{
+		auto map = pop.root()->string_map;
+
+		map->runtime_initialize();
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int step = static_cast<int>(concurrency);
+			for (int i = static_cast<int>(thread_id); i < n;
+			     i += step)
+				UT_ASSERT(map->insert_or_assign(
+					i, std::to_string(i)));
+		});
+
+		for (int i = 0; i < n; i += 3)
+			UT_ASSERT(map->erase(i));
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->string_map;
+
+		map->runtime_initialize();
+
+		UT_ASSERTeq(map->size(), size_t(n - (n + 2) / 3));
+
+		for (int i = 0; i < n; ++i) {
+			auto check = [&](const string_map_type::value_type &v) {
+				UT_ASSERT(v.second == std::to_string(i));
+			};
+			UT_ASSERT(map->find(i, check) == (i % 3 != 0));
+		}
+
+		map->clear();
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->string_map =
+				nvobj::make_persistent<string_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 4;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	basic_test(pop);
+	concurrent_test(pop, concurrency);
+	reopen_test(pop, path, concurrency);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<string_map_type>(
+			pop.root()->string_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
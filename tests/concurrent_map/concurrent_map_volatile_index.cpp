@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * concurrent_map_volatile_index.cpp --
+ * pmem::obj::experimental::volatile_index_concurrent_map test of concurrent
+ * operations, aborted inserts and rebuilding of volatile levels of the
+ * skip list after reopen.
+ *
+ */
+
+#include "thread_helpers.hpp"
+#include "unittest.hpp"
+
+#include <libpmemobj++/experimental/volatile_index_concurrent_map.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#define LAYOUT "concurrent_map"
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::volatile_index_concurrent_map<nvobj::p<int>,
+							    nvobj::p<int>>
+	persistent_map_type;
+
+typedef persistent_map_type::value_type value_type;
+
+/* Value, construction of which throws for negative arguments */
+struct throwing_value {
+	throwing_value(int v) : value(v)
+	{
+		if (v < 0)
+			throw std::runtime_error("negative value");
+	}
+
+	nvobj::p<int> value;
+};
+
+typedef nvobj::experimental::volatile_index_concurrent_map<nvobj::p<int>,
+							    throwing_value>
+	throwing_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+	nvobj::persistent_ptr<throwing_map_type> throwing_map;
+};
+
+void
+check_size(persistent_map_type &map, size_t expected_size)
+{
+	UT_ASSERTeq(map.size(), expected_size);
+	UT_ASSERTeq(static_cast<size_t>(std::distance(map.begin(), map.end())),
+		    expected_size);
+}
+
+void
+check_sorted(persistent_map_type &map)
+{
+	UT_ASSERT(std::is_sorted(map.begin(), map.end(),
+				 [](const value_type &lhs,
+				    const value_type &rhs) {
+					 return lhs.first < rhs.first;
+				 }));
+}
+
+/*
+ * check_lookups -- (internal) check that all keys in [0, n) can be found
+ * using lower_bound and upper_bound, which go through the volatile levels
+ */
+void
+check_lookups(persistent_map_type &map, int n, int step)
+{
+	for (int i = 0; i < n; ++i) {
+		bool present = i % step != 0;
+		UT_ASSERTeq(map.count(i), present ? 1 : 0);
+
+		auto it = map.lower_bound(i);
+		int next = present ? i : i + 1;
+		if (next < n) {
+			UT_ASSERT(it != map.end());
+			UT_ASSERT(it->first == next);
+		}
+
+		auto uit = map.upper_bound(i);
+		if (uit != map.end())
+			UT_ASSERT(uit->first > i);
+	}
+}
+
+/*
+ * concurrent_test -- (internal) test inserts, erases and lookups from many
+ * threads
+ */
+void
+concurrent_test(nvobj::pool<root> &pop, size_t concurrency)
+{
+	auto map = pop.root()->cons;
+
+	map->runtime_initialize();
+
+	const int n = 1000;
+	for (int i = 0; i < n; ++i)
+		UT_ASSERT(map->insert(value_type(i, i)).second);
+
+	parallel_exec(concurrency * 3, [&](size_t thread_id) {
+		int id = static_cast<int>(thread_id / 3);
+		int step = static_cast<int>(concurrency);
+
+		if (thread_id % 3 == 0) {
+			/* Even keys are erased */
+			for (int i = id * 2; i < n; i += step * 2)
+				UT_ASSERTeq(map->erase(i), 1);
+		} else if (thread_id % 3 == 1) {
+			for (int i = n + id; i < 2 * n; i += step)
+				UT_ASSERT(map->insert(value_type(i, i)).second);
+		} else {
+			/* Odd keys are never erased */
+			for (int i = 1; i < n; i += 2) {
+				auto it = map->find(i);
+				UT_ASSERT(it != map->end());
+				UT_ASSERT(it->second == i);
+			}
+		}
+	});
+
+	check_size(*map, size_t(n + n / 2));
+	check_sorted(*map);
+
+	map->unsafe_reclaim();
+
+	check_lookups(*map, n, 2);
+
+	map->clear();
+	check_size(*map, 0);
+}
+
+/*
+ * tx_abort_test -- (internal) test that volatile levels stay consistent
+ * after construction of an element throws and the transaction is aborted
+ */
+void
+tx_abort_test(nvobj::pool<root> &pop)
+{
+	auto map = pop.root()->throwing_map;
+
+	map->runtime_initialize();
+
+	const int n = 500;
+	for (int i = 0; i < n; ++i) {
+		if (i % 5 == 0) {
+			try {
+				map->emplace(i, -1);
+				UT_ASSERT(0);
+			} catch (std::runtime_error &) {
+			}
+		} else {
+			UT_ASSERT(map->emplace(i, i).second);
+		}
+	}
+
+	UT_ASSERTeq(map->size(), size_t(n - n / 5));
+	for (int i = 0; i < n; ++i) {
+		auto it = map->find(i);
+		if (i % 5 == 0) {
+			UT_ASSERT(it == map->end());
+		} else {
+			UT_ASSERT(it != map->end());
+			UT_ASSERT(it->second.value == i);
+		}
+	}
+
+	for (int i = 0; i < n; i += 5)
+		UT_ASSERT(map->emplace(i, i).second);
+
+	UT_ASSERTeq(map->size(), size_t(n));
+	UT_ASSERTeq(static_cast<size_t>(
+			    std::distance(map->begin(), map->end())),
+		    size_t(n));
+
+	map->clear();
+}
+
+/*
+ * reopen_test -- (internal) test that levels in volatile memory are rebuilt,
+ * by many threads, after reopen
+ */
+void
+reopen_test(nvobj::pool<root> &pop, const std::string &path,
+	    size_t concurrency)
+{
+	/* Big enough for the rebuild to be split between threads */
+	const int n = 20000;
+
+	{
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int step = static_cast<int>(concurrency);
+			for (int i = static_cast<int>(thread_id); i < n;
+			     i += step)
+				UT_ASSERT(map->insert(value_type(i, i)).second);
+		});
+
+		for (int i = 0; i < n; i += 3)
+			UT_ASSERTeq(map->erase(i), 1);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize(concurrency);
+
+		check_size(*map, size_t(n - (n + 2) / 3));
+		check_sorted(*map);
+		check_lookups(*map, n, 3);
+
+		parallel_exec(concurrency, [&](size_t thread_id) {
+			int step = static_cast<int>(concurrency) * 3;
+			for (int i = static_cast<int>(thread_id) * 3; i < n;
+			     i += step)
+				UT_ASSERT(map->insert(value_type(i, i)).second);
+		});
+
+		check_size(*map, size_t(n));
+		check_sorted(*map);
+
+		pop.close();
+	}
+
+	{
+		pop = nvobj::pool<root>::open(path, LAYOUT);
+
+		auto map = pop.root()->cons;
+
+		map->runtime_initialize();
+
+		check_size(*map, size_t(n));
+		for (int i = 0; i < n; ++i)
+			UT_ASSERTeq(map->count(i), 1);
+
+		map->clear();
+	}
+}
+}
+
+static void
+test(int argc, char *argv[])
+{
+	if (argc < 2) {
+		UT_FATAL("usage: %s file-name", argv[0]);
+	}
+
+	const char *path = argv[1];
+
+	nvobj::pool<root> pop;
+
+	try {
+		pop = nvobj::pool<root>::create(
+			path, LAYOUT, PMEMOBJ_MIN_POOL * 20, S_IWUSR | S_IRUSR);
+		nvobj::transaction::run(pop, [&] {
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+			pop.root()->throwing_map =
+				nvobj::make_persistent<throwing_map_type>();
+		});
+	} catch (pmem::pool_error &pe) {
+		UT_FATAL("!pool::create: %s %s", pe.what(), path);
+	}
+
+	size_t concurrency = 4;
+	if (On_drd)
+		concurrency = 2;
+	std::cout << "Running tests for " << concurrency << " threads"
+		  << std::endl;
+
+	concurrent_test(pop, concurrency);
+	tx_abort_test(pop);
+	reopen_test(pop, path, concurrency);
+
+	nvobj::transaction::run(pop, [&] {
+		nvobj::delete_persistent<persistent_map_type>(pop.root()->cons);
+		nvobj::delete_persistent<throwing_map_type>(
+			pop.root()->throwing_map);
+	});
+
+	pop.close();
+}
+
+int
+main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}